@@ -0,0 +1,375 @@
+#include <StdAfx.h>
+#include "AssetCache.h"
+#include "FileStream.h"
+#include <filesystem.h>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <atomic>
+#include <climits>
+
+namespace CudaTracerLib {
+
+static const unsigned long long PRIME1 = 11400714785074694791ULL, PRIME2 = 14029467366897019727ULL, PRIME3 = 1609587929392839161ULL,
+								PRIME4 = 9650029242287828579ULL, PRIME5 = 2870177450012600261ULL;
+
+static unsigned long long rotl(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static unsigned long long round64(unsigned long long acc, unsigned long long input)
+{
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+static unsigned long long mergeRound(unsigned long long acc, unsigned long long val)
+{
+	acc ^= round64(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+
+template<typename T> static T readUnaligned(const unsigned char* p)
+{
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+ContentHash::ContentHash(unsigned long long seed)
+	: m_uSeed(seed), m_uLength(0), m_uBufferSize(0)
+{
+	m_lanes[0] = seed + PRIME1 + PRIME2;
+	m_lanes[1] = seed + PRIME2;
+	m_lanes[2] = seed;
+	m_lanes[3] = seed - PRIME1;
+}
+
+void ContentHash::Update(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data, *end = p + size;
+	m_uLength += size;
+	if (m_uBufferSize + size < 32)
+	{
+		memcpy(m_buffer + m_uBufferSize, p, size);
+		m_uBufferSize += size;
+		return;
+	}
+	if (m_uBufferSize)
+	{
+		size_t n = 32 - m_uBufferSize;
+		memcpy(m_buffer + m_uBufferSize, p, n);
+		for (int i = 0; i < 4; i++)
+			m_lanes[i] = round64(m_lanes[i], readUnaligned<unsigned long long>(m_buffer + 8 * i));
+		p += n;
+		m_uBufferSize = 0;
+	}
+	//the lanes are independent which allows the compiler to interleave them
+	unsigned long long v0 = m_lanes[0], v1 = m_lanes[1], v2 = m_lanes[2], v3 = m_lanes[3];
+	for (; p + 32 <= end; p += 32)
+	{
+		v0 = round64(v0, readUnaligned<unsigned long long>(p));
+		v1 = round64(v1, readUnaligned<unsigned long long>(p + 8));
+		v2 = round64(v2, readUnaligned<unsigned long long>(p + 16));
+		v3 = round64(v3, readUnaligned<unsigned long long>(p + 24));
+	}
+	m_lanes[0] = v0; m_lanes[1] = v1; m_lanes[2] = v2; m_lanes[3] = v3;
+	m_uBufferSize = end - p;
+	memcpy(m_buffer, p, m_uBufferSize);
+}
+
+unsigned long long ContentHash::Finish() const
+{
+	unsigned long long h;
+	if (m_uLength >= 32)
+	{
+		h = rotl(m_lanes[0], 1) + rotl(m_lanes[1], 7) + rotl(m_lanes[2], 12) + rotl(m_lanes[3], 18);
+		for (int i = 0; i < 4; i++)
+			h = mergeRound(h, m_lanes[i]);
+	}
+	else h = m_uSeed + PRIME5;
+	h += m_uLength;
+
+	const unsigned char* p = m_buffer, *end = m_buffer + m_uBufferSize;
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= round64(0, readUnaligned<unsigned long long>(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= readUnaligned<unsigned int>(p) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++)
+	{
+		h ^= *p * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+static void moveStream(IInStream& in, long long off)
+{
+	while (off != 0)
+	{
+		int n = (int)std::max((long long)INT_MIN + 1, std::min((long long)INT_MAX, off));
+		in.Move(n);
+		off -= n;
+	}
+}
+
+unsigned long long AssetCache::HashStream(IInStream& in)
+{
+	ContentHash hash;
+	size_t remaining = in.getFileSize() - in.getPos();
+	if (const void* data = in.ReadMapped(remaining))
+		hash.Update(data, remaining);
+	else
+	{
+		std::vector<char> block(std::min(remaining, size_t(1024 * 1024)));
+		for (size_t off = 0; off < remaining; off += block.size())
+		{
+			size_t n = std::min(block.size(), remaining - off);
+			in.Read(&block[0], n);
+			hash.Update(&block[0], n);
+		}
+	}
+	moveStream(in, -(long long)remaining);
+	return hash.Finish();
+}
+
+unsigned long long AssetCache::HashFile(const std::string& path)
+{
+	IInStream* in = OpenFile(path);
+	unsigned long long h = HashStream(*in);
+	delete in;
+	return h;
+}
+
+std::string AssetCache::MakeKey(unsigned long long contentHash, const std::string& compiler, unsigned int version, const std::string& options)
+{
+	ContentHash hash(contentHash);
+	hash.Update(compiler);
+	hash.Update(&version, sizeof(version));
+	hash.Update(options);
+	std::ostringstream str;
+	str << std::hex << std::setw(16) << std::setfill('0') << hash.Finish();
+	return str.str();
+}
+
+AssetCache::AssetCache(const std::string& directory, size_t maxSize)
+	: m_sDirectory(directory), m_uMaxSize(maxSize), m_uSize(0), m_uClock(1), m_bIndexDirty(false)
+{
+	if (m_sDirectory.size() && m_sDirectory.back() != '/' && m_sDirectory.back() != '\\')
+		m_sDirectory += "/";
+	std::filesystem::create_directories(m_sDirectory);
+	loadIndex();
+}
+
+AssetCache::~AssetCache()
+{
+	try
+	{
+		Flush();
+	}
+	catch (std::exception& ex)
+	{
+		std::cout << "Could not write the asset cache index : " << ex.what() << "\n";
+	}
+}
+
+void AssetCache::loadIndex()
+{
+	std::ifstream index(m_sDirectory + "index.txt");
+	std::string key;
+	Entry e;
+	while (index >> key >> e.size >> e.last_use)
+		m_entries[key] = e;
+
+	//the index of another process may have been written last, files missing in it are adopted and entries of removed files are dropped
+	std::map<std::string, Entry> entries;
+	for (auto& f : std::filesystem::directory_iterator(m_sDirectory))
+	{
+		if (f.path().extension() != ".bin")
+			continue;
+		std::string key = f.path().stem().string();
+		auto it = m_entries.find(key);
+		Entry e = it != m_entries.end() ? it->second : Entry{ 0, 0 };
+		e.size = (size_t)std::filesystem::file_size(f.path());
+		entries[key] = e;
+		m_uSize += e.size;
+		m_uClock = std::max(m_uClock, e.last_use + 1);
+	}
+	m_bIndexDirty = entries.size() != m_entries.size();
+	m_entries.swap(entries);
+}
+
+void AssetCache::writeIndex()
+{
+	static std::atomic<unsigned int> counter(0);
+	std::string tmp = m_sDirectory + "index." + std::to_string(std::random_device()()) + "." + std::to_string(counter++) + ".tmp";
+	{
+		std::ofstream index(tmp);
+		for (auto& it : m_entries)
+			index << it.first << " " << it.second.size << " " << it.second.last_use << "\n";
+		if (!index)
+			throw std::runtime_error(format("Could not write asset cache index %s", tmp.c_str()));
+	}
+	std::filesystem::rename(tmp, m_sDirectory + "index.txt");
+	m_bIndexDirty = false;
+}
+
+void AssetCache::evict(const std::string& keep)
+{
+	while (m_uSize > m_uMaxSize && m_entries.size() > 1)
+	{
+		auto oldest = m_entries.end();
+		for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+			if (it->first != keep && !m_pins.count(it->first) && (oldest == m_entries.end() || it->second.last_use < oldest->second.last_use))
+				oldest = it;
+		if (oldest == m_entries.end())
+			break;
+		//fails if the file is opened on some platforms, it is then adopted again the next time the index is loaded
+		std::error_code ec;
+		std::filesystem::remove(getFilePath(oldest->first), ec);
+		m_uSize -= oldest->second.size;
+		m_entries.erase(oldest);
+		m_bIndexDirty = true;
+	}
+}
+
+std::string AssetCache::Lookup(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto path = getFilePath(key);
+	auto it = m_entries.find(key);
+	if (std::filesystem::exists(path))
+	{
+		//files compiled by another process sharing the directory are adopted
+		if (it == m_entries.end())
+		{
+			it = m_entries.insert(std::make_pair(key, Entry{ (size_t)std::filesystem::file_size(path), 0 })).first;
+			m_uSize += it->second.size;
+		}
+		it->second.last_use = m_uClock++;
+		m_bIndexDirty = true;
+		return path;
+	}
+	else if (it != m_entries.end())
+	{
+		//removed by another process
+		m_uSize -= it->second.size;
+		m_entries.erase(it);
+		m_bIndexDirty = true;
+	}
+	for (auto& dir : m_sharedDirectories)
+	{
+		auto shared_path = dir + key + ".bin";
+		if (std::filesystem::exists(shared_path))
+			return shared_path;
+	}
+	return "";
+}
+
+std::string AssetCache::GetOrCompile(const std::string& key, const std::function<void(FileOutputStream&)>& clb, bool force)
+{
+	if (!force)
+	{
+		auto path = Lookup(key);
+		if (path.size())
+			return path;
+	}
+
+	static std::atomic<unsigned int> counter(0);
+	std::string tmp = m_sDirectory + key + "." + std::to_string(std::random_device()()) + "." + std::to_string(counter++) + ".tmp";
+	{
+		FileOutputStream out(tmp);
+		try
+		{
+			clb(out);
+		}
+		catch (...)
+		{
+			out.Close();
+			std::error_code ec;
+			std::filesystem::remove(tmp, ec);
+			throw;
+		}
+		out.Close();
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto path = getFilePath(key);
+	std::error_code ec;
+	std::filesystem::rename(tmp, path, ec);
+	if (ec)
+	{
+		//the same asset was compiled concurrently and the existing file is in use
+		std::filesystem::remove(tmp, ec);
+		if (!std::filesystem::exists(path))
+			throw std::runtime_error(format("Could not move compiled asset to %s", path.c_str()));
+	}
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		m_uSize -= it->second.size;
+	Entry& e = m_entries[key];
+	e.size = (size_t)std::filesystem::file_size(path);
+	e.last_use = m_uClock++;
+	m_uSize += e.size;
+	evict(key);
+	writeIndex();
+	return path;
+}
+
+void AssetCache::Pin(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pins[key]++;
+}
+
+void AssetCache::Unpin(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_pins.find(key);
+	if (it == m_pins.end())
+		throw std::runtime_error(format("The asset cache key %s is not pinned!", key.c_str()));
+	if (!--it->second)
+		m_pins.erase(it);
+}
+
+void AssetCache::AddSharedDirectory(const std::string& dir)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::string d = dir;
+	if (d.size() && d.back() != '/' && d.back() != '\\')
+		d += "/";
+	m_sharedDirectories.push_back(d);
+}
+
+void AssetCache::setMaxSize(size_t maxSize)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_uMaxSize = maxSize;
+	evict("");
+	if (m_bIndexDirty)
+		writeIndex();
+}
+
+void AssetCache::Flush()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_bIndexDirty)
+		writeIndex();
+}
+
+}
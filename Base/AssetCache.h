@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Defines.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+namespace CudaTracerLib {
+
+class IInStream;
+class FileOutputStream;
+
+//Streaming 64 bit hash of arbitrary data, identical to xxHash64.
+class ContentHash
+{
+	unsigned long long m_lanes[4];
+	unsigned long long m_uSeed;
+	unsigned long long m_uLength;
+	unsigned char m_buffer[32];
+	size_t m_uBufferSize;
+public:
+	CTL_EXPORT ContentHash(unsigned long long seed = 0);
+	CTL_EXPORT void Update(const void* data, size_t size);
+	void Update(const std::string& str)
+	{
+		Update(str.c_str(), str.size());
+	}
+	CTL_EXPORT unsigned long long Finish() const;
+};
+
+//Cache of compiled assets keyed by the content hash of the source, the compiler and its version.
+//The compiled files are stored as <key>.bin in the cache directory, they are written to a temporary file first and renamed afterwards,
+//therefore readers never see partially written files, also not from other processes sharing the directory.
+//An index with the size and the last use of every file is kept on disk, the least recently used files are removed when the size limit is exceeded.
+//Additional directories, e.g. a cache on a network share filled by another machine, can be searched read only.
+//Files which are read after loading, e.g. the tiles of tiled textures, have to be pinned so that they are not evicted in the meantime.
+class AssetCache
+{
+	struct Entry
+	{
+		size_t size;
+		unsigned long long last_use;
+	};
+	std::mutex m_mutex;
+	std::string m_sDirectory;
+	std::vector<std::string> m_sharedDirectories;
+	std::map<std::string, Entry> m_entries;
+	//number of pins per key
+	std::map<std::string, unsigned int> m_pins;
+	size_t m_uMaxSize;
+	size_t m_uSize;
+	unsigned long long m_uClock;
+	bool m_bIndexDirty;
+
+	std::string getFilePath(const std::string& key) const
+	{
+		return m_sDirectory + key + ".bin";
+	}
+	void loadIndex();
+	void writeIndex();
+	void evict(const std::string& keep);
+public:
+	CTL_EXPORT AssetCache(const std::string& directory, size_t maxSize = size_t(8) << 30);
+	CTL_EXPORT ~AssetCache();
+
+	//hash of the remaining bytes of the stream, the position is restored afterwards
+	CTL_EXPORT static unsigned long long HashStream(IInStream& in);
+	CTL_EXPORT static unsigned long long HashFile(const std::string& path);
+	//combines the content hash with the name and version of the compiler and its options to a cache key
+	CTL_EXPORT static std::string MakeKey(unsigned long long contentHash, const std::string& compiler, unsigned int version, const std::string& options = "");
+
+	//returns the path of the compiled asset or an empty string if it is not cached
+	CTL_EXPORT std::string Lookup(const std::string& key);
+	//returns the path of the compiled asset, it is compiled with clb first if it is not cached or force is set
+	//can be called concurrently, for the same key the asset may be compiled more than once
+	CTL_EXPORT std::string GetOrCompile(const std::string& key, const std::function<void(FileOutputStream&)>& clb, bool force = false);
+
+	//the file of a pinned key is not evicted until it is unpinned as often as it was pinned, the key does not have to be cached yet
+	CTL_EXPORT void Pin(const std::string& key);
+	CTL_EXPORT void Unpin(const std::string& key);
+
+	//searches dir read only after the own directory, nothing is written to or removed from it
+	CTL_EXPORT void AddSharedDirectory(const std::string& dir);
+	//removes the least recently used files until the cache is smaller than maxSize
+	CTL_EXPORT void setMaxSize(size_t maxSize);
+	size_t getMaxSize() const
+	{
+		return m_uMaxSize;
+	}
+	size_t getSize() const
+	{
+		return m_uSize;
+	}
+	const std::string& getDirectory() const
+	{
+		return m_sDirectory;
+	}
+	//writes the index if the last use of an entry changed
+	CTL_EXPORT void Flush();
+};
+
+}
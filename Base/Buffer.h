@@ -14,6 +14,9 @@
 #include <type_traits>
 #include <boost/icl/interval_set.hpp>
 #include "Buffer_device.h"
+#include "BufferRangeAllocator.h"
+#include "UploadQueue.h"
+#include "MemoryReport.h"
 #include <Base/Platform.h>
 #include <Base/CudaMemoryManager.h>
 #include <Base/VirtualFuncType.h>
@@ -60,16 +63,26 @@ protected:
 
 	H* host;
 	D* device;
-	size_t m_uPos;
 	size_t m_uLength;
 	size_t m_uBlockSize;
 	bool m_bUpdateElement;
+	//no device memory is allocated, UpdateInvalidated only calls the update functions
+	bool m_bHostOnly;
 	range_set_t* m_uInvalidated;
-	range_set_t* m_uDeallocated;
+	BufferRangeAllocator m_allocator;
+	UploadQueue* m_pUploadQueue;
+	std::vector<UploadQueue::Range> m_uploadRanges;
+	std::string m_name;
+	size_t m_uPeakUsed;
+	size_t m_uMaxLength;
 
 	virtual void updateElement(size_t i) = 0;
-	virtual void copyRange(size_t i, size_t l) = 0;
+	//uploads the sorted invalidated ranges, the queue may coalesce them
+	virtual void uploadRanges(std::vector<UploadQueue::Range>& ranges) = 0;
+	//called after the buffer was enlarged, the first getUsedLength() elements have to be preserved
 	virtual void reallocAfterResize(){}
+	//called by Compact for every moved segment in increasing order, dest < src
+	virtual void moveRange(size_t dest, size_t src, size_t l){}
 	virtual D* getDeviceMappedData() = 0;
 
 	template<typename H2, typename D2> friend class BufferIterator;
@@ -79,44 +92,51 @@ protected:
 
 	BufferReference<H, D> malloc_internal(size_t a_Length)
 	{
-		BufferReference<H, D> res;
-		for (range_set_t::iterator it = m_uDeallocated->begin(); it != m_uDeallocated->end(); ++it)
-			if (it->upper() - it->lower() >= a_Length)
-			{
-				ival i(it->lower(), it->lower() + a_Length);
-				res = BufferReference<H, D>(this, it->lower(), a_Length);
-				m_uDeallocated->erase(i);
-				break;
-			}
-		if (a_Length <= m_uLength - m_uPos)
+		size_t p = m_allocator.Allocate(a_Length);
+		if (p == MINUS_ONE)
 		{
-			m_uPos += a_Length;
-			res = BufferReference<H, D>(this, m_uPos - a_Length, a_Length);
+			size_t required = m_allocator.getUsedLength() + a_Length;
+			if (required > m_uMaxLength)
+				throw std::runtime_error(format("%s : allocating %llu elements exceeds the budget of %llu elements, %llu are in use",
+					m_name.size() ? m_name.c_str() : __FUNCTION__, (unsigned long long)a_Length, (unsigned long long)m_uMaxLength, (unsigned long long)numElements()));
+			resize_internal(std::min(m_uMaxLength, std::max(required, m_uLength + m_uLength / 2)));
+			p = m_allocator.Allocate(a_Length);
 		}
-		else
+		m_uPeakUsed = std::max(m_uPeakUsed, m_allocator.getUsedLength());
+		BufferReference<H, D> res(this, p, a_Length);
+		Invalidate(res);
+		return res;
+	}
+
+	//the used part of the device buffer is copied on the device, only the new allocations have to be uploaded afterwards
+	void resize_internal(size_t newLength)
+	{
+		std::cout << __FUNCTION__ << " :: Resizing buffer from " << m_uLength << " to " << newLength << " elements" << std::endl;
+		size_t used = m_allocator.getUsedLength();
+		H* newHost;
+		HOST_MALLOC(&newHost, m_uBlockSize * newLength);
+		::memcpy(newHost, host, used * m_uBlockSize);
+		Platform::SetMemory((char*)newHost + used * m_uBlockSize, (newLength - used) * m_uBlockSize);
+		HOST_FREE(host);
+		host = newHost;
+		if (!m_bHostOnly)
 		{
-			//BAD_EXCEPTION("Cuda data stream malloc failure, %d elements requested, %d available.", a_Count, m_uLength - m_uPos)
-			size_t newLength = std::max(m_uPos + a_Length, m_uLength + m_uLength / 2);
-			std::cout << __FUNCTION__ << " :: Resizing buffer from " << m_uLength << " to " << newLength << " elements" << std::endl;
+			D* newDevice;
+			CUDA_MALLOC(&newDevice, sizeof(D) * newLength);
+			if (used)
+				ThrowCudaErrors(cudaMemcpy(newDevice, device, sizeof(D) * used, cudaMemcpyDeviceToDevice));
+			ThrowCudaErrors(cudaMemset(newDevice + used, 0, sizeof(D) * (newLength - used)));
 			CUDA_FREE(device);
-			H* newHost = (H*)::malloc(m_uBlockSize * newLength);
-			::memcpy(newHost, host, m_uPos * m_uBlockSize);
-			free(host);
-			host = newHost;
-			m_uLength = newLength;
-			CUDA_MALLOC(&device, sizeof(D) * newLength);
-			cudaMemset(device, 0, sizeof(D) * newLength);
-			reallocAfterResize();
-			Invalidate(0, m_uPos);
-			return malloc_internal(a_Length);
-
+			device = newDevice;
 		}
-		Invalidate(res);
-		return res;
+		m_uLength = newLength;
+		m_allocator.setCapacity(newLength);
+		reallocAfterResize();
 	}
 
 	template<bool CALL_F, typename CLB> void __UpdateInvalidated_internal(const CLB& f)
 	{
+		m_uploadRanges.clear();
 		for (range_set_t::iterator it = m_uInvalidated->begin(); it != m_uInvalidated->end(); ++it)
 		{
 			if (CALL_F || m_bUpdateElement)
@@ -129,42 +149,52 @@ protected:
 						updateElement(i);
 				}
 			}
-			copyRange(it->lower(), it->upper() - it->lower());
+			m_uploadRanges.push_back(UploadQueue::Range{ it->lower(), it->upper() - it->lower() });
 		}
 		m_uInvalidated->clear();
+		if (!m_bHostOnly)
+			uploadRanges(m_uploadRanges);
+	}
+
+	UploadQueue& getUploadQueue()
+	{
+		return m_pUploadQueue ? *m_pUploadQueue : UploadQueue::getGlobalQueue();
 	}
 
 public:
 
 	typedef BufferIterator<H, D> iterator;
 
-	BufferBase(size_t a_NumElements, size_t a_ElementSize, bool callUpdateElement)
-		: m_uPos(0), m_uLength(a_NumElements), m_uBlockSize(a_ElementSize != MINUS_ONE ? a_ElementSize : sizeof(H)), m_bUpdateElement(callUpdateElement)
+	BufferBase(size_t a_NumElements, size_t a_ElementSize, bool callUpdateElement, bool hostOnly = false)
+		: device(0), m_uLength(a_NumElements), m_uBlockSize(a_ElementSize != MINUS_ONE ? a_ElementSize : sizeof(H)), m_bUpdateElement(callUpdateElement), m_bHostOnly(hostOnly),
+		  m_allocator(a_NumElements), m_pUploadQueue(0), m_uPeakUsed(0), m_uMaxLength(MINUS_ONE)
 	{
-		host = (H*)::malloc(m_uBlockSize * m_uLength);
+		HOST_MALLOC(&host, m_uBlockSize * m_uLength);
 		Platform::SetMemory(host, m_uBlockSize * a_NumElements);
-		CUDA_MALLOC(&device, sizeof(D) * a_NumElements);
-		cudaMemset(device, 0, sizeof(D) * a_NumElements);
+		if (!m_bHostOnly)
+		{
+			CUDA_MALLOC(&device, sizeof(D) * a_NumElements);
+			cudaMemset(device, 0, sizeof(D) * a_NumElements);
+		}
 		m_uInvalidated = new range_set_t();
-		m_uDeallocated = new range_set_t();
 	}
 
 	virtual ~BufferBase()
 	{
-		if (device == 0)
+		if (host == 0)
 		{
 			std::cout << "Trying to destruct buffer multiple times!" << std::endl;
 			return;
 		}
 		for (auto it : *this)
 			(*it).~H();
-		free(host);
-		CUDA_FREE(device);
+		HOST_FREE(host);
+		if (device)
+			CUDA_FREE(device);
 		delete m_uInvalidated;
-		delete m_uDeallocated;
 		device = 0;
 		host = 0;
-		m_uInvalidated = m_uDeallocated = 0;
+		m_uInvalidated = 0;
 	}
 
 	size_t getBufferLength() const
@@ -172,6 +202,54 @@ public:
 		return m_uLength;
 	}
 
+	//name used in the memory report and in error messages
+	void setName(const std::string& name)
+	{
+		m_name = name;
+	}
+
+	const std::string& getName() const
+	{
+		return m_name;
+	}
+
+	//allocations which would grow the buffer above the budget (device bytes, host bytes for host only buffers) throw a std::runtime_error
+	//instead of reallocating, MINUS_ONE disables the budget
+	void setBudget(size_t bytes)
+	{
+		m_uMaxLength = bytes == MINUS_ONE ? MINUS_ONE : bytes / (m_bHostOnly ? m_uBlockSize : sizeof(D));
+	}
+
+	//live is the used length, elements freed in front of the used length are counted because they can only be reused partially
+	MemoryReportEntry getMemoryReportEntry() const
+	{
+		size_t deviceElement = m_bHostOnly ? 0 : sizeof(D), hostElement = m_uLength ? getHostSizeInBytes() / m_uLength : m_uBlockSize;
+		return MemoryReportEntry(m_name, getUsedLength() * deviceElement, m_uPeakUsed * deviceElement, getDeviceSizeInBytes(),
+			getUsedLength() * hostElement, m_uPeakUsed * hostElement, getHostSizeInBytes());
+	}
+
+	//the uploads of UpdateInvalidated are submitted to this queue instead of the global one, null resets to the global queue
+	//the host only mode of the queue has to match the one of the buffer, therefore the uploads of device buffers are always issued
+	//on the blocking upload stream and device memory can be read or freed afterwards without flushing the queue
+	void setUploadQueue(UploadQueue* queue)
+	{
+		if (queue && queue->isHostOnly() != m_bHostOnly)
+			throw std::runtime_error(format("%s : the host only mode of the upload queue does not match the one of the buffer!", m_name.size() ? m_name.c_str() : __FUNCTION__));
+		m_pUploadQueue = queue;
+	}
+
+	//end of the last allocated range, includes the freed ranges in front of it
+	size_t getUsedLength() const
+	{
+		return m_allocator.getUsedLength();
+	}
+
+	//number of freed elements in front of getUsedLength() which can only be reused by allocations fitting into them
+	size_t getNumFragmentedElements() const
+	{
+		return m_allocator.getNumFreeElements();
+	}
+
 	BufferReference<H, D> malloc(size_t a_Length)
 	{
 		static_assert(!std::is_same<H, char>::value, "Please use malloc_aligned instead of malloc on a char buffer to guarantee alignment!");
@@ -234,29 +312,93 @@ public:
 		m_uInvalidated->erase(ival(p, p + l));
 		for (size_t i = p; i < p + l; ++i)
 			host[i].~H();
-		if (p + l == m_uPos)
+		m_allocator.Free(p, l);
+	}
+
+	//Moves all allocated ranges to the front of the buffer, closing the gaps left by dealloc.
+	//The data is moved on the host and on the device, pending invalidations are moved with it.
+	//References into the buffer are not updated, the owners have to translate them with the returned remap.
+	BufferRemap Compact()
+	{
+		BufferRemap remap;
+		const BufferRangeAllocator::free_map_t& freeRanges = m_allocator.getFreeRanges();
+		if (freeRanges.empty())
+			return remap;
+
+		size_t src = freeRanges.begin()->first + freeRanges.begin()->second, dest = freeRanges.begin()->first;
+		for (auto it = std::next(freeRanges.begin()); ; ++it)
 		{
-			m_uPos -= l;
+			size_t end = it != freeRanges.end() ? it->first : m_allocator.getUsedLength();
+			remap.addSegment(src, dest, end - src);
+			dest += end - src;
+			if (it == freeRanges.end())
+				break;
+			src = it->first + it->second;
 		}
-		else
+
+		D* newDevice = 0;
+		if (!m_bHostOnly)
 		{
-			m_uDeallocated->insert(ival(p, p + l));
+			CUDA_MALLOC(&newDevice, sizeof(D) * m_uLength);
+			ThrowCudaErrors(cudaMemcpy(newDevice, device, sizeof(D) * remap.getFirstMovedIndex(), cudaMemcpyDeviceToDevice));
 		}
+		range_set_t invalidated;
+		for (range_set_t::iterator it = m_uInvalidated->begin(); it != m_uInvalidated->end(); ++it)
+			invalidated.insert(ival(remap(it->lower()), remap(it->upper() - 1) + 1));
+		remap.enumerateSegments([&](size_t segSrc, size_t segDest, size_t l)
+		{
+			::memmove((char*)host + segDest * m_uBlockSize, (char*)host + segSrc * m_uBlockSize, l * m_uBlockSize);
+			if (newDevice)
+				ThrowCudaErrors(cudaMemcpy(newDevice + segDest, device + segSrc, sizeof(D) * l, cudaMemcpyDeviceToDevice));
+			moveRange(segDest, segSrc, l);
+		});
+		if (newDevice)
+		{
+			ThrowCudaErrors(cudaMemset(newDevice + dest, 0, sizeof(D) * (m_uLength - dest)));
+			CUDA_FREE(device);
+			device = newDevice;
+		}
+		Platform::SetMemory((char*)host + dest * m_uBlockSize, (m_allocator.getUsedLength() - dest) * m_uBlockSize);
+		*m_uInvalidated = invalidated;
+		m_allocator.Reset(dest);
+		return remap;
+	}
+
+	//free ranges below the used length, offset -> length
+	const BufferRangeAllocator::free_map_t& getFreeRanges() const
+	{
+		return m_allocator.getFreeRanges();
+	}
 
-		if (m_uPos > 0)
+	//Recreates the allocated ranges of a buffer with the used length used and the free ranges freeRanges, e.g. when loading a snapshot.
+	//The buffer has to be empty, the allocated ranges are invalidated and their host data has to be written by the caller.
+	void RestoreLayout(size_t used, const BufferRangeAllocator::free_map_t& freeRanges)
+	{
+		if (this->hasElements())
+			throw std::runtime_error(format("%s : the layout can only be restored into an empty buffer!", m_name.size() ? m_name.c_str() : __FUNCTION__));
+		if (used > m_uLength)
+			resize_internal(used);
+		m_uInvalidated->clear();
+		m_allocator.Reset(used);
+		size_t p = 0;
+		for (auto& r : freeRanges)
 		{
-			range_set_t::const_iterator it = m_uDeallocated->find(m_uPos - 1);
-			if (it != m_uDeallocated->end())
-			{
-				m_uPos -= it->upper() - it->lower();
-				m_uDeallocated->erase(it);
-			}
+			Invalidate(p, r.first - p);
+			m_allocator.Free(r.first, r.second);
+			p = r.first + r.second;
 		}
+		Invalidate(p, used - p);
+		m_uPeakUsed = std::max(m_uPeakUsed, used);
 	}
 
 	void Invalidate()
 	{
-		m_uInvalidated->insert(ival(0U, m_uPos));
+		m_uInvalidated->insert(ival(0U, getUsedLength()));
+	}
+
+	bool hasInvalidatedElements() const
+	{
+		return !m_uInvalidated->empty();
 	}
 
 	void Invalidate(BufferReference<H, D> ref)
@@ -285,7 +427,8 @@ public:
         ref.Invalidate();
 
         Platform::SetMemory(ref.operator H *(), ref.getHostSize(), val);
-        cudaMemset(ref.getDevice(), (int)ref.getDeviceSize(), val);
+        if (!m_bHostOnly)
+            cudaMemset(ref.getDevice(), (int)ref.getDeviceSize(), val);
     }
 
 	template<typename CLB> void UpdateInvalidated(const CLB& f)
@@ -296,12 +439,14 @@ public:
 	void CopyFromDevice(BufferReference<H, D> ref)
 	{
 		static_assert(std::is_same<H, D>::value, "H != T");
+		if (m_bHostOnly)
+			throw std::runtime_error(__FUNCTION__);
 		ThrowCudaErrors(cudaMemcpy(this->host + ref.p, device + ref.p, sizeof(H) * ref.l, cudaMemcpyDeviceToHost));
 	}
 
 	virtual BufferReference<H, D> operator()(size_t i, size_t l = 1)
 	{
-		if (i >= m_uPos)
+		if (i >= getUsedLength())
 			throw std::runtime_error("Invalid idx!");
 		return BufferReference<H, D>(this, i, l);
 	}
@@ -313,20 +458,12 @@ public:
 
 	virtual BufferIterator<H, D> end()
 	{
-		return BufferIterator<H, D>(*this, m_uPos, true);
+		return BufferIterator<H, D>(*this, getUsedLength(), true);
 	}
 
 	virtual size_t numElements()
 	{
-		if (m_uDeallocated->empty())
-			return m_uPos;
-		size_t p = m_uPos;
-		for (range_set_t::iterator it = m_uDeallocated->begin(); it != m_uDeallocated->end(); it++)
-		{
-			size_t n = it->upper() - it->lower();
-			p -= n;
-		}
-		return p;
+		return getUsedLength() - m_allocator.getNumFreeElements();
 	}
 
 	virtual bool hasMoreThanElements(size_t i)
@@ -336,7 +473,17 @@ public:
 
 	size_t getDeviceSizeInBytes() const
 	{
-		return m_uLength * sizeof(D);
+		return m_bHostOnly ? 0 : m_uLength * sizeof(D);
+	}
+
+	virtual size_t getHostSizeInBytes() const
+	{
+		return m_uLength * m_uBlockSize;
+	}
+
+	bool isHostOnly() const
+	{
+		return m_bHostOnly;
 	}
 
 	virtual KernelBuffer<D> getKernelData(bool devicePointer = true) const = 0;
@@ -346,18 +493,18 @@ template<typename H, typename D> class BufferIterator
 {
 	BufferBase<H, D>& buf;
 	size_t idx;
-	typename BufferBase<H, D>::range_set_t::iterator next_interval;
+	BufferRangeAllocator::free_map_t::const_iterator next_free;
 public:
 	BufferIterator(BufferBase<H, D>& b, size_t i, bool isEnd)
 		: buf(b), idx(i)
 	{
 		if (!isEnd)
 		{
-			next_interval = buf.m_uDeallocated->find(idx);
-			if (next_interval != buf.m_uDeallocated->end())
+			next_free = buf.m_allocator.findFreeRange(idx);
+			if (next_free != buf.m_allocator.getFreeRanges().end() && next_free->first <= idx)
 			{
-				idx = next_interval->upper();
-				next_interval = buf.m_uDeallocated->lower_bound(typename BufferBase<H, D>::ival(idx, idx + 1));
+				idx = next_free->first + next_free->second;
+				++next_free;
 			}
 		}
 	}
@@ -374,10 +521,11 @@ public:
 
 	BufferIterator<H, D>& operator++()
 	{
-		if (next_interval != buf.m_uDeallocated->end() && idx + 1 == next_interval->lower())
+		//free ranges are never adjacent, after skipping one the next element is allocated
+		if (next_free != buf.m_allocator.getFreeRanges().end() && idx + 1 == next_free->first)
 		{
-			idx = next_interval->upper();
-			next_interval = buf.m_uDeallocated->lower_bound(typename BufferBase<H, D>::ival(idx, idx + 1));
+			idx = next_free->first + next_free->second;
+			++next_free;
 		}
 		else idx++;
 		if (idx > buf.m_uLength)
@@ -416,15 +564,23 @@ protected:
 	{
 		deviceMapped[i] = BufferBase<H, D>::operator()(i)->getKernelData();
 	}
-	virtual void copyRange(size_t i, size_t l)
+	virtual void uploadRanges(std::vector<UploadQueue::Range>& ranges)
 	{
-		cudaMemcpy(this->device + i, deviceMapped + i, l * sizeof(D), cudaMemcpyHostToDevice);
+		this->getUploadQueue().Submit(this->device, deviceMapped, ranges, sizeof(D));
 	}
 	virtual void reallocAfterResize()
 	{
-		free(deviceMapped);
-		deviceMapped = (D*)::malloc(BufferBase<H, D>::m_uLength * sizeof(D));
-		::memset(deviceMapped, 0, sizeof(D) * BufferBase<H, D>::m_uLength);
+		size_t used = this->getUsedLength(), length = this->m_uLength;
+		D* newDeviceMapped;
+		HOST_MALLOC(&newDeviceMapped, length * sizeof(D));
+		::memcpy(newDeviceMapped, deviceMapped, sizeof(D) * used);
+		::memset(newDeviceMapped + used, 0, sizeof(D) * (length - used));
+		HOST_FREE(deviceMapped);
+		deviceMapped = newDeviceMapped;
+	}
+	virtual void moveRange(size_t dest, size_t src, size_t l)
+	{
+		::memmove(deviceMapped + dest, deviceMapped + src, sizeof(D) * l);
 	}
 	virtual D* getDeviceMappedData()
 	{
@@ -434,19 +590,23 @@ public:
 	explicit Buffer(size_t a_NumElements, size_t a_ElementSize = MINUS_ONE)
 		: BufferBase<H, D>(a_NumElements, a_ElementSize, true)
 	{
-		deviceMapped = (D*)::malloc(a_NumElements * sizeof(D));
+		HOST_MALLOC(&deviceMapped, a_NumElements * sizeof(D));
 		::memset(deviceMapped, 0, sizeof(D) * a_NumElements);
 	}
 	virtual ~Buffer()
 	{
-		free(deviceMapped);
+		HOST_FREE(deviceMapped);
+	}
+	virtual size_t getHostSizeInBytes() const
+	{
+		return BufferBase<H, D>::getHostSizeInBytes() + this->m_uLength * sizeof(D);
 	}
 	virtual KernelBuffer<D> getKernelData(bool devicePointer = true) const
 	{
 		KernelBuffer<D> r;
 		r.Data = devicePointer ? BufferBase<H, D>::device : deviceMapped;
 		r.Length = (unsigned int)BufferBase<H, D>::m_uLength;
-		r.UsedCount = (unsigned int)BufferBase<H, D>::m_uPos;
+		r.UsedCount = (unsigned int)this->getUsedLength();
 		return r;
 	}
 };
@@ -458,26 +618,45 @@ protected:
 	{
 
 	}
-	virtual void copyRange(size_t i, size_t l)
+	virtual void uploadRanges(std::vector<UploadQueue::Range>& ranges)
 	{
-		ThrowCudaErrors(cudaMemcpy(this->device + i, this->host + i, l * sizeof(T), cudaMemcpyHostToDevice));
+		this->getUploadQueue().Submit(this->device, this->host, ranges, sizeof(T));
 	}
 	virtual T* getDeviceMappedData()
 	{
 		return this->host;
 	}
 public:
-	explicit Stream(size_t a_NumElements)
-		: BufferBase<T, T>(a_NumElements, sizeof(T), false)
+	//host only streams return null device pointers
+	explicit Stream(size_t a_NumElements, bool a_HostOnly = false)
+		: BufferBase<T, T>(a_NumElements, sizeof(T), false, a_HostOnly)
 	{
 
+	}
+	//copies src into the host memory of ref and submits the device upload from src directly, e.g. from a file mapping,
+	//ref is removed from the invalidated ranges. src only has to be valid during the call.
+	//host only streams only copy the data and invalidate ref, the callbacks of UpdateInvalidated still have to see it
+	void UploadFrom(BufferReference<T, T> ref, const T* src)
+	{
+		if (!ref.getLength())
+			return;
+		if (src != this->host + ref.getIndex())
+			::memcpy(this->host + ref.getIndex(), src, ref.getLength() * sizeof(T));
+		if (this->m_bHostOnly)
+		{
+			this->Invalidate(ref.getIndex(), ref.getLength());
+			return;
+		}
+		std::vector<UploadQueue::Range> range = { UploadQueue::Range{ 0, ref.getLength() } };
+		this->getUploadQueue().Submit(this->device + ref.getIndex(), src, range, sizeof(T));
+		*this->m_uInvalidated -= typename BufferBase<T, T>::ival(ref.getIndex(), ref.getIndex() + ref.getLength());
 	}
 	virtual KernelBuffer<T> getKernelData(bool devicePointer = true) const
 	{
 		KernelBuffer<T> r;
 		r.Data = devicePointer ? BufferBase<T, T>::device : BufferBase<T, T>::host;
 		r.Length = (unsigned int)BufferBase<T, T>::m_uLength;
-		r.UsedCount = (unsigned int)BufferBase<T, T>::m_uPos;
+		r.UsedCount = (unsigned int)this->getUsedLength();
 		return r;
 	}
 };
@@ -518,6 +697,40 @@ public:
 		m_sEntries[file] = e;
 		return e.ref;
 	}
+	//clb(file, ref, count) for every cached entry
+	template<typename CLB> void enumerateCached(const CLB& clb) const
+	{
+		for (auto& e : m_sEntries)
+			clb(e.first, e.second.ref, e.second.count);
+	}
+	//adds an entry for an allocated element, e.g. when loading a snapshot
+	void setCached(const std::string& file, BufferReference<H, D> ref, size_t count)
+	{
+		entry e;
+		e.count = count;
+		e.ref = ref;
+		m_sEntries[file] = e;
+	}
+	//returns true and the element if file is cached, the reference count is not changed
+	bool findCached(const std::string& file, BufferReference<H, D>& ref) const
+	{
+		auto it = m_sEntries.find(file);
+		if (it == m_sEntries.end())
+			return false;
+		ref = it->second.ref;
+		return true;
+	}
+	//removes the entry and deallocates the element directly instead of adding it to the unused entries
+	//the resources held by the element have to be freed by the caller
+	void Discard(const std::string& file)
+	{
+		typename std::map<std::string, entry>::iterator it = m_sEntries.find(file);
+		if (it == m_sEntries.end())
+			throw std::runtime_error(std::string(__FUNCTION__) + " : Entry not found!");
+		BufferReference<H, D> ref = it->second.ref;
+		m_sEntries.erase(it);
+		this->dealloc(ref);
+	}
 	void Release(const std::string& file)
 	{
 		typename std::map<std::string, entry>::iterator it = m_sEntries.find(file);
@@ -0,0 +1,106 @@
+#include <StdAfx.h>
+#include "BufferRangeAllocator.h"
+
+namespace CudaTracerLib {
+
+BufferRangeAllocator::BufferRangeAllocator(size_t capacity)
+	: m_uUsed(0), m_uCapacity(capacity), m_uFreeElements(0)
+{
+
+}
+
+void BufferRangeAllocator::insertFree(size_t offset, size_t length)
+{
+	m_freeRanges[offset] = length;
+	m_bins[getBin(length)].insert(std::make_pair(length, offset));
+	m_uFreeElements += length;
+}
+
+void BufferRangeAllocator::eraseFree(free_map_t::iterator it)
+{
+	m_bins[getBin(it->second)].erase(std::make_pair(it->second, it->first));
+	m_uFreeElements -= it->second;
+	m_freeRanges.erase(it);
+}
+
+size_t BufferRangeAllocator::Allocate(size_t length)
+{
+	if (length == 0)
+		return m_uUsed;
+
+	//ranges in the own bin can be too short, all ranges of the following bins fit
+	unsigned int b = getBin(length);
+	auto it = m_bins[b].lower_bound(std::make_pair(length, size_t(0)));
+	if (it == m_bins[b].end())
+	{
+		for (b = b + 1; b < NUM_BINS && m_bins[b].empty(); b++);
+		if (b < NUM_BINS)
+			it = m_bins[b].begin();
+	}
+
+	if (b < NUM_BINS && it != m_bins[b].end())
+	{
+		size_t offset = it->second, rangeLength = it->first;
+		eraseFree(m_freeRanges.find(offset));
+		if (rangeLength > length)
+			insertFree(offset + length, rangeLength - length);
+		return offset;
+	}
+
+	if (length > m_uCapacity - m_uUsed)
+		return MINUS_ONE;
+	m_uUsed += length;
+	return m_uUsed - length;
+}
+
+void BufferRangeAllocator::Free(size_t offset, size_t length)
+{
+	if (length == 0)
+		return;
+	if (offset + length > m_uUsed)
+		throw std::runtime_error("Trying to free a range which was not allocated!");
+
+	//merge with the neighbouring free ranges
+	auto next = m_freeRanges.lower_bound(offset);
+	if (next != m_freeRanges.end() && next->first < offset + length)
+		throw std::runtime_error("Trying to free a range multiple times!");
+	if (next != m_freeRanges.end() && next->first == offset + length)
+	{
+		length += next->second;
+		eraseFree(next++);
+	}
+	if (next != m_freeRanges.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second > offset)
+			throw std::runtime_error("Trying to free a range multiple times!");
+		if (prev->first + prev->second == offset)
+		{
+			offset = prev->first;
+			length += prev->second;
+			eraseFree(prev);
+		}
+	}
+
+	if (offset + length == m_uUsed)
+		m_uUsed = offset;
+	else insertFree(offset, length);
+}
+
+void BufferRangeAllocator::setCapacity(size_t capacity)
+{
+	if (capacity < m_uCapacity)
+		throw std::runtime_error("Buffer capacity can not be reduced!");
+	m_uCapacity = capacity;
+}
+
+void BufferRangeAllocator::Reset(size_t used)
+{
+	m_freeRanges.clear();
+	for (unsigned int i = 0; i < NUM_BINS; i++)
+		m_bins[i].clear();
+	m_uFreeElements = 0;
+	m_uUsed = used;
+}
+
+}
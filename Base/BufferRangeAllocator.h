@@ -0,0 +1,137 @@
+#pragma once
+
+#include <Defines.h>
+#include <map>
+#include <set>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include "Buffer_device.h"
+
+namespace CudaTracerLib {
+
+//Segregated fit allocator for the element ranges of a BufferBase.
+//Free ranges are kept in bins of power of two lengths, each bin ordered by (length, offset). An allocation takes the smallest fitting range
+//of its own bin or the smallest range of the next non empty bin. Neighbouring free ranges are merged, free ranges touching the end shrink the used length.
+class BufferRangeAllocator
+{
+public:
+	enum { NUM_BINS = 64 };
+	//offset -> length
+	typedef std::map<size_t, size_t> free_map_t;
+private:
+	free_map_t m_freeRanges;
+	std::set<std::pair<size_t, size_t>> m_bins[NUM_BINS];
+	size_t m_uUsed;
+	size_t m_uCapacity;
+	size_t m_uFreeElements;
+
+	static unsigned int getBin(size_t length)
+	{
+		unsigned int b = 0;
+		while (length >>= 1)
+			b++;
+		return b;
+	}
+	void insertFree(size_t offset, size_t length);
+	void eraseFree(free_map_t::iterator it);
+public:
+	CTL_EXPORT explicit BufferRangeAllocator(size_t capacity);
+
+	//returns the offset of the range or MINUS_ONE when it does not fit into the capacity
+	CTL_EXPORT size_t Allocate(size_t length);
+	CTL_EXPORT void Free(size_t offset, size_t length);
+	//the capacity can only grow
+	CTL_EXPORT void setCapacity(size_t capacity);
+	//removes all free ranges, used after the allocated ranges were moved to the front
+	CTL_EXPORT void Reset(size_t used);
+
+	//end of the last allocated range
+	size_t getUsedLength() const
+	{
+		return m_uUsed;
+	}
+	size_t getCapacity() const
+	{
+		return m_uCapacity;
+	}
+	//free elements below the used length
+	size_t getNumFreeElements() const
+	{
+		return m_uFreeElements;
+	}
+	const free_map_t& getFreeRanges() const
+	{
+		return m_freeRanges;
+	}
+	//free range containing idx or the first one starting after it
+	free_map_t::const_iterator findFreeRange(size_t idx) const
+	{
+		auto it = m_freeRanges.upper_bound(idx);
+		if (it != m_freeRanges.begin())
+		{
+			auto prev = std::prev(it);
+			if (prev->first + prev->second > idx)
+				return prev;
+		}
+		return it;
+	}
+};
+
+//Translates element indices of a buffer after BufferBase::Compact moved the allocated ranges.
+//Indices inside freed ranges are mapped to the start of the next allocated range which keeps empty references valid.
+class BufferRemap
+{
+	struct segment
+	{
+		size_t src, dst, length;
+	};
+	//only the moved segments, everything in front of the first one keeps its index
+	std::vector<segment> m_segments;
+public:
+	void addSegment(size_t src, size_t dst, size_t length)
+	{
+		m_segments.push_back({ src, dst, length });
+	}
+
+	bool isIdentity() const
+	{
+		return m_segments.empty();
+	}
+
+	//first index which was moved, MINUS_ONE when nothing was moved
+	size_t getFirstMovedIndex() const
+	{
+		return m_segments.empty() ? MINUS_ONE : m_segments.front().dst;
+	}
+
+	//clb(src, dest, length) for every moved segment in increasing order
+	template<typename CLB> void enumerateSegments(const CLB& clb) const
+	{
+		for (const segment& s : m_segments)
+			clb(s.src, s.dst, s.length);
+	}
+
+	size_t operator()(size_t idx) const
+	{
+		auto it = std::upper_bound(m_segments.begin(), m_segments.end(), idx, [](size_t i, const segment& s)
+		{
+			return i < s.src;
+		});
+		if (it == m_segments.begin())
+			return m_segments.empty() ? idx : std::min(idx, m_segments.front().dst);
+		const segment& s = *--it;
+		return s.dst + std::min(idx - s.src, s.length);
+	}
+
+	template<typename H, typename D> BufferReference<H, D> operator()(const BufferReference<H, D>& ref) const
+	{
+		BufferReference<H, D> r = ref;
+		if (r.buf)
+			r.p = (*this)(ref.p);
+		return r;
+	}
+};
+
+}
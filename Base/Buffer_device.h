@@ -20,11 +20,13 @@ template<typename T> struct KernelBuffer
 };
 
 template<typename H, typename D> class BufferBase;
+class BufferRemap;
 class IInStream;
 class FileOutputStream;
 template<typename H, typename D> class BufferReference
 {
 	template<typename H2, typename D2> friend class BufferBase;
+	friend class BufferRemap;
 	BufferBase<H, D>* buf;
 	size_t p, l;
 public:
@@ -1,43 +1,334 @@
 #include <StdAfx.h>
 #include "CudaMemoryManager.h"
+#include <unordered_map>
+#include <mutex>
 
 namespace CudaTracerLib {
 
-std::map<void*, CudaMemoryEntry> CudaMemoryManager::alloced_entries;
-std::vector<CudaMemoryEntry> CudaMemoryManager::freed_entries;
+namespace __cuda_memory_manager__
+{
+	//tag of the innermost CudaMemoryScope of the thread
+	static thread_local unsigned int g_scopeTag = UINT_MAX;
+
+	struct LiveEntry
+	{
+		size_t length;
+		unsigned int size_class;
+		unsigned int tag;
+	};
+
+	struct Pool
+	{
+		CudaMemorySpace space;
+		std::unordered_map<void*, LiveEntry> live;
+		std::vector<void*> free_blocks[CudaMemoryManager::MAX_POOLED_CLASS + 1];
+		size_t cached_bytes;
+		size_t cache_limit;
+		size_t live_bytes;
+		//rounded block sizes of the live allocations, the budget is checked against these plus the cached blocks
+		size_t block_bytes;
+		size_t budget;
+		std::vector<CudaMemoryTagStatistics> tags;
+		CudaMemoryEntry history[CudaMemoryManager::HISTORY_LENGTH];
+		size_t history_pos;
+
+		Pool(CudaMemorySpace space, size_t cache_limit)
+			: space(space), cached_bytes(0), cache_limit(cache_limit), live_bytes(0), block_bytes(0), budget(size_t(-1)), history_pos(0)
+		{
 
-cudaError_t CudaMemoryManager::Cuda_malloc_managed(void** v, size_t i, const std::string& callig_func)
+		}
+
+		bool backendAlloc(void** v, size_t size)
+		{
+			if (space == CudaMemorySpace::Device)
+				return cudaMalloc(v, size) == cudaSuccess;
+			*v = ::malloc(size);
+			return *v != 0 || size == 0;
+		}
+
+		void backendFree(void* v)
+		{
+			if (space == CudaMemorySpace::Device)
+				ThrowCudaErrors(cudaFree(v));
+			else ::free(v);
+		}
+
+		void releaseCachedBlocks()
+		{
+			for (unsigned int c = 0; c <= CudaMemoryManager::MAX_POOLED_CLASS; c++)
+			{
+				for (void* v : free_blocks[c])
+					backendFree(v);
+				free_blocks[c].clear();
+			}
+			cached_bytes = 0;
+		}
+	};
+}
+using namespace __cuda_memory_manager__;
+
+struct CudaMemoryManager::State
 {
-	cudaError_t r = cudaMalloc(v, i);
-	if (r == cudaError_t::cudaSuccess)
+	std::mutex mutex;
+	std::unordered_map<const char*, unsigned int> tagsByAddress;
+	std::unordered_map<std::string, unsigned int> tagsByName;
+	std::vector<std::string> tagNames;
+	Pool device, host;
+
+	State()
+		: device(CudaMemorySpace::Device, size_t(512) << 20), host(CudaMemorySpace::Host, size_t(256) << 20)
+	{
+
+	}
+
+	Pool& getPool(CudaMemorySpace space)
+	{
+		return space == CudaMemorySpace::Device ? device : host;
+	}
+
+	unsigned int internTag(const char* name)
+	{
+		//__func__ has a fixed address per function, only the first call of a call site has to compare the name
+		auto it = tagsByAddress.find(name);
+		if (it != tagsByAddress.end())
+			return it->second;
+		auto it2 = tagsByName.find(name);
+		unsigned int tag;
+		if (it2 != tagsByName.end())
+			tag = it2->second;
+		else
+		{
+			tag = (unsigned int)tagNames.size();
+			tagNames.push_back(name);
+			tagsByName[name] = tag;
+		}
+		tagsByAddress[name] = tag;
+		return tag;
+	}
+
+	unsigned int internTagName(const std::string& name)
+	{
+		auto it = tagsByName.find(name);
+		if (it != tagsByName.end())
+			return it->second;
+		unsigned int tag = (unsigned int)tagNames.size();
+		tagNames.push_back(name);
+		tagsByName[name] = tag;
+		return tag;
+	}
+};
+
+CudaMemoryManager::State& CudaMemoryManager::getState()
+{
+	//never destroyed so that buffers freed during static destruction still find their entries
+	static State* state = new State();
+	return *state;
+}
+
+unsigned int CudaMemoryManager::InternTag(const char* name)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.internTag(name);
+}
+
+unsigned int CudaMemoryManager::InternTagName(const std::string& name)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.internTagName(name);
+}
+
+CudaMemoryScope::CudaMemoryScope(const std::string& name)
+	: m_uPreviousTag(g_scopeTag), m_bActive(true)
+{
+	g_scopeTag = CudaMemoryManager::InternTagName(name);
+}
+
+CudaMemoryScope::~CudaMemoryScope()
+{
+	End();
+}
+
+void CudaMemoryScope::End()
+{
+	if (m_bActive)
+		g_scopeTag = m_uPreviousTag;
+	m_bActive = false;
+}
+
+bool CudaMemoryManager::allocate(CudaMemorySpace space, void** v, size_t size, const char* calling_func)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	Pool& pool = state.getPool(space);
+
+	LiveEntry e;
+	e.length = size;
+	e.tag = g_scopeTag != UINT_MAX ? g_scopeTag : state.internTag(calling_func);
+	e.size_class = size <= getSizeClassBytes(MAX_POOLED_CLASS) ? getSizeClass(size) : UINT_MAX;
+
+	*v = 0;
+	size_t blockSize = e.size_class != UINT_MAX ? getSizeClassBytes(e.size_class) : size;
+	bool reuseCached = e.size_class != UINT_MAX && pool.free_blocks[e.size_class].size();
+	//reusing a cached block does not change the resident bytes, a new block is charged with its rounded size
+	auto exceedsBudget = [&]() { return blockSize > pool.budget || pool.block_bytes + pool.cached_bytes > pool.budget - blockSize; };
+	if (!reuseCached && exceedsBudget())
+	{
+		pool.releaseCachedBlocks();
+		if (exceedsBudget())
+			throw std::runtime_error(format("%s memory budget exceeded : %s requested %llu bytes (%llu rounded), %llu of %llu bytes are in use",
+				space == CudaMemorySpace::Device ? "Device" : "Host", state.tagNames[e.tag].c_str(), (unsigned long long)size,
+				(unsigned long long)blockSize, (unsigned long long)pool.block_bytes, (unsigned long long)pool.budget));
+	}
+	if (reuseCached)
 	{
-		CudaMemoryEntry e;
-		e.address = *v;
-		e.free_func = "";
-		e.length = i;
-		e.malloc_func = callig_func;
-		alloced_entries[*v] = e;
+		*v = pool.free_blocks[e.size_class].back();
+		pool.free_blocks[e.size_class].pop_back();
+		pool.cached_bytes -= blockSize;
 	}
-	else ThrowCudaErrors(r);
-	return r;
+	else if (!pool.backendAlloc(v, blockSize))
+	{
+		//the cached blocks of other classes might be the reason for the failure
+		pool.releaseCachedBlocks();
+		if (!pool.backendAlloc(v, blockSize))
+			return false;
+	}
+
+	pool.live[*v] = e;
+	pool.live_bytes += size;
+	pool.block_bytes += blockSize;
+	if (e.tag >= pool.tags.size())
+		pool.tags.resize(e.tag + 1, CudaMemoryTagStatistics{ std::string(), 0, 0, 0, 0 });
+	CudaMemoryTagStatistics& t = pool.tags[e.tag];
+	t.live_bytes += size;
+	t.peak_bytes = std::max(t.peak_bytes, t.live_bytes);
+	t.num_allocations++;
+	return true;
 }
 
-cudaError_t CudaMemoryManager::Cuda_free_managed(void* v, const std::string& callig_func)
+void CudaMemoryManager::release(CudaMemorySpace space, void* v, const char* calling_func)
 {
-	cudaError_t r = cudaError_t::cudaSuccess;
-	if (alloced_entries.count(v))
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	Pool& pool = state.getPool(space);
+	auto it = pool.live.find(v);
+	if (it == pool.live.end())
+		throw std::runtime_error("Trying to free memory multiple times or without allocating it correctly!");
+	LiveEntry e = it->second;
+	pool.live.erase(it);
+
+	pool.live_bytes -= e.length;
+	pool.block_bytes -= e.size_class != UINT_MAX ? getSizeClassBytes(e.size_class) : e.length;
+	CudaMemoryTagStatistics& t = pool.tags[e.tag];
+	t.live_bytes -= e.length;
+	t.num_frees++;
+
+	CudaMemoryEntry& h = pool.history[pool.history_pos++ % HISTORY_LENGTH];
+	h.address = v;
+	h.length = e.length;
+	h.malloc_tag = e.tag;
+	h.free_tag = state.internTag(calling_func);
+
+	if (e.size_class != UINT_MAX && pool.cached_bytes + getSizeClassBytes(e.size_class) <= pool.cache_limit)
 	{
-		CudaMemoryEntry e = alloced_entries[v];
-		if (e.address == 0)
-			throw std::runtime_error("Trying to free cuda memory multiple times!");
-		//alloced_entries.erase(v);
-		e.free_func = callig_func;
-		freed_entries.push_back(e);
-		r = cudaFree(v);
-		ThrowCudaErrors(r);
+		pool.free_blocks[e.size_class].push_back(v);
+		pool.cached_bytes += getSizeClassBytes(e.size_class);
 	}
-	else throw std::runtime_error("Trying to free cuda memory without allocating it correctly!");
-	return r;
+	else pool.backendFree(v);
+}
+
+cudaError_t CudaMemoryManager::Cuda_malloc_managed(void** v, size_t i, const char* calling_func)
+{
+	if (!allocate(CudaMemorySpace::Device, v, i, calling_func))
+		ThrowCudaErrors(cudaErrorMemoryAllocation);
+	return cudaSuccess;
+}
+
+cudaError_t CudaMemoryManager::Cuda_free_managed(void* v, const char* calling_func)
+{
+	if (v)
+		release(CudaMemorySpace::Device, v, calling_func);
+	return cudaSuccess;
+}
+
+void CudaMemoryManager::Host_malloc_managed(void** v, size_t i, const char* calling_func)
+{
+	if (!allocate(CudaMemorySpace::Host, v, i, calling_func))
+		throw std::bad_alloc();
+}
+
+void CudaMemoryManager::Host_free_managed(void* v, const char* calling_func)
+{
+	if (v)
+		release(CudaMemorySpace::Host, v, calling_func);
+}
+
+std::vector<CudaMemoryTagStatistics> CudaMemoryManager::getTagStatistics(CudaMemorySpace space)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	std::vector<CudaMemoryTagStatistics> res = state.getPool(space).tags;
+	for (size_t i = 0; i < res.size(); i++)
+		res[i].name = state.tagNames[i];
+	return res;
+}
+
+std::vector<CudaMemoryEntry> CudaMemoryManager::getHistory(CudaMemorySpace space)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	const Pool& pool = state.getPool(space);
+	std::vector<CudaMemoryEntry> res;
+	size_t n = std::min(pool.history_pos, (size_t)HISTORY_LENGTH);
+	for (size_t i = pool.history_pos - n; i < pool.history_pos; i++)
+		res.push_back(pool.history[i % HISTORY_LENGTH]);
+	return res;
+}
+
+size_t CudaMemoryManager::getLiveBytes(CudaMemorySpace space)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.getPool(space).live_bytes;
+}
+
+size_t CudaMemoryManager::getCachedBytes(CudaMemorySpace space)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.getPool(space).cached_bytes;
+}
+
+void CudaMemoryManager::ReleaseCachedBlocks(CudaMemorySpace space)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	state.getPool(space).releaseCachedBlocks();
+}
+
+void CudaMemoryManager::setCacheLimit(CudaMemorySpace space, size_t bytes)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	Pool& pool = state.getPool(space);
+	pool.cache_limit = bytes;
+	if (pool.cached_bytes > bytes)
+		pool.releaseCachedBlocks();
+}
+
+void CudaMemoryManager::setBudget(CudaMemorySpace space, size_t bytes)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	state.getPool(space).budget = bytes;
+}
+
+size_t CudaMemoryManager::getBudget(CudaMemorySpace space)
+{
+	State& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.getPool(space).budget;
 }
 
 }
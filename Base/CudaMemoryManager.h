@@ -1,7 +1,6 @@
 #pragma once
 
 #include <string>
-#include <map>
 #include <vector>
 #include <stdlib.h>
 #include "cuda_runtime.h"
@@ -9,33 +8,120 @@
 
 namespace CudaTracerLib {
 
+//freed allocation, the tags index CudaMemoryManager::getTagStatistics
 struct CudaMemoryEntry
 {
 	void* address;
 	size_t length;
-	std::string malloc_func;
-	std::string free_func;
+	unsigned int malloc_tag;
+	unsigned int free_tag;
 };
+
+//live and peak bytes of all allocations made from one call site
+struct CudaMemoryTagStatistics
+{
+	std::string name;
+	size_t live_bytes;
+	size_t peak_bytes;
+	size_t num_allocations;
+	size_t num_frees;
+};
+
+enum class CudaMemorySpace
+{
+	Device,
+	Host,
+};
+
+//Size class pooling allocator for device and host memory.
+//Requests are rounded up to one of four classes per power of two and freed blocks are kept in per class free lists for reuse,
+//which makes repeated Resize calls of frame buffers cheap. All device work is issued on the default stream, therefore a block can be reused
+//directly after it was freed. Call sites are identified by interned tags, the last HISTORY_LENGTH frees are kept for debugging.
 class CudaMemoryManager
 {
 public:
-	CTL_EXPORT static std::map<void*, CudaMemoryEntry> alloced_entries;
-	CTL_EXPORT static std::vector<CudaMemoryEntry> freed_entries;
-public:
-	CTL_EXPORT static cudaError_t Cuda_malloc_managed(void** v, size_t i, const std::string& callig_func);
-	template<typename T> static cudaError_t Cuda_malloc_managed(T** v, size_t i, const std::string& callig_func)
+	enum
+	{
+		HISTORY_LENGTH = 4096,
+		//largest pooled size class (256MB), bigger requests are passed through to the backend
+		MAX_POOLED_CLASS = 4 * 20,
+	};
+	static size_t getSizeClassBytes(unsigned int c)
+	{
+		return size_t(4 + (c & 3)) << (c / 4 + 6);
+	}
+	//only valid for sizes up to getSizeClassBytes(MAX_POOLED_CLASS)
+	static unsigned int getSizeClass(size_t size)
 	{
-		return Cuda_malloc_managed((void**)v, i, callig_func);
+		//find the first power of two which fits, the result is one of the three classes below it or the power itself
+		unsigned int c = 0;
+		while (getSizeClassBytes(c) < size)
+			c += 4;
+		c = c < 4 ? 0 : c - 3;
+		while (getSizeClassBytes(c) < size)
+			c++;
+		return c;
 	}
-	CTL_EXPORT static cudaError_t Cuda_free_managed(void* v, const std::string& callig_func);
-	template<typename T> static cudaError_t Cuda_free_managed(T* v, const std::string&callig_func)
+
+	CTL_EXPORT static cudaError_t Cuda_malloc_managed(void** v, size_t i, const char* calling_func);
+	template<typename T> static cudaError_t Cuda_malloc_managed(T** v, size_t i, const char* calling_func)
+	{
+		return Cuda_malloc_managed((void**)v, i, calling_func);
+	}
+	CTL_EXPORT static cudaError_t Cuda_free_managed(void* v, const char* calling_func);
+
+	CTL_EXPORT static void Host_malloc_managed(void** v, size_t i, const char* calling_func);
+	template<typename T> static void Host_malloc_managed(T** v, size_t i, const char* calling_func)
 	{
-		return Cuda_free_managed((void*)v, callig_func);
+		Host_malloc_managed((void**)v, i, calling_func);
 	}
+	CTL_EXPORT static void Host_free_managed(void* v, const char* calling_func);
+
+	//returns the tag of the call site, the name is only copied the first time a call site is seen
+	CTL_EXPORT static unsigned int InternTag(const char* name);
+	//same as InternTag for names which are not stored at a fixed address
+	CTL_EXPORT static unsigned int InternTagName(const std::string& name);
+	CTL_EXPORT static std::vector<CudaMemoryTagStatistics> getTagStatistics(CudaMemorySpace space);
+	//freed allocations of the space, oldest first
+	CTL_EXPORT static std::vector<CudaMemoryEntry> getHistory(CudaMemorySpace space);
+	CTL_EXPORT static size_t getLiveBytes(CudaMemorySpace space);
+	//bytes held in the free lists
+	CTL_EXPORT static size_t getCachedBytes(CudaMemorySpace space);
+	//returns all cached blocks to the backend, done automatically when an allocation fails
+	CTL_EXPORT static void ReleaseCachedBlocks(CudaMemorySpace space);
+	//maximum number of bytes kept in the free lists, freed blocks exceeding the limit are released immediately
+	CTL_EXPORT static void setCacheLimit(CudaMemorySpace space, size_t bytes);
+	//allocations which would increase the resident bytes of the space above the budget throw a std::runtime_error naming the call site
+	//instead of trying the backend, the resident bytes are the rounded block sizes of the live allocations plus the cached blocks
+	//the cached blocks are released before an allocation fails, MINUS_ONE disables the budget
+	CTL_EXPORT static void setBudget(CudaMemorySpace space, size_t bytes);
+	CTL_EXPORT static size_t getBudget(CudaMemorySpace space);
+private:
+	struct State;
+	static State& getState();
+	static bool allocate(CudaMemorySpace space, void** v, size_t size, const char* calling_func);
+	static void release(CudaMemorySpace space, void* v, const char* calling_func);
+};
+
+//Accounts all allocations of the current thread to the tag of the scope instead of their call sites while the scope is alive.
+//Used to group the allocations of helper classes under the name of the owning subsystem, scopes can be nested.
+//Scopes which are members of a class can be ended at the end of the constructor with End.
+class CudaMemoryScope
+{
+	unsigned int m_uPreviousTag;
+	bool m_bActive;
+public:
+	CTL_EXPORT explicit CudaMemoryScope(const std::string& name);
+	CTL_EXPORT ~CudaMemoryScope();
+	CTL_EXPORT void End();
+	CudaMemoryScope(const CudaMemoryScope&) = delete;
+	CudaMemoryScope& operator=(const CudaMemoryScope&) = delete;
 };
 
-#define CUDA_MALLOC(v,i) CudaMemoryManager::Cuda_malloc_managed(v, i, std::string(__func__))
-#define CUDA_FREE(v) CudaMemoryManager::Cuda_free_managed(v, std::string(__func__))
+#define CUDA_MALLOC(v,i) CudaMemoryManager::Cuda_malloc_managed(v, i, __func__)
+#define CUDA_FREE(v) CudaMemoryManager::Cuda_free_managed(v, __func__)
+#define HOST_MALLOC(v,i) CudaMemoryManager::Host_malloc_managed(v, i, __func__)
+#define HOST_FREE(v) CudaMemoryManager::Host_free_managed(v, __func__)
 #define CUDA_MEMCPY_TO_HOST(dest,src,length) ThrowCudaErrors(cudaMemcpy(dest, src, length, cudaMemcpyDeviceToHost))
 #define CUDA_MEMCPY_TO_DEVICE(dest,src,length) ThrowCudaErrors(cudaMemcpy(dest, src, length, cudaMemcpyHostToDevice))
 
@@ -1,17 +1,112 @@
 #include <StdAfx.h>
 #include "FileStream.h"
 #include <filesystem.h>
+#include <miniz/miniz.h>
+#include "ThreadPool.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace CudaTracerLib {
 
 bool IInStream::ReadTo(std::string& str, char end)
 {
-	char ch;
+	char ch = 0;
 	str.clear();
 	str.reserve(128);
 	while (get(ch) && ch != end)
 		str.push_back(ch);
-	return ch == end && (!eof() || str.length());
+	//the last line does not have to be terminated
+	return ch == end || str.length();
+}
+
+//byte b of word i is moved to plane b, the planes of floats with similar exponents compress much better
+static void shuffleWords(const unsigned char* src, unsigned char* dst, size_t size)
+{
+	size_t n = size / 4;
+	for (size_t i = 0; i < n; i++)
+		for (size_t b = 0; b < 4; b++)
+			dst[b * n + i] = src[i * 4 + b];
+	memcpy(dst + n * 4, src + n * 4, size - n * 4);
+}
+
+static void unshuffleWords(const unsigned char* src, unsigned char* dst, size_t size)
+{
+	size_t n = size / 4;
+	for (size_t i = 0; i < n; i++)
+		for (size_t b = 0; b < 4; b++)
+			dst[i * 4 + b] = src[b * n + i];
+	memcpy(dst + n * 4, src + n * 4, size - n * 4);
+}
+
+const void* IInStream::ReadSection(void* dst, size_t size)
+{
+	unsigned int codec;
+	unsigned long long rawSize;
+	*this >> codec >> rawSize;
+	if (rawSize != size)
+		throw std::runtime_error(format("Invalid section size %llu, expected %llu in %s", rawSize, (unsigned long long)size, getFilePath().c_str()));
+	if (codec == SECTION_CODEC_RAW)
+	{
+		Align(SECTION_ALIGNMENT);
+		const void* data = ReadMapped(size);
+		if (!data && size)
+		{
+			if (dst)
+				Read(dst, size);
+			else for (size_t off = 0; off < size; off += INT_MAX)
+				Move((int)std::min(size - off, (size_t)INT_MAX));
+		}
+		return data;
+	}
+	else if (codec != SECTION_CODEC_DEFLATE)
+		throw std::runtime_error(format("Unknown section codec %u in %s", codec, getFilePath().c_str()));
+
+	unsigned int numBlocks;
+	*this >> numBlocks;
+	std::vector<unsigned int> blockSizes(numBlocks);
+	std::vector<size_t> blockOffsets(numBlocks + 1, 0);
+	if (numBlocks)
+		Read(&blockSizes[0], numBlocks * sizeof(unsigned int));
+	for (unsigned int i = 0; i < numBlocks; i++)
+		blockOffsets[i + 1] = blockOffsets[i] + blockSizes[i];
+	size_t compressedSize = blockOffsets[numBlocks];
+	const unsigned char* compressed = (const unsigned char*)ReadMapped(compressedSize);
+	std::vector<unsigned char> compressedCopy;
+	if (!compressed)
+	{
+		if (!dst)
+		{
+			for (size_t off = 0; off < compressedSize; off += INT_MAX)
+				Move((int)std::min(compressedSize - off, (size_t)INT_MAX));
+			return 0;
+		}
+		compressedCopy.resize(compressedSize);
+		if (compressedSize)
+			Read(&compressedCopy[0], compressedSize);
+		compressed = compressedCopy.data();
+	}
+	if (!dst)
+		return 0;
+
+	std::string path = getFilePath();
+	ThreadPool::getGlobalPool().ParallelFor(numBlocks, [&](unsigned int i, unsigned int)
+	{
+		size_t off = size_t(i) * SECTION_BLOCK_SIZE, n = std::min(size - off, (size_t)SECTION_BLOCK_SIZE);
+		std::vector<unsigned char> shuffled(n);
+		mz_ulong l = (mz_ulong)n;
+		if (mz_uncompress(&shuffled[0], &l, compressed + blockOffsets[i], blockSizes[i]) != MZ_OK || l != n)
+			throw std::runtime_error(format("Corrupt compressed section in %s", path.c_str()));
+		unshuffleWords(&shuffled[0], (unsigned char*)dst + off, n);
+	});
+	return 0;
 }
 
 unsigned char* IInStream::ReadToEnd()
@@ -55,6 +150,8 @@ void FileInputStream::Move(int off)
 {
 	if (size_t(numBytesRead + off) > m_uFileSize)
 		throw std::runtime_error("Passed end of file or tried moving before beginning!");
+	if (fseek(m_ptr, off, SEEK_CUR))
+		throw std::runtime_error("Error seeking in file!");
 	numBytesRead += off;
 }
 
@@ -95,8 +192,93 @@ void MemInputStream::Read(void* a_Data, size_t a_Size)
 	numBytesRead += a_Size;
 }
 
+const void* MemInputStream::ReadMapped(size_t size)
+{
+	if (size + numBytesRead > m_uFileSize)
+		throw std::runtime_error("Stream not long enough!");
+	const void* p = buf + numBytesRead;
+	numBytesRead += size;
+	return p;
+}
+
+//the file and mapping handles are closed right after mapping, the view keeps the file open
+MappedInputStream::MappedInputStream(const std::string& a_Name)
+	: numBytesRead(0), m_pData(0), path(a_Name)
+{
+	m_uFileSize = std::filesystem::file_size(a_Name);
+	if (!m_uFileSize)
+		return;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(a_Name.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Could not open file : " + a_Name);
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	CloseHandle(file);
+	if (!mapping)
+		throw std::runtime_error("Could not map file : " + a_Name);
+	m_pData = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!m_pData)
+		throw std::runtime_error("Could not map file : " + a_Name);
+#else
+	int fd = open(a_Name.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error("Could not open file : " + a_Name);
+	void* p = mmap(0, m_uFileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		throw std::runtime_error("Could not map file : " + a_Name);
+	madvise(p, m_uFileSize, MADV_SEQUENTIAL);
+	m_pData = (const unsigned char*)p;
+#endif
+}
+
+void MappedInputStream::Close()
+{
+	if (m_pData)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(m_pData);
+#else
+		munmap((void*)m_pData, m_uFileSize);
+#endif
+		m_pData = 0;
+	}
+}
+
+void MappedInputStream::Read(void* a_Data, size_t a_Size)
+{
+	memcpy(a_Data, ReadMapped(a_Size), a_Size);
+}
+
+void MappedInputStream::Move(int off)
+{
+	if (size_t(numBytesRead + off) > m_uFileSize)
+		throw std::runtime_error("Passed end of file or tried moving before beginning!");
+	numBytesRead += off;
+}
+
+const void* MappedInputStream::ReadMapped(size_t size)
+{
+	if (size + numBytesRead > m_uFileSize)
+		throw std::runtime_error("Passed end of file!");
+	if (!m_pData && size)
+		throw std::runtime_error("Stream is closed!");
+	const void* p = m_pData + numBytesRead;
+	numBytesRead += size;
+	return p;
+}
+
 IInStream* OpenFile(const std::string& filename)
 {
+	//mapping the file avoids reading it completely upfront and copying it through an intermediate buffer
+	try
+	{
+		return new MappedInputStream(filename);
+	}
+	catch (std::runtime_error&)
+	{
+	}
 	if (std::filesystem::file_size(filename) < 1024 * 1024 * 512)
 		return new MemInputStream(filename);
 	else return new FileInputStream(filename);
@@ -119,6 +301,50 @@ void FileOutputStream::_Write(const void* data, size_t size)
 	numBytesWrote += size;
 }
 
+void FileOutputStream::Align(size_t alignment)
+{
+	static const char zeros[256] = { 0 };
+	size_t n = (alignment - numBytesWrote % alignment) % alignment;
+	while (n)
+	{
+		size_t k = std::min(n, sizeof(zeros));
+		_Write(zeros, k);
+		n -= k;
+	}
+}
+
+void FileOutputStream::WriteSection(const void* data, size_t size)
+{
+	int level = m_sStorageOptions.compression_level;
+	*this << (level > 0 ? SECTION_CODEC_DEFLATE : SECTION_CODEC_RAW);
+	*this << (unsigned long long)size;
+	if (level <= 0)
+	{
+		Align(SECTION_ALIGNMENT);
+		_Write(data, size);
+		return;
+	}
+
+	unsigned int numBlocks = (unsigned int)((size + SECTION_BLOCK_SIZE - 1) / SECTION_BLOCK_SIZE);
+	std::vector<std::vector<unsigned char>> blocks(numBlocks);
+	ThreadPool::getGlobalPool().ParallelFor(numBlocks, [&](unsigned int i, unsigned int)
+	{
+		size_t off = size_t(i) * SECTION_BLOCK_SIZE, n = std::min(size - off, (size_t)SECTION_BLOCK_SIZE);
+		std::vector<unsigned char> shuffled(n);
+		shuffleWords((const unsigned char*)data + off, &shuffled[0], n);
+		mz_ulong l = mz_compressBound((mz_ulong)n);
+		blocks[i].resize(l);
+		if (mz_compress2(&blocks[i][0], &l, &shuffled[0], (mz_ulong)n, level) != MZ_OK)
+			throw std::runtime_error("Could not compress section!");
+		blocks[i].resize(l);
+	});
+	*this << numBlocks;
+	for (auto& b : blocks)
+		*this << (unsigned int)b.size();
+	for (auto& b : blocks)
+		_Write(&b[0], b.size());
+}
+
 void FileOutputStream::Close()
 {
 	if (H)
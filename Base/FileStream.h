@@ -12,6 +12,46 @@
 
 namespace CudaTracerLib {
 
+//Sections are large arrays of 4 byte words, e.g. triangle or texel data. They start with the codec and the raw size.
+//Raw sections are aligned so they can be used directly from a file mapping, deflate sections consist of independently
+//compressed blocks with the bytes of each word shuffled into planes, which are decompressed in parallel.
+#define SECTION_CODEC_RAW 0u
+#define SECTION_CODEC_DEFLATE 1u
+#define SECTION_ALIGNMENT 64
+#define SECTION_BLOCK_SIZE (1024 * 1024)
+
+//Options for writing compiled assets.
+struct AssetStorageOptions
+{
+	//miniz level of the sections, 0 stores them raw
+	int compression_level;
+	//mantissa bits kept of vertex positions and texture coordinates, 23 keeps them lossless
+	unsigned int position_bits;
+	unsigned int uv_bits;
+	//textures are stored in a block compressed format, chosen by the content of every texture
+	bool block_compress_textures;
+	//textures are stored as tiles of this size for on demand loading, 0 stores the levels linearly
+	unsigned int texture_tile_size;
+
+	AssetStorageOptions(int compression_level = 0, unsigned int position_bits = 23, unsigned int uv_bits = 23, bool block_compress_textures = false)
+		: compression_level(compression_level), position_bits(position_bits), uv_bits(uv_bits), block_compress_textures(block_compress_textures), texture_tile_size(0)
+	{
+
+	}
+
+	//the lossy options of compiled meshes, they can only be shared if these match
+	std::string getMeshOptions() const
+	{
+		return position_bits < 23 || uv_bits < 23 ? format("p%uuv%u", position_bits, uv_bits) : "";
+	}
+
+	//the lossy options of compiled textures, they can only be shared if these match
+	std::string getTextureOptions() const
+	{
+		return block_compress_textures ? "bc" : "";
+	}
+};
+
 class IInStream
 {
 protected:
@@ -35,6 +75,23 @@ public:
 	bool eof(){ return getPos() == getFileSize(); }
 	virtual void Move(int off) = 0;
 	virtual void Close() = 0;
+	//returns a pointer to the next size bytes and advances the position if the stream is memory backed,
+	//otherwise null is returned and the position is unchanged
+	virtual const void* ReadMapped(size_t size)
+	{
+		return 0;
+	}
+	//skips bytes until the position is a multiple of alignment
+	void Align(size_t alignment)
+	{
+		size_t r = getPos() % alignment;
+		if (r)
+			Move(int(alignment - r));
+	}
+	//reads a section of size bytes written by FileOutputStream::WriteSection to dst, compressed blocks are decompressed in parallel
+	//if the section is raw and the stream memory backed a pointer into the stream is returned instead and dst is not written
+	//a null dst skips the section
+	CTL_EXPORT const void* ReadSection(void* dst, size_t size);
 	template<typename T> bool get(T& c)
 	{
 		if (getPos() + sizeof(T) <= getFileSize())
@@ -182,12 +239,46 @@ public:
 	{
 		numBytesRead += off;
 	}
+	CTL_EXPORT virtual const void* ReadMapped(size_t size);
 	virtual const std::string& getFilePath() const
 	{
 		return path;
 	}
 };
 
+//Read only memory mapping of a file, the pages are loaded on demand from the page cache.
+//ReadMapped returns pointers into the mapping which stay valid until the stream is closed.
+class MappedInputStream : public IInStream
+{
+private:
+	size_t numBytesRead;
+	const unsigned char* m_pData;
+	std::string path;
+public:
+	CTL_EXPORT explicit MappedInputStream(const std::string& a_Name);
+	virtual ~MappedInputStream()
+	{
+		Close();
+	}
+	CTL_EXPORT virtual void Close();
+	virtual size_t getPos()
+	{
+		return numBytesRead;
+	}
+	CTL_EXPORT virtual void Read(void* a_Data, size_t a_Size);
+	CTL_EXPORT void Move(int off);
+	CTL_EXPORT virtual const void* ReadMapped(size_t size);
+	virtual const std::string& getFilePath() const
+	{
+		return path;
+	}
+	//the whole file, null for empty files
+	const unsigned char* getData() const
+	{
+		return m_pData;
+	}
+};
+
 CTL_EXPORT IInStream* OpenFile(const std::string& filename);
 
 class FileOutputStream
@@ -195,6 +286,7 @@ class FileOutputStream
 private:
 	size_t numBytesWrote;
 	void* H;
+	AssetStorageOptions m_sStorageOptions;
 	CTL_EXPORT void _Write(const void* data, size_t size);
 public:
 	CTL_EXPORT explicit FileOutputStream(const std::string& a_Name);
@@ -207,6 +299,18 @@ public:
 	{
 		return numBytesWrote;
 	}
+	//writes zero bytes until the number of written bytes is a multiple of alignment
+	CTL_EXPORT void Align(size_t alignment);
+	//writes an array of 4 byte words as section, compressed with the compression level of the storage options
+	CTL_EXPORT void WriteSection(const void* data, size_t size);
+	const AssetStorageOptions& getStorageOptions() const
+	{
+		return m_sStorageOptions;
+	}
+	void setStorageOptions(const AssetStorageOptions& opts)
+	{
+		m_sStorageOptions = opts;
+	}
 	template<typename T> void Write(T* a_Data, size_t a_Size)
 	{
 		_Write(a_Data, a_Size);
@@ -0,0 +1,78 @@
+#include <StdAfx.h>
+#include "MemoryReport.h"
+#include "CudaMemoryManager.h"
+#include <sstream>
+#include <iomanip>
+
+namespace CudaTracerLib {
+
+MemoryReportEntry MemoryReport::getTotal() const
+{
+	MemoryReportEntry t;
+	t.name = "Total";
+	for (const MemoryReportEntry& e : entries)
+	{
+		t.device_live += e.device_live;
+		t.device_peak += e.device_peak;
+		t.device_reserved += e.device_reserved;
+		t.host_live += e.host_live;
+		t.host_peak += e.host_peak;
+		t.host_reserved += e.host_reserved;
+	}
+	return t;
+}
+
+std::string MemoryReport::ToString() const
+{
+	const int L = 32, C = 12;
+	auto mb = [](size_t b)
+	{
+		return b / (1024.0 * 1024.0);
+	};
+	std::ostringstream str;
+	str << std::fixed << std::setprecision(2);
+	str << std::left << std::setw(L) << "[MB]" << std::right;
+	for (const char* c : { "dev live", "dev peak", "dev reserved", "host live", "host peak", "host reserved" })
+		str << std::setw(C + 2) << c;
+	str << "\n";
+	auto line = [&](const MemoryReportEntry& e)
+	{
+		str << std::left << std::setw(L) << e.name << std::right;
+		for (size_t b : { e.device_live, e.device_peak, e.device_reserved, e.host_live, e.host_peak, e.host_reserved })
+			str << std::setw(C + 2) << mb(b);
+		str << "\n";
+	};
+	for (const MemoryReportEntry& e : entries)
+		line(e);
+	line(getTotal());
+	return str.str();
+}
+
+MemoryReport MemoryReport::FromAllocationTags()
+{
+	MemoryReport r;
+	std::vector<CudaMemoryTagStatistics> device = CudaMemoryManager::getTagStatistics(CudaMemorySpace::Device),
+										 host = CudaMemoryManager::getTagStatistics(CudaMemorySpace::Host);
+	//both spaces share the tag indices
+	size_t n = std::max(device.size(), host.size());
+	for (size_t i = 0; i < n; i++)
+	{
+		MemoryReportEntry e;
+		e.name = i < device.size() ? device[i].name : host[i].name;
+		if (i < device.size())
+		{
+			e.device_live = e.device_reserved = device[i].live_bytes;
+			e.device_peak = device[i].peak_bytes;
+		}
+		if (i < host.size())
+		{
+			e.host_live = e.host_reserved = host[i].live_bytes;
+			e.host_peak = host[i].peak_bytes;
+		}
+		if (e.device_peak || e.host_peak)
+			r.Add(e);
+	}
+	return r;
+}
+
+}
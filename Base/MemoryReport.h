@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Defines.h>
+#include <string>
+#include <vector>
+
+namespace CudaTracerLib {
+
+//Memory usage of one subsystem in bytes.
+//live is the memory currently in use, peak the maximum of live and reserved the memory which is allocated, e.g. the capacity of a buffer.
+struct MemoryReportEntry
+{
+	std::string name;
+	size_t device_live, device_peak, device_reserved;
+	size_t host_live, host_peak, host_reserved;
+
+	MemoryReportEntry()
+		: device_live(0), device_peak(0), device_reserved(0), host_live(0), host_peak(0), host_reserved(0)
+	{
+
+	}
+
+	MemoryReportEntry(const std::string& name, size_t device_live, size_t device_peak, size_t device_reserved, size_t host_live, size_t host_peak, size_t host_reserved)
+		: name(name), device_live(device_live), device_peak(device_peak), device_reserved(device_reserved), host_live(host_live), host_peak(host_peak), host_reserved(host_reserved)
+	{
+
+	}
+};
+
+class MemoryReport
+{
+public:
+	std::vector<MemoryReportEntry> entries;
+
+	void Add(const MemoryReportEntry& e)
+	{
+		entries.push_back(e);
+	}
+
+	//sum of all entries, the peak is the sum of the individual peaks and therefore an upper bound
+	CTL_EXPORT MemoryReportEntry getTotal() const;
+	//table with one line per entry in MB
+	CTL_EXPORT std::string ToString() const;
+
+	//one entry per allocation tag of the CudaMemoryManager, i.e. per call site or CudaMemoryScope
+	CTL_EXPORT static MemoryReport FromAllocationTags();
+};
+
+}
@@ -47,8 +47,23 @@ float Platform::Add(float* add, float val)
 #if defined(ISCUDA)
 	return atomicAdd(add, val);
 #else
-	float f = *add;
-	*add = f + val;
+	//compare and swap on the bit pattern, there is no native atomic float addition on the host
+	volatile unsigned int* address = (volatile unsigned int*)add;
+	unsigned int old_bits = *address, assumed;
+	float f;
+	do
+	{
+		assumed = old_bits;
+		memcpy(&f, &assumed, sizeof(f));
+		float g = f + val;
+		unsigned int new_bits;
+		memcpy(&new_bits, &g, sizeof(g));
+#if defined(ISWINDOWS)
+		old_bits = (unsigned int)InterlockedCompareExchange((volatile LONG*)address, (LONG)new_bits, (LONG)assumed);
+#else
+		old_bits = __sync_val_compare_and_swap(address, assumed, new_bits);
+#endif
+	} while (assumed != old_bits);
 	return f;
 #endif
 }
@@ -0,0 +1,164 @@
+#include <StdAfx.h>
+#include "ThreadPool.h"
+
+namespace CudaTracerLib {
+
+//set for all threads currently executing a task to detect nested ParallelFor calls
+static thread_local bool g_isInsideTask = false;
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+	: m_jobGeneration(0), m_shutdown(false), m_pClb(0), m_uRemainingTasks(0)
+{
+	if (numThreads == 0)
+		numThreads = std::thread::hardware_concurrency();
+	numThreads = numThreads == 0 ? 1 : numThreads;
+
+	for (unsigned int i = 0; i < numThreads; i++)
+		m_queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	//thread 0 is the caller of ParallelFor
+	for (unsigned int i = 1; i < numThreads; i++)
+		m_threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_stateMutex);
+		m_shutdown = true;
+	}
+	m_startCondition.notify_all();
+	for (auto& t : m_threads)
+		t.join();
+}
+
+ThreadPool& ThreadPool::getGlobalPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+bool ThreadPool::tryGetTask(unsigned int thread_idx, unsigned int& task_idx)
+{
+	//own queue is processed front to back which keeps neighbouring tasks on the same thread
+	{
+		WorkQueue& q = *m_queues[thread_idx];
+		std::unique_lock<std::mutex> lock(q.mutex);
+		if (!q.tasks.empty())
+		{
+			task_idx = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+		}
+	}
+
+	unsigned int N = getNumThreads();
+	for (unsigned int i = 1; i < N; i++)
+	{
+		WorkQueue& q = *m_queues[(thread_idx + i) % N];
+		std::unique_lock<std::mutex> lock(q.mutex);
+		if (!q.tasks.empty())
+		{
+			task_idx = q.tasks.back();
+			q.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::executeTasks(unsigned int thread_idx)
+{
+	unsigned int task_idx;
+	while (tryGetTask(thread_idx, task_idx))
+	{
+		g_isInsideTask = true;
+		try
+		{
+			(*m_pClb)(task_idx, thread_idx);
+		}
+		catch (...)
+		{
+			std::unique_lock<std::mutex> lock(m_stateMutex);
+			if (!m_firstException)
+				m_firstException = std::current_exception();
+		}
+		g_isInsideTask = false;
+
+		if (--m_uRemainingTasks == 0)
+		{
+			std::unique_lock<std::mutex> lock(m_stateMutex);
+			m_doneCondition.notify_all();
+		}
+	}
+}
+
+void ThreadPool::workerLoop(unsigned int thread_idx)
+{
+	unsigned long long lastGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_stateMutex);
+			while (!m_shutdown && m_jobGeneration == lastGeneration)
+				m_startCondition.wait(lock);
+			if (m_shutdown)
+				return;
+			lastGeneration = m_jobGeneration;
+		}
+		executeTasks(thread_idx);
+	}
+}
+
+void ThreadPool::ParallelFor(unsigned int N, const task_clb_t& clb)
+{
+	if (N == 0)
+		return;
+
+	if (g_isInsideTask || getNumThreads() == 1 || N == 1)
+	{
+		for (unsigned int i = 0; i < N; i++)
+			clb(i, 0);
+		return;
+	}
+
+	std::unique_lock<std::mutex> jobLock(m_jobMutex);
+
+	m_pClb = &clb;
+	m_firstException = nullptr;
+	m_uRemainingTasks = N;
+
+	//distribute contiguous ranges, stealing takes care of the imbalance
+	unsigned int numQueues = getNumThreads();
+	for (unsigned int i = 0; i < numQueues; i++)
+	{
+		WorkQueue& q = *m_queues[i];
+		std::unique_lock<std::mutex> lock(q.mutex);
+		unsigned int start = (unsigned int)((unsigned long long)N * i / numQueues), end = (unsigned int)((unsigned long long)N * (i + 1) / numQueues);
+		for (unsigned int j = start; j < end; j++)
+			q.tasks.push_back(j);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_stateMutex);
+		m_jobGeneration++;
+	}
+	m_startCondition.notify_all();
+
+	executeTasks(0);
+
+	{
+		std::unique_lock<std::mutex> lock(m_stateMutex);
+		while (m_uRemainingTasks != 0)
+			m_doneCondition.wait(lock);
+	}
+
+	m_pClb = 0;
+	if (m_firstException)
+	{
+		auto ex = m_firstException;
+		m_firstException = nullptr;
+		std::rethrow_exception(ex);
+	}
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Defines.h>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace CudaTracerLib {
+
+//Simple work stealing thread pool for host side parallel loops.
+//Every worker owns a deque of task indices, when it runs out of work it steals from the back of the other deques.
+class ThreadPool
+{
+public:
+	//task index and the index of the executing thread in [0, getNumThreads())
+	typedef std::function<void(unsigned int task_idx, unsigned int thread_idx)> task_clb_t;
+
+	//numThreads includes the calling thread, 0 uses all hardware threads
+	CTL_EXPORT ThreadPool(unsigned int numThreads = 0);
+	CTL_EXPORT ~ThreadPool();
+
+	unsigned int getNumThreads() const
+	{
+		return (unsigned int)m_queues.size();
+	}
+
+	//executes clb for every task index in [0, N) and blocks until all tasks are finished
+	//the calling thread participates as thread 0, nested calls from inside a task are executed serially
+	//the first exception thrown by a task is rethrown after all remaining tasks are finished
+	CTL_EXPORT void ParallelFor(unsigned int N, const task_clb_t& clb);
+
+	//pool shared by the library, created on first use
+	CTL_EXPORT static ThreadPool& getGlobalPool();
+private:
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<unsigned int> tasks;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_jobMutex;
+	std::mutex m_stateMutex;
+	std::condition_variable m_startCondition;
+	std::condition_variable m_doneCondition;
+	unsigned long long m_jobGeneration;
+	bool m_shutdown;
+
+	const task_clb_t* m_pClb;
+	std::atomic<unsigned int> m_uRemainingTasks;
+	std::exception_ptr m_firstException;
+
+	void workerLoop(unsigned int thread_idx);
+	bool tryGetTask(unsigned int thread_idx, unsigned int& task_idx);
+	void executeTasks(unsigned int thread_idx);
+};
+
+}
@@ -0,0 +1,155 @@
+#include <StdAfx.h>
+#include "UploadQueue.h"
+#include <cstring>
+
+namespace CudaTracerLib {
+
+UploadQueue::UploadQueue(bool hostOnly, size_t arenaSize, size_t maxGapBytes)
+	: m_bHostOnly(hostOnly), m_uArenaSize(arenaSize & ~size_t(15)), m_uMaxGapBytes(maxGapBytes), m_stream(0), m_uHead(0)
+{
+	m_sStatistics = Statistics{ 0, 0, 0, 0 };
+	m_current.arenaStart = m_current.arenaEnd = 0;
+	m_current.fence = 0;
+	if (m_bHostOnly)
+	{
+		m_pArena = (char*)malloc(m_uArenaSize);
+		if (!m_pArena)
+			throw std::bad_alloc();
+	}
+	else
+	{
+		ThrowCudaErrors(cudaMallocHost((void**)&m_pArena, m_uArenaSize));
+		ThrowCudaErrors(cudaStreamCreate(&m_stream));
+	}
+}
+
+UploadQueue::~UploadQueue()
+{
+	Flush();
+	if (m_bHostOnly)
+		free(m_pArena);
+	else
+	{
+		for (cudaEvent_t e : m_freeEvents)
+			cudaEventDestroy(e);
+		cudaStreamDestroy(m_stream);
+		cudaFreeHost(m_pArena);
+	}
+}
+
+UploadQueue& UploadQueue::getGlobalQueue()
+{
+	//never destroyed, the cuda context may already be gone during static destruction
+	static UploadQueue* queue = new UploadQueue();
+	return *queue;
+}
+
+void UploadQueue::Coalesce(std::vector<Range>& ranges, size_t maxGap)
+{
+	if (ranges.empty())
+		return;
+	size_t n = 0;
+	for (size_t i = 1; i < ranges.size(); i++)
+	{
+		Range& last = ranges[n];
+		if (ranges[i].offset - (last.offset + last.length) <= maxGap)
+			last.length = ranges[i].offset + ranges[i].length - last.offset;
+		else ranges[++n] = ranges[i];
+	}
+	ranges.resize(n + 1);
+}
+
+void UploadQueue::closeBatch()
+{
+	if (m_current.copies.empty())
+		return;
+	if (!m_bHostOnly)
+	{
+		for (const Copy& c : m_current.copies)
+			ThrowCudaErrors(cudaMemcpyAsync(c.dest, m_pArena + c.arenaOffset, c.bytes, cudaMemcpyHostToDevice, m_stream));
+		if (m_freeEvents.empty())
+		{
+			cudaEvent_t e;
+			ThrowCudaErrors(cudaEventCreateWithFlags(&e, cudaEventDisableTiming));
+			m_freeEvents.push_back(e);
+		}
+		m_current.fence = m_freeEvents.back();
+		m_freeEvents.pop_back();
+		ThrowCudaErrors(cudaEventRecord(m_current.fence, m_stream));
+	}
+	m_current.arenaEnd = m_uHead;
+	m_pending.push_back(m_current);
+	m_current.copies.clear();
+	m_current.arenaStart = m_current.arenaEnd = m_uHead;
+}
+
+void UploadQueue::retireOldest()
+{
+	Batch& b = m_pending.front();
+	if (m_bHostOnly)
+	{
+		for (const Copy& c : b.copies)
+			memcpy(c.dest, m_pArena + c.arenaOffset, c.bytes);
+	}
+	else
+	{
+		ThrowCudaErrors(cudaEventSynchronize(b.fence));
+		m_freeEvents.push_back(b.fence);
+	}
+	m_pending.pop_front();
+}
+
+char* UploadQueue::reserve(size_t bytes)
+{
+	//16 byte alignment for the vectorized copies of the driver
+	bytes = (bytes + 15) & ~size_t(15);
+	if (m_uHead + bytes > m_uArenaSize)
+	{
+		closeBatch();
+		m_uHead = 0;
+		m_current.arenaStart = 0;
+	}
+	//pending batches are in ring order, the oldest one is the next in front of the head
+	while (m_pending.size() && m_pending.front().arenaStart < m_uHead + bytes && m_uHead < m_pending.front().arenaEnd)
+		retireOldest();
+	char* p = m_pArena + m_uHead;
+	m_uHead += bytes;
+	return p;
+}
+
+void UploadQueue::Submit(void* dest, const void* src, std::vector<Range>& ranges, size_t elementSize)
+{
+	if (ranges.empty())
+		return;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_sStatistics.num_submits++;
+	m_sStatistics.num_ranges_before_coalescing += ranges.size();
+	Coalesce(ranges, m_uMaxGapBytes / elementSize);
+
+	for (const Range& r : ranges)
+	{
+		//ranges larger than the arena are split
+		size_t off = r.offset * elementSize, end = (r.offset + r.length) * elementSize;
+		while (off < end)
+		{
+			size_t n = std::min(end - off, m_uArenaSize);
+			char* staging = reserve(n);
+			memcpy(staging, (const char*)src + off, n);
+			m_current.copies.push_back(Copy{ (char*)dest + off, size_t(staging - m_pArena), n });
+			m_sStatistics.num_copies++;
+			m_sStatistics.uploaded_bytes += n;
+			off += n;
+		}
+	}
+	closeBatch();
+}
+
+void UploadQueue::Flush()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	closeBatch();
+	while (m_pending.size())
+		retireOldest();
+}
+
+}
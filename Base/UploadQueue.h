@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Defines.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include "cuda_runtime.h"
+
+namespace CudaTracerLib {
+
+//Batched host to device uploads of dirty buffer ranges.
+//Ranges closer than the gap threshold are merged, gathered into a pinned staging arena and copied asynchronously on a separate stream.
+//The upload stream is a blocking stream, kernels and copies issued on the default stream afterwards wait for it implicitly.
+//The staging memory of a batch is reused once its fence was reached. In host only mode the arena is plain memory and the copies
+//are executed with memcpy when the fence is reached, which allows testing the batching without a device.
+class UploadQueue
+{
+public:
+	//element ranges
+	struct Range
+	{
+		size_t offset;
+		size_t length;
+	};
+
+	struct Statistics
+	{
+		size_t num_submits;
+		size_t num_copies;
+		size_t num_ranges_before_coalescing;
+		size_t uploaded_bytes;
+	};
+
+	CTL_EXPORT UploadQueue(bool hostOnly = false, size_t arenaSize = 16 * 1024 * 1024, size_t maxGapBytes = 4096);
+	CTL_EXPORT ~UploadQueue();
+
+	//merges neighbouring ranges of the sorted and disjoint ranges if the gap is at most maxGap elements
+	CTL_EXPORT static void Coalesce(std::vector<Range>& ranges, size_t maxGap);
+
+	//copies the ranges of src to dest, both arrays of elementSize bytes per element
+	//the ranges have to be sorted and disjoint, src can be modified as soon as the call returns
+	//the copies of one submit are issued together and share one fence
+	CTL_EXPORT void Submit(void* dest, const void* src, std::vector<Range>& ranges, size_t elementSize);
+	//blocks until all submitted copies are finished
+	CTL_EXPORT void Flush();
+
+	Statistics getStatistics() const
+	{
+		return m_sStatistics;
+	}
+	bool isHostOnly() const
+	{
+		return m_bHostOnly;
+	}
+	void setMaxGapBytes(size_t bytes)
+	{
+		m_uMaxGapBytes = bytes;
+	}
+
+	//queue used by all buffers which did not set their own one
+	CTL_EXPORT static UploadQueue& getGlobalQueue();
+private:
+	struct Copy
+	{
+		char* dest;
+		size_t arenaOffset;
+		size_t bytes;
+	};
+	struct Batch
+	{
+		size_t arenaStart, arenaEnd;
+		cudaEvent_t fence;
+		std::vector<Copy> copies;
+	};
+
+	std::mutex m_mutex;
+	bool m_bHostOnly;
+	char* m_pArena;
+	size_t m_uArenaSize;
+	size_t m_uMaxGapBytes;
+	cudaStream_t m_stream;
+	std::deque<Batch> m_pending;
+	std::vector<cudaEvent_t> m_freeEvents;
+	Batch m_current;
+	size_t m_uHead;
+	Statistics m_sStatistics;
+
+	char* reserve(size_t bytes);
+	void closeBatch();
+	void retireOldest();
+};
+
+}
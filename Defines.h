@@ -10,6 +10,8 @@ namespace CudaTracerLib {
 #define EXT_TRI
 #define NUM_UV_SETS 1
 #define MAX_AREALIGHT_NUM 2
+//count visited bvh nodes and tested triangles during traversal, the counts are visualized by TraversalStatistics
+//#define TRAVERSAL_COUNTERS
 
 #ifdef _MSC_VER
 #define ISWINDOWS
@@ -77,6 +77,10 @@ public:
 	StreamReference<char> m_sTriangles;
 	BVHRebuilder* m_pBuilder;
 public:
+	AnimatedMesh()
+		: m_pBuilder(0)
+	{
+	}
 	CTL_EXPORT AnimatedMesh(const std::string& path, IInStream& a_In, Stream<TriIntersectorData>* a_Stream0, Stream<TriangleData>* a_Stream1, Stream<BVHNodeData>* a_Stream2, Stream<TriIntersectorData2>* a_Stream3, Stream<Material>* a_Stream4, Stream<char>* a_Stream5);
 	CTL_EXPORT void FreeAnim(Stream<char>* a_Stream5);
 	CTL_EXPORT void k_ComputeState(unsigned int a_Anim, unsigned int a_Frame, float a_lerp, Stream<BVHNodeData>* a_BVHNodeStream, void* a_DeviceTmp, void* a_HostTmp);
@@ -9,13 +9,18 @@
 #include <SceneTypes/Node.h>
 #include "MIPMap.h"
 #include "SceneBVH.h"
+#include "SpatialStructures/BVH/WideBVH.h"
+#include "SpatialStructures/BVH/QuantizedBVHNodeBuffer.h"
 #include <SceneTypes/Light.h>
 #include <Base/Buffer.h>
 #include<iomanip>
 #include <filesystem.h>
 #include <algorithm>
 #include <sstream>
+#include <memory>
 #include <Kernel/TraceHelper.h>
+#include <Base/AssetCache.h>
+#include "TextureTileCache.h"
 
 namespace CudaTracerLib {
 
@@ -26,6 +31,11 @@ std::string IFileManager::getDataPath()
 	return dir.string();
 }
 
+std::string IFileManager::getAssetCachePath()
+{
+	return getDataPath() + "/AssetCache/";
+}
+
 struct textureLoader
 {
 	DynamicScene* S;
@@ -60,7 +70,7 @@ protected:
 	virtual void reallocAfterResize()
 	{
 		Stream<Material>::reallocAfterResize();
-		refCounter.resize(this->getBufferLength());
+		refCounter.resize(this->getBufferLength(), 1);
 	}
 public:
 	MatStream(int L)
@@ -121,6 +131,19 @@ public:
 		unusedRefs.clear();
 	}
 
+	//the reference counts of the used part are stored in snapshots
+	void writeRefCounts(FileOutputStream& a_Out)
+	{
+		if (getUsedLength())
+			a_Out.Write(&refCounter[0], getUsedLength() * sizeof(int));
+	}
+
+	void readRefCounts(IInStream& a_In)
+	{
+		if (getUsedLength())
+			a_In.Read(&refCounter[0], getUsedLength() * sizeof(int));
+	}
+
 	bool hasAlphaMappings()
 	{
 		for (auto r : *this)
@@ -170,6 +193,18 @@ public:
 		m_lightWeights[ref.getIndex()] = f;
 	}
 
+	void writeWeights(FileOutputStream& a_Out)
+	{
+		if (getUsedLength())
+			a_Out.Write(&m_lightWeights[0], getUsedLength() * sizeof(float));
+	}
+
+	void readWeights(IInStream& a_In)
+	{
+		if (getUsedLength())
+			a_In.Read(&m_lightWeights[0], getUsedLength() * sizeof(float));
+	}
+
 	void fillDeviceData(bool device, KernelDynamicScene& r)
 	{
 		float accum = 0;
@@ -197,12 +232,17 @@ public:
 };
 
 DynamicScene::DynamicScene(Sensor* C, SceneInitData a_Data, IFileManager* fManager)
-	: m_uEnvMapIndex(UINT_MAX), m_pCamera(C), m_pHostTmpFloats(0), m_pFileManager(fManager)
+	: m_uEnvMapIndex(UINT_MAX), m_pQuantizedBVHNodes(0), m_pCamera(C), m_pHostTmpFloats(0), m_pFileManager(fManager), m_pAssetCache(0), m_pTextureTileCache(0), m_bHostWideBVHEnabled(false), m_bAutomaticInstancing(true)
 {
+	if (fManager)
+		m_pAssetCache = new AssetCache(fManager->getAssetCachePath());
+	m_pHostWideBVH = new WideBVH();
 	m_pAnimStream = new Stream<char>(a_Data.m_uSizeAnimStream + (a_Data.m_bSupportEnvironmentMap ? (4096 * 4094 * 8) : 0));
 	m_pTriDataStream = new Stream<TriangleData>(a_Data.m_uNumTriangles);
 	m_pTriIntStream = new Stream<TriIntersectorData>(a_Data.m_uNumInt);
-	m_pBVHStream = new Stream<BVHNodeData>(a_Data.m_uNumBvhNodes);
+	m_pBVHStream = new Stream<BVHNodeData>(a_Data.m_uNumBvhNodes, a_Data.m_bQuantizedBVH);
+	if (a_Data.m_bQuantizedBVH)
+		m_pQuantizedBVHNodes = new QuantizedBVHNodeBuffer();
 	m_pBVHIndicesStream = new Stream<TriIntersectorData2>(a_Data.m_uNumBvhIndices);
 	m_pMaterialBuffer = new MatStream(a_Data.m_uNumMaterials);
 	m_pMeshBuffer = new CachedBuffer<Mesh, KernelMesh>(a_Data.m_uNumMeshes, sizeof(AnimatedMesh));
@@ -210,7 +250,18 @@ DynamicScene::DynamicScene(Sensor* C, SceneInitData a_Data, IFileManager* fManag
 	m_pTextureBuffer = new CachedBuffer<MIPMap, KernelMIPMap>(a_Data.m_uNumTextures);
 	m_pLightStream = new LightStream(a_Data.m_uNumLights);
 	m_pVolumes = new Stream<VolumeRegion>(128);
-	m_pBVH = new SceneBVH(a_Data.m_uNumNodes);
+	m_pBVH = new SceneBVH(a_Data.m_uNumNodes, a_Data.m_bQuantizedBVH, a_Data.m_bRefitSceneBVH);
+	m_pAnimStream->setName("Animation");
+	m_pTriDataStream->setName("Triangles");
+	m_pTriIntStream->setName("TriIntersectors");
+	m_pBVHStream->setName("MeshBVHNodes");
+	m_pBVHIndicesStream->setName("MeshBVHIndices");
+	m_pMaterialBuffer->setName("Materials");
+	m_pMeshBuffer->setName("Meshes");
+	m_pNodeStream->setName("Nodes");
+	m_pTextureBuffer->setName("Textures");
+	m_pLightStream->setName("Lights");
+	m_pVolumes->setName("Volumes");
 	const int L = 1024 * 16, S = L * sizeof(Vec3f) * 5;
 	CUDA_MALLOC(&m_pDeviceTmpFloats, S);
 	m_pHostTmpFloats = (e_TmpVertex*)malloc(S);
@@ -227,11 +278,15 @@ DynamicScene::~DynamicScene()
 	DEALLOC(m_pTriDataStream)
 	DEALLOC(m_pTriIntStream)
 	DEALLOC(m_pBVHStream)
+	if (m_pQuantizedBVHNodes)
+		DEALLOC(m_pQuantizedBVHNodes)
 	DEALLOC(m_pBVHIndicesStream)
 	DEALLOC(m_pMaterialBuffer)
 	for (auto ref : *m_pTextureBuffer)
 		ref->Free();
 	DEALLOC(m_pTextureBuffer)
+	if (m_pTextureTileCache)
+		DEALLOC(m_pTextureTileCache)
 	for (auto ref : *m_pMeshBuffer)
 		if (ref->m_uType == MESH_ANIMAT_TOKEN)
 			((AnimatedMesh*)ref.operator->())->FreeAnim(m_pAnimStream);
@@ -240,6 +295,8 @@ DynamicScene::~DynamicScene()
 	DEALLOC(m_pAnimStream)
 	DEALLOC(m_pLightStream)
 	DEALLOC(m_pVolumes)
+	DEALLOC(m_pAssetCache)
+	DEALLOC(m_pHostWideBVH)
 	CUDA_FREE(m_pDeviceTmpFloats);
 	free(m_pHostTmpFloats);
 #undef DEALLOC
@@ -266,43 +323,185 @@ std::tuple<std::filesystem::path, std::string> get_compiled_path(const std::stri
     return std::make_tuple(path, T);
 }
 
+//returns the path of the compiled mesh in the cache, the key contains the extension because the compiler is chosen by it
+//the compression level is not part of the key, compressed and uncompressed files can be loaded equally
+static std::string compileCached(AssetCache& cache, MeshCompilerManager& cmpManager, const AssetStorageOptions& opts, IInStream& in, const std::string& token, bool force)
+{
+	auto key = AssetCache::MakeKey(AssetCache::HashStream(in), "mesh", MESH_COMPILER_VERSION, std::filesystem::path(token).extension().string() + opts.getMeshOptions());
+	return cache.GetOrCompile(key, [&](FileOutputStream& a_Out)
+	{
+		std::cout << "Started compiling mesh : " << token << "\n";
+		a_Out.setStorageOptions(opts);
+		MeshCompileType t;
+		cmpManager.Compile(in, token, a_Out, &t);
+	}, force);
+}
+
+std::string DynamicScene::CompileMeshFile(const std::string& a_Token, IInStream& in)
+{
+	std::string token = to_lower(a_Token);
+	if (token.find(".xmsh") != std::string::npos)
+		return token;
+	return compileCached(*m_pAssetCache, m_sCmpManager, m_sStorageOptions, in, token, false);
+}
+
+template<typename T> static void hashStream(ContentHash& h, StreamReference<T> ref)
+{
+	unsigned int n = ref.getLength();
+	h.Update(&n, sizeof(n));
+	if (n)
+		h.Update((T*)ref(0), n * sizeof(T));
+}
+
+template<typename T> static bool equalStreams(StreamReference<T> a, StreamReference<T> b)
+{
+	return a.getLength() == b.getLength() && (!a.getLength() || !memcmp((T*)a(0), (T*)b(0), a.getLength() * sizeof(T)));
+}
+
+//only data which does not change when the mesh is translated, the positions are compared with a tolerance by equalTranslatedGeometry
+static unsigned long long hashMeshGeometry(BufferReference<Mesh, KernelMesh> M)
+{
+	ContentHash h;
+	unsigned int n = M->m_sIntInfo.getLength();
+	h.Update(&n, sizeof(n));
+	hashStream(h, M->m_sIndicesInfo);
+	for (unsigned int i = 0; i < M->m_sTriInfo.getLength(); i++)
+	{
+		const TriangleData* t = M->m_sTriInfo(i);
+		unsigned int mat = t->getMatIndex(0);
+		h.Update(&mat, sizeof(mat));
+		for (int s = 0; s < NUM_UV_SETS; s++)
+		{
+			Vec2f uv[3];
+			t->getUVSetData(s, uv[0], uv[1], uv[2]);
+			h.Update(uv, sizeof(uv));
+		}
+	}
+	return h.Finish();
+}
+
+//true if the geometry of M equals the one of C translated by offset, the positions are decoded from the intersection data
+//of both meshes and therefore only compared up to a tolerance relative to the magnitude of the coordinates
+static bool equalTranslatedGeometry(BufferReference<Mesh, KernelMesh> C, BufferReference<Mesh, KernelMesh> M, const Vec3f& offset)
+{
+	unsigned int n = M->m_sIntInfo.getLength();
+	if (C->m_sIntInfo.getLength() != n || C->m_sTriInfo.getLength() != M->m_sTriInfo.getLength() || !equalStreams(C->m_sIndicesInfo, M->m_sIndicesInfo))
+		return false;
+	auto magnitude = [](const AABB& box) { return max(abs(box.minV).max(abs(box.maxV))); };
+	float eps = 1e-4f * max(max(magnitude(C->m_sLocalBox), magnitude(M->m_sLocalBox)), 1e-3f);
+	for (unsigned int i = 0; i < n; i++)
+	{
+		Vec3f a[3], b[3];
+		C->m_sIntInfo(i)->getData(a[0], a[1], a[2]);
+		M->m_sIntInfo(i)->getData(b[0], b[1], b[2]);
+		for (int k = 0; k < 3; k++)
+			if (max(abs(a[k] + offset - b[k])) > eps)
+				return false;
+	}
+	//the shading data is compressed, the normals can be rounded differently
+	for (unsigned int i = 0; i < M->m_sTriInfo.getLength(); i++)
+	{
+		const TriangleData* a = C->m_sTriInfo(i), *b = M->m_sTriInfo(i);
+		if (a->getMatIndex(0) != b->getMatIndex(0))
+			return false;
+		for (int s = 0; s < NUM_UV_SETS; s++)
+		{
+			Vec2f uvA[3], uvB[3];
+			a->getUVSetData(s, uvA[0], uvA[1], uvA[2]);
+			b->getUVSetData(s, uvB[0], uvB[1], uvB[2]);
+			if (memcmp(uvA, uvB, sizeof(uvA)))
+				return false;
+		}
+		NormalizedT<Vec3f> nA[3], nB[3];
+		a->getNormals(nA[0], nA[1], nA[2]);
+		b->getNormals(nB[0], nB[1], nB[2]);
+		for (int k = 0; k < 3; k++)
+			if (dot(nA[k], nB[k]) < 0.99f)
+				return false;
+	}
+	return true;
+}
+
+//materials of meshes loaded from files have not loaded their textures yet while the ones of loaded meshes have,
+//therefore the texture indices are reset and the derived bsdf data is recomputed before hashing
+static unsigned long long hashMeshMaterials(BufferReference<Mesh, KernelMesh> M)
+{
+	ContentHash h;
+	unsigned int n = M->m_sMatInfo.getLength();
+	h.Update(&n, sizeof(n));
+	auto resetTexture = [](const std::string& file, unsigned int& lastVal) { return 0xffffffffu; };
+	for (unsigned int i = 0; i < n; i++)
+	{
+		//copied bytewise so that the padding is the same as in the buffer
+		Material mat;
+		memcpy(&mat, (Material*)M->m_sMatInfo(i), sizeof(Material));
+		mat.LoadTextures(resetTexture);
+		mat.bsdf.As()->Update();
+		h.Update(&mat, sizeof(Material));
+	}
+	return h.Finish();
+}
+
+void DynamicScene::addMeshFingerprint(const std::string& name, BufferReference<Mesh, KernelMesh> M, unsigned long long geometryHash)
+{
+	m_sMeshFingerprints.insert(std::make_pair(geometryHash, MeshFingerprint{ name, hashMeshMaterials(M) }));
+}
+
+void DynamicScene::removeMeshFingerprints(const std::string& name)
+{
+	for (auto it = m_sMeshFingerprints.begin(); it != m_sMeshFingerprints.end();)
+		it = it->second.mesh == name ? m_sMeshFingerprints.erase(it) : std::next(it);
+	for (auto it = m_sMeshAliases.begin(); it != m_sMeshAliases.end();)
+		it = it->first == name || it->second.mesh == name ? m_sMeshAliases.erase(it) : std::next(it);
+}
+
+bool DynamicScene::findInstancedMesh(BufferReference<Mesh, KernelMesh> M, unsigned long long geometryHash, MeshFingerprint& res, Vec3f& offset)
+{
+	auto range = m_sMeshFingerprints.equal_range(geometryHash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		BufferReference<Mesh, KernelMesh> C;
+		if (!m_pMeshBuffer->findCached(it->second.mesh, C))
+			continue;
+		//the hash does not cover the positions, the minima of the boxes define the translation between the meshes
+		offset = M->m_sLocalBox.minV - C->m_sLocalBox.minV;
+		if (C->m_uType == MESH_STATIC_TOKEN && C->m_sMatInfo.getLength() == M->m_sMatInfo.getLength() && equalTranslatedGeometry(C, M, offset))
+		{
+			res = it->second;
+			return true;
+		}
+	}
+	return false;
+}
+
 StreamReference<Node> DynamicScene::CreateNode(const std::string& a_Token, IInStream& in, bool force_recompile)
 {
 	std::string token = to_lower(a_Token);
     bool is_compiled = token.find(".xmsh") != std::string::npos;
-	auto cmp_id = is_compiled ? std::make_tuple(std::filesystem::path(token), token) : get_compiled_path(token, m_pFileManager);
-    auto compiled_path = std::get<0>(cmp_id);
-    auto mesh_token = std::get<1>(cmp_id);
+	auto mesh_token = is_compiled ? token : std::get<1>(get_compiled_path(token, m_pFileManager));
 
-	//visual studio doesn't support weakly_canonical at the moment so instead create the file with zero size
-	create_directories(compiled_path.parent_path());
-	if (!std::filesystem::exists(compiled_path))
+	//meshes replaced by an identical mesh before are not loaded again
+	const MeshAlias* alias = 0;
+	auto alias_it = m_sMeshAliases.find(mesh_token);
+	if (alias_it != m_sMeshAliases.end())
 	{
-		std::ofstream file;
-		file.open(compiled_path, std::ios::out);
+		BufferReference<Mesh, KernelMesh> C;
+		if (force_recompile || !m_pMeshBuffer->findCached(alias_it->second.mesh, C))
+			m_sMeshAliases.erase(alias_it);
+		else alias = &alias_it->second;
 	}
+	else if (force_recompile)
+		removeMeshFingerprints(mesh_token);
 
 	bool load;
-	BufferReference<Mesh, KernelMesh> M = m_pMeshBuffer->LoadCached(mesh_token, load);
+	BufferReference<Mesh, KernelMesh> M = m_pMeshBuffer->LoadCached(alias ? alias->mesh : mesh_token, load);
 	if (load || force_recompile)
 	{
 		IInStream* xmshStream = 0;
 		bool freeStream = false;
 		if (!is_compiled)
 		{
-			auto si = exists(compiled_path) ? file_size(compiled_path) : 0;
-			auto cmpStamp = si != 0 ? std::filesystem::last_write_time(compiled_path) : std::filesystem::file_time_type::clock::now();
-			auto rawStamp = std::filesystem::exists(in.getFilePath()) ? std::filesystem::last_write_time(in.getFilePath()) : std::filesystem::file_time_type::clock::from_time_t(0);
-			if (si <= 4 || rawStamp != cmpStamp)
-			{
-				std::cout << "Started compiling mesh : " << token << "\n";
-				FileOutputStream a_Out(compiled_path.string());
-				MeshCompileType t;
-				m_sCmpManager.Compile(in, token, a_Out, &t);
-				a_Out.Close();
-				std::filesystem::last_write_time(compiled_path, rawStamp);
-			}
-			xmshStream = OpenFile(compiled_path.string());
+			xmshStream = OpenFile(compileCached(*m_pAssetCache, m_sCmpManager, m_sStorageOptions, in, token, force_recompile));
 			freeStream = true;
 		}
 		else
@@ -319,10 +518,36 @@ StreamReference<Node> DynamicScene::CreateNode(const std::string& a_Token, IInSt
 		else throw std::runtime_error("Mesh file parser error.");
 		if (freeStream)
 			delete xmshStream;
-		m_pMeshBuffer->Invalidate(M);
-		M->m_sMatInfo.Invalidate();
+
+		//area lights are created from the mesh, therefore only meshes without them are shared
+		MeshFingerprint instanced;
+		Vec3f offset;
+		unsigned long long geometryHash = 0;
+		bool canInstance = load && !force_recompile && m_bAutomaticInstancing && M->m_uType == MESH_STATIC_TOKEN && M->m_sAreaLights.empty();
+		if (canInstance)
+			geometryHash = hashMeshGeometry(M);
+		if (canInstance && findInstancedMesh(M, geometryHash, instanced, offset))
+		{
+			MeshAlias& a = m_sMeshAliases[mesh_token];
+			a.mesh = instanced.mesh;
+			a.offset = offset;
+			a.materials.clear();
+			if (hashMeshMaterials(M) != instanced.materialHash)
+				a.materials.assign((Material*)M->m_sMatInfo(0), (Material*)M->m_sMatInfo(0) + M->m_sMatInfo.getLength());
+			alias = &a;
+			M->Free(m_pTriIntStream, m_pTriDataStream, m_pBVHStream, m_pBVHIndicesStream, m_pMaterialBuffer);
+			m_pMeshBuffer->Discard(mesh_token);
+			M = m_pMeshBuffer->LoadCached(instanced.mesh, load);
+		}
+		else
+		{
+			if (canInstance)
+				addMeshFingerprint(mesh_token, M, geometryHash);
+			m_pMeshBuffer->Invalidate(M);
+			M->m_sMatInfo.Invalidate();
+		}
 	}
-	else if (M->m_uType == MESH_ANIMAT_TOKEN)
+	if (!(load || force_recompile) && M->m_uType == MESH_ANIMAT_TOKEN)
 	{
 		BufferReference<Mesh, KernelMesh> oldM = M;
 		M = m_pMeshBuffer->malloc(1);
@@ -334,14 +559,29 @@ StreamReference<Node> DynamicScene::CreateNode(const std::string& a_Token, IInSt
 	StreamReference<Material> m2 = M->m_sMatInfo;
 	m2.Invalidate();
 	new(N.operator->()) Node(M.getIndex(), M.operator->(), m2);
-	if (!(load || force_recompile))
+	if (alias && alias->materials.size())
+	{
+		//the node owns the materials of the replaced mesh, they have not loaded their textures yet which is done by ReloadTextures
+		StreamReference<Material> mats = m_pMaterialBuffer->malloc(alias->materials.size());
+		for (unsigned int i = 0; i < mats.getLength(); i++)
+			*mats(i) = alias->materials[i];
+		mats.Invalidate();
+		N->m_uMaterialOffset = mats.getIndex();
+		N->m_uInstanciatedMaterial = true;
+	}
+	else if (!(load || force_recompile))
 		m_pMaterialBuffer->IncrementRef(m2);
 
 	for (unsigned int i = 0; i < M->m_sAreaLights.size(); i++)
 		CreateLight(N, M->m_sAreaLights[i].MatName, M->m_sAreaLights[i].L);
+	//the shared mesh is moved to the position of the replaced one
+	if (alias)
+		N->m_vMeshOffset = alias->offset;
 	N.Invalidate();
 	ReloadTextures();
 	m_pBVH->addNode(N);
+	if (alias)
+		m_pBVH->setTransform(N, float4x4::Translate(alias->offset));
 	return N;
 }
 
@@ -383,7 +623,19 @@ void DynamicScene::DeleteNode(StreamReference<Node> ref)
 	m_pBVH->removeNode(ref);
 }
 
-BufferReference<MIPMap, KernelMIPMap> DynamicScene::LoadTexture(const std::string& file, bool a_MipMap)
+void DynamicScene::EnableTextureTileCache(size_t tileMemory, unsigned int tileSize)
+{
+	if (m_pTextureTileCache || m_pTextureBuffer->hasElements())
+		throw std::runtime_error("The texture tile cache has to be enabled before loading textures!");
+	m_pTextureTileCache = new TextureTileCache(tileMemory, tileSize);
+}
+
+unsigned int DynamicScene::UpdateTextureTiles()
+{
+	return m_pTextureTileCache ? m_pTextureTileCache->Update() : 0;
+}
+
+BufferReference<MIPMap, KernelMIPMap> DynamicScene::LoadTexture(const std::string& file, bool a_MipMap, bool a_Tiled)
 {
 	std::filesystem::path rawFilePath = file;
 	if (!std::filesystem::exists(rawFilePath) || std::filesystem::is_directory(rawFilePath))
@@ -392,29 +644,44 @@ BufferReference<MIPMap, KernelMIPMap> DynamicScene::LoadTexture(const std::strin
 	if (!std::filesystem::exists(rawFilePath) || std::filesystem::is_directory(rawFilePath))
 	{
 		std::cout << "Texture : " << file << "mapped to : " << rawFilePath << " was not found\n";
-		return LoadTexture("404.jpg", a_MipMap);
+		return LoadTexture("404.jpg", a_MipMap, a_Tiled);
 	}
 	bool load;
 	BufferReference<MIPMap, KernelMIPMap> T = m_pTextureBuffer->LoadCached(file, load);
 	if (load)
 	{
-		std::filesystem::path cmpFilePath(m_pFileManager->getCompiledTexturePath(rawFilePath.filename().string()));
-		std::filesystem::create_directories(std::filesystem::path(cmpFilePath).parent_path());
-		auto rawStamp = std::filesystem::exists(rawFilePath) ? std::filesystem::last_write_time(rawFilePath) : std::filesystem::file_time_type::clock::now();
-		auto cmpStamp = std::filesystem::exists(cmpFilePath) ? std::filesystem::last_write_time(cmpFilePath) : std::filesystem::file_time_type::clock::from_time_t(0);
-		if (std::filesystem::file_time_type::clock::to_time_t(cmpStamp) == 0 || rawStamp != cmpStamp)
+		AssetStorageOptions opts = m_sStorageOptions;
+		opts.texture_tile_size = m_pTextureTileCache && a_Tiled ? m_pTextureTileCache->getTileSize() : 0;
+		//the image loader chooses the format by the extension
+		auto key = AssetCache::MakeKey(AssetCache::HashFile(rawFilePath.string()), "texture", MIPMAP_COMPILER_VERSION,
+									   to_lower(rawFilePath.extension().string()) + (a_MipMap ? "mip" : "") + opts.getTextureOptions() +
+									   (opts.texture_tile_size ? format("t%u", opts.texture_tile_size) : ""));
+		//the tiles are read from the compiled file until the texture is freed, it must not be evicted in the meantime
+		if (opts.texture_tile_size)
+			m_pAssetCache->Pin(key);
+		try
+		{
+			auto cmpFilePath = m_pAssetCache->GetOrCompile(key, [&](FileOutputStream& a_Out)
+			{
+				a_Out.setStorageOptions(opts);
+				MIPMap::CompileToBinary(rawFilePath.string().c_str(), a_Out, a_MipMap);
+			});
+			FileInputStream I(cmpFilePath.c_str());
+			AssetCache* cache = m_pAssetCache;
+			if (opts.texture_tile_size)
+				new(T)MIPMap(file, I, m_pTextureTileCache, [cache, key]() { cache->Unpin(key); });
+			else new(T)MIPMap(file, I);
+			I.Close();
+		}
+		catch (...)
 		{
-			FileOutputStream a_Out(cmpFilePath.string().c_str());
-			MIPMap::CompileToBinary(rawFilePath.string().c_str(), a_Out, a_MipMap);
-			a_Out.Close();
-			std::filesystem::last_write_time(cmpFilePath, rawStamp);
+			if (opts.texture_tile_size)
+				m_pAssetCache->Unpin(key);
+			throw;
 		}
-		FileInputStream I(cmpFilePath.string().c_str());
-		new(T)MIPMap(file, I);
-		I.Close();
 		T.Invalidate();
 	}
-	if (!T->getKernelData().m_pDeviceData)
+	if (!T->getKernelData().m_pDeviceData && !T->isTiled())
 		throw std::runtime_error(__FUNCTION__);
 	m_pTextureBuffer->UpdateInvalidated();
 	return T;
@@ -433,13 +700,17 @@ size_t DynamicScene::enumerateLights(StreamReference<Node> node, std::function<v
 void DynamicScene::SetNodeTransform(const float4x4& mat, StreamReference<Node> n)
 {
 	for (unsigned int i = 0; i < n.getLength(); i++)
-		m_pBVH->setTransform(n(i), mat);
-	n.Invalidate();
-	enumerateLights(n, [&](StreamReference<Light> l)
 	{
-		RecomputeShape(l->As<DiffuseLight>()->shapeSet, mat);
-		l.Invalidate();
-	});
+		//the scene bvh and the lights use the transform of the mesh
+		float4x4 meshMat = mat % float4x4::Translate(n(i)->m_vMeshOffset);
+		m_pBVH->setTransform(n(i), meshMat);
+		enumerateLights(n(i), [&](StreamReference<Light> l)
+		{
+			RecomputeShape(l->As<DiffuseLight>()->shapeSet, meshMat);
+			l.Invalidate();
+		});
+	}
+	n.Invalidate();
 }
 
 void DynamicScene::InvalidateNodesInBVH(StreamReference<Node> n)
@@ -499,6 +770,7 @@ bool DynamicScene::UpdateScene()
 	for (size_t i = 0; i < m_pMeshBuffer->m_UnusedEntries.size(); i++)
 	{
 		BufferReference<Mesh, KernelMesh> ref = m_pMeshBuffer->m_UnusedEntries[i];
+		removeMeshFingerprints(ref->m_uPath);
 		ref->Free(m_pTriIntStream, m_pTriDataStream, m_pBVHStream, m_pBVHIndicesStream, m_pMaterialBuffer);
 		if (ref->m_uType == MESH_ANIMAT_TOKEN)
 			((AnimatedMesh*)ref.operator->())->FreeAnim(m_pAnimStream);
@@ -541,16 +813,409 @@ bool DynamicScene::UpdateScene()
 	if (m_uEnvMapIndex != UINT_MAX)
 		m_pLightStream->operator()(m_uEnvMapIndex).Invalidate();
 
+	bool meshBVHsChanged = m_pBVHStream->hasInvalidatedElements() || m_pMeshBuffer->hasInvalidatedElements();
+	//the streams only stage their dirty ranges, the copies of all streams run asynchronously on the upload queue
 	m_pNodeStream->UpdateInvalidated();
 	m_pTriIntStream->UpdateInvalidated();
 	m_pTriDataStream->UpdateInvalidated();
-	m_pBVHStream->UpdateInvalidated();
+	if (m_pQuantizedBVHNodes)
+	{
+		//the stream may have been enlarged, only the new nodes are invalidated then
+		m_pQuantizedBVHNodes->Resize(m_pBVHStream->getBufferLength());
+		const BVHNodeData* nodes = m_pBVHStream->getKernelData(false).Data;
+		m_pBVHStream->UpdateInvalidated([&](StreamReference<BVHNodeData> ref)
+		{
+			m_pQuantizedBVHNodes->Update(nodes, ref.getIndex());
+		});
+		m_pQuantizedBVHNodes->Upload();
+	}
+	else m_pBVHStream->UpdateInvalidated();
 	m_pBVHIndicesStream->UpdateInvalidated();
 	m_pMeshBuffer->UpdateInvalidated();
 	m_pAnimStream->UpdateInvalidated();
 	m_pVolumes->UpdateInvalidated([](StreamReference<VolumeRegion> l){l->As()->Update(); });
 	ReloadTextures();
-	return m_pBVH->Build(m_pNodeStream, m_pMeshBuffer);
+	bool modified = m_pBVH->Build(m_pNodeStream, m_pMeshBuffer);
+	if (m_bHostWideBVHEnabled && (modified || meshBVHsChanged))
+		updateHostWideBVH();
+	return modified;
+}
+
+size_t DynamicScene::CompactGeometryBuffers()
+{
+	size_t reclaimed = m_pTriDataStream->getNumFragmentedElements() + m_pTriIntStream->getNumFragmentedElements() +
+					   m_pBVHStream->getNumFragmentedElements() + m_pBVHIndicesStream->getNumFragmentedElements();
+	if (reclaimed == 0)
+		return 0;
+
+	BufferRemap triRemap = m_pTriDataStream->Compact(), intRemap = m_pTriIntStream->Compact(),
+				nodeRemap = m_pBVHStream->Compact(), indicesRemap = m_pBVHIndicesStream->Compact();
+
+	//meshes waiting to be freed are still in the buffer and have to be translated as well
+	for (auto m : *m_pMeshBuffer)
+	{
+		m->m_sTriInfo = triRemap(m->m_sTriInfo);
+		m->m_sIntInfo = intRemap(m->m_sIntInfo);
+		m->m_sNodeInfo = nodeRemap(m->m_sNodeInfo);
+		m->m_sIndicesInfo = indicesRemap(m->m_sIndicesInfo);
+		m.Invalidate();
+	}
+	for (auto l : *m_pLightStream)
+		if (l->Is<DiffuseLight>())
+			l->As<DiffuseLight>()->shapeSet.Remap(m_pAnimStream, intRemap, triRemap);
+
+	//the quantized copy is derived from the host nodes and has to be recomputed for the moved part
+	if (m_pQuantizedBVHNodes && !nodeRemap.isIdentity())
+		m_pBVHStream->Invalidate(nodeRemap.getFirstMovedIndex(), m_pBVHStream->getUsedLength() - nodeRemap.getFirstMovedIndex());
+	return reclaimed;
+}
+
+//the allocated ranges are stored as the used length and the free ranges so that all elements keep their indices
+template<typename H, typename D> static void writeLayout(FileOutputStream& a_Out, BufferBase<H, D>* buf)
+{
+	a_Out << (unsigned long long)buf->getUsedLength();
+	a_Out << (unsigned long long)buf->getFreeRanges().size();
+	for (auto& r : buf->getFreeRanges())
+		a_Out << (unsigned long long)r.first << (unsigned long long)r.second;
+}
+
+template<typename H, typename D> static void readLayout(IInStream& a_In, BufferBase<H, D>* buf)
+{
+	unsigned long long used, numFree;
+	a_In >> used >> numFree;
+	BufferRangeAllocator::free_map_t freeRanges;
+	for (unsigned long long i = 0; i < numFree; i++)
+	{
+		unsigned long long off, l;
+		a_In >> off >> l;
+		freeRanges[(size_t)off] = (size_t)l;
+	}
+	buf->RestoreLayout((size_t)used, freeRanges);
+}
+
+//the host data of the used part is written as raw section which is copied directly from the file mapping when loading
+template<typename T> static void writeStream(FileOutputStream& a_Out, Stream<T>* stream)
+{
+	a_Out << (unsigned int)sizeof(T);
+	writeLayout(a_Out, stream);
+	a_Out.WriteSection(stream->getKernelData(false).Data, stream->getUsedLength() * sizeof(T));
+}
+
+template<typename T> static void readStream(IInStream& a_In, Stream<T>* stream)
+{
+	unsigned int elementSize;
+	a_In >> elementSize;
+	if (elementSize != sizeof(T))
+		throw std::runtime_error(format("The elements of %s in the snapshot %s have a different size!", stream->getName().c_str(), a_In.getFilePath().c_str()));
+	readLayout(a_In, stream);
+	T* host = stream->getKernelData(false).Data;
+	size_t size = stream->getUsedLength() * sizeof(T);
+	if (const void* data = a_In.ReadSection(host, size))
+		memcpy(host, data, size);
+}
+
+template<typename T> static void writeRef(FileOutputStream& a_Out, const StreamReference<T>& ref)
+{
+	a_Out << ref.getIndex() << ref.getLength();
+}
+
+template<typename T> static StreamReference<T> readRef(IInStream& a_In, Stream<T>* stream)
+{
+	unsigned int idx, l;
+	a_In >> idx >> l;
+	return StreamReference<T>(stream, idx, l);
+}
+
+static void writeString(FileOutputStream& a_Out, const std::string& str)
+{
+	a_Out << (unsigned int)str.size();
+	a_Out.Write(str.c_str(), str.size());
+}
+
+static std::string readString(IInStream& a_In)
+{
+	unsigned int l;
+	a_In >> l;
+	std::string str(l, ' ');
+	a_In.Read(&str[0], l);
+	return str;
+}
+
+template<typename H, typename D> static void writeCached(FileOutputStream& a_Out, CachedBuffer<H, D>* buf)
+{
+	unsigned int n = 0;
+	buf->enumerateCached([&](const std::string&, BufferReference<H, D>, size_t) {n++; });
+	a_Out << n;
+	buf->enumerateCached([&](const std::string& file, BufferReference<H, D> ref, size_t count)
+	{
+		writeString(a_Out, file);
+		a_Out << ref.getIndex() << (unsigned long long)count;
+	});
+}
+
+template<typename H, typename D> static void readCached(IInStream& a_In, CachedBuffer<H, D>* buf)
+{
+	unsigned int n;
+	a_In >> n;
+	for (unsigned int i = 0; i < n; i++)
+	{
+		std::string file = readString(a_In);
+		unsigned int idx;
+		unsigned long long count;
+		a_In >> idx >> count;
+		buf->setCached(file, buf->operator()(idx), (size_t)count);
+	}
+}
+
+void DynamicScene::SaveSnapshot(const std::string& file)
+{
+	if (m_pTextureTileCache && m_pTextureTileCache->usesFile(file))
+		throw std::runtime_error(format("Can not overwrite %s while tiled textures are loaded from it!", file.c_str()));
+	//deleted nodes and unreferenced meshes, materials and textures are freed
+	UpdateScene();
+
+	FileOutputStream a_Out(file);
+	a_Out << SCENE_SNAPSHOT_TOKEN << (unsigned int)SCENE_SNAPSHOT_VERSION;
+	a_Out << (unsigned int)sizeof(Sensor) << (unsigned int)(m_pCamera != 0);
+	if (m_pCamera)
+		a_Out.Write(*m_pCamera);
+
+	writeStream(a_Out, m_pAnimStream);
+	writeStream(a_Out, m_pTriDataStream);
+	writeStream(a_Out, m_pTriIntStream);
+	writeStream(a_Out, m_pBVHStream);
+	writeStream(a_Out, m_pBVHIndicesStream);
+	writeStream(a_Out, m_pNodeStream);
+	writeStream(a_Out, m_pVolumes);
+	writeStream(a_Out, m_pLightStream);
+	m_pLightStream->writeWeights(a_Out);
+	writeStream(a_Out, m_pMaterialBuffer);
+	m_pMaterialBuffer->writeRefCounts(a_Out);
+
+	//the host objects of the meshes reference the streams by index
+	writeLayout(a_Out, m_pMeshBuffer);
+	a_Out << (unsigned int)m_pMeshBuffer->numElements();
+	for (auto m : *m_pMeshBuffer)
+	{
+		a_Out << m.getIndex() << m->m_uType;
+		a_Out << m->m_sLocalBox;
+		writeRef(a_Out, m->m_sTriInfo);
+		writeRef(a_Out, m->m_sMatInfo);
+		writeRef(a_Out, m->m_sNodeInfo);
+		writeRef(a_Out, m->m_sIntInfo);
+		writeRef(a_Out, m->m_sIndicesInfo);
+		a_Out << (unsigned int)m->m_sAreaLights.size();
+		if (m->m_sAreaLights.size())
+			a_Out.Write(&m->m_sAreaLights[0], m->m_sAreaLights.size() * sizeof(MeshPartLight));
+		a_Out.Write(m->m_uPath);
+		if (m->m_uType == MESH_ANIMAT_TOKEN)
+		{
+			AnimatedMesh* A = (AnimatedMesh*)m.operator->();
+			a_Out.Write(A->k_Data);
+			for (auto& anim : A->m_pAnimations)
+			{
+				a_Out << (unsigned int)anim.m_pFrames.size() << anim.m_uFrameRate;
+				a_Out.Write(anim.m_sName);
+				for (auto& frame : anim.m_pFrames)
+					writeRef(a_Out, frame.m_sMatrices);
+			}
+			writeRef(a_Out, A->m_sVertices);
+			writeRef(a_Out, A->m_sTriangles);
+		}
+	}
+	writeCached(a_Out, m_pMeshBuffer);
+
+	writeLayout(a_Out, m_pTextureBuffer);
+	a_Out << (unsigned int)m_pTextureBuffer->numElements();
+	for (auto t : *m_pTextureBuffer)
+	{
+		a_Out << t.getIndex();
+		writeString(a_Out, t->m_pPath);
+		t->Serialize(a_Out);
+	}
+	writeCached(a_Out, m_pTextureBuffer);
+
+	//the environment light stores a copy of the kernel data of its texture and a pointer to the scene box
+	unsigned int envTexture = UINT_MAX;
+	if (m_uEnvMapIndex != UINT_MAX)
+	{
+		const KernelMIPMap& radianceMap = m_pLightStream->operator()(m_uEnvMapIndex)->As<InfiniteLight>()->radianceMap;
+		for (auto t : *m_pTextureBuffer)
+			if (t->getKernelData().m_pHostData == radianceMap.m_pHostData)
+				envTexture = t.getIndex();
+	}
+	a_Out << m_uEnvMapIndex << envTexture;
+	a_Out << m_psSceneBoxEnvLight;
+
+	//the scene bvh is rebuilt from the node transforms which is cheap compared to the bvhs of the meshes
+	a_Out << (unsigned int)m_pNodeStream->numElements();
+	for (auto n : *m_pNodeStream)
+		a_Out << n.getIndex() << m_pBVH->getNodeTransform(n);
+	a_Out.Close();
+}
+
+void DynamicScene::LoadSnapshot(const std::string& file)
+{
+	if (m_pNodeStream->hasElements() || m_pMeshBuffer->hasElements() || m_pTextureBuffer->hasElements() || m_pMaterialBuffer->hasElements() ||
+		m_pLightStream->hasElements() || m_pVolumes->hasElements() || m_pAnimStream->hasElements() || m_pTriDataStream->hasElements())
+		throw std::runtime_error("Snapshots can only be loaded into an empty scene!");
+	std::unique_ptr<IInStream> in(OpenFile(file));
+	IInStream& a_In = *in;
+	unsigned int token, version, sensorSize, hasCamera;
+	a_In >> token >> version >> sensorSize >> hasCamera;
+	if (token != SCENE_SNAPSHOT_TOKEN || version != SCENE_SNAPSHOT_VERSION || sensorSize != sizeof(Sensor))
+		throw std::runtime_error(format("%s is not a snapshot of this version of the library!", file.c_str()));
+	if (hasCamera)
+	{
+		Sensor camera;
+		a_In.Read(camera);
+		if (m_pCamera)
+		{
+			*m_pCamera = camera;
+			m_pCamera->SetVtable();
+		}
+	}
+
+	readStream(a_In, m_pAnimStream);
+	readStream(a_In, m_pTriDataStream);
+	readStream(a_In, m_pTriIntStream);
+	readStream(a_In, m_pBVHStream);
+	readStream(a_In, m_pBVHIndicesStream);
+	readStream(a_In, m_pNodeStream);
+	readStream(a_In, m_pVolumes);
+	readStream(a_In, m_pLightStream);
+	m_pLightStream->readWeights(a_In);
+	readStream(a_In, m_pMaterialBuffer);
+	m_pMaterialBuffer->readRefCounts(a_In);
+	//the virtual function tables of the aggregates differ between processes
+	for (auto m : *m_pMaterialBuffer)
+	{
+		m->bsdf.SetVtable();
+		m->bssrdf.SetVtable();
+		m->AlphaMap.tex.SetVtable();
+		m->HeightMap.tex.SetVtable();
+		m->NormalMap.tex.SetVtable();
+	}
+	for (auto l : *m_pLightStream)
+		l->SetVtable();
+	for (auto v : *m_pVolumes)
+		v->SetVtable();
+
+	readLayout(a_In, m_pMeshBuffer);
+	unsigned int numMeshes;
+	a_In >> numMeshes;
+	for (unsigned int i = 0; i < numMeshes; i++)
+	{
+		unsigned int idx;
+		int type;
+		a_In >> idx >> type;
+		BufferReference<Mesh, KernelMesh> M = m_pMeshBuffer->operator()(idx);
+		Mesh* m = type == MESH_ANIMAT_TOKEN ? new(M.operator->()) AnimatedMesh() : new(M.operator->()) Mesh();
+		m->m_uType = type;
+		a_In >> m->m_sLocalBox;
+		m->m_sTriInfo = readRef(a_In, m_pTriDataStream);
+		m->m_sMatInfo = readRef<Material>(a_In, m_pMaterialBuffer);
+		m->m_sNodeInfo = readRef(a_In, m_pBVHStream);
+		m->m_sIntInfo = readRef(a_In, m_pTriIntStream);
+		m->m_sIndicesInfo = readRef(a_In, m_pBVHIndicesStream);
+		unsigned int numLights;
+		a_In >> numLights;
+		m->m_sAreaLights.resize(numLights);
+		if (numLights)
+			a_In.Read(&m->m_sAreaLights[0], numLights * sizeof(MeshPartLight));
+		a_In.Read(m->m_uPath);
+		if (type == MESH_ANIMAT_TOKEN)
+		{
+			AnimatedMesh* A = (AnimatedMesh*)m;
+			a_In.Read(A->k_Data);
+			A->m_pAnimations.resize(A->k_Data.m_uAnimCount);
+			for (auto& anim : A->m_pAnimations)
+			{
+				unsigned int numFrames;
+				a_In >> numFrames >> anim.m_uFrameRate;
+				a_In.Read(anim.m_sName);
+				anim.m_pFrames.resize(numFrames);
+				for (auto& frame : anim.m_pFrames)
+					frame.m_sMatrices = readRef(a_In, m_pAnimStream);
+			}
+			A->m_sVertices = readRef(a_In, m_pAnimStream);
+			A->m_sTriangles = readRef(a_In, m_pAnimStream);
+		}
+	}
+	readCached(a_In, m_pMeshBuffer);
+	//meshes loaded afterwards are instanced with the ones from the snapshot
+	m_pMeshBuffer->enumerateCached([&](const std::string& name, BufferReference<Mesh, KernelMesh> M, size_t)
+	{
+		if (M->m_uType == MESH_STATIC_TOKEN && M->m_sAreaLights.empty())
+			addMeshFingerprint(name, M, hashMeshGeometry(M));
+	});
+
+	readLayout(a_In, m_pTextureBuffer);
+	unsigned int numTextures;
+	a_In >> numTextures;
+	for (unsigned int i = 0; i < numTextures; i++)
+	{
+		unsigned int idx;
+		a_In >> idx;
+		std::string path = readString(a_In);
+		new(m_pTextureBuffer->operator()(idx))MIPMap(path, a_In, m_pTextureTileCache);
+	}
+	readCached(a_In, m_pTextureBuffer);
+
+	unsigned int envTexture;
+	a_In >> m_uEnvMapIndex >> envTexture;
+	a_In >> m_psSceneBoxEnvLight;
+	if (m_uEnvMapIndex != UINT_MAX)
+	{
+		InfiniteLight* l = m_pLightStream->operator()(m_uEnvMapIndex)->As<InfiniteLight>();
+		l->radianceMap = m_pTextureBuffer->operator()(envTexture)->getKernelData();
+		l->m_pSceneBox = &m_psSceneBoxEnvLight;
+	}
+
+	unsigned int numNodes;
+	a_In >> numNodes;
+	for (unsigned int i = 0; i < numNodes; i++)
+	{
+		unsigned int idx;
+		float4x4 mat;
+		a_In >> idx >> mat;
+		StreamReference<Node> n = m_pNodeStream->operator()(idx);
+		m_pBVH->addNode(n);
+		m_pBVH->setTransform(n, mat);
+	}
+	in->Close();
+	UpdateScene();
+}
+
+void DynamicScene::setHostWideBVHEnabled(bool enabled)
+{
+	if (enabled && !m_bHostWideBVHEnabled)
+	{
+		m_bHostWideBVHEnabled = true;
+		updateHostWideBVH();
+	}
+	else if (!enabled)
+	{
+		m_bHostWideBVHEnabled = false;
+		m_pHostWideBVH->Clear();
+	}
+}
+
+void DynamicScene::updateHostWideBVH()
+{
+	m_pHostWideBVH->Clear();
+	for (auto it : *m_pMeshBuffer)
+	{
+		if (it->m_sNodeInfo.getLength() == 0)
+			continue;
+		int root = m_pHostWideBVH->Collapse((BVHNodeData*)it->m_sNodeInfo, 0);
+		m_pHostWideBVH->setMeshRoot(it.getIndex(), root);
+	}
+	if (m_pNodeStream->hasElements())
+	{
+		KernelSceneBVH sceneBVH = m_pBVH->getData(false);
+		m_pHostWideBVH->setSceneRoot(m_pHostWideBVH->Collapse(sceneBVH.m_pNodes, sceneBVH.m_sStartNode));
+	}
 }
 
 void DynamicScene::AnimateMesh(StreamReference<Node> n, float t, unsigned int anim)
@@ -571,6 +1236,8 @@ KernelDynamicScene DynamicScene::getKernelSceneData(bool devicePointer)
 	r.m_sBVHIndexData = m_pBVHIndicesStream->getKernelData(devicePointer);
 	r.m_sBVHIntData = m_pTriIntStream->getKernelData(devicePointer);
 	r.m_sBVHNodeData = m_pBVHStream->getKernelData(devicePointer);
+	r.m_pQuantizedBVHNodes = devicePointer && m_pQuantizedBVHNodes ? m_pQuantizedBVHNodes->getData(true) : 0;
+	r.m_bQuantizedBVH = m_pQuantizedBVHNodes != 0;
 	r.m_sLightBuf = m_pLightStream->getKernelData(devicePointer);
 	r.m_sMatData = m_pMaterialBuffer->getKernelData(devicePointer);
 	r.m_sMeshData = m_pMeshBuffer->getKernelData(devicePointer);
@@ -579,6 +1246,7 @@ KernelDynamicScene DynamicScene::getKernelSceneData(bool devicePointer)
 	r.m_sTriData = m_pTriDataStream->getKernelData(devicePointer);
 	r.m_sVolume = KernelAggregateVolume(m_pVolumes, devicePointer);
 	r.m_sSceneBVH = m_pBVH->getData(devicePointer);
+	r.m_pHostWideBVH = !devicePointer && m_bHostWideBVHEnabled ? m_pHostWideBVH : 0;
 	r.m_uEnvMapIndex = m_uEnvMapIndex;
 	r.m_sBox = getSceneBox();
 	r.m_Camera = *m_pCamera;
@@ -622,6 +1290,7 @@ size_t DynamicScene::getCudaBufferSize()
 		m_pTriDataStream->getDeviceSizeInBytes() +
 		m_pTriIntStream->getDeviceSizeInBytes() +
 		m_pBVHStream->getDeviceSizeInBytes() +
+		(m_pQuantizedBVHNodes ? m_pQuantizedBVHNodes->getDeviceSizeInBytes() : 0) +
 		m_pBVHIndicesStream->getDeviceSizeInBytes() +
 		m_pMaterialBuffer->getDeviceSizeInBytes() +
 		m_pTextureBuffer->getDeviceSizeInBytes() +
@@ -635,6 +1304,55 @@ size_t DynamicScene::getCudaBufferSize()
 	return i;
 }
 
+MemoryReport DynamicScene::getMemoryReport()
+{
+	MemoryReport r;
+	r.Add(m_pAnimStream->getMemoryReportEntry());
+	r.Add(m_pTriDataStream->getMemoryReportEntry());
+	r.Add(m_pTriIntStream->getMemoryReportEntry());
+	r.Add(m_pBVHStream->getMemoryReportEntry());
+	if (m_pQuantizedBVHNodes)
+	{
+		size_t s = m_pQuantizedBVHNodes->getDeviceSizeInBytes();
+		r.Add(MemoryReportEntry("MeshBVHQuantizedNodes", s, s, s, s, s, s));
+	}
+	r.Add(m_pBVHIndicesStream->getMemoryReportEntry());
+	r.Add(m_pMaterialBuffer->getMemoryReportEntry());
+	r.Add(m_pMeshBuffer->getMemoryReportEntry());
+	r.Add(m_pNodeStream->getMemoryReportEntry());
+	r.Add(m_pTextureBuffer->getMemoryReportEntry());
+	r.Add(m_pLightStream->getMemoryReportEntry());
+	r.Add(m_pVolumes->getMemoryReportEntry());
+	m_pBVH->getMemoryReport(r);
+	//the texel data is allocated by the individual mip maps and stored on both sides
+	size_t texels = 0;
+	for (Buffer<MIPMap, KernelMIPMap>::iterator it = m_pTextureBuffer->begin(); it != m_pTextureBuffer->end(); ++it)
+		texels += it->getBufferSize();
+	r.Add(MemoryReportEntry("TextureData", texels, texels, texels, texels, texels, texels));
+	if (m_pTextureTileCache)
+	{
+		size_t s = m_pTextureTileCache->getSizeInBytes();
+		r.Add(MemoryReportEntry("TextureTileCache", s, s, s, s, s, s));
+	}
+	return r;
+}
+
+void DynamicScene::setStreamBudget(const std::string& name, size_t bytes)
+{
+	if (name == m_pAnimStream->getName()) m_pAnimStream->setBudget(bytes);
+	else if (name == m_pTriDataStream->getName()) m_pTriDataStream->setBudget(bytes);
+	else if (name == m_pTriIntStream->getName()) m_pTriIntStream->setBudget(bytes);
+	else if (name == m_pBVHStream->getName()) m_pBVHStream->setBudget(bytes);
+	else if (name == m_pBVHIndicesStream->getName()) m_pBVHIndicesStream->setBudget(bytes);
+	else if (name == m_pMaterialBuffer->getName()) m_pMaterialBuffer->setBudget(bytes);
+	else if (name == m_pMeshBuffer->getName()) m_pMeshBuffer->setBudget(bytes);
+	else if (name == m_pNodeStream->getName()) m_pNodeStream->setBudget(bytes);
+	else if (name == m_pTextureBuffer->getName()) m_pTextureBuffer->setBudget(bytes);
+	else if (name == m_pLightStream->getName()) m_pLightStream->setBudget(bytes);
+	else if (name == m_pVolumes->getName()) m_pVolumes->setBudget(bytes);
+	else throw std::runtime_error("Unknown stream name : " + name);
+}
+
 std::string DynamicScene::printInfo()
 {
 	const int L = 40;
@@ -651,6 +1369,8 @@ std::string DynamicScene::printInfo()
 	PRINT(m_pTriDataStream);
 	PRINT(m_pTriIntStream);
 	PRINT(m_pBVHStream);
+	if (m_pQuantizedBVHNodes)
+		PRINT(m_pQuantizedBVHNodes);
 	PRINT(m_pBVHIndicesStream);
 	PRINT(m_pMaterialBuffer);
 	PRINT(m_pTextureBuffer);
@@ -665,6 +1385,7 @@ std::string DynamicScene::printInfo()
 	float s = (float)l, per = s / (float)n * 100;
 	std::string texName = "Textures";
 	str << texName << std::setw(L - texName.size()) << std::setfill(' ') << std::right << per << "%, " << (s / (1024 * 1024)) << "[MB]\n";
+	str << "\n" << getMemoryReport().ToString();
 	return str.str();
 }
 
@@ -672,7 +1393,7 @@ AABB DynamicScene::getNodeBox(StreamReference<Node> n)
 {
 	AABB r = AABB::Identity();
 	for (unsigned int i = 0; i < n.getLength(); i++)
-		r = r.Extend(n(i)->getWorldBox(getMesh(n(i)), GetNodeTransform(n(i))));
+		r = r.Extend(n(i)->getWorldBox(getMesh(n(i)), m_pBVH->getNodeTransform(n(i))));
 	return r;
 }
 
@@ -682,7 +1403,7 @@ AABB DynamicScene::getSceneBox()
 		return m_pBVH->getSceneBox();
 	AABB res = AABB::Identity();
 	for (Stream<Node>::iterator it = m_pNodeStream->begin(); it != m_pNodeStream->end(); ++it)
-		res = res.Extend(it->getWorldBox(getMesh(*it), GetNodeTransform(*it)));
+		res = res.Extend(it->getWorldBox(getMesh(*it), m_pBVH->getNodeTransform(*it)));
 	return res;
 }
 
@@ -762,7 +1483,7 @@ ShapeSet DynamicScene::CreateShape(StreamReference<Node> Node, const std::string
 		i++;
 	}
 
-	ShapeSet r = ShapeSet(&n[0], &n3[0], (unsigned int)n.size(), GetNodeTransform(Node), m_pAnimStream, m_pTriIntStream, m_pTriDataStream);
+	ShapeSet r = ShapeSet(&n[0], &n3[0], (unsigned int)n.size(), m_pBVH->getNodeTransform(Node), m_pAnimStream, m_pTriIntStream, m_pTriDataStream);
 	return r;
 }
 
@@ -850,7 +1571,8 @@ StreamReference<Light> DynamicScene::setEnvironementMap(const Spectrum& power, c
 		//TODO
 		throw std::runtime_error("Can't set environment map when it is already set!");
 	}
-	BufferReference<MIPMap, KernelMIPMap> m = LoadTexture(file, true);
+	//the distribution of the environment map is computed from all texels
+	BufferReference<MIPMap, KernelMIPMap> m = LoadTexture(file, true, false);
 	m_psSceneBoxEnvLight = getSceneBox();
 	InfiniteLight l = InfiniteLight(m_pAnimStream, m, power, &m_psSceneBoxEnvLight);
 	StreamReference<Light> r = CreateLight(l);
@@ -867,7 +1589,7 @@ AnimatedMesh* DynamicScene::AccessAnimatedMesh(StreamReference<Node> n)
 
 float4x4 DynamicScene::GetNodeTransform(StreamReference<Node> n)
 {
-	return m_pBVH->getNodeTransform(n);
+	return m_pBVH->getNodeTransform(n) % float4x4::Translate(-n->m_vMeshOffset);
 }
 
 StreamRange<Node>& DynamicScene::getNodes()
@@ -9,6 +9,7 @@
 #include "SceneInitData.h"
 #include "ShapeSet.h"
 #include <functional>
+#include <map>
 #include <SceneTypes/Light.h>
 
 namespace CudaTracerLib {
@@ -19,11 +20,16 @@ template<typename H, typename D> class BufferReference;
 template<typename T> class Stream;
 template<typename H, typename D> class CachedBuffer;
 class SceneBVH;
+class WideBVH;
+class QuantizedBVHNodeBuffer;
 struct Sensor;
 struct KernelMIPMap;
 class MIPMap;
 class Mesh;
 template<typename H, typename D> class BufferRange;
+class MemoryReport;
+class AssetCache;
+class TextureTileCache;
 
 struct textureLoader;
 
@@ -35,8 +41,14 @@ public:
 	virtual std::string getCompiledTexturePath(const std::string& name) = 0;
 	//this is only for standard folder layouts
 	virtual std::string getDataPath();
+	//directory of the compiled asset cache, by default a folder in the data path
+	virtual std::string getAssetCachePath();
 };
 
+//snapshots start with this token and version, the version has to be increased when the layout of snapshots changes
+#define SCENE_SNAPSHOT_TOKEN 0x50534E53u
+#define SCENE_SNAPSHOT_VERSION 2
+
 class DynamicScene
 {
 	class MatStream;
@@ -51,6 +63,8 @@ private:
 	Stream<TriangleData>* m_pTriDataStream;
 	Stream<TriIntersectorData>* m_pTriIntStream;
 	Stream<BVHNodeData>* m_pBVHStream;
+	//device copy of m_pBVHStream when quantized bvhs are used, m_pBVHStream is host only then
+	QuantizedBVHNodeBuffer* m_pQuantizedBVHNodes;
 	Stream<TriIntersectorData2>* m_pBVHIndicesStream;
 	MatStream* m_pMaterialBuffer;
 	CachedBuffer<MIPMap, KernelMIPMap>* m_pTextureBuffer;
@@ -63,9 +77,36 @@ private:
 	Sensor* m_pCamera;
 	std::function<bool(StreamReference<TriangleData>, StreamReference<TriIntersectorData>)> m_sShapeCreationClb;
 	IFileManager* m_pFileManager;
+	AssetCache* m_pAssetCache;
+	AssetStorageOptions m_sStorageOptions;
+	TextureTileCache* m_pTextureTileCache;
+	WideBVH* m_pHostWideBVH;
+	bool m_bHostWideBVHEnabled;
+	void updateHostWideBVH();
+	//static meshes by the hash of their geometry, used to instance meshes with identical geometry loaded from different files
+	struct MeshFingerprint
+	{
+		std::string mesh;
+		unsigned long long materialHash;
+	};
+	std::multimap<unsigned long long, MeshFingerprint> m_sMeshFingerprints;
+	//meshes which were replaced by a mesh with identical geometry, the materials are only stored when they differ
+	//offset is the translation of the replaced mesh relative to the shared one
+	struct MeshAlias
+	{
+		std::string mesh;
+		std::vector<Material> materials;
+		Vec3f offset;
+	};
+	std::map<std::string, MeshAlias> m_sMeshAliases;
+	bool m_bAutomaticInstancing;
+	void addMeshFingerprint(const std::string& name, BufferReference<Mesh, KernelMesh> M, unsigned long long geometryHash);
+	void removeMeshFingerprints(const std::string& name);
+	bool findInstancedMesh(BufferReference<Mesh, KernelMesh> M, unsigned long long geometryHash, MeshFingerprint& res, Vec3f& offset);
 protected:
 	friend struct textureLoader;
-	BufferReference<MIPMap, KernelMIPMap> LoadTexture(const std::string& file, bool a_MipMap);
+	//textures which are accessed in full when loading, e.g. environment maps, are not tiled
+	BufferReference<MIPMap, KernelMIPMap> LoadTexture(const std::string& file, bool a_MipMap, bool a_Tiled = true);
 public:
 	CTL_EXPORT DynamicScene(Sensor* C, SceneInitData a_Data, IFileManager* fManager);
 	CTL_EXPORT ~DynamicScene();
@@ -73,6 +114,9 @@ public:
 	CTL_EXPORT BufferReference<Node, Node> CreateNode(const std::string& a_MeshFile, bool force_recompile = false);
 	CTL_EXPORT BufferReference<Node, Node> CreateNode(const std::string& a_MeshFile, IInStream& in, bool force_recompile = false);
 	CTL_EXPORT BufferReference<Node, Node> CreateNode(unsigned int a_TriangleCount, unsigned int a_MaterialCount);
+	//Compiles the mesh into the asset cache if it is not cached yet and returns the path of the compiled file.
+	//The scene is not modified, it can be called concurrently for different meshes before creating the nodes.
+	CTL_EXPORT std::string CompileMeshFile(const std::string& a_MeshFile, IInStream& in);
 	CTL_EXPORT void DeleteNode(BufferReference<Node, Node> ref);
 	CTL_EXPORT AnimatedMesh* AccessAnimatedMesh(BufferReference<Node, Node> n);
 	//Creates and returns a shape structure for the submesh with material name \ref name, returning the material index optionally in \ref a_Mi
@@ -110,11 +154,15 @@ public:
 															 const float4x4& worldToVol, const PhaseFunction& p);
 
 	CTL_EXPORT void ReloadTextures();
+	//the transform of the node in the space of its mesh file, the mesh offset of nodes sharing a translated mesh is applied internally
 	CTL_EXPORT float4x4 GetNodeTransform(BufferReference<Node, Node> n);
 	CTL_EXPORT void SetNodeTransform(const float4x4& mat, BufferReference<Node, Node> n);
 	CTL_EXPORT void AnimateMesh(BufferReference<Node, Node> n, float t, unsigned int anim);
 	//Updates the buffer contents, rebuilds the acceleration bvh and returns true when there was a change to geometry
 	CTL_EXPORT bool UpdateScene();
+	//Closes the gaps left by deleted meshes in the triangle and bvh streams and translates the references of all meshes and area lights.
+	//References to these streams obtained from the shape creation callback are invalidated. Returns the number of elements reclaimed.
+	CTL_EXPORT size_t CompactGeometryBuffers();
 	//Instanciate the materials in \ref node so that nodes with the same mesh can have different materials
 	CTL_EXPORT void instanciateNodeMaterials(BufferReference<Node, Node> node);
 	//Tells the acceleratio bvh that \ref node has been updated 
@@ -122,8 +170,28 @@ public:
 	//Tells the acceleration bvh that \ref mesh has been updated and all nodes using it will be invalidated
 	CTL_EXPORT void InvalidateMeshesInBVH(BufferReference<Mesh, KernelMesh> mesh);
 	CTL_EXPORT KernelDynamicScene getKernelSceneData(bool devicePointer = true);
+	//Maintains a collapsed wide bvh of the scene which is used for host side ray tracing
+	CTL_EXPORT void setHostWideBVHEnabled(bool enabled);
+	bool isHostWideBVHEnabled() const
+	{
+		return m_bHostWideBVHEnabled;
+	}
+	//Static meshes without area lights whose geometry is identical to an already loaded mesh are not loaded again, the node references the loaded mesh
+	//and receives instanced materials when the materials differ. Enabled by default, it only affects meshes loaded afterwards.
+	void setAutomaticInstancingEnabled(bool enabled)
+	{
+		m_bAutomaticInstancing = enabled;
+	}
+	bool isAutomaticInstancingEnabled() const
+	{
+		return m_bAutomaticInstancing;
+	}
 	//Returns the accumulated size of all cuda allocations from buffers and textures
 	CTL_EXPORT size_t getCudaBufferSize();
+	//Returns the live, peak and reserved memory of every stream and of the texture data
+	CTL_EXPORT MemoryReport getMemoryReport();
+	//Sets the device budget in bytes of the stream with the report name \ref name, exceeding it throws instead of enlarging the stream
+	CTL_EXPORT void setStreamBudget(const std::string& name, size_t bytes);
 	CTL_EXPORT std::string printInfo();
 	void setCamera(Sensor* C)
 	{
@@ -153,7 +221,36 @@ public:
 	{
 		return m_pFileManager;
 	}
+	//cache of the compiled meshes and textures, can be used to set the size limit or to add shared read only caches
+	AssetCache* getAssetCache()
+	{
+		return m_pAssetCache;
+	}
+	//compression and quantization of newly compiled meshes and textures, assets compiled with other lossy options are compiled again
+	void setAssetStorageOptions(const AssetStorageOptions& opts)
+	{
+		m_sStorageOptions = opts;
+	}
+	const AssetStorageOptions& getAssetStorageOptions() const
+	{
+		return m_sStorageOptions;
+	}
+	//Textures loaded afterwards are stored as tiles which are loaded on demand into a cache with tileMemory bytes on the device and the host.
+	//Has to be called before any texture is loaded.
+	CTL_EXPORT void EnableTextureTileCache(size_t tileMemory, unsigned int tileSize = 64);
+	TextureTileCache* getTextureTileCache()
+	{
+		return m_pTextureTileCache;
+	}
+	//loads the tiles requested by the last pass, called by UpdateKernel, returns the number of loaded tiles
+	CTL_EXPORT unsigned int UpdateTextureTiles();
 	CTL_EXPORT void RecomputeShape(ShapeSet& shape, const float4x4& mat);
+	//Writes all streams, meshes, textures, node transforms and the camera into one file, pending changes are applied first.
+	//The stream contents are stored raw, snapshots can only be loaded by the same build of the library.
+	CTL_EXPORT void SaveSnapshot(const std::string& file);
+	//Loads a snapshot into this scene which has to be empty, the elements keep their indices and the scene bvh is rebuilt.
+	//Tiled textures are registered with the texture tile cache and read from the snapshot file later, which has to be kept then.
+	CTL_EXPORT void LoadSnapshot(const std::string& file);
 
 	CTL_EXPORT BufferRange<Node, Node>& getNodes();
 	CTL_EXPORT BufferRange<VolumeRegion, VolumeRegion>& getVolumes();
@@ -36,9 +36,10 @@ void Image::AddSample(float sx, float sy, const Spectrum &_L)
 			atomicAdd(ref.rgb + i, rgb[i]);
 		atomicAdd(&ref.weightSum, 1.0f);
 #else
+		//the host backend renders blocks in parallel, splats can cross block boundaries
 		for (int i = 0; i < 3; i++)
-			ref.rgb[i] += rgb[i];
-		ref.weightSum += 1.0f;
+			Platform::Add(ref.rgb + i, rgb[i]);
+		Platform::Add(&ref.weightSum, 1.0f);
 #endif
 	});
 }
@@ -62,7 +63,7 @@ void Image::Splat(float sx, float sy, const Spectrum &_L)
 			atomicAdd(ref.rgbSplat + i, rgb[i]);
 #else
 		for (int i = 0; i < 3; i++)
-			ref.rgbSplat[i] += rgb[i];
+			Platform::Add(ref.rgbSplat + i, rgb[i]);
 #endif
 	});
 
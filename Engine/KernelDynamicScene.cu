@@ -69,6 +69,8 @@ Spectrum KernelDynamicScene::EvalEnvironment(const Ray& r, const Ray& rX, const
 
 bool KernelDynamicScene::Occluded(const Ray& r, float tmin, float tmax, TraceResult* res) const
 {
+	if (!res)
+		return traceOcclusion(r, tmin, tmax);
 	//remember this is an occluded test, so we shrink the interval!
 	TraceResult r2 = traceRay(r);
 	if (r2.hasHit() && res)
@@ -79,6 +81,11 @@ bool KernelDynamicScene::Occluded(const Ray& r, float tmin, float tmax, TraceRes
 	return r2.m_fDist > tmin + m_rayTraceEps && end;
 }
 
+bool KernelDynamicScene::Occluded(const Ray& r, float tmin, float tmax, OccluderCache& cache) const
+{
+	return traceOcclusion(r, tmin, tmax, &cache);
+}
+
 bool KernelDynamicScene::Occluded(const Ray& r, float tmin, float tmax, float t) const
 {
 	bool end = t < tmax - m_rayTraceEps;
@@ -19,9 +19,12 @@ struct TriIntersectorData2;
 class DynamicScene;
 struct Sensor;
 struct BVHNodeData;
+struct BVHNodeDataQuantized;
 struct Material;
 struct KernelMIPMap;
 struct TraceResult;
+struct OccluderCache;
+class WideBVH;
 
 #define MAX_NUM_LIGHTS 16
 
@@ -30,6 +33,10 @@ struct KernelDynamicScene
 	KernelBuffer<TriangleData> m_sTriData;
 	KernelBuffer<TriIntersectorData> m_sBVHIntData;
 	KernelBuffer<BVHNodeData> m_sBVHNodeData;
+	//quantized copy of m_sBVHNodeData (same length), only set for device data
+	BVHNodeDataQuantized* m_pQuantizedBVHNodes;
+	//the device traverses the quantized nodes, the host always uses the full precision nodes
+	bool m_bQuantizedBVH;
 	KernelBuffer<TriIntersectorData2> m_sBVHIndexData;
 	KernelBuffer<Material> m_sMatData;
 	KernelBuffer<KernelMIPMap> m_sTexData;
@@ -37,6 +44,8 @@ struct KernelDynamicScene
 	KernelBuffer<Node> m_sNodeData;
 	KernelBuffer<char> m_sAnimData;
 	KernelSceneBVH m_sSceneBVH;
+	//collapsed copy of the scene and mesh bvhs for faster host traversal, 0 for device data or when disabled
+	const WideBVH* m_pHostWideBVH;
 	KernelAggregateVolume m_sVolume;
 	unsigned int m_uEnvMapIndex;
 	AABB m_sBox;
@@ -56,7 +65,10 @@ struct KernelDynamicScene
     //this is the epsilon used by the reay tracing routines
     float m_rayTraceEps;
 
+	//without res only an any hit traversal is performed
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST bool Occluded(const Ray& r, float tmin, float tmax, TraceResult* res = 0) const;
+	//tests the cached occluder first and stores the blocking triangle in cache
+	CTL_EXPORT CUDA_DEVICE CUDA_HOST bool Occluded(const Ray& r, float tmin, float tmax, OccluderCache& cache) const;
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST bool Occluded(const Ray& r, float tmin, float tmax, float t) const;
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum EvalEnvironment(const Ray& r) const;
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum EvalEnvironment(const Ray& r, const Ray& rX, const Ray& rY) const;
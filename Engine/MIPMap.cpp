@@ -1,15 +1,223 @@
 #include "StdAfx.h"
 #include "MIPMap.h"
 #include "MIPMapHelper.h"
+#include "TextureCompression.h"
+#include "TextureTileCache.h"
 #include <Base/FileStream.h>
 #include <Base/CudaMemoryManager.h>
+#include <Base/ThreadPool.h>
+#include <Base/Timer.h>
+#include <vector>
+
+#if !defined(__CUDA_ARCH__) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define MIPMAP_USE_SIMD
+#include <immintrin.h>
+#endif
 
 namespace CudaTracerLib {
 
-MIPMap::MIPMap(const std::string& a_InputFile, IInStream& a_In)
-	: m_pPath(a_InputFile)
+//the 4 channels of a texel are filtered together in one sse register
+#ifdef MIPMAP_USE_SIMD
+typedef __m128 texel4;
+static inline texel4 texelZero() { return _mm_setzero_ps(); }
+static inline texel4 texelLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void texelStore(float* p, texel4 v) { _mm_storeu_ps(p, v); }
+static inline texel4 texelMadd(texel4 acc, float w, texel4 v) { return _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w), v)); }
+#else
+struct texel4
+{
+	float v[4];
+};
+static inline texel4 texelZero() { return texel4{ { 0, 0, 0, 0 } }; }
+static inline texel4 texelLoad(const float* p) { return texel4{ { p[0], p[1], p[2], p[3] } }; }
+static inline void texelStore(float* p, texel4 v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline texel4 texelMadd(texel4 acc, float w, texel4 v)
+{
+	for (int i = 0; i < 4; i++)
+		acc.v[i] += w * v.v[i];
+	return acc;
+}
+#endif
+
+//filter weights of one axis, every destination texel uses numTaps source texels starting at first
+struct DownsampleTaps
+{
+	int numTaps;
+	std::vector<int> first;
+	std::vector<float> weights;
+};
+
+static float sinc(float x)
+{
+	if (math::abs(x) < 1e-5f)
+		return 1.0f;
+	x *= PI;
+	return math::sin(x) / x;
+}
+
+static float besselI0(float x)
 {
-	a_In >> m_uWidth;
+	float sum = 1.0f, term = 1.0f, q = x * x / 4.0f;
+	for (int k = 1; k < 32 && term > sum * 1e-8f; k++)
+	{
+		term *= q / float(k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+//radius and weights in texels of the destination level, the windowed sinc filters use three lobes
+static float downsampleFilterRadius(MIPMapDownsampleFilter filter)
+{
+	return filter == MIPMAP_DOWNSAMPLE_Box ? 0.5f : 3.0f;
+}
+
+static float downsampleFilterWeight(MIPMapDownsampleFilter filter, float x)
+{
+	x = math::abs(x);
+	if (x >= 3.0f)
+		return 0.0f;
+	if (filter == MIPMAP_DOWNSAMPLE_Lanczos)
+		return sinc(x) * sinc(x / 3.0f);
+	const float alpha = 4.0f, t = x / 3.0f;
+	return sinc(x) * besselI0(alpha * math::sqrt(1.0f - t * t)) / besselI0(alpha);
+}
+
+static DownsampleTaps computeDownsampleTaps(int srcSize, int dstSize, MIPMapDownsampleFilter filter)
+{
+	float scale = float(srcSize) / float(dstSize), radius = downsampleFilterRadius(filter) * scale;
+	DownsampleTaps taps;
+	taps.numTaps = 0;
+	taps.first.resize(dstSize);
+	for (int x = 0; x < dstSize; x++)
+	{
+		float center = (x + 0.5f) * scale;
+		taps.first[x] = (int)math::floor(center - radius);
+		taps.numTaps = max(taps.numTaps, (int)math::ceil(center + radius) - taps.first[x]);
+	}
+	taps.weights.resize(dstSize * taps.numTaps);
+	for (int x = 0; x < dstSize; x++)
+	{
+		float center = (x + 0.5f) * scale, sum = 0.0f;
+		float* w = &taps.weights[x * taps.numTaps];
+		for (int k = 0; k < taps.numTaps; k++)
+		{
+			float lo = float(taps.first[x] + k);
+			//the box filter uses the exact coverage, which also handles odd sizes
+			if (filter == MIPMAP_DOWNSAMPLE_Box)
+				w[k] = max(0.0f, min(lo + 1.0f, center + radius) - max(lo, center - radius));
+			else w[k] = downsampleFilterWeight(filter, (lo + 0.5f - center) / scale);
+			sum += w[k];
+		}
+		for (int k = 0; k < taps.numTaps; k++)
+			w[k] /= sum;
+	}
+	return taps;
+}
+
+static void decodeRow(const imgData& img, int y, float* out)
+{
+	if (img.t() == vtRGBCOL)
+	{
+		const RGBCOL* p = (const RGBCOL*)img.d() + y * img.w();
+		for (int x = 0; x < img.w(); x++)
+		{
+			out[4 * x + 0] = p[x].x / 255.0f;
+			out[4 * x + 1] = p[x].y / 255.0f;
+			out[4 * x + 2] = p[x].z / 255.0f;
+			out[4 * x + 3] = p[x].w / 255.0f;
+		}
+	}
+	else
+	{
+		const RGBE* p = (const RGBE*)img.d() + y * img.w();
+		for (int x = 0; x < img.w(); x++)
+		{
+			Vec3f c = SpectrumConverter::RGBEToFloat3(p[x]);
+			out[4 * x + 0] = c.x;
+			out[4 * x + 1] = c.y;
+			out[4 * x + 2] = c.z;
+			out[4 * x + 3] = 1.0f;
+		}
+	}
+}
+
+//negative lobes of the sinc filters can produce values below zero which are clamped
+static void encodeRow(imgData& img, int y, const float* in)
+{
+	if (img.t() == vtRGBCOL)
+	{
+		RGBCOL* p = (RGBCOL*)img.d() + y * img.w();
+		for (int x = 0; x < img.w(); x++)
+		{
+			auto toByte = [](float f) {return (unsigned char)(math::clamp01(f) * 255.0f); };
+			p[x] = make_uchar4(toByte(in[4 * x + 0]), toByte(in[4 * x + 1]), toByte(in[4 * x + 2]), toByte(in[4 * x + 3]));
+		}
+	}
+	else
+	{
+		RGBE* p = (RGBE*)img.d() + y * img.w();
+		for (int x = 0; x < img.w(); x++)
+			p[x] = SpectrumConverter::Float3ToRGBE(Vec3f(max(0.0f, in[4 * x + 0]), max(0.0f, in[4 * x + 1]), max(0.0f, in[4 * x + 2])));
+	}
+}
+
+void DownsampleImage(const imgData& src, imgData& dst, MIPMapDownsampleFilter filter)
+{
+	const int W = src.w(), H = src.h(), w = dst.w(), h = dst.h();
+	DownsampleTaps tx = computeDownsampleTaps(W, w, filter), ty = computeDownsampleTaps(H, h, filter);
+	//the decoded source rows are padded so the horizontal taps never wrap
+	const int padL = max(0, -tx.first[0]), padR = max(0, tx.first[w - 1] + tx.numTaps - W);
+	const int bandSize = 16;
+	ThreadPool::getGlobalPool().ParallelFor((h + bandSize - 1) / bandSize, [&](unsigned int band, unsigned int)
+	{
+		//the horizontally filtered source rows of a band of destination rows, rows shared with the neighbour bands are filtered twice
+		int y0 = band * bandSize, y1 = min(h, y0 + bandSize);
+		int r0 = ty.first[y0], r1 = ty.first[y1 - 1] + ty.numTaps;
+		std::vector<float> row((padL + W + padR) * 4), filtered((r1 - r0) * w * 4), out(w * 4);
+		for (int r = r0; r < r1; r++)
+		{
+			decodeRow(src, ((r % H) + H) % H, &row[padL * 4]);
+			for (int i = 0; i < padL; i++)
+				memcpy(&row[i * 4], &row[(padL + (((i - padL) % W) + W) % W) * 4], 4 * sizeof(float));
+			for (int i = 0; i < padR; i++)
+				memcpy(&row[(padL + W + i) * 4], &row[(padL + i % W) * 4], 4 * sizeof(float));
+
+			float* hr = &filtered[(r - r0) * w * 4];
+			for (int x = 0; x < w; x++)
+			{
+				const float* s = &row[(tx.first[x] + padL) * 4], *wt = &tx.weights[x * tx.numTaps];
+				texel4 acc = texelZero();
+				for (int k = 0; k < tx.numTaps; k++)
+					acc = texelMadd(acc, wt[k], texelLoad(s + 4 * k));
+				texelStore(hr + 4 * x, acc);
+			}
+		}
+		for (int y = y0; y < y1; y++)
+		{
+			const float* wt = &ty.weights[y * ty.numTaps];
+			for (int x = 0; x < w; x++)
+				texelStore(&out[4 * x], texelZero());
+			for (int k = 0; k < ty.numTaps; k++)
+			{
+				const float* hr = &filtered[(ty.first[y] + k - r0) * w * 4];
+				for (int x = 0; x < w; x++)
+					texelStore(&out[4 * x], texelMadd(texelLoad(&out[4 * x]), wt[k], texelLoad(hr + 4 * x)));
+			}
+			encodeRow(dst, y, &out[0]);
+		}
+	});
+}
+
+MIPMap::MIPMap(const std::string& a_InputFile, IInStream& a_In, TextureTileCache* a_TileCache, const std::function<void()>& a_ReleaseFile)
+	: m_pDeviceData(0), m_pHostData(0), m_pTileCache(0), m_uTileShift(0), m_uFirstPage(0), m_pPath(a_InputFile)
+{
+	unsigned int token;
+	a_In >> token;
+	bool sections = token == MIPMAP_SECTION_LAYOUT_TOKEN, tiled = token == MIPMAP_TILED_LAYOUT_TOKEN;
+	if (sections || tiled)
+		a_In >> m_uWidth;
+	else m_uWidth = token;
 	a_In >> m_uHeight;
 	a_In >> m_uBpp;
 	a_In.operator>>(*(int*)&m_uType);
@@ -17,9 +225,36 @@ MIPMap::MIPMap(const std::string& a_InputFile, IInStream& a_In)
 	a_In.operator>>(*(int*)&m_uFilterMode);
 	a_In >> m_uLevels;
 	a_In >> m_uSize;
+	if (tiled)
+	{
+		unsigned int tileSize;
+		a_In >> tileSize;
+		if (!a_TileCache || a_TileCache->getTileSize() != tileSize)
+			throw std::runtime_error(format("The tiled texture %s requires a texture tile cache with a tile size of %u!", a_InputFile.c_str(), tileSize));
+		a_In.Read(m_sOffsets, sizeof(m_sOffsets));
+		a_In.Read(m_weightLut, sizeof(m_weightLut));
+		unsigned int tileBytes = getTextureLevelSize(m_uType, tileSize, tileSize);
+		while ((1u << m_uTileShift) < tileSize)
+			m_uTileShift++;
+		//all tiles of the coarsest level are pinned, it can consist of several tiles for narrow textures
+		unsigned int numPages = m_uSize / tileBytes;
+		m_uFirstPage = a_TileCache->Register(a_In.getFilePath(), a_In.getPos(), numPages, numPages - m_sOffsets[m_uLevels - 1], tileBytes, a_ReleaseFile);
+		m_pTileCache = a_TileCache;
+		//the stream is left after the texture which can be part of a larger file
+		for (size_t left = m_uSize; left;)
+		{
+			int n = (int)min(left, (size_t)INT_MAX);
+			a_In.Move(n);
+			left -= n;
+		}
+		return;
+	}
 	CUDA_MALLOC(&m_pDeviceData, m_uSize);
 	m_pHostData = (unsigned int*)malloc(m_uSize);
-	a_In.Read(m_pHostData, m_uSize);
+	if (!sections)
+		a_In.Read(m_pHostData, m_uSize);
+	else if (const void* data = a_In.ReadSection(m_pHostData, m_uSize))
+		memcpy(m_pHostData, data, m_uSize);
 	ThrowCudaErrors(cudaMemcpy(m_pDeviceData, m_pHostData, m_uSize, cudaMemcpyHostToDevice));
 	a_In.Read(m_sOffsets, sizeof(m_sOffsets));
 	a_In.Read(m_weightLut, sizeof(m_weightLut));
@@ -27,63 +262,120 @@ MIPMap::MIPMap(const std::string& a_InputFile, IInStream& a_In)
 
 void MIPMap::Free()
 {
+	if (m_pTileCache)
+	{
+		m_pTileCache->Unregister(m_uFirstPage);
+		return;
+	}
 	CUDA_FREE(m_pDeviceData);
 	free(m_pHostData);
 }
 
-void MIPMap::CompileToBinary(const std::string& in, const std::string& out, bool a_MipMap)
+void MIPMap::Serialize(FileOutputStream& a_Out)
+{
+	a_Out << (unsigned int)(m_pTileCache ? MIPMAP_TILED_LAYOUT_TOKEN : MIPMAP_SECTION_LAYOUT_TOKEN);
+	a_Out << m_uWidth;
+	a_Out << m_uHeight;
+	a_Out << m_uBpp;
+	a_Out << (int)m_uType;
+	a_Out << (int)m_uWrapMode;
+	a_Out << (int)m_uFilterMode;
+	a_Out << m_uLevels;
+	a_Out << m_uSize;
+	if (m_pTileCache)
+		a_Out << (1u << m_uTileShift);
+	else a_Out.WriteSection(m_pHostData, m_uSize);
+	a_Out.Write(m_sOffsets, sizeof(m_sOffsets));
+	a_Out.Write(m_weightLut, sizeof(m_weightLut));
+	if (m_pTileCache)
+		m_pTileCache->WriteTiles(m_uFirstPage, a_Out);
+}
+
+void MIPMap::CompileToBinary(const std::string& in, const std::string& out, bool a_MipMap, MIPMapDownsampleFilter filter)
 {
 	FileOutputStream o(out);
-	CompileToBinary(in, o, a_MipMap);
+	CompileToBinary(in, o, a_MipMap, filter);
 	o.Close();
 }
 
-void MIPMap::CompileToBinary(const std::string& a_InputFile, FileOutputStream& a_Out, bool a_MipMap)
+void MIPMap::CompileToBinary(const std::string& a_InputFile, FileOutputStream& a_Out, bool a_MipMap, MIPMapDownsampleFilter filter)
 {
 	imgData data;
 	if (!parseImage(a_InputFile, data))
 		throw std::runtime_error("Impossible to load texture file!");
-	if (popc(data.w()) != 1 || popc(data.h()) != 1)
-		data.RescaleToPowerOf2();
 
 	unsigned int nLevels = 1 + math::Log2Int(min(float(data.w()), float(data.h())));
 	//if(!a_MipMap)
 	//	nLevels = 1;
+	Texture_DataType type = a_Out.getStorageOptions().block_compress_textures ? ChooseBlockFormat(data) : data.t();
+	const int tileSize = (int)a_Out.getStorageOptions().texture_tile_size;
+	if (tileSize && (tileSize < 4 || (tileSize & (tileSize - 1))))
+		throw std::runtime_error(format("Invalid texture tile size %d, it has to be a power of two of at least 4!", tileSize));
+	const unsigned int tileBytes = tileSize ? getTextureLevelSize(type, tileSize, tileSize) : 0;
 	unsigned int size = 0;
 	for (unsigned int i = 0, j = data.w(), k = data.h(); i < nLevels; i++, j = j >> 1, k = k >> 1)
-		size += j * k * 4;
+		size += tileSize ? ((j + tileSize - 1) / tileSize) * ((k + tileSize - 1) / tileSize) * tileBytes : getTextureLevelSize(type, j, k);
 
+	a_Out << (unsigned int)(tileSize ? MIPMAP_TILED_LAYOUT_TOKEN : MIPMAP_SECTION_LAYOUT_TOKEN);
 	a_Out << data.w();
 	a_Out << data.h();
 	a_Out << (unsigned int)4;
-	a_Out << (int)data.t();
+	a_Out << (int)type;
 	a_Out << (int)TEXTURE_REPEAT;
 	a_Out << (int)TEXTURE_Anisotropic;
 	a_Out << nLevels;
 	a_Out << size;
-	a_Out.Write(data.d(), data.w() * data.h() * sizeof(RGBCOL));
+	if (tileSize)
+		a_Out << (unsigned int)tileSize;
+	//all levels are written as one section, the offsets are in words or in tiles for the tiled layout
+	std::vector<unsigned char> texels(size);
+	unsigned int m_sOffsets[MAX_MIPS];
+	unsigned int off = 0;
+	auto storeLevel = [&](const imgData& img, unsigned int level)
+	{
+		if (!tileSize)
+		{
+			m_sOffsets[level] = off / 4;
+			if (type == img.t())
+				memcpy(&texels[off], img.d(), img.w() * img.h() * 4);
+			else CompressImage(img, type, (unsigned int*)&texels[off]);
+			off += getTextureLevelSize(type, img.w(), img.h());
+			return;
+		}
+		const int tilesX = (img.w() + tileSize - 1) / tileSize, tilesY = (img.h() + tileSize - 1) / tileSize;
+		m_sOffsets[level] = off / tileBytes;
+		ThreadPool::getGlobalPool().ParallelFor(tilesX * tilesY, [&](unsigned int t, unsigned int)
+		{
+			//tiles at the border are padded by repeating the last texels
+			imgData tile;
+			tile.Allocate(tileSize, tileSize, img.t());
+			const int tx = t % tilesX, ty = t / tilesX;
+			for (int y = 0; y < tileSize; y++)
+				for (int x = 0; x < tileSize; x++)
+					((unsigned int*)tile.d())[y * tileSize + x] = ((const unsigned int*)img.d())[min(ty * tileSize + y, img.h() - 1) * img.w() + min(tx * tileSize + x, img.w() - 1)];
+			unsigned char* dst = &texels[off + t * tileBytes];
+			if (type == img.t())
+				memcpy(dst, tile.d(), tileBytes);
+			else CompressImage(tile, type, (unsigned int*)dst);
+			tile.Free();
+		});
+		off += tilesX * tilesY * tileBytes;
+	};
+	storeLevel(data, 0);
 
+	//every level is smaller than both buffers
 	imgData tmpData;
-	tmpData.Allocate(data.w() * 2, data.h() * 2, data.t());
+	tmpData.Allocate(max(1, data.w() / 2), max(1, data.h() / 2), data.t());
 	imgData* buffer[2] = { &data, &tmpData };
-	unsigned int m_sOffsets[MAX_MIPS];
-	m_sOffsets[0] = 0;
-	unsigned int off = data.w() * data.h();
 	for (unsigned int i = 1, j = data.w() / 2, k = data.h() / 2; i < nLevels; i++, j >>= 1, k >>= 1)
 	{
-		buffer[0]->SetInfo(j * 2, k * 2, buffer[0]->t()); buffer[1]->SetInfo(j, k, buffer[1]->t());
-		for (unsigned int t = 0; t < k; t++)
-			for (unsigned int s = 0; s < j; s++)
-			{
-				Spectrum v = 0.25f * (buffer[0]->Load(2 * s, 2 * t) + buffer[0]->Load(2 * s + 1, 2 * t) + 
-									  buffer[0]->Load(2 * s, 2 * t + 1) + buffer[0]->Load(2 * s + 1, 2 * t + 1));
-				buffer[1]->Set(v, s, t);
-			}
-		m_sOffsets[i] = off;
-		off += j * k;
-		a_Out.Write(buffer[1]->d(), j * k * sizeof(RGBCOL));
+		buffer[1]->SetInfo(j, k, buffer[1]->t());
+		DownsampleImage(*buffer[0], *buffer[1], filter);
+		storeLevel(*buffer[1], i);
 		swapk(buffer[0], buffer[1]);
 	}
+	if (!tileSize)
+		a_Out.WriteSection(&texels[0], size);
 	a_Out.Write(m_sOffsets, sizeof(m_sOffsets));
 	for (int i = 0; i < MTS_MIPMAP_LUT_SIZE; ++i)
 	{
@@ -91,10 +383,77 @@ void MIPMap::CompileToBinary(const std::string& a_InputFile, FileOutputStream& a
 		float val = math::exp(-2.0f * r2) - math::exp(-2.0f);
 		a_Out << val;
 	}
+	//the tiles are stored raw at the end of the file so that they can be read individually
+	if (tileSize)
+		a_Out.Write(&texels[0], size);
 	data.Free();
 	tmpData.Free();
 }
 
+void MIPMap::BenchmarkDownsampling(unsigned int width, unsigned int height)
+{
+	imgData data;
+	data.Allocate(width, height, vtRGBCOL);
+	RGBCOL* texels = (RGBCOL*)data.d();
+	for (unsigned int y = 0; y < height; y++)
+		for (unsigned int x = 0; x < width; x++)
+			texels[y * width + x] = make_uchar4((unsigned char)(x ^ y), (unsigned char)(x * 3), (unsigned char)(y * 5), 255);
+	unsigned int nLevels = 1 + math::Log2Int(min(float(width), float(height)));
+	double mpixels = width * double(height) / 1e6;
+	printf("MIP pyramid benchmark, %u x %u, %u levels, %u threads\n", width, height, nLevels, ThreadPool::getGlobalPool().getNumThreads());
+
+	InstructionTimer timer;
+	auto report = [&](const char* name, double sec)
+	{
+		printf("%-16s : %10.1f ms, %8.1f MPixel/s\n", name, sec * 1000.0, mpixels / sec);
+	};
+
+	//the previous serial 2x2 average of spectra, only valid for power of two sizes
+	if (popc(width) == 1 && popc(height) == 1)
+	{
+		imgData a, b;
+		a.Allocate(max(1u, width / 2), max(1u, height / 2), vtRGBCOL);
+		b.Allocate(max(1u, width / 2), max(1u, height / 2), vtRGBCOL);
+		imgData* src = &data, *dst = &a;
+		timer.StartTimer();
+		for (unsigned int i = 1, j = width / 2, k = height / 2; i < nLevels; i++, j >>= 1, k >>= 1)
+		{
+			dst->SetInfo(j, k, vtRGBCOL);
+			for (unsigned int t = 0; t < k; t++)
+				for (unsigned int s = 0; s < j; s++)
+					dst->Set(0.25f * (src->Load(2 * s, 2 * t) + src->Load(2 * s + 1, 2 * t) + src->Load(2 * s, 2 * t + 1) + src->Load(2 * s + 1, 2 * t + 1)), s, t);
+			src = dst;
+			dst = dst == &a ? &b : &a;
+		}
+		report("serial box", timer.EndTimer());
+		a.Free();
+		b.Free();
+	}
+
+	const std::pair<const char*, MIPMapDownsampleFilter> filters[] = {
+		{ "box", MIPMAP_DOWNSAMPLE_Box }, { "lanczos", MIPMAP_DOWNSAMPLE_Lanczos }, { "kaiser", MIPMAP_DOWNSAMPLE_Kaiser }
+	};
+	for (auto& f : filters)
+	{
+		imgData a, b;
+		a.Allocate(max(1u, width / 2), max(1u, height / 2), vtRGBCOL);
+		b.Allocate(max(1u, width / 2), max(1u, height / 2), vtRGBCOL);
+		imgData* src = &data, *dst = &a;
+		timer.StartTimer();
+		for (unsigned int i = 1, j = width / 2, k = height / 2; i < nLevels; i++, j >>= 1, k >>= 1)
+		{
+			dst->SetInfo(j, k, vtRGBCOL);
+			DownsampleImage(*src, *dst, f.second);
+			src = dst;
+			dst = dst == &a ? &b : &a;
+		}
+		report(f.first, timer.EndTimer());
+		a.Free();
+		b.Free();
+	}
+	data.Free();
+}
+
 KernelMIPMap MIPMap::getKernelData()
 {
 	KernelMIPMap r;
@@ -107,6 +466,10 @@ KernelMIPMap MIPMap::getKernelData()
 	r.m_uHeight = m_uHeight;
 	r.m_fDim = Vec2f((float)m_uWidth - 1, (float)m_uHeight - 1);
 	r.m_uLevels = m_uLevels;
+	r.m_uTileShift = m_uTileShift;
+	r.m_uFirstPage = m_uFirstPage;
+	r.m_sDeviceTileCache = m_pTileCache ? m_pTileCache->getKernelData(true) : KernelTextureTileCache();
+	r.m_sHostTileCache = m_pTileCache ? m_pTileCache->getKernelData(false) : KernelTextureTileCache();
 	memcpy(r.m_sOffsets, m_sOffsets, sizeof(m_sOffsets));
 	memcpy(r.m_weightLut, m_weightLut, sizeof(m_weightLut));
 	return r;
@@ -1,6 +1,7 @@
 #include "StdAfx.h"
 #include "MIPMap.h"
 #include "MIPMapHelper.h"
+#include "TextureCompression.h"
 #include <Base/FileStream.h>
 #include <Base/CudaMemoryManager.h>
 #define FREEIMAGE_LIB
@@ -18,6 +19,73 @@ CUDA_FUNC_IN float hypot2(float a, float b)
 	return math::sqrt(a * a + b * b);
 }
 
+const unsigned int* KernelMIPMap::getTexels(unsigned int& level, int& x, int& y, unsigned int& w) const
+{
+	if (!m_uTileShift)
+	{
+		w = m_uWidth >> level;
+#ifdef ISCUDA
+		return m_pDeviceData + m_sOffsets[level];
+#else
+		return m_pHostData + m_sOffsets[level];
+#endif
+	}
+#ifdef ISCUDA
+	const KernelTextureTileCache& cache = m_sDeviceTileCache;
+#else
+	const KernelTextureTileCache& cache = m_sHostTileCache;
+#endif
+	const unsigned int tileSize = 1u << m_uTileShift;
+	for (bool requested = false; level < m_uLevels; level++)
+	{
+		unsigned int w_level = m_uWidth >> level, tilesX = (w_level + tileSize - 1) >> m_uTileShift;
+		unsigned int page = m_uFirstPage + m_sOffsets[level] + (y >> m_uTileShift) * tilesX + (x >> m_uTileShift);
+		unsigned int slot = cache.m_pPageTable[page];
+		if (slot != UINT_MAX)
+		{
+			cache.m_pUsed[slot] = 1;
+			w = tileSize;
+			x &= tileSize - 1;
+			y &= tileSize - 1;
+			return cache.m_pTiles + slot * cache.m_uSlotWords;
+		}
+		//only the finest tile is requested, the coarser ones are not needed after it was loaded
+		if (!requested)
+		{
+			cache.m_pRequests[page] = 1;
+			requested = true;
+		}
+		if (level + 1 < m_uLevels)
+		{
+			x = min(x >> 1, int(w_level >> 1) - 1);
+			y = min(y >> 1, int(m_uHeight >> (level + 1)) - 1);
+		}
+	}
+	return 0;
+}
+
+Spectrum KernelMIPMap::fetchTexel(unsigned int level, int x, int y) const
+{
+	unsigned int w;
+	const unsigned int* data = getTexels(level, x, y, w);
+	Spectrum s;
+	if (!data)
+		s = Spectrum(0.0f);
+	else if (m_uType == vtRGBE)
+		s.fromRGBE(*(RGBE*)(data + y * w + x));
+	else if (m_uType == vtRGBCOL)
+		s.fromRGBCOL(*(RGBCOL*)(data + y * w + x));
+	else
+	{
+		//only the requested texel of the block is decoded
+		const unsigned int* block = data + getTextureBlockOffset(m_uType, w, x, y);
+		unsigned int i = (y & 3) * 4 + (x & 3);
+		Vec3f c = m_uType == vtBC6 ? decodeBC6(block, i) : decodeBC1(m_uType == vtBC3 ? block + 2 : block, i);
+		s.fromLinearRGB(c.x, c.y, c.z);
+	}
+	return s;
+}
+
 Spectrum KernelMIPMap::Texel(unsigned int level, const Vec2f& a_UV) const
 {
 	Vec2f l;
@@ -27,17 +95,7 @@ Spectrum KernelMIPMap::Texel(unsigned int level, const Vec2f& a_UV) const
 	{
 		int w_level = m_uWidth >> level, h_level = m_uHeight >> level;
 		int x = math::clamp((int)l.x, 0, w_level - 1), y = math::clamp((int)l.y, 0, h_level - 1);
-		void* data;
-#ifdef ISCUDA
-		data = m_pDeviceData + (m_sOffsets[level] + y * w_level + x);
-#else
-		data = m_pHostData + (m_sOffsets[level] + y * w_level + x);
-#endif
-		Spectrum s;
-		if (m_uType == vtRGBE)
-			s.fromRGBE(*(RGBE*)data);
-		else s.fromRGBCOL(*(RGBCOL*)data);
-		return s;
+		return fetchTexel(level, x, y);
 	}
 }
 
@@ -125,16 +183,16 @@ float KernelMIPMap::SampleAlpha(const Vec2f& uv) const
 	Vec2f l;
 	if (!WrapCoordinates(uv, Vec2f((float)m_uWidth, (float)m_uHeight), m_uWrapMode, &l))
 		return 0.0f;
-	unsigned int x = (unsigned int)l.x, y = (unsigned int)l.y, level = 0;
-	void* data;
-#ifdef ISCUDA
-	data = m_pDeviceData + (m_sOffsets[level] + y * (m_uWidth >> level) + x);
-#else
-	data = m_pHostData + (m_sOffsets[level] + y * (m_uWidth >> level) + x);
-#endif
-	if (m_uType == vtRGBE)
+	int x = (int)l.x, y = (int)l.y;
+	unsigned int level = 0, w;
+	const unsigned int* data = getTexels(level, x, y, w);
+	if (!data)
 		return 1.0f;
-	else return float(((RGBCOL*)data)->w) / 255.0f;
+	else if (m_uType == vtRGBCOL)
+		return float(((RGBCOL*)(data + y * w + x))->w) / 255.0f;
+	else if (m_uType == vtBC3)
+		return decodeBC4(data + getTextureBlockOffset(m_uType, w, x, y), (y & 3) * 4 + (x & 3));
+	else return 1.0f;
 }
 
 Spectrum KernelMIPMap::Sample(const Vec2f& a_UV, float width) const
@@ -158,17 +216,7 @@ Spectrum KernelMIPMap::Sample(float width, int x, int y) const
 	int level = (int)math::clamp(l, 0.0f, float(m_uLevels - 1));
 	int w_level = m_uWidth >> level, h_level = m_uHeight >> level;
 	x = math::clamp(x, 0, w_level - 1); y = math::clamp(y, 0, h_level - 1);
-	void* data;
-#ifdef ISCUDA
-	data = m_pDeviceData + (m_sOffsets[level] + y * w_level + x);
-#else
-	data = m_pHostData + (m_sOffsets[level] + y * w_level + x);
-#endif
-	Spectrum s;
-	if (m_uType == vtRGBE)
-		s.fromRGBE(*(RGBE*)data);
-	else s.fromRGBCOL(*(RGBCOL*)data);
-	return s;
+	return fetchTexel(level, x, y);
 }
 
 void KernelMIPMap::evalGradient(const Vec2f& uv, Spectrum* gradient) const
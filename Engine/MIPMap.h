@@ -1,11 +1,28 @@
 #pragma once
 #include "MIPMap_device.h"
 #include <Base/FixedString.h>
+#include <functional>
 
 namespace CudaTracerLib {
 
 class IInStream;
 class FileOutputStream;
+class TextureTileCache;
+
+//has to be increased when the output of CompileToBinary changes, cached compiled textures are not used then
+#define MIPMAP_COMPILER_VERSION 3
+//compiled textures starting with this token instead of the width store the texels as one section written with FileOutputStream::WriteSection
+#define MIPMAP_SECTION_LAYOUT_TOKEN 0xFFFFFFF0u
+//compiled textures starting with this token store square tiles of all levels after the header, which can be loaded on demand by a TextureTileCache
+#define MIPMAP_TILED_LAYOUT_TOKEN 0xFFFFFFF1u
+
+//filters for computing the mip levels, the windowed sinc filters keep more detail than the box filter
+enum MIPMapDownsampleFilter
+{
+	MIPMAP_DOWNSAMPLE_Box,
+	MIPMAP_DOWNSAMPLE_Lanczos,
+	MIPMAP_DOWNSAMPLE_Kaiser,
+};
 
 class MIPMap
 {
@@ -20,14 +37,25 @@ class MIPMap
 	ImageWrap m_uWrapMode;
 	unsigned int m_sOffsets[MAX_MIPS];
 	float m_weightLut[MTS_MIPMAP_LUT_SIZE];
+	TextureTileCache* m_pTileCache;
+	unsigned int m_uTileShift;
+	unsigned int m_uFirstPage;
 public:
 	ImageFilter m_uFilterMode;
 	std::string m_pPath;
 	MIPMap() = default;
-	CTL_EXPORT MIPMap(const std::string& a_InputFile, IInStream& a_In);
+	//tiled textures are registered with the tile cache, which has to use the same tile size, only the coarsest level is loaded immediately
+	//the tiles are read from the file of a_In later which has to be kept, a_ReleaseFile is called once they are not read anymore
+	CTL_EXPORT MIPMap(const std::string& a_InputFile, IInStream& a_In, TextureTileCache* a_TileCache = 0, const std::function<void()>& a_ReleaseFile = std::function<void()>());
 	CTL_EXPORT void Free();
-	CTL_EXPORT static void CompileToBinary(const std::string& a_InputFile, FileOutputStream& a_Out, bool a_MipMap);
-	CTL_EXPORT static void CompileToBinary(const std::string& in, const std::string& out, bool a_MipMap);
+	//writes the texture in the compiled format, the tiles of tiled textures are copied from the file they were registered with
+	CTL_EXPORT void Serialize(FileOutputStream& a_Out);
+	//images with non power of two sizes are not rescaled, every level is half the size of the previous one rounded down
+	//the tiled layout is written if the texture_tile_size of the storage options of a_Out is not 0
+	CTL_EXPORT static void CompileToBinary(const std::string& a_InputFile, FileOutputStream& a_Out, bool a_MipMap, MIPMapDownsampleFilter filter = MIPMAP_DOWNSAMPLE_Box);
+	CTL_EXPORT static void CompileToBinary(const std::string& in, const std::string& out, bool a_MipMap, MIPMapDownsampleFilter filter = MIPMAP_DOWNSAMPLE_Box);
+	//computes all levels of a generated image with each filter and prints the throughput
+	CTL_EXPORT static void BenchmarkDownsampling(unsigned int width = 8192, unsigned int height = 8192);
 	CTL_EXPORT static void CreateSphericalSkydomeTexture(const std::string& front, const std::string& back, const std::string& left, const std::string& right, const std::string& top, const std::string& bottom, const std::string& outFile);
 	CTL_EXPORT static void CreateRelaxedConeMap(const std::string& a_InputFile, FileOutputStream& Out);
 	CTL_EXPORT KernelMIPMap getKernelData();
@@ -35,9 +63,14 @@ public:
 	{
 		return m_uLevels;
 	}
+	//the tiles of tiled textures are stored in the tile cache and not included
 	unsigned int getBufferSize() const
 	{
-		return m_uSize;
+		return m_pTileCache ? 0 : m_uSize;
+	}
+	bool isTiled() const
+	{
+		return m_pTileCache != 0;
 	}
 };
 
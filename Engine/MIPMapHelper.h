@@ -88,4 +88,8 @@ public:
 
 bool parseImage(const std::string& a_InputFile, imgData& data);
 
+//filters src into dst which has to be allocated with the size of the next level, max(1, w / 2) x max(1, h / 2), and the same type
+//the image is treated as repeating, rows of dst are computed in parallel bands
+void DownsampleImage(const imgData& src, imgData& dst, MIPMapDownsampleFilter filter);
+
 }
\ No newline at end of file
@@ -28,6 +28,10 @@ enum Texture_DataType
 {
 	vtRGBE,
 	vtRGBCOL,
+	//block compressed formats, see TextureCompression.h
+	vtBC1,
+	vtBC3,
+	vtBC6,
 };
 
 CUDA_FUNC_IN bool WrapCoordinates(const Vec2f& a_UV, const Vec2f& dim, ImageWrap w, Vec2f* loc)
@@ -54,6 +58,19 @@ CUDA_FUNC_IN bool WrapCoordinates(const Vec2f& a_UV, const Vec2f& dim, ImageWrap
 	return false;
 }
 
+//view of a TextureTileCache, the pointers are either all device or all host pointers
+struct KernelTextureTileCache
+{
+	//slot of every page or UINT_MAX if the page is not resident
+	unsigned int* m_pPageTable;
+	//set for pages which were accessed while not being resident
+	unsigned char* m_pRequests;
+	//set for slots which were accessed, used for the eviction of the least recently used tiles
+	unsigned char* m_pUsed;
+	unsigned int* m_pTiles;
+	unsigned int m_uSlotWords;
+};
+
 struct KernelMIPMap
 {
 	CUDA_ALIGN(16) unsigned int* m_pDeviceData;
@@ -66,6 +83,11 @@ struct KernelMIPMap
 	unsigned int m_sOffsets[MAX_MIPS];
 	unsigned int m_uLevels;
 	float m_weightLut[MTS_MIPMAP_LUT_SIZE];
+	//tiled textures are paged in on demand, m_sOffsets hold the first page of every level relative to m_uFirstPage then
+	//0 for textures which are stored completely
+	unsigned int m_uTileShift;
+	unsigned int m_uFirstPage;
+	KernelTextureTileCache m_sDeviceTileCache, m_sHostTileCache;
 
 	//Texture functions
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum Sample(const Vec2f& uv) const;
@@ -76,6 +98,10 @@ struct KernelMIPMap
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum Sample(float width, int x, int y) const;
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum eval(const Vec2f& uv, const Vec2f& d0, const Vec2f& d1) const;
 private:
+	//texels of the level or of the tile containing (x, y) which are changed to be relative to it, w is the width of the returned data
+	//for tiled textures a coarser level is returned if the tile is not resident, null is only returned if no level is resident
+	CTL_EXPORT CUDA_DEVICE CUDA_HOST const unsigned int* getTexels(unsigned int& level, int& x, int& y, unsigned int& w) const;
+	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum fetchTexel(unsigned int level, int x, int y) const;
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum Texel(unsigned int level, const Vec2f& a_UV) const;
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum triangle(unsigned int level, const Vec2f& a_UV) const;
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST Spectrum evalEWA(unsigned int level, const Vec2f &uv, float A, float B, float C) const;
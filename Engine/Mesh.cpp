@@ -9,6 +9,10 @@
 #include "TriangleData.h"
 #include "Material.h"
 #include "TriIntersectorData.h"
+#include "MeshLoader/MeshCompiler.h"
+#include <Base/Timer.h>
+#include <Base/ThreadPool.h>
+#include <filesystem.h>
 
 namespace CudaTracerLib {
 
@@ -43,11 +47,34 @@ void printBVHData(const BVHNodeData* bvh, const std::string& path)
 	file.close();
 }
 
+//memory backed streams are copied and uploaded directly from their data, otherwise the section is read and invalidated
+//compressed sections are decompressed to the host memory and submitted immediately, the upload overlaps the decompression of the next section
+template<typename T> static void readSection(IInStream& a_In, bool sections, Stream<T>* stream, StreamReference<T> ref)
+{
+	const void* data = sections ? a_In.ReadSection(ref.operator T*(), ref.getHostSize()) : a_In.ReadMapped(ref.getHostSize());
+	if (data)
+		stream->UploadFrom(ref, (const T*)data);
+	else if (sections)
+		stream->UploadFrom(ref, ref.operator T*());
+	else a_In >> ref;
+}
+
 Mesh::Mesh(const std::string& path, IInStream& a_In, Stream<TriIntersectorData>* a_Stream0, Stream<TriangleData>* a_Stream1, Stream<BVHNodeData>* a_Stream2, Stream<TriIntersectorData2>* a_Stream3, Stream<Material>* a_Stream4, Stream<char>* a_Stream5)
 	: m_uPath(path)
 {
 	m_uType = MESH_STATIC_TOKEN;
 
+	unsigned int layoutToken;
+	a_In >> layoutToken;
+	bool aligned = layoutToken == MESH_ALIGNED_LAYOUT_TOKEN, sections = layoutToken == MESH_SECTION_LAYOUT_TOKEN;
+	if (!aligned && !sections)
+		a_In.Move(-(int)sizeof(layoutToken));
+	auto alignSection = [&]()
+	{
+		if (aligned)
+			a_In.Align(MESH_SECTION_ALIGNMENT);
+	};
+
 	a_In >> m_sLocalBox;
 	unsigned int numLights;
 	a_In >> numLights;
@@ -58,8 +85,8 @@ Mesh::Mesh(const std::string& path, IInStream& a_In, Stream<TriIntersectorData>*
 	unsigned int m_uTriangleCount;
 	a_In >> m_uTriangleCount;
 	m_sTriInfo = a_Stream1->malloc(m_uTriangleCount);
-	a_In >> m_sTriInfo;
-	m_sTriInfo.Invalidate();
+	alignSection();
+	readSection(a_In, sections, a_Stream1, m_sTriInfo);
 
 	unsigned int m_uMaterialCount;
 	a_In >> m_uMaterialCount;
@@ -79,20 +106,20 @@ Mesh::Mesh(const std::string& path, IInStream& a_In, Stream<TriIntersectorData>*
 	unsigned long long m_uNodeSize;
 	a_In >> m_uNodeSize;
 	m_sNodeInfo = a_Stream2->malloc(m_uNodeSize);
-	a_In >> m_sNodeInfo;
-	m_sNodeInfo.Invalidate();
+	alignSection();
+	readSection(a_In, sections, a_Stream2, m_sNodeInfo);
 
 	unsigned long long m_uIntSize;
 	a_In >> m_uIntSize;
 	m_sIntInfo = a_Stream0->malloc(m_uIntSize);
-	a_In >> m_sIntInfo;
-	m_sIntInfo.Invalidate();
+	alignSection();
+	readSection(a_In, sections, a_Stream0, m_sIntInfo);
 
 	unsigned long long m_uIndicesSize;
 	a_In >> m_uIndicesSize;
 	m_sIndicesInfo = a_Stream3->malloc(m_uIndicesSize);
-	a_In >> m_sIndicesInfo;
-	m_sIndicesInfo.Invalidate();
+	alignSection();
+	readSection(a_In, sections, a_Stream3, m_sIndicesInfo);
 
 	//printBVHData(m_sNodeInfo(0), "mesh.txt");
 }
@@ -119,28 +146,33 @@ void Mesh::Free(Stream<TriIntersectorData>* a_Stream0, Stream<TriangleData>* a_S
 
 SceneInitData Mesh::ParseBinary(const std::string& a_InputFile)
 {
-	FileInputStream a_In(a_InputFile);
+	MappedInputStream a_In(a_InputFile);
+	unsigned int type, layoutToken;
+	a_In >> type >> layoutToken;
+	bool aligned = layoutToken == MESH_ALIGNED_LAYOUT_TOKEN, sections = layoutToken == MESH_SECTION_LAYOUT_TOKEN;
+	if (!aligned && !sections)
+		a_In.Move(-(int)sizeof(layoutToken));
 	AABB m_sLocalBox;
 	a_In >> m_sLocalBox;
 	unsigned int numLights;
 	a_In >> numLights;
 	a_In.Move(sizeof(MeshPartLight) * numLights);
-#define PRINT(n, t) { a_In.Move((int)(n * sizeof(t))); Platform::OutputDebug(format("Buf : %s, length : %llu, size : %llu[MB]\n", #t, size_t(n), size_t((n) * sizeof(t) / (1024 * 1024))));}
+#define PRINT(n, t, a) { if (sections && a) a_In.ReadSection(0, n * sizeof(t)); else { if (aligned && a) a_In.Align(MESH_SECTION_ALIGNMENT); a_In.ReadMapped(n * sizeof(t)); } Platform::OutputDebug(format("Buf : %s, length : %llu, size : %llu[MB]\n", #t, size_t(n), size_t((n) * sizeof(t) / (1024 * 1024))));}
 	unsigned int m_uTriangleCount;
 	a_In >> m_uTriangleCount;
-	PRINT(m_uTriangleCount, TriangleData)
+	PRINT(m_uTriangleCount, TriangleData, true)
 	unsigned int m_uMaterialCount;
 	a_In >> m_uMaterialCount;
-	PRINT(m_uMaterialCount, Material)
+	PRINT(m_uMaterialCount, Material, false)
 	unsigned long long m_uNodeSize;
 	a_In >> m_uNodeSize;
-	PRINT(m_uNodeSize, BVHNodeData)
+	PRINT(m_uNodeSize, BVHNodeData, true)
 	unsigned long long m_uIntSize;
 	a_In >> m_uIntSize;
-	PRINT(m_uIntSize, TriIntersectorData)
+	PRINT(m_uIntSize, TriIntersectorData, true)
 	unsigned long long m_uIndicesSize;
 	a_In >> m_uIndicesSize;
-	PRINT(m_uIndicesSize, TriIntersectorData2)
+	PRINT(m_uIndicesSize, TriIntersectorData2, true)
 #undef PRINT
 #undef PRINT2
 		a_In.Close();
@@ -196,8 +228,34 @@ void Mesh::CompileMesh(const Vec3f* vertices, unsigned int nVertices, const Vec3
 
 }
 
+//rounds to the nearest float with only the highest bits of the mantissa set, the zero low bytes compress well
+static float quantizeMantissa(float f, unsigned int bits)
+{
+	if (bits >= 23)
+		return f;
+	unsigned int drop = 23 - bits, u;
+	memcpy(&u, &f, sizeof(u));
+	if ((u & 0x7f800000) == 0x7f800000)
+		return f;
+	u = (u + (1u << (drop - 1))) & ~((1u << drop) - 1);
+	memcpy(&f, &u, sizeof(u));
+	return f;
+}
+
 void Mesh::CompileMesh(const Vec3f* vertices, unsigned int nVertices, const Vec3f* a_normals, const Vec2f** uvs, unsigned int nUV_Sets, const unsigned int* indices, unsigned int nIndices, const Material* mats, const Spectrum* Les, const unsigned int* subMeshes, const unsigned char* extraData, FileOutputStream& a_Out, bool flipNormals, bool faceNormals, float maxSmoothAngle)
 {
+	const AssetStorageOptions& opts = a_Out.getStorageOptions();
+	//the bvh is built from the quantized positions so it is consistent with the triangles
+	std::vector<Vec3f> quantizedVertices;
+	if (opts.position_bits < 23)
+	{
+		quantizedVertices.resize(nVertices);
+		for (unsigned int i = 0; i < nVertices; i++)
+			for (int j = 0; j < 3; j++)
+				quantizedVertices[i][j] = quantizeMantissa(vertices[i][j], opts.position_bits);
+		vertices = quantizedVertices.data();
+	}
+
 	std::vector<MeshPartLight> lights;
 	auto add_light = [&](int submesh_index)
 	{
@@ -234,6 +292,7 @@ void Mesh::CompileMesh(const Vec3f* vertices, unsigned int nVertices, const Vec3
 			for (unsigned int j = 0; j < 3; j++)
 			{
 				t[j] = uvs[uvIdx][v_idx(j)];
+				t[j] = Vec2f(quantizeMantissa(t[j].x, opts.uv_bits), quantizeMantissa(t[j].y, opts.uv_bits));
 			}
 			tri.setUvSetData(uvIdx, t[0], t[1], t[2]);
 		}
@@ -276,12 +335,13 @@ void Mesh::CompileMesh(const Vec3f* vertices, unsigned int nVertices, const Vec3
 		triData[ti] = tri;
 	}
 	add_light(submesh_index);
+	a_Out << (unsigned int)MESH_SECTION_LAYOUT_TOKEN;
 	a_Out << box;
 	a_Out << (unsigned int)lights.size();
 	if (lights.size())
 		a_Out.Write(&lights[0], lights.size() * sizeof(MeshPartLight));
 	a_Out << numTriangles;
-	a_Out.Write(triData, sizeof(TriangleData) * numTriangles);
+	a_Out.WriteSection(triData, sizeof(TriangleData) * numTriangles);
 	unsigned int nMaterials = submesh_index + 1;
 	a_Out << nMaterials;
 	a_Out.Write(&mats[0], sizeof(Material) * nMaterials);
@@ -289,4 +349,90 @@ void Mesh::CompileMesh(const Vec3f* vertices, unsigned int nVertices, const Vec3
 	delete[] triData;
 }
 
-}
\ No newline at end of file
+void BenchmarkMeshStorage(unsigned int gridSize)
+{
+	std::vector<Vec3f> positions(gridSize * gridSize);
+	std::vector<Vec2f> uvs(gridSize * gridSize);
+	for (unsigned int y = 0; y < gridSize; y++)
+		for (unsigned int x = 0; x < gridSize; x++)
+		{
+			float fx = x / float(gridSize - 1), fy = y / float(gridSize - 1);
+			positions[y * gridSize + x] = Vec3f(fx * 100.0f, math::sin(fx * 6.0f) * math::cos(fy * 4.0f), fy * 100.0f);
+			uvs[y * gridSize + x] = Vec2f(fx, fy);
+		}
+	std::vector<unsigned int> indices;
+	for (unsigned int y = 0; y + 1 < gridSize; y++)
+		for (unsigned int x = 0; x + 1 < gridSize; x++)
+		{
+			unsigned int a = y * gridSize + x, b = a + 1, c = a + gridSize + 1, d = a + gridSize;
+			unsigned int q[6] = { a, b, c, a, c, d };
+			indices.insert(indices.end(), q, q + 6);
+		}
+	Material mat("benchmark");
+	printf("Mesh storage benchmark, %u triangles, %u threads\n", (unsigned int)indices.size() / 3, ThreadPool::getGlobalPool().getNumThreads());
+
+	struct config
+	{
+		const char* name;
+		AssetStorageOptions opts;
+	};
+	const config configs[] = {
+		{ "raw", AssetStorageOptions(0) },
+		{ "deflate 1", AssetStorageOptions(1) },
+		{ "deflate 6", AssetStorageOptions(6) },
+		{ "deflate 9", AssetStorageOptions(9) },
+		{ "deflate 1 p16 uv10", AssetStorageOptions(1, 16, 10) },
+		{ "deflate 6 p12 uv8", AssetStorageOptions(6, 12, 8) },
+	};
+	auto path = (std::filesystem::temp_directory_path() / "mesh_storage_benchmark.xmsh").string();
+	size_t rawSize = 0;
+	InstructionTimer timer;
+	printf("%-20s %10s %8s %12s %12s\n", "options", "size [MB]", "ratio", "compile [ms]", "load [ms]");
+	for (auto& cfg : configs)
+	{
+		timer.StartTimer();
+		{
+			FileOutputStream out(path);
+			out.setStorageOptions(cfg.opts);
+			Mesh::CompileMesh(&positions[0], (unsigned int)positions.size(), 0, &uvs[0], &indices[0], (unsigned int)indices.size(), mat, Spectrum(0.0f), out);
+			out.Close();
+		}
+		double compileSec = timer.EndTimer();
+		size_t size = (size_t)std::filesystem::file_size(path);
+		if (!rawSize)
+			rawSize = size;
+
+		//reads all sections to host memory like the mesh constructor
+		std::vector<char> scratch;
+		timer.StartTimer();
+		{
+			MappedInputStream in(path);
+			unsigned int layoutToken, numLights, numTriangles, numMaterials;
+			unsigned long long numNodes, numInt, numIndices;
+			AABB box;
+			in >> layoutToken >> box >> numLights;
+			in.Move(int(numLights * sizeof(MeshPartLight)));
+			auto section = [&](size_t bytes)
+			{
+				scratch.resize(std::max(scratch.size(), bytes));
+				if (const void* data = in.ReadSection(scratch.data(), bytes))
+					memcpy(scratch.data(), data, bytes);
+			};
+			in >> numTriangles;
+			section(numTriangles * sizeof(TriangleData));
+			in >> numMaterials;
+			in.Move(int(numMaterials * sizeof(Material)));
+			in >> numNodes;
+			section(numNodes * sizeof(BVHNodeData));
+			in >> numInt;
+			section(numInt * sizeof(TriIntersectorData));
+			in >> numIndices;
+			section(numIndices * sizeof(TriIntersectorData2));
+		}
+		double loadSec = timer.EndTimer();
+		printf("%-20s %10.2f %8.2f %12.1f %12.1f\n", cfg.name, size / (1024.0 * 1024.0), rawSize / double(size), compileSec * 1000.0, loadSec * 1000.0);
+	}
+	std::filesystem::remove(path);
+}
+
+}
@@ -36,6 +36,13 @@ struct MeshPartLight
 #define MESH_STATIC_TOKEN 1
 #define MESH_ANIMAT_TOKEN 2
 
+//compiled meshes starting with this token (a NaN in place of the box) store the triangle, bvh node, intersector and index sections
+//at file offsets which are multiples of MESH_SECTION_ALIGNMENT so they can be used directly from a file mapping
+#define MESH_ALIGNED_LAYOUT_TOKEN 0x7FC1A5EDu
+#define MESH_SECTION_ALIGNMENT 64
+//these sections are written with FileOutputStream::WriteSection instead, they are optionally compressed
+#define MESH_SECTION_LAYOUT_TOKEN 0x7FC1A5EEu
+
 class IInStream;
 class FileOutputStream;
 template<typename T> class Stream;
@@ -60,6 +67,8 @@ public:
 	std::vector<MeshPartLight> m_sAreaLights;
 	FixedString<64> m_uPath;
 public:
+	//the members have to be set by the caller, used when loading snapshots
+	Mesh() = default;
 	CTL_EXPORT Mesh(const std::string& path, IInStream& a_In, Stream<TriIntersectorData>* a_Stream0,
 			Stream<TriangleData>* a_Stream1, Stream<BVHNodeData>* a_Stream2, Stream<TriIntersectorData2>* a_Stream3,
 			Stream<Material>* a_Stream4, Stream<char>* a_Stream5);
@@ -1,7 +1,11 @@
 #include <StdAfx.h>
 #include <Base/FileStream.h>
 #include "BVHBuilderHelper.h"
-#include <Engine/SpatialStructures/BVH/SplitBVHBuilder.hpp>
+#include <Base/Timer.h>
+#include <Base/CudaRandom.h>
+#include <Math/Warp.h>
+#include <Engine/SpatialStructures/BVH/BVHTraversal.h>
+#include <algorithm>
 
 namespace CudaTracerLib {
 
@@ -113,12 +117,14 @@ public:
 };
 }
 
-void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount, BVH_Construction_Result& out)
+static void constructBVH(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount, BVH_Construction_Result& out, const SplitBVHBuilder::BuildParams& params)
 {
 	bvh_helper::clb c(vCount, cCount, vertices, indices, out.nodes, out.tris, out.tris2);
 	SplitBVHBuilder::Platform P; P.m_maxLeafSize = 8;
-	SplitBVHBuilder bu(&c, P, SplitBVHBuilder::BuildParams());
+	SplitBVHBuilder bu(&c, P, params);
 	bu.run();
+	if (params.optimizeLayout)
+		OptimizeBVHNodeLayout(out.nodes);
 	BVH_Construction_Result r;
 	r.box = c.box;
 	r.tris2 = c.indices;
@@ -126,7 +132,12 @@ void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, unsigned i
 	r.tris = c.tris;
 }
 
-void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, int vCount, int cCount, FileOutputStream& O, BVH_Construction_Result* out)
+void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount, BVH_Construction_Result& out, const SplitBVHBuilder::BuildParams& params)
+{
+	constructBVH(vertices, indices, vCount, cCount, out, params);
+}
+
+void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, int vCount, int cCount, FileOutputStream& O, BVH_Construction_Result* out, const SplitBVHBuilder::BuildParams& params)
 {
 	BVH_Construction_Result localRes;
 	if (!out)
@@ -134,16 +145,316 @@ void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, int vCount
 
 	bvh_helper::clb c(vCount, cCount, vertices, indices, out->nodes, out->tris, out->tris2);
 	SplitBVHBuilder::Platform P; P.m_maxLeafSize = 8;
-	SplitBVHBuilder bu(&c, P, SplitBVHBuilder::BuildParams()); bu.run();
+	SplitBVHBuilder bu(&c, P, params); bu.run();
+	if (params.optimizeLayout)
+		OptimizeBVHNodeLayout(c.nodes);
 	O << (unsigned long long)c.l0;
-	if (c.l0)
-		O.Write(&c.nodes[0], (unsigned int)c.l0 * sizeof(BVHNodeData));
+	O.WriteSection(c.nodes.data(), c.l0 * sizeof(BVHNodeData));
 	O << (unsigned long long)c.l1;
-	if (c.l1)
-		O.Write(&c.tris[0], (unsigned int)c.l1 * sizeof(TriIntersectorData));
+	O.WriteSection(c.tris.data(), c.l1 * sizeof(TriIntersectorData));
 	O << (unsigned long long)c.l1;
-	if (c.l1)
-		O.Write(&c.indices[0], (unsigned int)c.l1 * sizeof(TriIntersectorData2));
+	O.WriteSection(c.indices.data(), c.l1 * sizeof(TriIntersectorData2));
+}
+
+void BenchmarkBVHBuildQualities(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount)
+{
+	struct mode
+	{
+		const char* name;
+		SplitBVHBuilder::BuildParams::BuildQuality quality;
+		bool optimizeTreelets;
+	};
+	const mode modes[] = {
+		{ "SBVH", SplitBVHBuilder::BuildParams::Quality_SBVH, false },
+		{ "Binned SAH", SplitBVHBuilder::BuildParams::Quality_BinnedSAH, false },
+		{ "LBVH", SplitBVHBuilder::BuildParams::Quality_LBVH, false },
+		{ "LBVH + treelets", SplitBVHBuilder::BuildParams::Quality_LBVH, true },
+	};
+
+	printf("BVH build benchmark, %u triangles\n", cCount / 3);
+	for (auto& m : modes)
+	{
+		SplitBVHBuilder::Stats stats;
+		SplitBVHBuilder::BuildParams params;
+		params.stats = &stats;
+		params.enablePrints = false;
+		params.quality = m.quality;
+		params.optimizeTreelets = m.optimizeTreelets;
+
+		BVH_Construction_Result res;
+		InstructionTimer timer;
+		timer.StartTimer();
+		ConstructBVH(vertices, indices, vCount, cCount, res, params);
+		double sec = timer.EndTimer();
+		printf("%-16s : %10.1f ms, SAH cost = %8.2f, %d inner nodes, %d leafs\n", m.name, sec * 1000.0, stats.SAHCost, stats.numInnerNodes, stats.numLeafNodes);
+	}
+}
+
+void OptimizeBVHNodeLayout(std::vector<BVHNodeData>& nodes, unsigned int treeletSize)
+{
+	if (nodes.empty())
+		return;
+	treeletSize = max(treeletSize, 1u);
+
+	//new order of the reachable nodes, the root is always the first node
+	std::vector<unsigned int> order;
+	order.reserve(nodes.size());
+	std::vector<unsigned char> inTreelet(nodes.size(), 0);
+	std::vector<unsigned int> treelet, treeletRoots, stack;
+	std::vector<std::pair<float, unsigned int>> candidates;
+	auto forChildren = [&](unsigned int nodeIdx, const std::function<void(float, unsigned int)>& f)
+	{
+		const BVHNodeData& node = nodes[nodeIdx];
+		Vec2i c = node.getChildren();
+		if (c.x >= 0 && c.x != 0x76543210)
+			f(node.getLeft().Area(), (unsigned int)c.x / 4);
+		if (c.y >= 0 && c.y != 0x76543210)
+			f(node.getRight().Area(), (unsigned int)c.y / 4);
+	};
+	treeletRoots.push_back(0);
+	while (!treeletRoots.empty())
+	{
+		unsigned int root = treeletRoots.back();
+		treeletRoots.pop_back();
+
+		//grow the treelet by the most probable candidate
+		treelet.clear();
+		candidates.clear();
+		candidates.push_back(std::make_pair(0.0f, root));
+		while (treelet.size() < treeletSize && !candidates.empty())
+		{
+			auto it = std::max_element(candidates.begin(), candidates.end(), [](const std::pair<float, unsigned int>& a, const std::pair<float, unsigned int>& b)
+			{
+				return a.first < b.first;
+			});
+			unsigned int nodeIdx = it->second;
+			candidates.erase(it);
+			treelet.push_back(nodeIdx);
+			inTreelet[nodeIdx] = 1;
+			forChildren(nodeIdx, [&](float area, unsigned int child)
+			{
+				candidates.push_back(std::make_pair(area, child));
+			});
+		}
+
+		//lay out the treelet depth first in creation order, the builder emits the children in spatial order which benefits coherent rays
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			unsigned int nodeIdx = stack.back();
+			stack.pop_back();
+			order.push_back(nodeIdx);
+			unsigned int c[2];
+			int n = 0;
+			forChildren(nodeIdx, [&](float, unsigned int child)
+			{
+				if (inTreelet[child])
+					c[n++] = child;
+			});
+			while (n)
+				stack.push_back(c[--n]);
+		}
+		for (unsigned int nodeIdx : treelet)
+			inTreelet[nodeIdx] = 0;
+
+		//the remaining candidates start new treelets which are also laid out in creation order
+		std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, unsigned int>& a, const std::pair<float, unsigned int>& b)
+		{
+			return a.second > b.second;
+		});
+		for (auto& c : candidates)
+			treeletRoots.push_back(c.second);
+	}
+
+	size_t numReachable = order.size();
+	std::vector<unsigned int> newIdx(nodes.size(), UINT_MAX);
+	for (size_t i = 0; i < numReachable; i++)
+		newIdx[order[i]] = (unsigned int)i;
+	unsigned int next = (unsigned int)numReachable;
+	for (size_t i = 0; i < nodes.size(); i++)
+		if (newIdx[i] == UINT_MAX)
+			newIdx[i] = next++;
+
+	std::vector<BVHNodeData> reordered(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		BVHNodeData node = nodes[i];
+		if (newIdx[i] < numReachable)
+		{
+			Vec2i& c = node.getChildren();
+			if (c.x >= 0 && c.x != 0x76543210)
+				c.x = newIdx[c.x / 4] * 4;
+			if (c.y >= 0 && c.y != 0x76543210)
+				c.y = newIdx[c.y / 4] * 4;
+			unsigned int parent = node.getParent();
+			if (parent != UINT_MAX)
+				node.setParent(newIdx[parent / 4] * 4);
+		}
+		reordered[newIdx[i]] = node;
+	}
+	nodes.swap(reordered);
+}
+
+namespace bvh_helper
+{
+//set associative cache with lru replacement used to estimate the memory traffic of a node layout
+class CacheSimulator
+{
+	enum { LineSize = 128, Ways = 4, NumSets = 32 };
+	unsigned long long m_tags[NumSets][Ways];
+	unsigned long long m_lastUse[NumSets][Ways];
+	unsigned long long m_time;
+public:
+	unsigned long long numAccesses, numMisses;
+
+	CacheSimulator()
+		: m_time(0), numAccesses(0), numMisses(0)
+	{
+		for (int i = 0; i < NumSets; i++)
+			for (int j = 0; j < Ways; j++)
+			{
+				m_tags[i][j] = ULLONG_MAX;
+				m_lastUse[i][j] = 0;
+			}
+	}
+
+	void access(size_t byteOffset)
+	{
+		unsigned long long line = byteOffset / LineSize;
+		unsigned int set = (unsigned int)(line % NumSets);
+		numAccesses++;
+		m_time++;
+		int lru = 0;
+		for (int j = 0; j < Ways; j++)
+		{
+			if (m_tags[set][j] == line)
+			{
+				m_lastUse[set][j] = m_time;
+				return;
+			}
+			if (m_lastUse[set][j] < m_lastUse[set][lru])
+				lru = j;
+		}
+		numMisses++;
+		m_tags[set][lru] = line;
+		m_lastUse[set][lru] = m_time;
+	}
+};
+
+//closest hit traversal visiting the nearer child first, reports every inner node fetch to the cache
+static void traceNodes(const BVH_Construction_Result& res, const Ray& r, CacheSimulator& cache)
+{
+	float rayT = FLT_MAX;
+	int stack[128];
+	int stackPtr = 0;
+	stack[stackPtr++] = 0;
+	while (stackPtr)
+	{
+		int addr = stack[--stackPtr];
+		if (addr < 0)
+		{
+			for (int i = ~addr; ; i++)
+			{
+				res.tris[i].Intersect(r, &rayT);
+				if (res.tris2[i].getFlag())
+					break;
+			}
+			continue;
+		}
+		const BVHNodeData& node = res.nodes[addr / 4];
+		cache.access(addr / 4 * sizeof(BVHNodeData));
+		Vec2i c = node.getChildren();
+		auto intersect = [&](const AABB& box, float& tmin)
+		{
+			Vec3f t0 = (box.minV - r.ori()) / r.dir(), t1 = (box.maxV - r.ori()) / r.dir();
+			tmin = kepler_math::spanBeginKepler(t0.x, t1.x, t0.y, t1.y, t0.z, t1.z, 0);
+			return tmin <= kepler_math::spanEndKepler(t0.x, t1.x, t0.y, t1.y, t0.z, t1.z, rayT);
+		};
+		float t0min, t1min;
+		bool hit0 = c.x != 0x76543210 && intersect(node.getLeft(), t0min);
+		bool hit1 = c.y != 0x76543210 && intersect(node.getRight(), t1min);
+		if (hit0 && hit1 && t1min < t0min)
+		{
+			swapk(c.x, c.y);
+			swapk(hit0, hit1);
+		}
+		if (hit1)
+			stack[stackPtr++] = c.y;
+		if (hit0)
+			stack[stackPtr++] = c.x;
+	}
 }
+}
+
+void BenchmarkBVHNodeLayout(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount, unsigned int numRays)
+{
+	BVH_Construction_Result res;
+	SplitBVHBuilder::BuildParams params;
+	params.enablePrints = false;
+	params.optimizeLayout = false;
+	constructBVH(vertices, indices, vCount, cCount, res, params);
+	if (!res.nodes.size() || res.nodes[0].getChildren().y == 0x76543210)
+		return;
+
+	//coherent camera rays in scanline order and incoherent rays with random origin and direction
+	AABB box = res.nodes[0].getBox();
+	unsigned int res1D = (unsigned int)math::sqrt((float)numRays);
+	numRays = res1D * res1D;
+	std::vector<Ray> rays[2];
+	Vec3f eye = box.maxV + box.Size() * 0.5f;
+	for (unsigned int y = 0; y < res1D; y++)
+		for (unsigned int x = 0; x < res1D; x++)
+		{
+			Vec3f target = Vec3f(box.minV.x + box.Size().x * (x + 0.5f) / res1D, box.minV.y + box.Size().y * (y + 0.5f) / res1D, box.Center().z);
+			rays[0].push_back(Ray(eye, normalize(target - eye)));
+		}
+	LinearCongruental_GENERATOR rng;
+	for (unsigned int i = 0; i < numRays; i++)
+	{
+		Vec3f o = box.minV + Vec3f(rng.randomFloat(), rng.randomFloat(), rng.randomFloat()) * box.Size();
+		rays[1].push_back(Ray(o, Warp::squareToUniformSphere(Vec2f(rng.randomFloat(), rng.randomFloat()))));
+	}
+
+	printf("BVH node layout benchmark, %u triangles, %u rays\n", cCount / 3, numRays);
+	for (int layout = 0; layout < 2; layout++)
+	{
+		if (layout)
+			OptimizeBVHNodeLayout(res.nodes);
+		for (int raySet = 0; raySet < 2; raySet++)
+		{
+			const std::vector<Ray>& R = rays[raySet];
+			bvh_helper::CacheSimulator cache;
+			for (unsigned int i = 0; i < numRays; i++)
+				bvh_helper::traceNodes(res, R[i], cache);
 
-}
\ No newline at end of file
+			InstructionTimer timer;
+			timer.StartTimer();
+			unsigned int numHits = 0;
+			for (unsigned int i = 0; i < numRays; i++)
+			{
+				float rayT = FLT_MAX;
+				numHits += TracerayTemplate(R[i], rayT, [&](int idx)
+				{
+					bool found = false;
+					for (int j = idx; ; j++)
+					{
+						found |= res.tris[j].Intersect(R[i], &rayT);
+						if (res.tris2[j].getFlag())
+							return found;
+					}
+				}, &res.nodes[0], &res.nodes[0]);
+			}
+			double sec = timer.EndTimer();
+			printf("%-16s %-9s : %8.1f ms, %u hits, %.2f nodes/ray, %.3f simulated cache misses/ray\n", layout ? "optimized" : "creation order", raySet ? "random" : "primary", sec * 1000.0, numHits, cache.numAccesses / (double)numRays, cache.numMisses / (double)numRays);
+		}
+	}
+}
+
+void QuantizeBVHNodes(const std::vector<BVHNodeData>& nodes, std::vector<BVHNodeDataQuantized>& out)
+{
+	out.resize(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+		out[i].setData(nodes[i]);
+}
+
+}
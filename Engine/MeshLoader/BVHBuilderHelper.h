@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <Engine/Mesh.h>
+#include <Engine/SpatialStructures/BVH/SplitBVHBuilder.hpp>
 
 namespace CudaTracerLib {
 
@@ -12,8 +13,29 @@ struct BVH_Construction_Result
 	AABB box;
 };
 
-CTL_EXPORT void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount, BVH_Construction_Result& res);
+//the build quality can be selected with BuildParams::quality, the LBVH and binned modes are intended for meshes which are rebuilt frequently
+//the node layout of the result is optimized with OptimizeBVHNodeLayout unless BuildParams::optimizeLayout is disabled
+CTL_EXPORT void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount, BVH_Construction_Result& res, const SplitBVHBuilder::BuildParams& params = SplitBVHBuilder::BuildParams());
 
-CTL_EXPORT void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, int vCount, int cCount, FileOutputStream& O, BVH_Construction_Result* out = 0);
+CTL_EXPORT void ConstructBVH(const Vec3f* vertices, const unsigned int* indices, int vCount, int cCount, FileOutputStream& O, BVH_Construction_Result* out = 0, const SplitBVHBuilder::BuildParams& params = SplitBVHBuilder::BuildParams());
+
+//builds the bvh of the triangle mesh with every build quality and prints the build time and SAH cost
+CTL_EXPORT void BenchmarkBVHBuildQualities(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount);
+
+//reorders the reachable nodes (the root stays at index 0) so that nodes likely visited together are stored contiguously.
+//Starting at the root, treelets of treeletSize nodes are formed by greedily adding the child with the largest surface area,
+//i.e. the highest probability to be visited, the children which did not fit start new treelets.
+//Child indices and the parent indices in BVHNodeData::d.z are fixed up, unreachable nodes are moved to the end.
+CTL_EXPORT void OptimizeBVHNodeLayout(std::vector<BVHNodeData>& nodes, unsigned int treeletSize = 64);
+inline void OptimizeBVHNodeLayout(BVH_Construction_Result& res, unsigned int treeletSize = 64)
+{
+	OptimizeBVHNodeLayout(res.nodes, treeletSize);
+}
+
+//traces coherent and random rays through the bvh in creation order and the optimized layout and prints the time as well as the simulated cache misses
+CTL_EXPORT void BenchmarkBVHNodeLayout(const Vec3f* vertices, const unsigned int* indices, unsigned int vCount, unsigned int cCount, unsigned int numRays = 1 << 18);
+
+//converts the nodes of a construction result into the conservative quantized format, node i of the output corresponds to node i of the input
+CTL_EXPORT void QuantizeBVHNodes(const std::vector<BVHNodeData>& nodes, std::vector<BVHNodeDataQuantized>& out);
 
 }
\ No newline at end of file
@@ -5,8 +5,16 @@
 
 namespace CudaTracerLib {
 
+//has to be increased when the output of a mesh compiler or the compiled mesh layout changes, cached compiled meshes are not used then
+#define MESH_COMPILER_VERSION 3
+
 CTL_EXPORT void compileply(IInStream& in, FileOutputStream& a_Out);
+//files larger than a few MB are parsed in parallel, the result is identical to the serial parser
 CTL_EXPORT void compileobj(IInStream& in, FileOutputStream& a_Out);
+//parses a generated grid mesh with the serial and the parallel parser and prints the throughput of both
+CTL_EXPORT void BenchmarkObjParser(unsigned int gridSize = 2048);
+//compiles a generated height field mesh with different storage options and prints the file sizes, compile and section load times
+CTL_EXPORT void BenchmarkMeshStorage(unsigned int gridSize = 1024);
 CTL_EXPORT void compilemd5(IInStream& in, std::vector<IInStream*>& animFiles, FileOutputStream& a_Out);
 
 enum MeshCompileType
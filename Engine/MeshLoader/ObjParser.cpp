@@ -6,8 +6,11 @@
 #include <filesystem.h>
 #include <Base/FileStream.h>
 #include <Base/Platform.h>
+#include <Base/ThreadPool.h>
+#include <Base/Timer.h>
 #include <unordered_map>
 #include <iterator>
+#include <sstream>
 
 template <class T>
 inline void hash_combine(std::size_t& seed, const T& v)
@@ -592,6 +595,51 @@ template<typename T> void push(std::vector<T>& left, const std::vector<T>& right
 	std::move(right.begin(), right.end(), std::back_inserter(left));
 }
 
+//usemtl, the triangles of the current submesh are flushed and the submesh of the material is selected
+static void useMaterial(ImportState& s, const std::string& name, int& submesh)
+{
+	int mati = s.materialHash.searchi(name);
+	if (submesh != -1)
+	{
+		push(s.subMeshes[submesh].indices, s.indexTmp);
+		s.indexTmp.clear();
+		submesh = -1;
+	}
+	if (mati != -1)
+	{
+		auto& mat = s.materialHash.vec[mati];
+		if (mat.submesh == -1)
+		{
+			mat.submesh = s.addSubMesh();
+			s.subMeshes[mat.submesh].material = mat;
+		}
+		submesh = mat.submesh;
+		s.indexTmp.clear();
+	}
+}
+
+//faces without a preceding known material are added to the default submesh
+static void beginFaces(ImportState& s, int& submesh, int& defaultSubmesh)
+{
+	if (submesh == -1)
+	{
+		if (defaultSubmesh == -1)
+			defaultSubmesh = s.addSubMesh();
+		submesh = defaultSubmesh;
+	}
+}
+
+static void loadMtlLib(ImportState& s, const char* ptr, const std::string& dirName)
+{
+	if (dirName.size())
+	{
+		std::string fileName = dirName + "/" + ptr;
+		MemInputStream mtlIn(fileName.c_str());
+		loadMtl(s, mtlIn, dirName);
+		mtlIn.Close();
+	}
+}
+
 void parse(ImportState& s, IInStream& in)
 {
 	std::string dirName = std::filesystem::path(in.getFilePath()).parent_path().string();
@@ -647,7 +695,8 @@ void parse(ImportState& s, IInStream& in)
 			s.vertexTmp.clear();
 			while (*ptr)
 			{
-				Vec3i ptn;
+				//missing texture coordinate and normal indices are invalid
+				Vec3i ptn(0);
 				if (!parseInt(ptr, ptn.x))
 					break;
 				for (int i = 1; i < 4 && parseLiteral(ptr, "/"); i++)
@@ -688,12 +737,7 @@ void parse(ImportState& s, IInStream& in)
 			}
 			if (!*ptr)
 			{
-				if (submesh == -1)
-				{
-					if (defaultSubmesh == -1)
-						defaultSubmesh = s.addSubMesh();
-					submesh = defaultSubmesh;
-				}
+				beginFaces(s, submesh, defaultSubmesh);
 				for (int i = 2; i < s.vertexTmp.size(); i++)
 					s.indexTmp.push_back(Vec3i(s.vertexTmp[0], s.vertexTmp[i - 1], s.vertexTmp[i]));
 				valid = true;
@@ -701,37 +745,12 @@ void parse(ImportState& s, IInStream& in)
 		}
 		else if (parseLiteral(ptr, "usemtl ") && parseSpace(ptr)) // material name
 		{
-			int mati = s.materialHash.searchi(std::string(ptr));
-			if (submesh != -1)
-			{
-				push(s.subMeshes[submesh].indices, s.indexTmp);
-				s.indexTmp.clear();
-				submesh = -1;
-			}
-			if (mati != -1)
-			{
-				auto& mat = s.materialHash.vec[mati];
-				if (mat.submesh == -1)
-				{
-					mat.submesh = s.addSubMesh();
-					s.subMeshes[mat.submesh].material = mat;
-				}
-				submesh = mat.submesh;
-				s.indexTmp.clear();
-			}
+			useMaterial(s, std::string(ptr), submesh);
 			valid = true;
 		}
 		else if (parseLiteral(ptr, "mtllib ") && parseSpace(ptr) && *ptr) // material library
 		{
-			if (dirName.size())
-			{
-				std::string str = std::string(ptr);
-				trim(str);
-				std::string fileName = dirName + "/" + ptr;
-				MemInputStream mtlIn(fileName.c_str());
-				loadMtl(s, mtlIn, dirName);
-				mtlIn.Close();
-			}
+			loadMtlLib(s, ptr, dirName);
 			valid = true;
 		}
 		else if (
@@ -781,10 +800,300 @@ void parse(ImportState& s, IInStream& in)
 		push(s.subMeshes[submesh].indices, s.indexTmp);
 }
 
+//Parallel parsing of large obj files.
+//The file is split into line aligned chunks which are parsed concurrently. Face vertices keep their raw indices together with the
+//number of positions, texture coordinates and normals in front of them in the chunk, they are resolved once the counts of all previous chunks are known.
+//Vertex tuples are deduplicated per chunk and the unique tuples are merged in file order, which assigns the same vertex indices as the serial parser.
+//usemtl and mtllib are recorded as directives and replayed in order during the merge.
+#define PARALLEL_OBJ_PARSE_MIN_SIZE (4 * 1024 * 1024)
+
+struct ObjChunk
+{
+	struct Face
+	{
+		unsigned int firstVertex, numVertices;
+		Vec3i localSizes;
+		bool valid;
+	};
+	//usemtl or mtllib in front of face firstFace
+	struct Directive
+	{
+		size_t firstFace;
+		bool isMtllib;
+		std::string arg;
+	};
+	//faces between two directives
+	struct Segment
+	{
+		size_t numValidFaces;
+		size_t firstTriangle, numTriangles;
+	};
+
+	const char* begin, *end;
+	std::vector<Vec3f> positions, normals;
+	std::vector<Vec2f> texCoords;
+	std::vector<Vec3i> faceVertices;
+	std::vector<Face> faces;
+	std::vector<Directive> directives;
+
+	Vec3i globalOffset;
+	//per face vertex the index into uniqueTuples, after the merge the global vertex index
+	std::vector<int> vertexIds;
+	std::vector<Vec3i> uniqueTuples;
+	std::vector<int> uniqueToGlobal;
+	std::vector<Vec3i> triangles;
+	std::vector<Segment> segments;
+};
+
+static void parseObjChunk(ObjChunk& c)
+{
+	std::string line;
+	const char* lineStart = c.begin;
+	while (lineStart < c.end)
+	{
+		const char* lineEnd = (const char*)memchr(lineStart, '\n', c.end - lineStart);
+		if (!lineEnd)
+			lineEnd = c.end;
+		line.assign(lineStart, lineEnd);
+		lineStart = lineEnd + 1;
+		trim(line);
+		const char* ptr = line.c_str();
+		parseSpace(ptr);
+
+		if (!*ptr || parseLiteral(ptr, "#"))
+			continue;
+		else if (parseLiteral(ptr, "v ") && parseSpace(ptr))
+		{
+			Vec3f v;
+			if (parseFloats(ptr, v.getPtr(), 3) && parseSpace(ptr) && !*ptr)
+				c.positions.push_back(v);
+		}
+		else if (parseLiteral(ptr, "vt ") && parseSpace(ptr))
+		{
+			Vec2f v;
+			if (parseFloats(ptr, v.getPtr(), 2) && parseSpace(ptr))
+			{
+				float dummy;
+				while (parseFloat(ptr, dummy) && parseSpace(ptr));
+				if (!*ptr)
+					c.texCoords.push_back(Vec2f(v.x, 1.0f - v.y));
+			}
+		}
+		else if (parseLiteral(ptr, "vn ") && parseSpace(ptr))
+		{
+			Vec3f v;
+			if (parseFloats(ptr, v.getPtr(), 3) && parseSpace(ptr) && !*ptr)
+				c.normals.push_back(v);
+		}
+		else if (parseLiteral(ptr, "f ") && parseSpace(ptr))
+		{
+			//the vertices of invalid faces are still added to the vertex list like in the serial parser
+			ObjChunk::Face f;
+			f.firstVertex = (unsigned int)c.faceVertices.size();
+			f.localSizes = Vec3i((int)c.positions.size(), (int)c.texCoords.size(), (int)c.normals.size());
+			while (*ptr)
+			{
+				Vec3i ptn(0);
+				if (!parseInt(ptr, ptn.x))
+					break;
+				for (int i = 1; i < 4 && parseLiteral(ptr, "/"); i++)
+				{
+					int tmp = 0;
+					parseInt(ptr, tmp);
+					if (i < 3)
+						ptn[i] = tmp;
+				}
+				parseSpace(ptr);
+				c.faceVertices.push_back(ptn);
+			}
+			f.numVertices = (unsigned int)c.faceVertices.size() - f.firstVertex;
+			f.valid = !*ptr;
+			c.faces.push_back(f);
+		}
+		else if (parseLiteral(ptr, "usemtl ") && parseSpace(ptr))
+			c.directives.push_back(ObjChunk::Directive{ c.faces.size(), false, std::string(ptr) });
+		else if (parseLiteral(ptr, "mtllib ") && parseSpace(ptr) && *ptr)
+			c.directives.push_back(ObjChunk::Directive{ c.faces.size(), true, std::string(ptr) });
+	}
+}
+
+static void resolveObjChunk(ObjChunk& c)
+{
+	std::unordered_map<Vec3i, int> localHash;
+	localHash.reserve(c.faceVertices.size() / 2);
+	c.vertexIds.resize(c.faceVertices.size());
+	for (const ObjChunk::Face& f : c.faces)
+	{
+		Vec3i faceSize = c.globalOffset + f.localSizes;
+		for (unsigned int j = 0; j < f.numVertices; j++)
+		{
+			Vec3i ptn = c.faceVertices[f.firstVertex + j];
+			for (int i = 0; i < 3; i++)
+			{
+				if (ptn[i] < 0)
+					ptn[i] += faceSize[i];
+				else
+					ptn[i]--;
+
+				if (ptn[i] < 0 || ptn[i] >= faceSize[i])
+					ptn[i] = -1;
+			}
+			auto it = localHash.find(ptn);
+			if (it == localHash.end())
+			{
+				it = localHash.insert(std::make_pair(ptn, (int)c.uniqueTuples.size())).first;
+				c.uniqueTuples.push_back(ptn);
+			}
+			c.vertexIds[f.firstVertex + j] = it->second;
+		}
+	}
+	std::vector<Vec3i>().swap(c.faceVertices);
+}
+
+static void triangulateObjChunk(ObjChunk& c)
+{
+	size_t nextDirective = 0;
+	c.segments.push_back(ObjChunk::Segment{ 0, 0, 0 });
+	for (size_t fi = 0; fi <= c.faces.size(); fi++)
+	{
+		while (nextDirective < c.directives.size() && c.directives[nextDirective].firstFace == fi)
+		{
+			c.segments.push_back(ObjChunk::Segment{ 0, c.triangles.size(), 0 });
+			nextDirective++;
+		}
+		if (fi == c.faces.size())
+			break;
+		const ObjChunk::Face& f = c.faces[fi];
+		if (!f.valid)
+			continue;
+		c.segments.back().numValidFaces++;
+		const int* ids = &c.vertexIds[f.firstVertex];
+		for (unsigned int i = 2; i < f.numVertices; i++)
+			c.triangles.push_back(Vec3i(c.uniqueToGlobal[ids[0]], c.uniqueToGlobal[ids[i - 1]], c.uniqueToGlobal[ids[i]]));
+		c.segments.back().numTriangles = c.triangles.size() - c.segments.back().firstTriangle;
+	}
+}
+
+void parseParallel(ImportState& s, const char* data, size_t size, const std::string& dirName, unsigned int numChunks)
+{
+	ThreadPool& pool = ThreadPool::getGlobalPool();
+	if (!numChunks)
+		numChunks = pool.getNumThreads() * 4;
+
+	//line aligned chunk boundaries
+	std::vector<ObjChunk> chunks(numChunks);
+	const char* pos = data, *end = data + size;
+	for (unsigned int i = 0; i < numChunks; i++)
+	{
+		const char* chunkEnd = i + 1 == numChunks ? end : std::max(pos, data + size * (i + 1) / numChunks);
+		if (chunkEnd < end)
+		{
+			const char* nl = (const char*)memchr(chunkEnd, '\n', end - chunkEnd);
+			chunkEnd = nl ? nl + 1 : end;
+		}
+		chunks[i].begin = pos;
+		chunks[i].end = chunkEnd;
+		pos = chunkEnd;
+	}
+
+	pool.ParallelFor(numChunks, [&](unsigned int i, unsigned int)
+	{
+		parseObjChunk(chunks[i]);
+	});
+
+	Vec3i size3(0);
+	for (ObjChunk& c : chunks)
+	{
+		c.globalOffset = size3;
+		size3 += Vec3i((int)c.positions.size(), (int)c.texCoords.size(), (int)c.normals.size());
+	}
+	s.positions.reserve(size3.x);
+	s.texCoords.reserve(size3.y);
+	s.normals.reserve(size3.z);
+	for (ObjChunk& c : chunks)
+	{
+		push(s.positions, c.positions);
+		push(s.texCoords, c.texCoords);
+		push(s.normals, c.normals);
+		std::vector<Vec3f>().swap(c.positions);
+		std::vector<Vec2f>().swap(c.texCoords);
+		std::vector<Vec3f>().swap(c.normals);
+	}
+
+	pool.ParallelFor(numChunks, [&](unsigned int i, unsigned int)
+	{
+		resolveObjChunk(chunks[i]);
+	});
+
+	//unique tuples in file order
+	for (ObjChunk& c : chunks)
+	{
+		c.uniqueToGlobal.resize(c.uniqueTuples.size());
+		for (size_t i = 0; i < c.uniqueTuples.size(); i++)
+		{
+			const Vec3i& ptn = c.uniqueTuples[i];
+			int idx;
+			if (!s.vertexHash.search(ptn, idx))
+			{
+				idx = s.vertexHash.add(ptn, (int)s.vertices.size());
+				ImportState::VertexPNT v;
+				v.p = (ptn.x == -1) ? Vec3f(0.0f) : s.positions[ptn.x];
+				v.t = (ptn.y == -1) ? Vec2f(0.0f) : s.texCoords[ptn.y];
+				v.n = (ptn.z == -1) ? Vec3f(0.0f) : s.normals[ptn.z];
+				s.vertices.push_back(v);
+			}
+			c.uniqueToGlobal[i] = idx;
+		}
+	}
+
+	pool.ParallelFor(numChunks, [&](unsigned int i, unsigned int)
+	{
+		triangulateObjChunk(chunks[i]);
+	});
+
+	//replay of the submesh state machine of the serial parser
+	int submesh = -1, defaultSubmesh = -1;
+	for (ObjChunk& c : chunks)
+	{
+		for (size_t i = 0; i < c.segments.size(); i++)
+		{
+			if (i)
+			{
+				const ObjChunk::Directive& d = c.directives[i - 1];
+				if (d.isMtllib)
+					loadMtlLib(s, d.arg.c_str(), dirName);
+				else useMaterial(s, d.arg, submesh);
+			}
+			const ObjChunk::Segment& seg = c.segments[i];
+			if (seg.numValidFaces)
+			{
+				beginFaces(s, submesh, defaultSubmesh);
+				s.indexTmp.insert(s.indexTmp.end(), c.triangles.begin() + seg.firstTriangle, c.triangles.begin() + seg.firstTriangle + seg.numTriangles);
+			}
+		}
+	}
+	if (submesh != -1)
+		push(s.subMeshes[submesh].indices, s.indexTmp);
+}
+
 void compileobj(IInStream& in, FileOutputStream& a_Out)
 {
 	ImportState state;
-	parse(state, in);
+	size_t size = in.getFileSize() - in.getPos();
+	if (size >= PARALLEL_OBJ_PARSE_MIN_SIZE)
+	{
+		std::string dirName = std::filesystem::path(in.getFilePath()).parent_path().string();
+		const char* data = (const char*)in.ReadMapped(size);
+		if (data)
+			parseParallel(state, data, size, dirName, 0);
+		else
+		{
+			unsigned char* buf = in.ReadToEnd();
+			parseParallel(state, (const char*)buf, size, dirName, 0);
+			free(buf);
+		}
+	}
+	else parse(state, in);
 
 	if (state.subMeshes.size() == 0)
 		throw std::runtime_error("Invalid obj file, did not find submeshes!");
@@ -870,4 +1179,63 @@ void compileobj(IInStream& in, FileOutputStream& a_Out)
 	Mesh::CompileMesh(&positions[0], numVertices, state.normals.size() != 0 ? &normals[0] : 0, uv_sets.data(), uv_sets[0] ? 1 : 0 , &indices[0], (unsigned int)indices.size(), &matData[0], lights.size() ? &lights[0] : 0, &submeshes[0], 0, a_Out);
 }
 
-}
\ No newline at end of file
+void BenchmarkObjParser(unsigned int gridSize)
+{
+	//grid of quads with positions, texture coordinates and normals, every other row uses relative indices and material switches
+	std::ostringstream str;
+	str.setf(std::ios::fixed);
+	str.precision(6);
+	for (unsigned int y = 0; y < gridSize; y++)
+		for (unsigned int x = 0; x < gridSize; x++)
+		{
+			float fx = x / float(gridSize - 1), fy = y / float(gridSize - 1);
+			str << "v " << fx << " " << math::sin(fx * 6.0f) * math::cos(fy * 4.0f) << " " << fy << "\n";
+			str << "vt " << fx << " " << fy << "\n";
+			str << "vn 0 1 0\n";
+		}
+	int numVertices = int(gridSize * gridSize);
+	for (unsigned int y = 0; y + 1 < gridSize; y++)
+	{
+		if (y % 64 == 0)
+			str << "usemtl material" << (y / 64) % 3 << "\n";
+		for (unsigned int x = 0; x + 1 < gridSize; x++)
+		{
+			int idx[4] = { int(y * gridSize + x), int(y * gridSize + x + 1), int((y + 1) * gridSize + x + 1), int((y + 1) * gridSize + x) };
+			str << "f";
+			for (int i = 0; i < 4; i++)
+			{
+				int j = y % 2 ? idx[i] - numVertices : idx[i] + 1;
+				str << " " << j << "/" << j << "/" << j;
+			}
+			str << "\n";
+		}
+	}
+	std::string data = str.str();
+	double mb = data.size() / (1024.0 * 1024.0);
+	printf("OBJ parser benchmark, %u triangles, %.1f MB\n", 2 * (gridSize - 1) * (gridSize - 1), mb);
+
+	InstructionTimer timer;
+	ImportState serial;
+	{
+		MemInputStream in((const unsigned char*)data.c_str(), data.size());
+		timer.StartTimer();
+		parse(serial, in);
+	}
+	double serialSec = timer.EndTimer();
+	printf("%-10s : %10.1f ms, %8.1f MB/s\n", "serial", serialSec * 1000.0, mb / serialSec);
+
+	ImportState parallel;
+	timer.StartTimer();
+	parseParallel(parallel, data.c_str(), data.size(), "", 0);
+	double parallelSec = timer.EndTimer();
+	printf("%-10s : %10.1f ms, %8.1f MB/s, %u threads, speedup %.2f\n", "parallel", parallelSec * 1000.0, mb / parallelSec, ThreadPool::getGlobalPool().getNumThreads(), serialSec / parallelSec);
+
+	bool identical = serial.vertices.size() == parallel.vertices.size() && serial.subMeshes.size() == parallel.subMeshes.size() &&
+		(serial.vertices.empty() || !memcmp(&serial.vertices[0], &parallel.vertices[0], serial.vertices.size() * sizeof(ImportState::VertexPNT)));
+	for (size_t i = 0; identical && i < serial.subMeshes.size(); i++)
+		identical = serial.subMeshes[i].indices.size() == parallel.subMeshes[i].indices.size() &&
+			std::equal(serial.subMeshes[i].indices.begin(), serial.subMeshes[i].indices.end(), parallel.subMeshes[i].indices.begin());
+	printf("results identical : %s\n", identical ? "yes" : "no");
+}
+
+}
@@ -11,6 +11,7 @@
 #include <vector>
 #include <cctype>
 #include <Base/FileStream.h>
+#include <Base/ThreadPool.h>
 
 namespace CudaTracerLib {
 
@@ -69,9 +70,9 @@ struct varReader
 			t = u16;
 		else if (type == "int" || type == "int32")
 			t = u32;
-		else if (type == "float")
+		else if (type == "float" || type == "float32")
 			t = f32;
-		else if (type == "double")
+		else if (type == "double" || type == "float64")
 			t = f64;
 	}
 	///in bytes
@@ -179,6 +180,209 @@ float LongSwap(const float inFloat)
 	return retVal;
 }
 
+//layout of the elements, used to decide whether the bulk binary path is applicable
+struct PlyProperty
+{
+	std::string name;
+	varReader type;
+	bool isList;
+	varReader countType;
+};
+
+struct PlyElement
+{
+	std::string name;
+	size_t count;
+	std::vector<PlyProperty> properties;
+};
+
+static void recordPlyProperty(std::vector<PlyElement>& elements, const std::string& line)
+{
+	if (elements.empty())
+		return;
+	std::istringstream tokens(line);
+	std::string keyword, type;
+	tokens >> keyword >> type;
+	PlyProperty p;
+	p.isList = type == "list";
+	if (p.isList)
+	{
+		std::string countType, scalarType;
+		tokens >> countType >> scalarType;
+		p.countType = varReader(countType);
+		p.type = varReader(scalarType);
+	}
+	else p.type = varReader(type);
+	tokens >> p.name;
+	elements.back().properties.push_back(p);
+}
+
+//float vertex properties followed by triangle and quad faces with uchar vertex counts and 32 bit indices, the layout written by most scanners and exporters
+static bool isBulkPlyLayout(const std::vector<PlyElement>& elements)
+{
+	if (elements.size() < 2 || elements[0].name != "vertex" || elements[1].name != "face")
+		return false;
+	for (const PlyProperty& p : elements[0].properties)
+		if (p.isList || p.type.t != varReader::f32)
+			return false;
+	const std::vector<PlyProperty>& fp = elements[1].properties;
+	return fp.size() == 1 && fp[0].isList && fp[0].countType.t == varReader::u8 && fp[0].type.t == varReader::u32 &&
+		(fp[0].name == "vertex_indices" || fp[0].name == "vertex_index");
+}
+
+//written as shifts so compilers emit vectorized byte shuffles for the loops
+inline unsigned int byteSwap32(unsigned int x)
+{
+	return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+//reads whole element blocks, the vertices are converted in parallel chunks and the faces triangulated in parallel
+//the triangulation and index clamping match the generic binary reader
+static void readPlyBulk(const unsigned char* data, size_t size, bool bigEndian, const std::vector<PlyElement>& elements,
+	std::vector<Vec3f>& positions, std::vector<Vec3f>& normals, std::vector<Vec2f>& texCoords, std::vector<unsigned int>& indices)
+{
+	const size_t CHUNK_SIZE = 1 << 16;
+	ThreadPool& pool = ThreadPool::getGlobalPool();
+
+	const std::vector<PlyProperty>& props = elements[0].properties;
+	size_t numProps = props.size(), vertexCount = elements[0].count, faceCount = elements[1].count;
+	auto find = [&](std::initializer_list<const char*> names)
+	{
+		for (const char* n : names)
+			for (size_t i = 0; i < numProps; i++)
+				if (props[i].name == n)
+					return (int)i;
+		return -1;
+	};
+	int px = find({ "x" }), py = find({ "y" }), pz = find({ "z" });
+	int nx = find({ "nx" }), ny = find({ "ny" }), nz = find({ "nz" });
+	int tu = find({ "u", "s", "texture_u" }), tv = find({ "v", "t", "texture_v" });
+	if (px == -1 || py == -1 || pz == -1)
+		throw std::runtime_error("Ply file without vertex positions!");
+	bool hasNormals = nx != -1 && ny != -1 && nz != -1, hasUV = tu != -1 && tv != -1;
+
+	size_t vertexBytes = vertexCount * numProps * sizeof(float);
+	if (vertexBytes > size)
+		throw std::runtime_error("Ply file too short for its vertices!");
+	positions.resize(vertexCount);
+	normals.resize(hasNormals ? vertexCount : 0);
+	texCoords.resize(hasUV ? vertexCount : 0);
+	pool.ParallelFor((unsigned int)((vertexCount + CHUNK_SIZE - 1) / CHUNK_SIZE), [&](unsigned int chunk, unsigned int)
+	{
+		size_t start = chunk * CHUNK_SIZE, n = std::min(CHUNK_SIZE, vertexCount - start);
+		std::vector<unsigned int> block(n * numProps);
+		memcpy(&block[0], data + start * numProps * sizeof(float), block.size() * sizeof(float));
+		if (bigEndian)
+			for (size_t i = 0; i < block.size(); i++)
+				block[i] = byteSwap32(block[i]);
+		const float* f = (const float*)&block[0];
+		for (size_t i = 0; i < n; i++, f += numProps)
+		{
+			positions[start + i] = Vec3f(f[px], f[py], f[pz]);
+			if (hasNormals)
+				normals[start + i] = Vec3f(f[nx], f[ny], f[nz]);
+			if (hasUV)
+				texCoords[start + i] = Vec2f(f[tu], f[tv]);
+		}
+	});
+
+	//start offsets and first triangles of the face chunks, pure triangle meshes have a constant stride which is verified in parallel
+	const unsigned char* faces = data + vertexBytes;
+	size_t faceBytes = size - vertexBytes, numChunks = (faceCount + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<size_t> chunkOffset(numChunks + 1), chunkTriangle(numChunks + 1);
+	bool onlyTriangles = faceCount * 13 <= faceBytes;
+	if (onlyTriangles)
+	{
+		std::vector<unsigned char> chunkIsTriangles(numChunks);
+		pool.ParallelFor((unsigned int)numChunks, [&](unsigned int chunk, unsigned int)
+		{
+			size_t end = std::min(faceCount, (chunk + 1) * CHUNK_SIZE);
+			bool b = true;
+			for (size_t i = chunk * CHUNK_SIZE; i < end; i++)
+				b &= faces[i * 13] == 3;
+			chunkIsTriangles[chunk] = b;
+		});
+		onlyTriangles = std::find(chunkIsTriangles.begin(), chunkIsTriangles.end(), 0) == chunkIsTriangles.end();
+	}
+	if (onlyTriangles)
+	{
+		for (size_t c = 0; c <= numChunks; c++)
+		{
+			size_t f = std::min(faceCount, c * CHUNK_SIZE);
+			chunkOffset[c] = f * 13;
+			chunkTriangle[c] = f;
+		}
+	}
+	else
+	{
+		size_t off = 0, numTriangles = 0;
+		for (size_t f = 0; f < faceCount; f++)
+		{
+			if (f % CHUNK_SIZE == 0)
+			{
+				chunkOffset[f / CHUNK_SIZE] = off;
+				chunkTriangle[f / CHUNK_SIZE] = numTriangles;
+			}
+			if (off >= faceBytes)
+				throw std::runtime_error("Ply file too short for its faces!");
+			unsigned char n = faces[off];
+			if (n != 3 && n != 4)
+				throw std::runtime_error("Only triangles and quads are supported in ply files!");
+			numTriangles += n - 2;
+			off += 1 + 4 * n;
+		}
+		if (off > faceBytes)
+			throw std::runtime_error("Ply file too short for its faces!");
+		chunkOffset[numChunks] = off;
+		chunkTriangle[numChunks] = numTriangles;
+	}
+
+	indices.resize(chunkTriangle[numChunks] * 3);
+	pool.ParallelFor((unsigned int)numChunks, [&](unsigned int chunk, unsigned int)
+	{
+		size_t off = chunkOffset[chunk];
+		unsigned int* out = indices.data() + chunkTriangle[chunk] * 3;
+		size_t end = std::min(faceCount, (chunk + 1) * CHUNK_SIZE);
+		for (size_t f = chunk * CHUNK_SIZE; f < end; f++)
+		{
+			unsigned char n = faces[off];
+			unsigned int idx[4];
+			memcpy(idx, faces + off + 1, 4 * n);
+			for (unsigned int i = 0; i < n; i++)
+			{
+				if (bigEndian)
+					idx[i] = byteSwap32(idx[i]);
+				idx[i] = idx[i] >= vertexCount ? 0 : idx[i];
+			}
+			if (n == 3)
+			{
+				*out++ = idx[2];
+				*out++ = idx[1];
+				*out++ = idx[0];
+			}
+			else
+			{
+				*out++ = idx[2];
+				*out++ = idx[3];
+				*out++ = idx[0];
+				*out++ = idx[0];
+				*out++ = idx[1];
+				*out++ = idx[2];
+			}
+			off += 1 + 4 * n;
+		}
+	});
+}
+
+static void compilePlyMesh(const std::vector<Vec3f>& vertices, const Vec3f* normals, const Vec2f* texCoords, const std::vector<unsigned int>& indices, unsigned int indexCount, FileOutputStream& a_Out)
+{
+	Material defaultMat("Default_Material");
+	diffuse mat;
+	mat.m_reflectance = CreateTexture(Spectrum(1, 0, 0));
+	defaultMat.bsdf.SetData(mat);
+	Mesh::CompileMesh(&vertices[0], (unsigned int)vertices.size(), normals, texCoords, &indices[0], indexCount, defaultMat, Spectrum(0.0f), a_Out);
+}
+
 void compileply(IInStream& istream, FileOutputStream& a_Out)
 {
 	format_type format;
@@ -192,6 +396,7 @@ void compileply(IInStream& istream, FileOutputStream& a_Out)
 	int hasUV = 0, vertexProp = 0, hasPos = 0;
 	int posStart = -1, uvStart = -1, elementIndex = 0;
 	varReader listCount, listElements;
+	std::vector<PlyElement> elements;
 
 	while (istream.getline(line))
 	{
@@ -220,6 +425,7 @@ void compileply(IInStream& istream, FileOutputStream& a_Out)
 			std::size_t count;
 			char space_element_name, space_name_count;
 			stringstream >> space_element_name >> std::ws >> name >> space_name_count >> std::ws >> count >> std::ws;
+			elements.push_back(PlyElement{ name, count, std::vector<PlyProperty>() });
 			vertexProp = false;
 			if (name == "vertex")
 			{
@@ -232,6 +438,7 @@ void compileply(IInStream& istream, FileOutputStream& a_Out)
 		}
 		else if (keyword == "property")
 		{
+			recordPlyProperty(elements, line);
 			std::string type_or_list;
 			char space_property_type_or_list;
 			stringstream >> space_property_type_or_list >> std::ws >> type_or_list;
@@ -279,6 +486,21 @@ void compileply(IInStream& istream, FileOutputStream& a_Out)
 	if (hasPos != 7)
 		throw std::runtime_error(__FUNCTION__);
 
+	if (format != ascii_format && isBulkPlyLayout(elements))
+	{
+		std::vector<Vec3f> positions, normals;
+		std::vector<Vec2f> uvs;
+		std::vector<unsigned int> bulkIndices;
+		size_t size = istream.getFileSize() - istream.getPos();
+		const unsigned char* data = (const unsigned char*)istream.ReadMapped(size);
+		unsigned char* buf = data ? 0 : istream.ReadToEnd();
+		readPlyBulk(data ? data : buf, size, format == binary_big_endian_format, elements, positions, normals, uvs, bulkIndices);
+		if (buf)
+			free(buf);
+		compilePlyMesh(positions, normals.size() ? &normals[0] : 0, uvs.size() ? &uvs[0] : 0, bulkIndices, (unsigned int)bulkIndices.size(), a_Out);
+		return;
+	}
+
 	std::vector<Vec3f> vertices(vertexCount);
 	std::vector<Vec2f> texCoords(vertexCount);
 	std::vector<unsigned int> indices(sizeof(unsigned int) * faceCount * 6);//don't know if they are triangles or quads
@@ -355,7 +577,7 @@ void compileply(IInStream& istream, FileOutputStream& a_Out)
 			}
 			else throw std::runtime_error(__FUNCTION__);
 			for (unsigned int i = indexCount - FILE_BUF[file_pos]; i < indexCount; i++)
-				indices[i] = indices[i] > (unsigned int)vertexCount ? 0 : indices[i];
+				indices[i] = indices[i] >= (unsigned int)vertexCount ? 0 : indices[i];
 			file_pos += 4 * FILE_BUF[file_pos] + 1;
 		}
 		free(FILE_BUF);
@@ -364,11 +586,7 @@ void compileply(IInStream& istream, FileOutputStream& a_Out)
 	//if(pos != size)
 	//	throw std::runtime_error(__FUNCTION__);
 
-	Material defaultMat("Default_Material");
-	diffuse mat;
-	mat.m_reflectance = CreateTexture(Spectrum(1, 0, 0));
-	defaultMat.bsdf.SetData(mat);
-	Mesh::CompileMesh(&vertices[0], (unsigned int)vertices.size(), 0, hasUV ? &texCoords[0] : 0, &indices[0], indexCount, defaultMat, Spectrum(0.0f), a_Out);
+	compilePlyMesh(vertices, 0, hasUV ? &texCoords[0] : 0, indices, indexCount, a_Out);
 }
 
 }
@@ -5,6 +5,7 @@
 #include <SceneTypes/Node.h>
 #include "SpatialStructures/BVH/SplitBVHBuilder.hpp"
 #include "SpatialStructures/BVH/BVHRebuilder.h"
+#include "SpatialStructures/BVH/QuantizedBVHNodeBuffer.h"
 
 namespace CudaTracerLib {
 
@@ -43,27 +44,56 @@ bool SceneBVH::Build(Stream<Node>* nodStream, Buffer<Mesh, KernelMesh>* mesh_buf
 	bool modified = m_pBuilder->Build(&p);
 	if (modified)
 	{
-		m_pNodes->Invalidate();
+		//after a refit only the updated nodes and the transforms set since the last build are uploaded
+		auto refitted = m_pBuilder->getRefittedNodes();
+		if (refitted)
+		{
+			for (auto& level : *refitted)
+				for (unsigned int nodeIdx : level)
+				{
+					m_pNodes->Invalidate(nodeIdx, 1);
+					if (m_pQuantizedNodes)
+						m_pQuantizedNodes->Update(node_ref(), nodeIdx);
+				}
+		}
+		else
+		{
+			m_pNodes->Invalidate();
+			if (m_pQuantizedNodes)
+				m_pQuantizedNodes->Update(node_ref(), 0, m_pBuilder->getNumBVHNodesUsed());
+			m_pTransforms->Invalidate();
+			m_pInvTransforms->Invalidate();
+		}
 		m_pNodes->UpdateInvalidated();
-		m_pTransforms->Invalidate();
+		if (m_pQuantizedNodes)
+			m_pQuantizedNodes->Upload();
 		m_pTransforms->UpdateInvalidated();
-		m_pInvTransforms->Invalidate();
 		m_pInvTransforms->UpdateInvalidated();
 	}
 	return modified;
 }
 
-SceneBVH::SceneBVH(size_t a_NodeCount)
+SceneBVH::SceneBVH(size_t a_NodeCount, bool a_Quantized, bool a_RefitOnly)
+	: m_pQuantizedNodes(0)
 {
-	m_pNodes = new Stream<BVHNodeData>(a_NodeCount * 2);//largest binary tree has the same amount of inner nodes
+	m_pNodes = new Stream<BVHNodeData>(a_NodeCount * 2, a_Quantized);//largest binary tree has the same amount of inner nodes
+	if (a_Quantized)
+	{
+		m_pQuantizedNodes = new QuantizedBVHNodeBuffer();
+		m_pQuantizedNodes->Resize(m_pNodes->getBufferLength());
+	}
 	m_pTransforms = new Stream<float4x4>(a_NodeCount);
 	m_pInvTransforms = new Stream<float4x4>(a_NodeCount);
+	m_pNodes->setName("SceneBVHNodes");
+	m_pTransforms->setName("SceneBVHTransforms");
+	m_pInvTransforms->setName("SceneBVHInvTransforms");
 	tr_ref = m_pTransforms->malloc(m_pTransforms->getBufferLength());
 	iv_tr_ref = m_pInvTransforms->malloc(m_pInvTransforms->getBufferLength());
 	node_ref = m_pNodes->malloc(m_pNodes->getBufferLength());
 	for (unsigned int i = 0; i < a_NodeCount; i++)
 		*tr_ref(i) = *iv_tr_ref(i) = float4x4::Identity();
 	m_pBuilder = new BVHRebuilder(node_ref(), node_ref.getLength(), (unsigned int)a_NodeCount, 0, 0);
+	m_pBuilder->setRefitMode(a_RefitOnly);
 }
 
 SceneBVH::~SceneBVH()
@@ -72,6 +102,8 @@ SceneBVH::~SceneBVH()
 	delete m_pTransforms;
 	delete m_pInvTransforms;
 	delete m_pBuilder;
+	if (m_pQuantizedNodes)
+		delete m_pQuantizedNodes;
 }
 
 void SceneBVH::setTransform(BufferReference<Node, Node> n, const float4x4& mat)
@@ -93,6 +125,7 @@ KernelSceneBVH SceneBVH::getData(bool devicePointer)
 	KernelSceneBVH q;
 	q.m_uNumNodes = (unsigned int)m_pBuilder->getNumBVHNodesUsed();
 	q.m_pNodes = m_pNodes->getKernelData(devicePointer).Data;
+	q.m_pQuantizedNodes = devicePointer && m_pQuantizedNodes ? m_pQuantizedNodes->getData(true) : 0;
 	q.m_sStartNode = m_pBuilder->getStartNode();
 	q.m_pNodeTransforms = m_pTransforms->getKernelData(devicePointer).Data;
 	q.m_pInvNodeTransforms = m_pInvTransforms->getKernelData(devicePointer).Data;
@@ -101,7 +134,19 @@ KernelSceneBVH SceneBVH::getData(bool devicePointer)
 
 size_t SceneBVH::getDeviceSizeInBytes()
 {
-	return m_pNodes->getDeviceSizeInBytes() + m_pTransforms->getDeviceSizeInBytes() + m_pInvTransforms->getDeviceSizeInBytes();
+	return m_pNodes->getDeviceSizeInBytes() + (m_pQuantizedNodes ? m_pQuantizedNodes->getDeviceSizeInBytes() : 0) + m_pTransforms->getDeviceSizeInBytes() + m_pInvTransforms->getDeviceSizeInBytes();
+}
+
+void SceneBVH::getMemoryReport(MemoryReport& report)
+{
+	report.Add(m_pNodes->getMemoryReportEntry());
+	if (m_pQuantizedNodes)
+	{
+		size_t s = m_pQuantizedNodes->getDeviceSizeInBytes();
+		report.Add(MemoryReportEntry("SceneBVHQuantizedNodes", s, s, s, s, s, s));
+	}
+	report.Add(m_pTransforms->getMemoryReportEntry());
+	report.Add(m_pInvTransforms->getMemoryReportEntry());
 }
 
 const float4x4& SceneBVH::getNodeTransform(BufferReference<Node, Node> n)
@@ -150,4 +195,9 @@ void SceneBVH::printGraph(const std::string& path)
 	m_pBuilder->printGraph(path);
 }
 
+void SceneBVH::setRefitMode(bool refitOnly, float maxSAHIncrease)
+{
+	m_pBuilder->setRefitMode(refitOnly, maxSAHIncrease);
+}
+
 }
\ No newline at end of file
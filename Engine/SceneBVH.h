@@ -14,6 +14,8 @@ template<typename T> class Stream;
 template<typename H, typename D> class Buffer;
 template<typename H, typename D> class BufferRange;
 class BVHRebuilder;
+class QuantizedBVHNodeBuffer;
+class MemoryReport;
 
 class SceneBVH
 {
@@ -22,14 +24,16 @@ private:
 	Stream<float4x4>* m_pTransforms;
 	Stream<float4x4>* m_pInvTransforms;
 	BVHRebuilder* m_pBuilder;
+	QuantizedBVHNodeBuffer* m_pQuantizedNodes;
 	BufferReference<BVHNodeData, BVHNodeData> node_ref;
 	BufferReference<float4x4, float4x4> tr_ref, iv_tr_ref;
 public:
-	CTL_EXPORT SceneBVH(size_t a_NodeCount);
+	CTL_EXPORT SceneBVH(size_t a_NodeCount, bool a_Quantized = false, bool a_RefitOnly = false);
 	CTL_EXPORT ~SceneBVH();
 	CTL_EXPORT bool Build(Stream<Node>* nodStream, Buffer<Mesh, KernelMesh>* mesh_buf);
 	CTL_EXPORT KernelSceneBVH getData(bool devicePointer = true);
 	CTL_EXPORT size_t getDeviceSizeInBytes();
+	CTL_EXPORT void getMemoryReport(MemoryReport& report);
 	CTL_EXPORT void setTransform(BufferReference<Node, Node> n, const float4x4& mat);
 	CTL_EXPORT void invalidateNode(BufferReference<Node, Node> n);
 	CTL_EXPORT void addNode(BufferReference<Node, Node> n);
@@ -39,6 +43,8 @@ public:
 	CTL_EXPORT bool needsBuild();
 	CTL_EXPORT AABB getSceneBox();
 	CTL_EXPORT void printGraph(const std::string& path);
+	//see BVHRebuilder::setRefitMode
+	CTL_EXPORT void setRefitMode(bool refitOnly, float maxSAHIncrease = 1.5f);
 };
 
 }
\ No newline at end of file
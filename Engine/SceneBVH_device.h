@@ -4,12 +4,15 @@ namespace CudaTracerLib {
 
 struct float4x4;
 struct BVHNodeData;
+struct BVHNodeDataQuantized;
 
 struct KernelSceneBVH
 {
 	int m_sStartNode;
 	unsigned int m_uNumNodes;
 	BVHNodeData* m_pNodes;
+	//quantized copy of m_pNodes, only set for device data when the scene uses quantized bvhs
+	BVHNodeDataQuantized* m_pQuantizedNodes;
 	float4x4* m_pNodeTransforms;
 	float4x4* m_pInvNodeTransforms;
 };
@@ -15,11 +15,17 @@ struct SceneInitData
 	unsigned int m_uSizeAnimStream;
 	unsigned int m_uNumMeshes;
 	bool m_bSupportEnvironmentMap;
+	//stores the device copy of all bvh nodes in the quantized format (BVHNodeDataQuantized), the full precision nodes are only kept on the host
+	bool m_bQuantizedBVH;
+	//only refits the scene bvh when nodes are transformed, it is rebuilt once the sah cost degraded too much
+	bool m_bRefitSceneBVH;
 
 	static SceneInitData CreateForSpecificMesh(unsigned int a_Triangles, unsigned int a_Int, unsigned int a_Nodes, unsigned int a_Indices, unsigned int a_Mats, unsigned int a_Lights, unsigned int a_SceneNodes, unsigned int a_SceneMeshes)
 	{
 		SceneInitData r;
 		r.m_bSupportEnvironmentMap = true;
+		r.m_bQuantizedBVH = false;
+		r.m_bRefitSceneBVH = false;
 		r.m_uNumTriangles = a_Triangles;
 		r.m_uNumInt = a_Int;
 		r.m_uNumBvhNodes = a_Nodes;
@@ -38,6 +44,8 @@ struct SceneInitData
 		r.m_uNumInt = a_NumObjects * a_NumAvgTriPerObj * 3 / 2;
 		r.m_uNumMeshes = a_Meshes;
 		r.m_bSupportEnvironmentMap = envMap;
+		r.m_bQuantizedBVH = false;
+		r.m_bRefitSceneBVH = false;
 		r.m_uNumTriangles = a_NumObjects * a_NumAvgTriPerObj;
 		r.m_uNumBvhNodes = a_NumObjects * a_NumAvgTriPerObj / 2;
 		r.m_uNumBvhIndices = a_NumObjects * a_NumAvgTriPerObj * 4;
@@ -19,6 +19,8 @@ void ParseMitsubaScene(DynamicScene& scene, const std::string& scene_file, const
 		throw std::runtime_error("couldn't loader scene xml!");
 	CudaTracerLib::XMLNode root("", doc);
 
+	ShapeParser::compileMeshes(root.get_child_node("scene"), S);
+
 	root.get_child_node("scene").iterate_child_nodes([&](const CudaTracerLib::XMLNode& n)
 	{
 		if (n.name() == "include")
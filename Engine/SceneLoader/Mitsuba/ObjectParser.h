@@ -1134,12 +1134,25 @@ public:
                 mesh_path = compiled_folder + "/" + mesh_path;
             }
 
+			//the path of an automatically instanced node is the one of the shared mesh, its geometry is moved by the offset of the source
 			auto node_tar = S.scene.CreateNode(mesh_path);
-			S.scene.SetNodeTransform(m, node_tar);
+			S.scene.SetNodeTransform(m % float4x4::Translate(node_src->m_vMeshOffset - node_tar->m_vMeshOffset), node_tar);
+
+			//the instance has to land where a load of the original mesh file would
+			AABB localBox = S.scene.getMesh(node_tar)->m_sLocalBox;
+			AABB expectedBox = AABB(localBox.minV + node_src->m_vMeshOffset, localBox.maxV + node_src->m_vMeshOffset).Transform(m), box = S.scene.getNodeBox(node_tar);
+			float tolerance = 1e-4f * max(1.0f, length(expectedBox.Size()));
+			if (length(box.minV - expectedBox.minV) > tolerance || length(box.maxV - expectedBox.maxV) > tolerance)
+				throw std::runtime_error(format("The instance of shapegroup mesh %s does not match the bounds of the original mesh!", mesh_path.c_str()));
+
+			//the shared materials of the mesh are used by all other nodes
+			if (!node_tar->m_uInstanciatedMaterial)
+				S.scene.instanciateNodeMaterials(node_tar);
 			auto mat_tar = S.scene.getMaterials(node_tar), mat_src = S.scene.getMaterials(node_src);
 			mat_tar->bsdf = mat_src->bsdf;
 			mat_tar->AlphaMap = mat_src->AlphaMap;
 			mat_tar->HeightMap = mat_src->HeightMap;
+			mat_tar.Invalidate();
 		}
 	};
 
@@ -1170,6 +1183,11 @@ public:
 	};
 
 	ShapeParseResult serialized(const XMLNode& node, ParserState& S);
+	static void compileSerialized(const std::string& filename, const std::string& compiled_tar_folder, bool flipNormals, bool faceNormals, float maxSmoothAngle);
+
+	//first phase of loading a scene, the meshes of all obj, ply and serialized shapes are compiled concurrently
+	//the nodes are created afterwards in document order from the compiled files which keeps the scene deterministic
+	static void compileMeshes(const XMLNode& scene_node, ParserState& S);
 
 	ShapeParseResult obj(const XMLNode& node, ParserState& S)
 	{
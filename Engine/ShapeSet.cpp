@@ -58,4 +58,16 @@ void ShapeSet::Recalculate(const float4x4& mat, Stream<char>* buffer, Stream<Tri
 		areaDistribution[i] = areaDistribution[i] / sumArea;
 }
 
+void ShapeSet::Remap(Stream<char>* buffer, const BufferRemap& intRemap, const BufferRemap& triRemap)
+{
+	StreamReference<char> buffer2 = buffer->operator()(m_trianglesIndex, m_trianglesLength);
+	buffer2.Invalidate();
+	triData* triangles = (triData*)buffer2.operator char *();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		triangles[i].iDat = (unsigned int)intRemap(triangles[i].iDat);
+		triangles[i].tDat = (unsigned int)triRemap(triangles[i].tDat);
+	}
+}
+
 }
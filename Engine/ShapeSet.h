@@ -10,6 +10,7 @@ struct TriangleData;
 struct PositionSamplingRecord;
 template<typename H, typename D> class BufferReference;
 template<typename T> class Stream;
+class BufferRemap;
 
 struct ShapeSet
 {
@@ -38,6 +39,8 @@ public:
 	}
     CTL_EXPORT CUDA_DEVICE CUDA_HOST AABB getBox() const;
 	CTL_EXPORT void Recalculate(const float4x4& mat, Stream<char>* buffer, Stream<TriIntersectorData>* indices, Stream<TriangleData>* triDataBuffer);
+	//translates the stored triangle indices after the triangle streams were compacted
+	CTL_EXPORT void Remap(Stream<char>* buffer, const BufferRemap& intRemap, const BufferRemap& triRemap);
 
 	CUDA_FUNC_IN unsigned int numTriangles() const
 	{
@@ -3,6 +3,7 @@
 #include "BVHRebuilder.h"
 #include <Engine/SpatialStructures/BVH/SplitBVHBuilder.hpp>
 #include <Engine/Mesh.h>
+#include <Base/ThreadPool.h>
 #include <algorithm>
 
 namespace CudaTracerLib {
@@ -293,7 +294,7 @@ void BVHRebuilder::recomputeNode(BVHIndex bvhNodeIdx, AABB& newBox)
 		bool modified = false;
 		for (int i = 0; i < 2; i++)
 		{
-			if (c[i].isLeaf() || (!c[i].NoNode() && (recomputeAll || flaggedBVHNodes[c[i].innerIdx()])))
+			if (c[i].isLeaf() || (!c[i].NoNode() && (recomputeAll || flaggedBVHNodes.contains(c[i].innerIdx()))))
 			{
 				modified = true;
 				recomputeNode(c[i], newBox);
@@ -350,9 +351,9 @@ void BVHRebuilder::propagateFlag(BVHIndex idx)
 	}
 	else
 	{
-		if (flaggedBVHNodes[idx.innerIdx()])
+		if (flaggedBVHNodes.contains(idx.innerIdx()))
 			return;
-		flaggedBVHNodes[idx.innerIdx()] = 1;
+		flaggedBVHNodes.insert(idx.innerIdx());
 		BVHIndex parent = BVHIndex::FromNative(m_pBVHData[idx.innerIdx()].getParent());
 		if (parent.isValid())
 			propagateFlag(parent);
@@ -372,25 +373,15 @@ bool BVHRebuilder::Build(ISpatialInfoProvider* data, bool invalidateAll)
 	if (needsBuild() || invalidateAll)
 	{
 		modified = true;
+		m_bRefitted = false;
 		if (startNode == -1)
-		{
-			Platform::SetMemory(m_pBVHData, sizeof(BVHNodeData) * m_uBVHDataLength);
-			Platform::SetMemory(m_pBVHIndices, sizeof(TriIntersectorData2) * m_uBVHIndicesLength);
-			BuilderCLB b(this);
-			SplitBVHBuilder::Platform Pq;
-			if (!m_pBVHIndices)
-				Pq.m_maxLeafSize = 1;
-			SplitBVHBuilder bu(&b, Pq, SplitBVHBuilder::BuildParams());
-			bu.run();
-			BuildInfoTree(BVHIndex::FromNative(startNode), BVHIndex::INVALID());
-#ifndef NDEBUG
-			validateTree(BVHIndex::FromNative(startNode), BVHIndex::INVALID());
-#endif
-		}
+			buildFromScratch();
 		else
 		{
-			typedef std::set<unsigned int>::iterator n_it;
-			for (n_it it = nodesToRemove.begin(); it != nodesToRemove.end(); ++it)
+			//the queues are processed in index order to keep the result independent of the call order
+			std::vector<unsigned int> sortedNodes(nodesToRemove.elements());
+			std::sort(sortedNodes.begin(), sortedNodes.end());
+			for (auto it = sortedNodes.begin(); it != sortedNodes.end(); ++it)
 			{
 				std::vector<BVHIndex> leafIndices;
 				const auto& nodes = objectToBVHNodes[*it];
@@ -420,41 +411,203 @@ bool BVHRebuilder::Build(ISpatialInfoProvider* data, bool invalidateAll)
 					if (!m_pBVHIndices || removeObjectFromLeaf(leafIndices[i], *it))
 						removeNodeAndCollapse(nodes[i], leafIndices[i]);
 			}
-			for (n_it it = nodesToInsert.begin(); it != nodesToInsert.end(); ++it)
+			sortedNodes = nodesToInsert.elements();
+			std::sort(sortedNodes.begin(), sortedNodes.end());
+			for (auto it = sortedNodes.begin(); it != sortedNodes.end(); ++it)
 			{
 				objectToBVHNodes[*it].clear();
 				insertNode(BVHIndex::FromNative(startNode), BVHIndex::INVALID(), *it, data->getBox(*it));
 			}
 			recomputeAll = invalidateAll;
-			if (!recomputeAll)
-				m_pData->iterateObjects([&](unsigned int i)
+			if (m_bRefitOnly && invalidateAll)
+				buildFromScratch();
+			else if (m_bRefitOnly)
 			{
-				if (nodesToRecompute[i])
-					propagateFlag(BVHIndex::FromSceneNode((unsigned int)i));
-			});
-			AABB box;
-			if (recomputeAll || flaggedBVHNodes[startNode / 4])
-				recomputeNode(BVHIndex::FromNative(startNode), box);
-			flaggedBVHNodes.reset();
+				//inserting and removing restructures the tree, the area sums have to be recomputed
+				if (nodesToInsert.size() || nodesToRemove.size())
+				{
+					m_dInnerArea = m_dLeafArea = 0;
+					computeAreaSums(BVHIndex::FromNative(startNode));
+				}
+				refit();
+				m_bRefitted = !nodesToInsert.size() && !nodesToRemove.size();
+				if (getSAHCost() > m_fBuildSAH * m_fMaxSAHIncrease)
+				{
+					buildFromScratch();
+					m_bRefitted = false;
+				}
+			}
+			else
+			{
+				if (!recomputeAll)
+					for (unsigned int i : nodesToRecompute.elements())
+						propagateFlag(BVHIndex::FromSceneNode(i));
+				AABB box;
+				if (recomputeAll || flaggedBVHNodes.contains(startNode / 4))
+					recomputeNode(BVHIndex::FromNative(startNode), box);
+				flaggedBVHNodes.clear();
+			}
 		}
 		//printGraph("1.txt");
 #ifndef NDEBUG
 		validateTree(BVHIndex::FromNative(startNode), BVHIndex::INVALID());
 #endif
 	}
-	nodesToRecompute.reset();
+	nodesToRecompute.clear();
 	nodesToInsert.clear();
 	nodesToRemove.clear();
 	m_uModifiedCount = 0;
 	return modified;
 }
 
+void BVHRebuilder::buildFromScratch()
+{
+	for (auto& nodes : objectToBVHNodes)
+		nodes.clear();
+	Platform::SetMemory(m_pBVHData, sizeof(BVHNodeData) * m_uBVHDataLength);
+	Platform::SetMemory(m_pBVHIndices, sizeof(TriIntersectorData2) * m_uBVHIndicesLength);
+	BuilderCLB b(this);
+	SplitBVHBuilder::Platform Pq;
+	if (!m_pBVHIndices)
+		Pq.m_maxLeafSize = 1;
+	SplitBVHBuilder::BuildParams params;
+	//rebuilds in refit mode happen during animations and have to be fast, the treelet optimization keeps the sah cost close to the sah builds
+	if (m_bRefitOnly)
+	{
+		params.quality = SplitBVHBuilder::BuildParams::Quality_LBVH;
+		params.optimizeTreelets = true;
+		params.enablePrints = false;
+	}
+	SplitBVHBuilder bu(&b, Pq, params);
+	bu.run();
+	BuildInfoTree(BVHIndex::FromNative(startNode), BVHIndex::INVALID());
+#ifndef NDEBUG
+	validateTree(BVHIndex::FromNative(startNode), BVHIndex::INVALID());
+#endif
+	if (m_bRefitOnly)
+	{
+		m_dInnerArea = m_dLeafArea = 0;
+		computeAreaSums(BVHIndex::FromNative(startNode));
+		m_fBuildSAH = getSAHCost();
+	}
+}
+
+void BVHRebuilder::refit()
+{
+	for (unsigned int i : nodesToRecompute.elements())
+		propagateFlag(BVHIndex::FromSceneNode(i));
+
+	//the flagged nodes form the union of the paths to the root, sort them by depth starting at the root
+	for (auto& level : m_refitLevels)
+		level.clear();
+	size_t numLevels = 0;
+	if (flaggedBVHNodes.contains(startNode / 4))
+	{
+		if (m_refitLevels.empty())
+			m_refitLevels.resize(1);
+		m_refitLevels[0].push_back(startNode / 4);
+		numLevels = 1;
+		while (m_refitLevels[numLevels - 1].size())
+		{
+			if (m_refitLevels.size() == numLevels)
+				m_refitLevels.resize(numLevels + 1);
+			for (unsigned int nodeIdx : m_refitLevels[numLevels - 1])
+			{
+				BVHIndexTuple c = children(BVHIndex::FromBVHNode(nodeIdx));
+				for (int i = 0; i < 2; i++)
+					if (!c[i].isLeaf() && !c[i].NoNode() && flaggedBVHNodes.contains(c[i].innerIdx()))
+						m_refitLevels[numLevels].push_back(c[i].innerIdx());
+			}
+			numLevels++;
+		}
+	}
+
+	//bottom up, all nodes of one level are independent
+	ThreadPool& pool = ThreadPool::getGlobalPool();
+	for (size_t l = numLevels; l-- > 0;)
+	{
+		const std::vector<unsigned int>& level = m_refitLevels[l];
+		unsigned int numTasks = (unsigned int)min(level.size() / 256 + 1, (size_t)pool.getNumThreads() * 4);
+		std::vector<double> innerArea(numTasks, 0.0), leafArea(numTasks, 0.0);
+		pool.ParallelFor(numTasks, [&](unsigned int task_idx, unsigned int)
+		{
+			size_t start = level.size() * task_idx / numTasks, end = level.size() * (task_idx + 1) / numTasks;
+			for (size_t i = start; i < end; i++)
+				refitNode(level[i], innerArea[task_idx], leafArea[task_idx]);
+		});
+		for (unsigned int i = 0; i < numTasks; i++)
+		{
+			m_dInnerArea += innerArea[i];
+			m_dLeafArea += leafArea[i];
+		}
+	}
+	flaggedBVHNodes.clear();
+}
+
+void BVHRebuilder::refitNode(unsigned int nodeIdx, double& innerArea, double& leafArea)
+{
+	BVHNodeData& node = m_pBVHData[nodeIdx];
+	BVHIndexTuple c = children(BVHIndex::FromBVHNode(nodeIdx));
+	float oldArea = node.getBox().Area();
+	AABB boxes[2];
+	node.getBox(boxes[0], boxes[1]);
+	for (int i = 0; i < 2; i++)
+	{
+		if (c[i].NoNode())
+			continue;
+		if (c[i].isLeaf())
+		{
+			AABB box = getBox(c[i]);
+			leafArea += (box.Area() - boxes[i].Area()) * numLeafs(c[i]);
+			boxes[i] = box;
+		}
+		else if (flaggedBVHNodes.contains(c[i].innerIdx()))
+			boxes[i] = m_pBVHData[c[i].innerIdx()].getBox();
+	}
+	node.setLeft(boxes[0]);
+	node.setRight(boxes[1]);
+	innerArea += node.getBox().Area() - oldArea;
+}
+
+void BVHRebuilder::computeAreaSums(BVHIndex idx)
+{
+	AABB boxes[2];
+	m_pBVHData[idx.innerIdx()].getBox(boxes[0], boxes[1]);
+	m_dInnerArea += m_pBVHData[idx.innerIdx()].getBox().Area();
+	BVHIndexTuple c = children(idx);
+	for (int i = 0; i < 2; i++)
+	{
+		if (c[i].isLeaf())
+			m_dLeafArea += boxes[i].Area() * numLeafs(c[i]);
+		else if (!c[i].NoNode())
+			computeAreaSums(c[i]);
+	}
+}
+
+void BVHRebuilder::setRefitMode(bool refitOnly, float maxSAHIncrease)
+{
+	m_fMaxSAHIncrease = maxSAHIncrease;
+	if (refitOnly && !m_bRefitOnly && startNode != -1)
+	{
+		m_dInnerArea = m_dLeafArea = 0;
+		computeAreaSums(BVHIndex::FromNative(startNode));
+		m_fBuildSAH = getSAHCost();
+	}
+	m_bRefitOnly = refitOnly;
+}
+
+float BVHRebuilder::getSAHCost() const
+{
+	if (startNode == -1)
+		return 0.0f;
+	float rootArea = m_pBVHData[startNode / 4].getBox().Area();
+	return rootArea > 0 ? (float)((m_dInnerArea + m_dLeafArea) / rootArea) : 0.0f;
+}
+
 BVHRebuilder::BVHRebuilder(BVHNodeData* data, unsigned int a_BVHNodeLength, unsigned int a_SceneNodeLength, TriIntersectorData2* indices, unsigned int a_IndicesLength)
 	: m_pBVHData(data), m_uBVHDataLength(a_BVHNodeLength), m_uBvhNodeCount(0), m_pBVHIndices(indices), m_uBVHIndicesLength(a_IndicesLength), m_UBVHIndicesCount(0),
-	m_pData(0), startNode(-1), m_uModifiedCount(0), recomputeAll(false)
+	m_pData(0), startNode(-1), m_uModifiedCount(0), recomputeAll(false), m_bRefitOnly(false), m_bRefitted(false), m_fMaxSAHIncrease(1.5f), m_fBuildSAH(0), m_dInnerArea(0), m_dLeafArea(0)
 {
-	if (a_SceneNodeLength > MAX_NODES)
-		throw std::runtime_error("BVHRebuilder too many objects!");
 	objectToBVHNodes.resize(a_SceneNodeLength);
 	bvhNodeData.resize(m_uBVHDataLength);
 }
@@ -462,11 +615,9 @@ BVHRebuilder::BVHRebuilder(BVHNodeData* data, unsigned int a_BVHNodeLength, unsi
 BVHRebuilder::BVHRebuilder(Mesh* mesh, ISpatialInfoProvider* data)
 	: m_pBVHData(mesh->m_sNodeInfo(0)), m_uBVHDataLength(mesh->m_sNodeInfo.getLength()), m_uBvhNodeCount(0),
 	m_pBVHIndices(mesh->m_sIndicesInfo(0)), m_uBVHIndicesLength(mesh->m_sIndicesInfo.getLength()), m_UBVHIndicesCount(0),
-	m_pData(data), startNode(-1), m_uModifiedCount(0), recomputeAll(false)
+	m_pData(data), startNode(-1), m_uModifiedCount(0), recomputeAll(false), m_bRefitOnly(false), m_bRefitted(false), m_fMaxSAHIncrease(1.5f), m_fBuildSAH(0), m_dInnerArea(0), m_dLeafArea(0)
 {
 	unsigned int a_SceneNodeLength = mesh->m_sTriInfo.getLength();
-	if (a_SceneNodeLength > MAX_NODES)
-		throw std::runtime_error("BVHRebuilder too many objects!");
 	objectToBVHNodes.resize(a_SceneNodeLength);
 	bvhNodeData.resize(m_uBVHDataLength);
 
@@ -513,8 +664,8 @@ int BVHRebuilder::BuildInfoTree(BVHIndex idx, BVHIndex parent)
 void BVHRebuilder::invalidateNode(unsigned int n)
 {
 	m_uModifiedCount++;
-	if (nodesToInsert.find(n) == nodesToInsert.end())
-		nodesToRecompute.set(n);
+	if (!nodesToInsert.contains(n))
+		nodesToRecompute.insert(n);
 }
 
 void BVHRebuilder::addNode(unsigned int n)
@@ -525,10 +676,8 @@ void BVHRebuilder::addNode(unsigned int n)
 void BVHRebuilder::removeNode(unsigned int n)
 {
 	nodesToRemove.insert(n);
-	std::set<unsigned int>::iterator it = nodesToInsert.find(n);
-	if (it != nodesToInsert.end())
-		nodesToInsert.erase(it);
-	nodesToRecompute.reset(n);
+	nodesToInsert.erase(n);
+	nodesToRecompute.erase(n);
 }
 
 bool BVHRebuilder::needsBuild() const
@@ -538,7 +687,7 @@ bool BVHRebuilder::needsBuild() const
 
 AABB BVHRebuilder::getBox() const
 {
-	return m_pBVHData[startNode].getBox();
+	return m_pBVHData[startNode / 4].getBox();
 }
 
 int BVHRebuilder::getChildIdxInLocal(BVHIndex nodeIdx, BVHIndex childIdx)
@@ -1,10 +1,10 @@
 #pragma once
 
 #include <Math/AABB.h>
-#include <set>
+#include <vector>
+#include <algorithm>
 #include <functional>
 #include <fstream>
-#include <bitset>
 
 namespace CudaTracerLib {
 
@@ -29,6 +29,68 @@ class Mesh;
 
 class BVHRebuilder
 {
+public:
+	//Set of indices which is cleared in constant time by incrementing the epoch.
+	//The storage grows with the largest index inserted, all operations only touch the modified indices.
+	class IndexSet
+	{
+		std::vector<unsigned int> m_stamps;
+		std::vector<unsigned int> m_positions;
+		std::vector<unsigned int> m_elements;
+		unsigned int m_uEpoch;
+	public:
+		IndexSet()
+			: m_uEpoch(1)
+		{
+		}
+		bool contains(unsigned int i) const
+		{
+			return i < m_stamps.size() && m_stamps[i] == m_uEpoch;
+		}
+		void insert(unsigned int i)
+		{
+			if (i >= m_stamps.size())
+			{
+				size_t n = std::max(size_t(i) + 1, m_stamps.size() * 2);
+				m_stamps.resize(n, 0);
+				m_positions.resize(n, 0);
+			}
+			if (m_stamps[i] == m_uEpoch)
+				return;
+			m_stamps[i] = m_uEpoch;
+			m_positions[i] = (unsigned int)m_elements.size();
+			m_elements.push_back(i);
+		}
+		void erase(unsigned int i)
+		{
+			if (!contains(i))
+				return;
+			unsigned int last = m_elements.back();
+			m_elements[m_positions[i]] = last;
+			m_positions[last] = m_positions[i];
+			m_elements.pop_back();
+			m_stamps[i] = 0;
+		}
+		void clear()
+		{
+			m_elements.clear();
+			if (++m_uEpoch == 0)
+			{
+				std::fill(m_stamps.begin(), m_stamps.end(), 0);
+				m_uEpoch = 1;
+			}
+		}
+		size_t size() const
+		{
+			return m_elements.size();
+		}
+		//the elements in unspecified order
+		const std::vector<unsigned int>& elements() const
+		{
+			return m_elements;
+		}
+	};
+private:
 	struct BVHIndex;
 	struct BVHIndexTuple;
 
@@ -50,16 +112,25 @@ class BVHRebuilder
 	std::vector<BVHNodeInfo> bvhNodeData;
 	std::vector<std::vector<BVHIndex>> objectToBVHNodes;
 
-	enum{ MAX_NODES = 1024 * 1024 * 32 };
+	IndexSet nodesToRecompute;
+	IndexSet nodesToInsert;
+	IndexSet nodesToRemove;
 
-	std::bitset<MAX_NODES> nodesToRecompute;
-	std::set<unsigned int> nodesToInsert;
-	std::set<unsigned int> nodesToRemove;
-
-	std::bitset<2 * MAX_NODES> flaggedBVHNodes;
+	//inner bvh nodes on the path from a modified object to the root
+	IndexSet flaggedBVHNodes;
 	unsigned int m_uModifiedCount;
 	bool recomputeAll;
 
+	//refit only mode, the tree is rebuilt when the sah cost exceeds the cost after the last build by m_fMaxSAHIncrease
+	bool m_bRefitOnly;
+	//the last build only refitted the nodes in m_refitLevels
+	bool m_bRefitted;
+	float m_fMaxSAHIncrease;
+	float m_fBuildSAH;
+	//sum of the surface areas of all inner nodes and of all leafs weighted by the number of objects
+	double m_dInnerArea, m_dLeafArea;
+	std::vector<std::vector<unsigned int>> m_refitLevels;
+
 public:
 	CTL_EXPORT BVHRebuilder(BVHNodeData* data, unsigned int a_BVHNodeLength, unsigned int a_SceneNodeLength, TriIntersectorData2* indices, unsigned int a_IndicesLength);
 	CTL_EXPORT BVHRebuilder(Mesh* mesh, ISpatialInfoProvider* data);
@@ -74,12 +145,25 @@ public:
 	CTL_EXPORT void removeNode(unsigned int n);
 	CTL_EXPORT void invalidateNode(unsigned int n);
 
-	const std::bitset<MAX_NODES>& getInvalidatedNodes() const { return nodesToRecompute; }
+	//in refit mode invalidated objects only update the bounds of the nodes above them, the tree is not restructured
+	//once the sah cost grew by more than the factor maxSAHIncrease compared to the last build the whole tree is rebuilt
+	CTL_EXPORT void setRefitMode(bool refitOnly, float maxSAHIncrease = 1.5f);
+	bool isRefitOnly() const { return m_bRefitOnly; }
+	//sah cost of the current tree normalized by the area of the root, only maintained in refit mode
+	float getSAHCost() const;
+	//the inner nodes updated by the last Build grouped by depth if it only refitted the tree, otherwise null and all nodes may have changed
+	const std::vector<std::vector<unsigned int>>* getRefittedNodes() const { return m_bRefitted ? &m_refitLevels : 0; }
+
+	const IndexSet& getInvalidatedNodes() const { return nodesToRecompute; }
 	unsigned int getNumBVHIndicesUsed() const { return m_UBVHIndicesCount; }
 	int getStartNode() const{ return startNode; }
 	unsigned int getNumBVHNodesUsed() const { return m_uBvhNodeCount; }
 	CTL_EXPORT AABB getBox() const;
 private:
+	void buildFromScratch();
+	void refit();
+	void refitNode(unsigned int nodeIdx, double& innerArea, double& leafArea);
+	void computeAreaSums(BVHIndex idx);
 	int BuildInfoTree(BVHIndex idx, BVHIndex parent);
 	void removeNodeAndCollapse(BVHIndex nodeIdx, BVHIndex childIdx);
 	void insertNode(BVHIndex bvhNodeIdx, BVHIndex parent, unsigned int nodeIdx, const AABB& nodeWorldBox);
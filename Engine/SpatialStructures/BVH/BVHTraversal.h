@@ -4,12 +4,42 @@
 
 namespace CudaTracerLib {
 
+//traversal cost of one or more rays, only updated when TRAVERSAL_COUNTERS is defined
+struct TraversalCounters
+{
+	unsigned int innerNodes;
+	unsigned int leafNodes;
+	unsigned int triangleTests;
+	CUDA_FUNC_IN void Init()
+	{
+		innerNodes = leafNodes = triangleTests = 0;
+	}
+	CUDA_FUNC_IN TraversalCounters& operator+=(const TraversalCounters& rhs)
+	{
+		innerNodes += rhs.innerNodes;
+		leafNodes += rhs.leafNodes;
+		triangleTests += rhs.triangleTests;
+		return *this;
+	}
+};
+
+#ifdef TRAVERSAL_COUNTERS
+#define TRAVERSAL_COUNT(counters, member, n) do { if (counters) (counters)->member += (n); } while (0)
+#else
+#define TRAVERSAL_COUNT(counters, member, n)
+#endif
+
+//With quantizedNodes the texture/pointers contain BVHNodeDataQuantized and the offset and start node have to be converted with BVHNodeDataQuantized::convertAddress.
+//With ANY_HIT the children are not ordered by distance and the traversal terminates as soon as clb reports an intersection.
 #ifdef __CUDACC__
-template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& rayT, const CLB& clb, texture<float4, 1> bvhNodes_texture, const BVHNodeData* hosthNodes, int bvhNodesOffset = 0, int startNode = 0)
+template<bool ANY_HIT = false, typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& rayT, const CLB& clb, texture<float4, 1> bvhNodes_texture, const BVHNodeData* hosthNodes, int bvhNodesOffset = 0, int startNode = 0, bool quantizedNodes = false, TraversalCounters* counters = 0)
 {
 	const int EntrypointSentinel = 0x76543210;
 	if (startNode < 0)
+	{
+		TRAVERSAL_COUNT(counters, leafNodes, 1);
 		return clb(~startNode);
+	}
 	bool found = false;
 	int traversalStack[64];
 	traversalStack[0] = EntrypointSentinel;
@@ -34,18 +64,39 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 		while (((unsigned int)nodeAddr) < ((unsigned int)EntrypointSentinel))
 		{
 #ifdef ISCUDA
-			const float4 n0xy = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 0); // (c0.lo.x, c0.hi.x, c0.lo.y, c0.hi.y)
-			const float4 n1xy = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 1); // (c1.lo.x, c1.hi.x, c1.lo.y, c1.hi.y)
-			const float4 nz = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 2); // (c0.lo.z, c0.hi.z, c1.lo.z, c1.hi.z)
-			float4 tmp = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 3); // child_index0, child_index1
+			float4 n0xy, n1xy, nz, tmp;
+			if (quantizedNodes)
+			{
+				const float4 q0 = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 0);
+				const float4 q1 = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 1);
+				tmp = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 2);
+				BVHNodeDataQuantized::decode(q0, q1, n0xy, n1xy, nz);
+			}
+			else
+			{
+				n0xy = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 0); // (c0.lo.x, c0.hi.x, c0.lo.y, c0.hi.y)
+				n1xy = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 1); // (c1.lo.x, c1.hi.x, c1.lo.y, c1.hi.y)
+				nz = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 2); // (c0.lo.z, c0.hi.z, c1.lo.z, c1.hi.z)
+				tmp = tex1Dfetch(bvhNodes_texture, bvhNodesOffset + nodeAddr + 3); // child_index0, child_index1
+			}
 #else
 			Vec4f* dat = (Vec4f*)hosthNodes;
-			const Vec4f n0xy = dat[bvhNodesOffset + nodeAddr + 0];
-			const Vec4f n1xy = dat[bvhNodesOffset + nodeAddr + 1];
-			const Vec4f nz = dat[bvhNodesOffset + nodeAddr + 2];
-			Vec4f tmp = dat[bvhNodesOffset + nodeAddr + 3];
+			Vec4f n0xy, n1xy, nz, tmp;
+			if (quantizedNodes)
+			{
+				tmp = dat[bvhNodesOffset + nodeAddr + 2];
+				BVHNodeDataQuantized::decode(dat[bvhNodesOffset + nodeAddr + 0], dat[bvhNodesOffset + nodeAddr + 1], n0xy, n1xy, nz);
+			}
+			else
+			{
+				n0xy = dat[bvhNodesOffset + nodeAddr + 0];
+				n1xy = dat[bvhNodesOffset + nodeAddr + 1];
+				nz = dat[bvhNodesOffset + nodeAddr + 2];
+				tmp = dat[bvhNodesOffset + nodeAddr + 3];
+			}
 #endif
 			Vec2i  cnodes = *(Vec2i*)&tmp;
+			TRAVERSAL_COUNT(counters, innerNodes, 1);
 			const float c0lox = n0xy.x * idirx - oodx;
 			const float c0hix = n0xy.y * idirx - oodx;
 			const float c0loy = n0xy.z * idiry - oody;
@@ -62,7 +113,7 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 			const float c1hiy = n1xy.w * idiry - oody;
 			const float c1min = kepler_math::spanBeginKepler(c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, 0);
 			const float c1max = kepler_math::spanEndKepler(c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, rayT);
-			bool swp = (c1min < c0min);
+			bool swp = !ANY_HIT && (c1min < c0min);
 			bool traverseChild0 = (c0max >= c0min);
 			bool traverseChild1 = (c1max >= c1min);
 			if (!traverseChild0 && !traverseChild1)
@@ -106,8 +157,13 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 		}
 		while (leafAddr < 0)
 		{
-			if (leafAddr != -214783648)
-				found |= clb(~leafAddr);
+			TRAVERSAL_COUNT(counters, leafNodes, leafAddr != -214783648);
+			if (leafAddr != -214783648 && clb(~leafAddr))
+			{
+				if (ANY_HIT)
+					return true;
+				found = true;
+			}
 			leafAddr = nodeAddr;
 			if (nodeAddr < 0)
 			{
@@ -119,7 +175,7 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 	return found;
 }
 #endif
-template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& rayT, const CLB& clb, const BVHNodeData* hosthNodes, const BVHNodeData* deviceNodes, int bvhNodesOffset = 0, int startNode = 0)
+template<bool ANY_HIT = false, typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& rayT, const CLB& clb, const BVHNodeData* hosthNodes, const BVHNodeData* deviceNodes, int bvhNodesOffset = 0, int startNode = 0, bool quantizedNodes = false, TraversalCounters* counters = 0)
 {
 #ifdef ISCUDA
 	float4* data = (float4*)deviceNodes;
@@ -128,7 +184,10 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 #endif
 	const int EntrypointSentinel = 0x76543210;
 	if (startNode < 0)
+	{
+		TRAVERSAL_COUNT(counters, leafNodes, 1);
 		return clb(~startNode);
+	}
 	bool found = false;
 	int traversalStack[64];
 	traversalStack[0] = EntrypointSentinel;
@@ -152,11 +211,21 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 	{
 		while ((unsigned int)nodeAddr < (unsigned int)EntrypointSentinel)
 		{
-			const float4 n0xy = data[bvhNodesOffset + nodeAddr + 0];
-			const float4 n1xy = data[bvhNodesOffset + nodeAddr + 1];
-			const float4 nz = data[bvhNodesOffset + nodeAddr + 2];
-			const float4 tmp = data[bvhNodesOffset + nodeAddr + 3];
+			float4 n0xy, n1xy, nz, tmp;
+			if (quantizedNodes)
+			{
+				tmp = data[bvhNodesOffset + nodeAddr + 2];
+				BVHNodeDataQuantized::decode(data[bvhNodesOffset + nodeAddr + 0], data[bvhNodesOffset + nodeAddr + 1], n0xy, n1xy, nz);
+			}
+			else
+			{
+				n0xy = data[bvhNodesOffset + nodeAddr + 0];
+				n1xy = data[bvhNodesOffset + nodeAddr + 1];
+				nz = data[bvhNodesOffset + nodeAddr + 2];
+				tmp = data[bvhNodesOffset + nodeAddr + 3];
+			}
 			Vec2i  cnodes = *(Vec2i*)&tmp;
+			TRAVERSAL_COUNT(counters, innerNodes, 1);
 
 			const float c0lox = n0xy.x * idirx - oodx;
 			const float c0hix = n0xy.y * idirx - oodx;
@@ -174,7 +243,7 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 			const float c1hiy = n1xy.w * idiry - oody;
 			const float c1min = kepler_math::spanBeginKepler(c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, 0);
 			const float c1max = kepler_math::spanEndKepler(c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, rayT);
-			bool swp = (c1min < c0min);
+			bool swp = !ANY_HIT && (c1min < c0min);
 			bool traverseChild0 = (c0max >= c0min);
 			bool traverseChild1 = (c1max >= c1min);
 			if (!traverseChild0 && !traverseChild1)
@@ -218,8 +287,13 @@ template<typename CLB> CUDA_FUNC_IN bool TracerayTemplate(const Ray& r, float& r
 		}
 		while (leafAddr < 0)
 		{
-			if (leafAddr != -214783648)
-				found |= clb(~leafAddr);
+			TRAVERSAL_COUNT(counters, leafNodes, leafAddr != -214783648);
+			if (leafAddr != -214783648 && clb(~leafAddr))
+			{
+				if (ANY_HIT)
+					return true;
+				found = true;
+			}
 			leafAddr = nodeAddr;
 			if (nodeAddr < 0)
 			{
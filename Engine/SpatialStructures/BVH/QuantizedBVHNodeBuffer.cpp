@@ -0,0 +1,82 @@
+#include <StdAfx.h>
+#include "QuantizedBVHNodeBuffer.h"
+#include <Base/CudaMemoryManager.h>
+#include <algorithm>
+
+namespace CudaTracerLib {
+
+QuantizedBVHNodeBuffer::QuantizedBVHNodeBuffer()
+	: m_pHost(0), m_pDevice(0), m_uLength(0)
+{
+}
+
+QuantizedBVHNodeBuffer::~QuantizedBVHNodeBuffer()
+{
+	Resize(0);
+}
+
+void QuantizedBVHNodeBuffer::Resize(size_t length)
+{
+	if (length == m_uLength)
+		return;
+	//the node stream only uploads its new elements after growing, therefore the common prefix is kept
+	size_t keep = min(length, m_uLength);
+	BVHNodeDataQuantized* newHost = 0, *newDevice = 0;
+	if (length)
+	{
+		newHost = (BVHNodeDataQuantized*)malloc(length * sizeof(BVHNodeDataQuantized));
+		Platform::SetMemory(newHost, length * sizeof(BVHNodeDataQuantized));
+		CUDA_MALLOC(&newDevice, length * sizeof(BVHNodeDataQuantized));
+		ThrowCudaErrors(cudaMemset(newDevice, 0, length * sizeof(BVHNodeDataQuantized)));
+		if (keep)
+		{
+			memcpy(newHost, m_pHost, keep * sizeof(BVHNodeDataQuantized));
+			ThrowCudaErrors(cudaMemcpy(newDevice, m_pDevice, keep * sizeof(BVHNodeDataQuantized), cudaMemcpyDeviceToDevice));
+		}
+	}
+	if (m_pHost)
+	{
+		free(m_pHost);
+		CUDA_FREE(m_pDevice);
+	}
+	m_pHost = newHost;
+	m_pDevice = newDevice;
+	m_uLength = length;
+	for (auto& r : m_dirtyRanges)
+	{
+		r.first = min(r.first, keep);
+		r.second = min(r.second, keep);
+	}
+}
+
+void QuantizedBVHNodeBuffer::Update(const BVHNodeData* nodes, size_t idx, size_t count)
+{
+	if (idx + count > m_uLength)
+		throw std::runtime_error(__FUNCTION__);
+	for (size_t i = idx; i < idx + count; i++)
+		m_pHost[i].setData(nodes[i]);
+	if (m_dirtyRanges.size() && idx <= m_dirtyRanges.back().second && idx + count >= m_dirtyRanges.back().first)
+	{
+		m_dirtyRanges.back().first = min(m_dirtyRanges.back().first, idx);
+		m_dirtyRanges.back().second = max(m_dirtyRanges.back().second, idx + count);
+	}
+	else m_dirtyRanges.push_back(std::make_pair(idx, idx + count));
+}
+
+void QuantizedBVHNodeBuffer::Upload()
+{
+	//copying a few unchanged nodes is cheaper than an additional copy
+	const size_t maxGap = 64;
+	std::sort(m_dirtyRanges.begin(), m_dirtyRanges.end());
+	for (size_t i = 0; i < m_dirtyRanges.size();)
+	{
+		size_t start = m_dirtyRanges[i].first, end = m_dirtyRanges[i].second;
+		for (i++; i < m_dirtyRanges.size() && m_dirtyRanges[i].first <= end + maxGap; i++)
+			end = max(end, m_dirtyRanges[i].second);
+		if (end > start)
+			CUDA_MEMCPY_TO_DEVICE(m_pDevice + start, m_pHost + start, (end - start) * sizeof(BVHNodeDataQuantized));
+	}
+	m_dirtyRanges.clear();
+}
+
+}
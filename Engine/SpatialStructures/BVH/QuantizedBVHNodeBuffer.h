@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Defines.h>
+#include <Engine/TriIntersectorData.h>
+#include <vector>
+
+namespace CudaTracerLib {
+
+//Device copy of a BVHNodeData array in the quantized format. Element i is the quantized version of node i of the source array,
+//i.e. the addresses can be converted with BVHNodeDataQuantized::convertAddress.
+class QuantizedBVHNodeBuffer
+{
+	BVHNodeDataQuantized* m_pHost;
+	BVHNodeDataQuantized* m_pDevice;
+	size_t m_uLength;
+	//[start, end) ranges updated since the last upload
+	std::vector<std::pair<size_t, size_t>> m_dirtyRanges;
+public:
+	CTL_EXPORT QuantizedBVHNodeBuffer();
+	CTL_EXPORT ~QuantizedBVHNodeBuffer();
+
+	//reallocates the buffers if the length changed, the common prefix is kept and new nodes have to be updated afterwards
+	CTL_EXPORT void Resize(size_t length);
+	//quantizes the nodes [idx, idx + count) of the source array
+	CTL_EXPORT void Update(const BVHNodeData* nodes, size_t idx, size_t count = 1);
+	//copies all quantized nodes updated since the last upload to the device, close ranges are merged into one copy
+	CTL_EXPORT void Upload();
+
+	BVHNodeDataQuantized* getData(bool devicePointer = true) const
+	{
+		return devicePointer ? m_pDevice : m_pHost;
+	}
+	size_t getLength() const
+	{
+		return m_uLength;
+	}
+	size_t getDeviceSizeInBytes() const
+	{
+		return m_uLength * sizeof(BVHNodeDataQuantized);
+	}
+};
+
+}
@@ -1,5 +1,7 @@
 #include <StdAfx.h>
 #include "SplitBVHBuilder.hpp"
+#include <Base/ThreadPool.h>
+#include <algorithm>
 
 namespace CudaTracerLib {
 
@@ -144,11 +146,9 @@ SplitBVHBuilder::SplitBVHBuilder(IBVHBuilderCallback* clb, const Platform& P, co
 	m_platform(P),
 	m_params(stats),
 	m_minOverlap(0.0f),
-	m_sortDim(-1)
+	m_subtreeTaskSize(0),
+	m_numDuplicates(0)
 {
-	for (int i = 0; i < 3; i++)
-		for (int j = 0; j < NumSpatialBins; j++)
-			m_bins[i][j].bounds = AABB::Identity();
 }
 
 //------------------------------------------------------------------------
@@ -159,8 +159,8 @@ SplitBVHBuilder::~SplitBVHBuilder(void)
 
 //------------------------------------------------------------------------
 
-static std::vector<unsigned int> g_ObjIndices;
-unsigned int handleNode(std::vector<BVHNode>& nodes, BVHNode* n, IBVHBuilderCallback* clb, std::vector<int>& m_Indices, int level = 0, unsigned int parent = UINT_MAX)
+//objIndices is scratch memory of the build for the indices of one leaf, meshes can be compiled concurrently
+unsigned int handleNode(std::vector<BVHNode>& nodes, BVHNode* n, IBVHBuilderCallback* clb, std::vector<int>& m_Indices, std::vector<unsigned int>& objIndices, int level = 0, unsigned int parent = UINT_MAX)
 {
 	if (n->isLeaf())
 	{
@@ -168,19 +168,19 @@ unsigned int handleNode(std::vector<BVHNode>& nodes, BVHNode* n, IBVHBuilderCall
 		{
 			if (n->getRight() - n->getLeft() == 0)
 				return 0x76543210;
-			g_ObjIndices.clear();
+			objIndices.clear();
 			for (unsigned int j = n->getLeft(); j < n->getRight(); j++)
-				g_ObjIndices.push_back(m_Indices[j]);
-			return ~clb->createLeafNode(parent, g_ObjIndices);
+				objIndices.push_back(m_Indices[j]);
+			return ~clb->createLeafNode(parent, objIndices);
 		}
 		else
 		{
 			BVHNodeData* node;
 			unsigned int nodeIdx = clb->createInnerNode(node);
-			g_ObjIndices.clear();
+			objIndices.clear();
 			for (unsigned int j = n->getLeft(); j < n->getRight(); j++)
-				g_ObjIndices.push_back(m_Indices[j]);
-			unsigned int leafIdx = ~clb->createLeafNode(parent, g_ObjIndices);
+				objIndices.push_back(m_Indices[j]);
+			unsigned int leafIdx = ~clb->createLeafNode(parent, objIndices);
 			node->setChildren(Vec2i(leafIdx, 0x76543210));
 			node->setParent(-1);
 			node->setLeft(n->box);
@@ -192,8 +192,8 @@ unsigned int handleNode(std::vector<BVHNode>& nodes, BVHNode* n, IBVHBuilderCall
 	{
 		BVHNodeData* node;
 		unsigned int nodeIdx = clb->createInnerNode(node) * 4;
-		int a = handleNode(nodes, &nodes[n->getLeft()], clb, m_Indices, level + 1, nodeIdx);
-		int b = handleNode(nodes, &nodes[n->getRight()], clb, m_Indices, level + 1, nodeIdx);
+		int a = handleNode(nodes, &nodes[n->getLeft()], clb, m_Indices, objIndices, level + 1, nodeIdx);
+		int b = handleNode(nodes, &nodes[n->getRight()], clb, m_Indices, objIndices, level + 1, nodeIdx);
 		node->setChildren(Vec2i(a, b));
 		node->setParent(parent);
 		node->setLeft(nodes[n->getLeft()].box);
@@ -220,6 +220,8 @@ void SplitBVHBuilder::run(void)
 {
 	// Initialize reference stack and determine root bounds.
 
+	BuildContext topCtx;
+	topCtx.isTopLevel = true;
 	NodeSpec rootSpec;
 	rootSpec.numRef = 0;
 	rootSpec.bounds = AABB::Identity();
@@ -230,29 +232,63 @@ void SplitBVHBuilder::run(void)
 		r.bounds = box;
 		r.triIdx = i;
 		rootSpec.bounds = rootSpec.bounds.Extend(r.bounds);
-		m_refStack.push_back(r);
+		topCtx.refStack.push_back(r);
 	});
 
 	// Initialize rest of the members.
 
 	m_minOverlap = rootSpec.bounds.Area() * m_params.splitAlpha;
-	m_rightBounds.resize(max(rootSpec.numRef, (int)NumSpatialBins));
+	topCtx.rightBounds.resize(max(rootSpec.numRef, (int)NumSpatialBins));
 	m_numDuplicates = 0;
+	m_subtreeTasks.clear();
+	//the task size only changes how the work is distributed, not the resulting tree
+	ThreadPool& pool = ThreadPool::getGlobalPool();
+	m_subtreeTaskSize = m_params.parallelBuild && pool.getNumThreads() > 1 ? max(rootSpec.numRef / (16 * (int)pool.getNumThreads()), (int)MinSubtreeTaskSize) : 0;
 	m_Timer.StartTimer();
 
-	// Build recursively.
+	// Build the top levels recursively and the remaining subtrees in parallel.
+
+	unsigned int root = m_params.quality == BuildParams::Quality_LBVH ? buildLBVH(topCtx, rootSpec) : buildNode(topCtx, rootSpec, 0, 0.0f, 1.0f);
+	pool.ParallelFor((unsigned int)m_subtreeTasks.size(), [&](unsigned int task_idx, unsigned int thread_idx)
+	{
+		SubtreeTask& task = *m_subtreeTasks[task_idx];
+		task.ctx.rightBounds.resize(max(task.spec.numRef, (int)NumSpatialBins));
+		task.root = buildNode(task.ctx, task.spec, task.level, 0.0f, 1.0f);
+	});
+
+	// Combine the subtrees in the same order a sequential build would have produced them.
 
-	unsigned int root = buildNode(rootSpec, 0, 0.0f, 1.0f);
+	m_Nodes.clear();
+	m_Indices.clear();
+	if (m_subtreeTasks.size())
+		root = mergeNode(topCtx, root);
+	else
+	{
+		m_Nodes.swap(topCtx.nodes);
+		m_Indices.swap(topCtx.indices);
+	}
+	m_numDuplicates = topCtx.numDuplicates;
+	for (auto& task : m_subtreeTasks)
+		m_numDuplicates += task->ctx.numDuplicates;
+	m_subtreeTasks.clear();
 
 	// Done.
 	*(bool*)&m_params.enablePrints = false;
 	printf("SplitBVHBuilder: progress %.0f%%\n",
 		100.0f);
 
+	if (m_params.stats)
+	{
+		m_params.stats->clear();
+		m_params.stats->branchingFactor = 2;
+		m_params.stats->SAHCost = computeStats(root, *m_params.stats) / max(rootSpec.bounds.Area(), 1e-20f);
+	}
+
 	unsigned int innerC = 0, leafC = 0;
 	countNodes(m_Nodes, &m_Nodes[root], innerC, leafC);
 	m_pClb->startConstruction(innerC, leafC);
-	unsigned int rootIdx = handleNode(m_Nodes, &m_Nodes[root], m_pClb, m_Indices);
+	std::vector<unsigned int> objIndices;
+	unsigned int rootIdx = handleNode(m_Nodes, &m_Nodes[root], m_pClb, m_Indices, objIndices);
 	m_pClb->finishConstruction(rootIdx, rootSpec.bounds);
 }
 
@@ -260,30 +296,46 @@ void SplitBVHBuilder::run(void)
 
 bool SplitBVHBuilder::sortCompare(void* data, int idxA, int idxB)
 {
-	const SplitBVHBuilder* ptr = (const SplitBVHBuilder*)data;
-	int dim = ptr->m_sortDim;
-	const Reference& ra = ptr->m_refStack[idxA];
-	const Reference& rb = ptr->m_refStack[idxB];
+	const SortData* ptr = (const SortData*)data;
+	int dim = ptr->dim;
+	const Reference& ra = (*ptr->refs)[idxA];
+	const Reference& rb = (*ptr->refs)[idxB];
 	float ca = ra.bounds.minV[dim] + ra.bounds.maxV[dim];
 	float cb = rb.bounds.minV[dim] + rb.bounds.maxV[dim];
-	return (ca < cb || (ca == cb && ra.triIdx < rb.triIdx));
+	if (ca != cb)
+		return ca < cb;
+	if (ra.triIdx != rb.triIdx)
+		return ra.triIdx < rb.triIdx;
+	//duplicates of the same object, ordering by the bounds makes the result independent of the input order
+	for (int i = 0; i < 3; i++)
+		if (ra.bounds.minV[i] != rb.bounds.minV[i])
+			return ra.bounds.minV[i] < rb.bounds.minV[i];
+	for (int i = 0; i < 3; i++)
+		if (ra.bounds.maxV[i] != rb.bounds.maxV[i])
+			return ra.bounds.maxV[i] < rb.bounds.maxV[i];
+	return false;
 }
 
 //------------------------------------------------------------------------
 
 void SplitBVHBuilder::sortSwap(void* data, int idxA, int idxB)
 {
-	SplitBVHBuilder* ptr = (SplitBVHBuilder*)data;
-	swapk(ptr->m_refStack[idxA], ptr->m_refStack[idxB]);
+	SortData* ptr = (SortData*)data;
+	swapk((*ptr->refs)[idxA], (*ptr->refs)[idxB]);
 }
 
 //------------------------------------------------------------------------
 
-unsigned int SplitBVHBuilder::buildNode(NodeSpec spec, int level, float progressStart, float progressEnd)
+unsigned int SplitBVHBuilder::buildNode(BuildContext& ctx, NodeSpec spec, int level, float progressStart, float progressEnd)
 {
+	// Subtrees below the top levels are built by separate tasks.
+
+	if (ctx.isTopLevel && m_subtreeTaskSize && spec.numRef <= m_subtreeTaskSize)
+		return createSubtreeTask(ctx, spec, level);
+
 	// Display progress.
 
-	if (m_Timer.EndTimer() >= 1.0f)
+	if (ctx.isTopLevel && m_Timer.EndTimer() >= 1.0f)
 	{
 		printf("SplitBVHBuilder: progress %.0f%%\r",
 			progressStart * 100.0f);
@@ -292,38 +344,45 @@ unsigned int SplitBVHBuilder::buildNode(NodeSpec spec, int level, float progress
 
 	// Remove degenerates.
 	{
-		int firstRef = (int)m_refStack.size() - spec.numRef;
-		for (int i = (int)m_refStack.size() - 1; i >= firstRef; i--)
+		int firstRef = (int)ctx.refStack.size() - spec.numRef;
+		for (int i = (int)ctx.refStack.size() - 1; i >= firstRef; i--)
 		{
-			Vec3f size = m_refStack[i].bounds.maxV - m_refStack[i].bounds.minV;
+			Vec3f size = ctx.refStack[i].bounds.maxV - ctx.refStack[i].bounds.minV;
 			if (min(size) < 0.0f || sum(size) == max(size))
-				removeSwap(m_refStack, i);
+				removeSwap(ctx.refStack, i);
 		}
-		spec.numRef = (int)m_refStack.size() - firstRef;
+		spec.numRef = (int)ctx.refStack.size() - firstRef;
 	}
 
 	// Small enough or too deep => create leaf.
 
 	if (spec.numRef <= m_platform.getMinLeafSize() || level >= MaxDepth)
-		return createLeaf(spec);
+		return createLeaf(ctx, spec);
 
 	// Find split candidates.
 
+	bool parallel = ctx.isTopLevel && m_subtreeTaskSize != 0 && spec.numRef >= MinParallelSplitSize;
 	float area = spec.bounds.Area();
 	float leafSAH = area * m_platform.getTriangleCost(spec.numRef);
 	float nodeSAH = area * m_platform.getNodeCost(2);
 	ObjectSplit object;
 	if (m_platform.m_objectSplits)
-		object = findObjectSplit(spec, nodeSAH);
+	{
+		if (m_params.quality == BuildParams::Quality_BinnedSAH)
+			object = findBinnedObjectSplit(ctx, spec, nodeSAH);
+		//fall back to the sorted sweep when all centroids fall into the same bin
+		if (object.sah == FLT_MAX)
+			object = findObjectSplit(ctx, spec, nodeSAH, parallel);
+	}
 
 	SpatialSplit spatial;
 	spatial.dim = 0; spatial.pos = 0; spatial.sah = FLT_MAX;
-	if (m_platform.m_spatialSplits && level < MaxSpatialDepth)
+	if (m_platform.m_spatialSplits && m_params.quality == BuildParams::Quality_SBVH && level < MaxSpatialDepth)
 	{
 		AABB overlap = object.leftBounds;
 		overlap = overlap.Intersect(object.rightBounds);
 		if (overlap.Area() >= m_minOverlap)
-			spatial = findSpatialSplit(spec, nodeSAH);
+			spatial = findSpatialSplit(ctx, spec, nodeSAH, parallel);
 	}
 
 	//printf("%f, %d, %d, %f, %f, %f\n", object.sah, object.sortDim, object.numLeft, object.leftBounds.minV.x, object.leftBounds.minV.x, object.leftBounds.minV.z);
@@ -335,7 +394,7 @@ unsigned int SplitBVHBuilder::buildNode(NodeSpec spec, int level, float progress
 	if (minSAH == leafSAH && spec.numRef <= m_platform.getMaxLeafSize())
 	{
 		//printf("leaf = %d\n", spec.numRef);
-		return createLeaf(spec);
+		return createLeaf(ctx, spec);
 	}
 
 	// Perform split.
@@ -344,74 +403,220 @@ unsigned int SplitBVHBuilder::buildNode(NodeSpec spec, int level, float progress
 	if (minSAH == spatial.sah)
 	{
 		//printf("spatial = %f, %d, %f\n", spatial.sah, spatial.dim, spatial.pos);
-		performSpatialSplit(left, right, spec, spatial);
+		performSpatialSplit(ctx, left, right, spec, spatial);
 	}
 	if (!left.numRef || !right.numRef)
 	{
 		//printf("object = %f, %d, %d\n", object.sah, object.sortDim, object.numLeft);
-		performObjectSplit(left, right, spec, object);
+		performObjectSplit(ctx, left, right, spec, object);
 	}
 
 	// Create inner node.
 
-	m_numDuplicates += left.numRef + right.numRef - spec.numRef;
+	ctx.numDuplicates += left.numRef + right.numRef - spec.numRef;
 	float progressMid = math::lerp(progressStart, progressEnd, (float)right.numRef / (float)(left.numRef + right.numRef));
-	unsigned int rightNode = buildNode(right, level + 1, progressStart, progressMid);
-	unsigned int leftNode = buildNode(left, level + 1, progressMid, progressEnd);
-	m_Nodes.push_back(BVHNode(spec.bounds, leftNode, rightNode, false));
-	return (unsigned int)m_Nodes.size() - 1;
+	unsigned int rightNode = buildNode(ctx, right, level + 1, progressStart, progressMid);
+	unsigned int leftNode = buildNode(ctx, left, level + 1, progressMid, progressEnd);
+	ctx.nodes.push_back(BVHNode(spec.bounds, leftNode, rightNode, false));
+	return (unsigned int)ctx.nodes.size() - 1;
 }
 
 //------------------------------------------------------------------------
 
-unsigned int SplitBVHBuilder::createLeaf(const NodeSpec& spec)
+unsigned int SplitBVHBuilder::createLeaf(BuildContext& ctx, const NodeSpec& spec)
 {
 	for (int i = 0; i < spec.numRef; i++)
-		m_Indices.push_back(removeLast(m_refStack).triIdx);
-	m_Nodes.push_back(BVHNode(spec.bounds, (unsigned int)m_Indices.size() - spec.numRef, (unsigned int)m_Indices.size(), true));
+		ctx.indices.push_back(removeLast(ctx.refStack).triIdx);
+	ctx.nodes.push_back(BVHNode(spec.bounds, (unsigned int)ctx.indices.size() - spec.numRef, (unsigned int)ctx.indices.size(), true));
+	return (unsigned int)ctx.nodes.size() - 1;
+}
+
+//------------------------------------------------------------------------
+
+//marks a leaf in the top level context which is replaced by the subtree of the task stored in the left index
+#define SUBTREE_PLACEHOLDER UINT_MAX
+
+unsigned int SplitBVHBuilder::createSubtreeTask(BuildContext& ctx, const NodeSpec& spec, int level)
+{
+	std::unique_ptr<SubtreeTask> task(new SubtreeTask());
+	task->spec = spec;
+	task->level = level;
+	task->root = 0;
+	task->ctx.refStack.assign(ctx.refStack.end() - spec.numRef, ctx.refStack.end());
+	ctx.refStack.resize(ctx.refStack.size() - spec.numRef);
+
+	unsigned int taskIdx = (unsigned int)m_subtreeTasks.size();
+	m_subtreeTasks.push_back(std::move(task));
+	ctx.nodes.push_back(BVHNode(spec.bounds, taskIdx, SUBTREE_PLACEHOLDER, true));
+	return (unsigned int)ctx.nodes.size() - 1;
+}
+
+//------------------------------------------------------------------------
+
+unsigned int SplitBVHBuilder::mergeNode(BuildContext& ctx, unsigned int nodeIdx)
+{
+	const BVHNode n = ctx.nodes[nodeIdx];
+	if (n.isLeaf())
+	{
+		if (n.getRight() == SUBTREE_PLACEHOLDER)
+		{
+			SubtreeTask& task = *m_subtreeTasks[n.getLeft()];
+			return mergeNode(task.ctx, task.root);
+		}
+		unsigned int firstIdx = (unsigned int)m_Indices.size();
+		for (unsigned int j = n.getLeft(); j < n.getRight(); j++)
+			m_Indices.push_back(ctx.indices[j]);
+		m_Nodes.push_back(BVHNode(n.box, firstIdx, (unsigned int)m_Indices.size(), true));
+	}
+	else
+	{
+		unsigned int rightNode = mergeNode(ctx, n.getRight());
+		unsigned int leftNode = mergeNode(ctx, n.getLeft());
+		m_Nodes.push_back(BVHNode(n.box, leftNode, rightNode, false));
+	}
 	return (unsigned int)m_Nodes.size() - 1;
 }
 
 //------------------------------------------------------------------------
 
-SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findObjectSplit(const NodeSpec& spec, float nodeSAH)
+SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findObjectSplit(BuildContext& ctx, const NodeSpec& spec, float nodeSAH, bool parallel)
 {
+	// Sort along each dimension, either in place one after another or on copies in parallel.
+
+	ObjectSplit splits[3];
+	if (parallel)
+	{
+		ThreadPool::getGlobalPool().ParallelFor(3, [&](unsigned int dim, unsigned int thread_idx)
+		{
+			std::vector<Reference> refs(ctx.refStack.end() - spec.numRef, ctx.refStack.end());
+			std::vector<AABB> rightBounds(max(spec.numRef, 1));
+			splits[dim] = sweepObjectSplit(refs, 0, spec.numRef, dim, nodeSAH, rightBounds);
+		});
+	}
+	else
+	{
+		for (int dim = 0; dim < 3; dim++)
+			splits[dim] = sweepObjectSplit(ctx.refStack, (int)ctx.refStack.size() - spec.numRef, spec.numRef, dim, nodeSAH, ctx.rightBounds);
+	}
+
 	ObjectSplit split;
-	const Reference* refPtr = &m_refStack[m_refStack.size() - spec.numRef];
-	float bestTieBreak = FLT_MAX;
+	for (int dim = 0; dim < 3; dim++)
+		if (splits[dim].sah < split.sah || (splits[dim].sah == split.sah && splits[dim].tieBreak < split.tieBreak))
+			split = splits[dim];
+	return split;
+}
+
+//------------------------------------------------------------------------
+
+SplitBVHBuilder::ObjectSplit SplitBVHBuilder::sweepObjectSplit(std::vector<Reference>& refs, int firstRef, int numRef, int dim, float nodeSAH, std::vector<AABB>& rightBounds)
+{
+	ObjectSplit split;
+	SortData sortData = { &refs, dim };
+	sort(&sortData, firstRef, firstRef + numRef, sortCompare, sortSwap);
+	const Reference* refPtr = &refs[firstRef];
 
-	// Sort along each dimension.
+	// Sweep right to left and determine bounds.
 
-	for (m_sortDim = 0; m_sortDim < 3; m_sortDim++)
+	AABB rBounds = AABB::Identity();
+	for (int i = numRef - 1; i > 0; i--)
 	{
-		sort(this, (int)m_refStack.size() - spec.numRef, (int)m_refStack.size(), sortCompare, sortSwap);
+		rBounds = rBounds.Extend(refPtr[i].bounds);
+		rightBounds[i - 1] = rBounds;
+	}
+
+	// Sweep left to right and select lowest SAH.
+
+	AABB leftBounds = AABB::Identity();
+	for (int i = 1; i < numRef; i++)
+	{
+		leftBounds = leftBounds.Extend(refPtr[i - 1].bounds);
+		float lA = leftBounds.Area(), rA = rightBounds[i - 1].Area();
+		float sah = nodeSAH + lA * m_platform.getTriangleCost(i) + rA * m_platform.getTriangleCost(numRef - i);
+		float tieBreak = math::sqr((float)i) + math::sqr((float)(numRef - i));
+		if (sah < split.sah || (sah == split.sah && tieBreak < split.tieBreak))
+		{
+			split.sah = sah;
+			split.sortDim = dim;
+			split.numLeft = i;
+			split.leftBounds = leftBounds;
+			split.rightBounds = rightBounds[i - 1];
+			split.tieBreak = tieBreak;
+		}
+	}
+	return split;
+}
+
+//------------------------------------------------------------------------
+
+static int objectBin(const AABB& box, int dim, float origin, float scale, int numBins)
+{
+	float c = (box.minV[dim] + box.maxV[dim]) * 0.5f;
+	return math::clamp((int)((c - origin) * scale), 0, numBins - 1);
+}
+
+SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findBinnedObjectSplit(BuildContext& ctx, const NodeSpec& spec, float nodeSAH)
+{
+	ObjectSplit split;
+	int firstRef = (int)ctx.refStack.size() - spec.numRef;
+	AABB centroidBounds = AABB::Identity();
+	for (int i = firstRef; i < (int)ctx.refStack.size(); i++)
+		centroidBounds = centroidBounds.Extend(ctx.refStack[i].bounds.Center());
+
+	for (int dim = 0; dim < 3; dim++)
+	{
+		float extent = centroidBounds.maxV[dim] - centroidBounds.minV[dim];
+		if (extent <= 0.0f)
+			continue;
+
+		// Count the references per centroid bin.
+
+		float origin = centroidBounds.minV[dim], scale = (float)NumObjectBins / extent;
+		AABB binBounds[NumObjectBins], rightBounds[NumObjectBins];
+		int binCounts[NumObjectBins];
+		for (int i = 0; i < NumObjectBins; i++)
+		{
+			binBounds[i] = AABB::Identity();
+			binCounts[i] = 0;
+		}
+		for (int i = firstRef; i < (int)ctx.refStack.size(); i++)
+		{
+			const Reference& ref = ctx.refStack[i];
+			int b = objectBin(ref.bounds, dim, origin, scale, NumObjectBins);
+			binBounds[b] = binBounds[b].Extend(ref.bounds);
+			binCounts[b]++;
+		}
 
 		// Sweep right to left and determine bounds.
 
-		AABB rightBounds = AABB::Identity();
-		for (int i = spec.numRef - 1; i > 0; i--)
+		AABB rBounds = AABB::Identity();
+		for (int i = NumObjectBins - 1; i > 0; i--)
 		{
-			rightBounds = rightBounds.Extend(refPtr[i].bounds);
-			m_rightBounds[i - 1] = rightBounds;
+			rBounds = rBounds.Extend(binBounds[i]);
+			rightBounds[i - 1] = rBounds;
 		}
 
 		// Sweep left to right and select lowest SAH.
 
 		AABB leftBounds = AABB::Identity();
-		for (int i = 1; i < spec.numRef; i++)
+		int leftNum = 0;
+		for (int i = 1; i < NumObjectBins; i++)
 		{
-			leftBounds = leftBounds.Extend(refPtr[i - 1].bounds);
-			float lA = leftBounds.Area(), rA = m_rightBounds[i - 1].Area();
-			float sah = nodeSAH + lA * m_platform.getTriangleCost(i) + rA * m_platform.getTriangleCost(spec.numRef - i);
-			float tieBreak = math::sqr((float)i) + math::sqr((float)(spec.numRef - i));
-			if (sah < split.sah || (sah == split.sah && tieBreak < bestTieBreak))
+			leftBounds = leftBounds.Extend(binBounds[i - 1]);
+			leftNum += binCounts[i - 1];
+			int rightNum = spec.numRef - leftNum;
+			if (!leftNum || !rightNum)
+				continue;
+			float sah = nodeSAH + leftBounds.Area() * m_platform.getTriangleCost(leftNum) + rightBounds[i - 1].Area() * m_platform.getTriangleCost(rightNum);
+			if (sah < split.sah)
 			{
 				split.sah = sah;
-				split.sortDim = m_sortDim;
-				split.numLeft = i;
+				split.sortDim = dim;
+				split.numLeft = leftNum;
 				split.leftBounds = leftBounds;
-				split.rightBounds = m_rightBounds[i - 1];
-				bestTieBreak = tieBreak;
+				split.rightBounds = rightBounds[i - 1];
+				split.splitBin = i;
+				split.binOrigin = origin;
+				split.binScale = scale;
 			}
 		}
 	}
@@ -420,10 +625,20 @@ SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findObjectSplit(const NodeSpec& sp
 
 //------------------------------------------------------------------------
 
-void SplitBVHBuilder::performObjectSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split)
+void SplitBVHBuilder::performObjectSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split)
 {
-	m_sortDim = split.sortDim;
-	sort(this, (int)m_refStack.size() - spec.numRef, (int)m_refStack.size(), sortCompare, sortSwap);
+	if (split.splitBin >= 0)
+	{
+		std::partition(ctx.refStack.end() - spec.numRef, ctx.refStack.end(), [&](const Reference& ref)
+		{
+			return objectBin(ref.bounds, split.sortDim, split.binOrigin, split.binScale, NumObjectBins) < split.splitBin;
+		});
+	}
+	else
+	{
+		SortData sortData = { &ctx.refStack, split.sortDim };
+		sort(&sortData, (int)ctx.refStack.size() - spec.numRef, (int)ctx.refStack.size(), sortCompare, sortSwap);
+	}
 
 	left.numRef = split.numLeft;
 	left.bounds = split.leftBounds;
@@ -433,82 +648,102 @@ void SplitBVHBuilder::performObjectSplit(NodeSpec& left, NodeSpec& right, const
 
 //------------------------------------------------------------------------
 
-SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplit(const NodeSpec& spec, float nodeSAH)
+SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplit(BuildContext& ctx, const NodeSpec& spec, float nodeSAH, bool parallel)
+{
+	// The dimensions use separate bins and can be evaluated independently.
+
+	SpatialSplit splits[3];
+	if (parallel)
+	{
+		ThreadPool::getGlobalPool().ParallelFor(3, [&](unsigned int dim, unsigned int thread_idx)
+		{
+			std::vector<AABB> rightBounds(NumSpatialBins);
+			splits[dim] = findSpatialSplitDim(ctx, spec, nodeSAH, dim, rightBounds);
+		});
+	}
+	else
+	{
+		for (int dim = 0; dim < 3; dim++)
+			splits[dim] = findSpatialSplitDim(ctx, spec, nodeSAH, dim, ctx.rightBounds);
+	}
+
+	// Select best split plane.
+
+	SpatialSplit split;
+	for (int dim = 0; dim < 3; dim++)
+		if (splits[dim].sah < split.sah)
+			split = splits[dim];
+	return split;
+}
+
+//------------------------------------------------------------------------
+
+SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplitDim(BuildContext& ctx, const NodeSpec& spec, float nodeSAH, int dim, std::vector<AABB>& rightBounds)
 {
 	// Initialize bins.
 
 	Vec3f origin = spec.bounds.minV;
 	Vec3f binSize = (spec.bounds.maxV - origin) * (1.0f / (float)NumSpatialBins);
 	Vec3f invBinSize = 1.0f / binSize;
+	SpatialBin* bins = ctx.bins[dim];
 
-	for (int dim = 0; dim < 3; dim++)
+	for (int i = 0; i < NumSpatialBins; i++)
 	{
-		for (int i = 0; i < NumSpatialBins; i++)
-		{
-			SpatialBin& bin = m_bins[dim][i];
-			bin.bounds = AABB::Identity();
-			bin.enter = 0;
-			bin.exit = 0;
-		}
+		SpatialBin& bin = bins[i];
+		bin.bounds = AABB::Identity();
+		bin.enter = 0;
+		bin.exit = 0;
 	}
 
 	// Chop references into bins.
 
-	for (int refIdx = (int)m_refStack.size() - spec.numRef; refIdx < m_refStack.size(); refIdx++)
+	for (int refIdx = (int)ctx.refStack.size() - spec.numRef; refIdx < ctx.refStack.size(); refIdx++)
 	{
-		const Reference& ref = m_refStack[refIdx];
+		const Reference& ref = ctx.refStack[refIdx];
 		Vec3i firstBin = clamp(Vec3i((ref.bounds.minV - origin) * invBinSize), Vec3i(0), Vec3i(NumSpatialBins - 1));
 		Vec3i lastBin = clamp(Vec3i((ref.bounds.maxV - origin) * invBinSize), Vec3i(firstBin), Vec3i(NumSpatialBins - 1));
 
-		for (int dim = 0; dim < 3; dim++)
+		Reference currRef = ref;
+		for (int i = firstBin[dim]; i < lastBin[dim]; i++)
 		{
-			Reference currRef = ref;
-			for (int i = firstBin[dim]; i < lastBin[dim]; i++)
-			{
-				Reference leftRef, rightRef;
-				splitReference(leftRef, rightRef, currRef, dim, origin[dim] + binSize[dim] * (float)(i + 1));
-				m_bins[dim][i].bounds = m_bins[dim][i].bounds.Extend(leftRef.bounds);
-				currRef = rightRef;
-			}
-			m_bins[dim][lastBin[dim]].bounds = m_bins[dim][lastBin[dim]].bounds.Extend(currRef.bounds);
-			m_bins[dim][firstBin[dim]].enter++;
-			m_bins[dim][lastBin[dim]].exit++;
+			Reference leftRef, rightRef;
+			splitReference(leftRef, rightRef, currRef, dim, origin[dim] + binSize[dim] * (float)(i + 1));
+			bins[i].bounds = bins[i].bounds.Extend(leftRef.bounds);
+			currRef = rightRef;
 		}
+		bins[lastBin[dim]].bounds = bins[lastBin[dim]].bounds.Extend(currRef.bounds);
+		bins[firstBin[dim]].enter++;
+		bins[lastBin[dim]].exit++;
 	}
 
-	// Select best split plane.
+	// Sweep right to left and determine bounds.
 
 	SpatialSplit split;
-	for (int dim = 0; dim < 3; dim++)
+	AABB rBounds = AABB::Identity();
+	for (int i = NumSpatialBins - 1; i > 0; i--)
 	{
-		// Sweep right to left and determine bounds.
+		rBounds = rBounds.Extend(bins[i].bounds);
+		rightBounds[i - 1] = rBounds;
+	}
 
-		AABB rightBounds = AABB::Identity();
-		for (int i = NumSpatialBins - 1; i > 0; i--)
-		{
-			rightBounds = rightBounds.Extend(m_bins[dim][i].bounds);
-			m_rightBounds[i - 1] = rightBounds;
-		}
+	// Sweep left to right and select lowest SAH.
 
-		// Sweep left to right and select lowest SAH.
+	AABB leftBounds = AABB::Identity();
+	int leftNum = 0;
+	int rightNum = spec.numRef;
 
-		AABB leftBounds = AABB::Identity();
-		int leftNum = 0;
-		int rightNum = spec.numRef;
+	for (int i = 1; i < NumSpatialBins; i++)
+	{
+		leftBounds = leftBounds.Extend(bins[i - 1].bounds);
+		leftNum += bins[i - 1].enter;
+		rightNum -= bins[i - 1].exit;
 
-		for (int i = 1; i < NumSpatialBins; i++)
+		float sah = nodeSAH + leftBounds.Area() * m_platform.getTriangleCost(leftNum) + rightBounds[i - 1].Area() * m_platform.getTriangleCost(rightNum);
+		if (sah < split.sah)
 		{
-			leftBounds = leftBounds.Extend(m_bins[dim][i - 1].bounds);
-			leftNum += m_bins[dim][i - 1].enter;
-			rightNum -= m_bins[dim][i - 1].exit;
-
-			float sah = nodeSAH + leftBounds.Area() * m_platform.getTriangleCost(leftNum) + m_rightBounds[i - 1].Area() * m_platform.getTriangleCost(rightNum);
-			if (sah < split.sah)
-			{
-				split.sah = sah;
-				split.dim = dim;
-				split.pos = origin[dim] + binSize[dim] * (float)i;
-			}
+			split.sah = sah;
+			split.dim = dim;
+			split.pos = origin[dim] + binSize[dim] * (float)i;
 		}
 	}
 	return split;
@@ -516,7 +751,7 @@ SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplit(const NodeSpec&
 
 //------------------------------------------------------------------------
 
-void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split)
+void SplitBVHBuilder::performSpatialSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split)
 {
 	// Categorize references and compute bounds.
 	//
@@ -524,7 +759,7 @@ void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const
 	// Uncategorized/split: [leftEnd, rightStart[
 	// Right-hand side:     [rightStart, refs.getSize()[
 
-	std::vector<Reference>& refs = m_refStack;
+	std::vector<Reference>& refs = ctx.refStack;
 	int leftStart = (int)refs.size() - spec.numRef;
 	int leftEnd = leftStart;
 	int rightStart = (int)refs.size();
@@ -612,7 +847,7 @@ void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const
 
 //------------------------------------------------------------------------
 
-void SplitBVHBuilder::splitReference(Reference& left, Reference& right, const Reference& ref, int dim, float pos)
+void SplitBVHBuilder::splitReference(Reference& left, Reference& right, const Reference& ref, int dim, float pos) const
 {
 	if (!m_pClb->SplitNode(ref.triIdx, dim, pos, left.bounds, right.bounds, ref.bounds))
 	{
@@ -624,4 +859,283 @@ void SplitBVHBuilder::splitReference(Reference& left, Reference& right, const Re
 
 //------------------------------------------------------------------------
 
-}
\ No newline at end of file
+//------------------------------------------------------------------------
+
+static unsigned int expandMortonBits(unsigned int v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+static int mortonPrefixLength(unsigned int a, unsigned int b)
+{
+	unsigned int x = a ^ b;
+	int n = 0;
+	while (n < 32 && !(x & (0x80000000u >> n)))
+		n++;
+	return n;
+}
+
+unsigned int SplitBVHBuilder::buildLBVH(BuildContext& ctx, const NodeSpec& rootSpec)
+{
+	// Remove degenerates and determine the centroid bounds.
+
+	std::vector<MortonRef> refs;
+	refs.reserve(ctx.refStack.size());
+	AABB centroidBounds = AABB::Identity();
+	for (size_t i = 0; i < ctx.refStack.size(); i++)
+	{
+		Vec3f size = ctx.refStack[i].bounds.maxV - ctx.refStack[i].bounds.minV;
+		if (min(size) < 0.0f || sum(size) == max(size))
+			continue;
+		MortonRef r;
+		r.code = 0;
+		r.ref = ctx.refStack[i];
+		refs.push_back(r);
+		centroidBounds = centroidBounds.Extend(r.ref.bounds.Center());
+	}
+	ctx.refStack.clear();
+	if (refs.empty())
+		return createLeaf(ctx, NodeSpec());
+
+	// Compute the morton codes of the centroids.
+
+	const unsigned int numCodeBins = 1u << MortonBitsPerDim;
+	Vec3f origin = centroidBounds.minV, extent = centroidBounds.Size();
+	Vec3f scale = Vec3f(extent.x > 0.0f ? numCodeBins / extent.x : 0.0f, extent.y > 0.0f ? numCodeBins / extent.y : 0.0f, extent.z > 0.0f ? numCodeBins / extent.z : 0.0f);
+	const unsigned int chunkSize = 16384;
+	ThreadPool::getGlobalPool().ParallelFor(((unsigned int)refs.size() + chunkSize - 1) / chunkSize, [&](unsigned int task_idx, unsigned int thread_idx)
+	{
+		size_t end = min(refs.size(), (size_t)(task_idx + 1) * chunkSize);
+		for (size_t i = (size_t)task_idx * chunkSize; i < end; i++)
+		{
+			Vec3f c = (refs[i].ref.bounds.Center() - origin) * scale;
+			unsigned int x = (unsigned int)math::clamp((int)c.x, 0, (int)numCodeBins - 1);
+			unsigned int y = (unsigned int)math::clamp((int)c.y, 0, (int)numCodeBins - 1);
+			unsigned int z = (unsigned int)math::clamp((int)c.z, 0, (int)numCodeBins - 1);
+			refs[i].code = (expandMortonBits(x) << 2) | (expandMortonBits(y) << 1) | expandMortonBits(z);
+		}
+	});
+	std::sort(refs.begin(), refs.end(), [](const MortonRef& a, const MortonRef& b)
+	{
+		return a.code < b.code || (a.code == b.code && a.ref.triIdx < b.ref.triIdx);
+	});
+
+	// Build the hierarchy from the sorted codes and optimize it.
+
+	float cost;
+	unsigned int root = buildLBVHNode(ctx, refs, 0, (int)refs.size(), cost);
+	if (m_params.optimizeTreelets)
+	{
+		std::vector<float> costs(ctx.nodes.size());
+		optimizeTreelets(ctx, root, costs);
+	}
+	return root;
+}
+
+//------------------------------------------------------------------------
+
+unsigned int SplitBVHBuilder::buildLBVHNode(BuildContext& ctx, const std::vector<MortonRef>& refs, int first, int last, float& cost)
+{
+	int numRef = last - first;
+	if (numRef <= m_platform.getMinLeafSize() || (numRef <= m_platform.getMaxLeafSize() && refs[first].code == refs[last - 1].code))
+	{
+		AABB bounds = AABB::Identity();
+		for (int i = first; i < last; i++)
+		{
+			bounds = bounds.Extend(refs[i].ref.bounds);
+			ctx.indices.push_back(refs[i].ref.triIdx);
+		}
+		cost = bounds.Area() * m_platform.getTriangleCost(numRef);
+		ctx.nodes.push_back(BVHNode(bounds, (unsigned int)ctx.indices.size() - numRef, (unsigned int)ctx.indices.size(), true));
+		return (unsigned int)ctx.nodes.size() - 1;
+	}
+
+	// Split at the highest differing bit of the morton codes, identical codes are split in the middle.
+
+	int split = first + numRef / 2;
+	unsigned int firstCode = refs[first].code, lastCode = refs[last - 1].code;
+	if (firstCode != lastCode)
+	{
+		int commonPrefix = mortonPrefixLength(firstCode, lastCode);
+		split = first;
+		int step = numRef - 1;
+		do
+		{
+			step = (step + 1) >> 1;
+			int newSplit = split + step;
+			if (newSplit < last - 1 && mortonPrefixLength(firstCode, refs[newSplit].code) > commonPrefix)
+				split = newSplit;
+		} while (step > 1);
+		split++;
+	}
+
+	// Both subtrees write their nodes and indices contiguously which allows collapsing them into a leaf.
+
+	unsigned int firstNode = (unsigned int)ctx.nodes.size();
+	unsigned int firstIndex = (unsigned int)ctx.indices.size();
+	float leftCost, rightCost;
+	unsigned int leftNode = buildLBVHNode(ctx, refs, first, split, leftCost);
+	unsigned int rightNode = buildLBVHNode(ctx, refs, split, last, rightCost);
+	AABB bounds = ctx.nodes[leftNode].box;
+	bounds = bounds.Extend(ctx.nodes[rightNode].box);
+	cost = bounds.Area() * m_platform.getNodeCost(2) + leftCost + rightCost;
+
+	float leafCost = bounds.Area() * m_platform.getTriangleCost(numRef);
+	if (numRef <= m_platform.getMaxLeafSize() && leafCost <= cost)
+	{
+		ctx.nodes.erase(ctx.nodes.begin() + firstNode, ctx.nodes.end());
+		cost = leafCost;
+		ctx.nodes.push_back(BVHNode(bounds, firstIndex, (unsigned int)ctx.indices.size(), true));
+		return (unsigned int)ctx.nodes.size() - 1;
+	}
+
+	ctx.nodes.push_back(BVHNode(bounds, leftNode, rightNode, false));
+	return (unsigned int)ctx.nodes.size() - 1;
+}
+
+//------------------------------------------------------------------------
+
+void SplitBVHBuilder::optimizeTreelets(BuildContext& ctx, unsigned int nodeIdx, std::vector<float>& costs)
+{
+	// Bottom up, every inner node is the root of one treelet.
+
+	BVHNode n = ctx.nodes[nodeIdx];
+	if (n.isLeaf())
+	{
+		costs[nodeIdx] = n.box.Area() * m_platform.getTriangleCost(n.getRight() - n.getLeft());
+		return;
+	}
+	optimizeTreelets(ctx, n.getLeft(), costs);
+	optimizeTreelets(ctx, n.getRight(), costs);
+	costs[nodeIdx] = n.box.Area() * m_platform.getNodeCost(2) + costs[n.getLeft()] + costs[n.getRight()];
+	restructureTreelet(ctx, nodeIdx, costs);
+}
+
+//------------------------------------------------------------------------
+
+void SplitBVHBuilder::restructureTreelet(BuildContext& ctx, unsigned int nodeIdx, std::vector<float>& costs)
+{
+	// Form the treelet by repeatedly expanding the treelet leaf with the largest surface area.
+
+	Treelet t;
+	const BVHNode& root = ctx.nodes[nodeIdx];
+	t.numLeafs = 2;
+	t.leafs[0] = root.getLeft();
+	t.leafs[1] = root.getRight();
+	t.inner[0] = nodeIdx;
+	int numInner = 1;
+	while (t.numLeafs < MaxTreeletLeafs)
+	{
+		int best = -1;
+		float bestArea = -1.0f;
+		for (int i = 0; i < t.numLeafs; i++)
+		{
+			const BVHNode& c = ctx.nodes[t.leafs[i]];
+			if (!c.isLeaf() && c.box.Area() > bestArea)
+			{
+				best = i;
+				bestArea = c.box.Area();
+			}
+		}
+		if (best == -1)
+			break;
+		const BVHNode& c = ctx.nodes[t.leafs[best]];
+		t.inner[numInner++] = t.leafs[best];
+		t.leafs[t.numLeafs++] = c.getRight();
+		t.leafs[best] = c.getLeft();
+	}
+	if (t.numLeafs < 3)
+		return;
+
+	// Find the optimal topology over all subsets of treelet leafs, subsets of s are always smaller than s.
+
+	int numSubsets = 1 << t.numLeafs;
+	for (int s = 1; s < numSubsets; s++)
+	{
+		AABB box = AABB::Identity();
+		for (int i = 0; i < t.numLeafs; i++)
+			if (s & (1 << i))
+				box = box.Extend(ctx.nodes[t.leafs[i]].box);
+		t.bounds[s] = box;
+	}
+	for (int s = 1; s < numSubsets; s++)
+	{
+		if (!(s & (s - 1)))
+		{
+			int i = 0;
+			while (s != (1 << i))
+				i++;
+			t.cost[s] = costs[t.leafs[i]];
+			t.partition[s] = 0;
+			continue;
+		}
+		float bestCost = FLT_MAX;
+		int bestPartition = 0;
+		for (int p = (s - 1) & s; p; p = (p - 1) & s)
+		{
+			float c = t.cost[p] + t.cost[s ^ p];
+			if (c < bestCost)
+			{
+				bestCost = c;
+				bestPartition = p;
+			}
+		}
+		t.cost[s] = t.bounds[s].Area() * m_platform.getNodeCost(2) + bestCost;
+		t.partition[s] = bestPartition;
+	}
+
+	// Reuse the inner nodes of the old topology, the treelet root keeps its index.
+
+	if (t.cost[numSubsets - 1] >= costs[nodeIdx])
+		return;
+	int nextInner = 1;
+	writeTreelet(ctx, costs, t, numSubsets - 1, nodeIdx, nextInner);
+}
+
+//------------------------------------------------------------------------
+
+void SplitBVHBuilder::writeTreelet(BuildContext& ctx, std::vector<float>& costs, const Treelet& t, int subset, unsigned int nodeIdx, int& nextInner)
+{
+	int subsets[2] = { t.partition[subset], subset ^ t.partition[subset] };
+	unsigned int children[2];
+	for (int k = 0; k < 2; k++)
+	{
+		if (!(subsets[k] & (subsets[k] - 1)))
+		{
+			int i = 0;
+			while (subsets[k] != (1 << i))
+				i++;
+			children[k] = t.leafs[i];
+		}
+		else
+		{
+			children[k] = t.inner[nextInner++];
+			writeTreelet(ctx, costs, t, subsets[k], children[k], nextInner);
+		}
+	}
+	ctx.nodes[nodeIdx] = BVHNode(t.bounds[subset], children[0], children[1], false);
+	costs[nodeIdx] = t.cost[subset];
+}
+
+//------------------------------------------------------------------------
+
+float SplitBVHBuilder::computeStats(unsigned int nodeIdx, Stats& stats) const
+{
+	const BVHNode& n = m_Nodes[nodeIdx];
+	if (n.isLeaf())
+	{
+		int numTris = n.getRight() - n.getLeft();
+		stats.numLeafNodes++;
+		stats.numTris += numTris;
+		return n.box.Area() * m_platform.getTriangleCost(numTris);
+	}
+	stats.numInnerNodes++;
+	stats.numChildNodes += 2;
+	return n.box.Area() * m_platform.getNodeCost(2) + computeStats(n.getLeft(), stats) + computeStats(n.getRight(), stats);
+}
+
+}
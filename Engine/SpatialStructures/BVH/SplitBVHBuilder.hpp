@@ -4,6 +4,7 @@
 #include <Base/Timer.h>
 #include <vector>
 #include <functional>
+#include <memory>
 
 namespace CudaTracerLib {
 
@@ -64,6 +65,11 @@ private:
 		MaxDepth = 64,
 		MaxSpatialDepth = 48,
 		NumSpatialBins = 128,
+		MinSubtreeTaskSize = 4096,
+		MinParallelSplitSize = 16384,
+		NumObjectBins = 32,
+		MortonBitsPerDim = 10,
+		MaxTreeletLeafs = 7,
 	};
 
 	struct Reference
@@ -90,7 +96,12 @@ private:
 		AABB                leftBounds;
 		AABB                rightBounds;
 
-		ObjectSplit(void) : sah(FLT_MAX), sortDim(0), numLeft(0), leftBounds(AABB::Identity()), rightBounds(AABB::Identity()) { }
+		float                 tieBreak;
+		int                   splitBin;     // first centroid bin of the right child for binned splits, -1 for sorted splits
+		float                 binOrigin;
+		float                 binScale;
+
+		ObjectSplit(void) : sah(FLT_MAX), sortDim(0), numLeft(0), leftBounds(AABB::Identity()), rightBounds(AABB::Identity()), tieBreak(FLT_MAX), splitBin(-1), binOrigin(0.0f), binScale(0.0f) { }
 	};
 
 	struct SpatialSplit
@@ -109,6 +120,50 @@ private:
 		int                 exit;
 	};
 
+	//state of one build task, the top levels are built in the main context and large subtrees below in their own contexts
+	struct BuildContext
+	{
+		std::vector<Reference>  refStack;
+		std::vector<AABB>       rightBounds;
+		SpatialBin              bins[3][NumSpatialBins];
+		std::vector<int>        indices;
+		std::vector<BVHNode>    nodes;
+		int                     numDuplicates;
+		bool                    isTopLevel;
+
+		BuildContext(void) : numDuplicates(0), isTopLevel(false) { }
+	};
+
+	struct SubtreeTask
+	{
+		NodeSpec                spec;
+		int                     level;
+		unsigned int            root;
+		BuildContext            ctx;
+	};
+
+	struct SortData
+	{
+		std::vector<Reference>* refs;
+		int                     dim;
+	};
+
+	struct MortonRef
+	{
+		unsigned int            code;
+		Reference               ref;
+	};
+
+	struct Treelet
+	{
+		int                     numLeafs;
+		unsigned int            leafs[MaxTreeletLeafs];
+		unsigned int            inner[MaxTreeletLeafs - 1];
+		AABB                    bounds[1 << MaxTreeletLeafs];
+		float                   cost[1 << MaxTreeletLeafs];
+		int                     partition[1 << MaxTreeletLeafs];
+	};
+
 public:
 
 	class Platform
@@ -165,15 +220,30 @@ public:
 	};
 	struct BuildParams
 	{
+		enum BuildQuality
+		{
+			Quality_SBVH,       // sorted object splits and spatial splits, slowest build and best trees
+			Quality_BinnedSAH,  // object splits evaluated on centroid bins
+			Quality_LBVH,       // morton code based linear bvh, fastest build
+		};
+
 		Stats*      stats;
 		bool        enablePrints;
 		float       splitAlpha;     // spatial split area threshold
+		bool        parallelBuild;  // build subtrees and evaluate the top level splits on the global thread pool
+		BuildQuality quality;
+		bool        optimizeTreelets; // restructure small treelets of the LBVH to minimize the SAH cost, off by default because of the exhaustive search per node
+		bool        optimizeLayout; // reorder the nodes of ConstructBVH with OptimizeBVHNodeLayout, does not change the tree itself
 
 		BuildParams(void)
 		{
 			stats = NULL;
 			enablePrints = true;
 			splitAlpha = 1.0e-5f;
+			parallelBuild = true;
+			quality = Quality_SBVH;
+			optimizeTreelets = false;
+			optimizeLayout = true;
 		}
 	};
 
@@ -186,15 +256,28 @@ private:
 	static bool             sortCompare(void* data, int idxA, int idxB);
 	static void             sortSwap(void* data, int idxA, int idxB);
 
-	unsigned int                buildNode(NodeSpec spec, int level, float progressStart, float progressEnd);
-	unsigned int                createLeaf(const NodeSpec& spec);
+	unsigned int                buildNode(BuildContext& ctx, NodeSpec spec, int level, float progressStart, float progressEnd);
+	unsigned int                createLeaf(BuildContext& ctx, const NodeSpec& spec);
+	unsigned int                createSubtreeTask(BuildContext& ctx, const NodeSpec& spec, int level);
+	unsigned int                mergeNode(BuildContext& ctx, unsigned int nodeIdx);
+
+	ObjectSplit             findObjectSplit(BuildContext& ctx, const NodeSpec& spec, float nodeSAH, bool parallel);
+	ObjectSplit             sweepObjectSplit(std::vector<Reference>& refs, int firstRef, int numRef, int dim, float nodeSAH, std::vector<AABB>& rightBounds);
+	ObjectSplit             findBinnedObjectSplit(BuildContext& ctx, const NodeSpec& spec, float nodeSAH);
+	void                    performObjectSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split);
+
+	SpatialSplit            findSpatialSplit(BuildContext& ctx, const NodeSpec& spec, float nodeSAH, bool parallel);
+	SpatialSplit            findSpatialSplitDim(BuildContext& ctx, const NodeSpec& spec, float nodeSAH, int dim, std::vector<AABB>& rightBounds);
+	void                    performSpatialSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split);
+	void                    splitReference(Reference& left, Reference& right, const Reference& ref, int dim, float pos) const;
 
-	ObjectSplit             findObjectSplit(const NodeSpec& spec, float nodeSAH);
-	void                    performObjectSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split);
+	unsigned int            buildLBVH(BuildContext& ctx, const NodeSpec& rootSpec);
+	unsigned int            buildLBVHNode(BuildContext& ctx, const std::vector<MortonRef>& refs, int first, int last, float& cost);
+	void                    optimizeTreelets(BuildContext& ctx, unsigned int nodeIdx, std::vector<float>& costs);
+	void                    restructureTreelet(BuildContext& ctx, unsigned int nodeIdx, std::vector<float>& costs);
+	void                    writeTreelet(BuildContext& ctx, std::vector<float>& costs, const Treelet& t, int subset, unsigned int nodeIdx, int& nextInner);
 
-	SpatialSplit            findSpatialSplit(const NodeSpec& spec, float nodeSAH);
-	void                    performSpatialSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split);
-	void                    splitReference(Reference& left, Reference& right, const Reference& ref, int dim, float pos);
+	float                   computeStats(unsigned int nodeIdx, Stats& stats) const;
 
 private:
 	SplitBVHBuilder(const SplitBVHBuilder&); // forbidden
@@ -205,11 +288,9 @@ private:
 	const Platform& m_platform;
 	BuildParams	m_params;
 
-	std::vector<Reference>  m_refStack;
 	float                   m_minOverlap;
-	std::vector<AABB>       m_rightBounds;
-	int                     m_sortDim;
-	SpatialBin              m_bins[3][NumSpatialBins];
+	int                     m_subtreeTaskSize;
+	std::vector<std::unique_ptr<SubtreeTask>> m_subtreeTasks;
 
 	int                     m_numDuplicates;
 
@@ -0,0 +1,96 @@
+#include <StdAfx.h>
+#include "WideBVH.h"
+
+namespace CudaTracerLib {
+
+void WideBVH::Clear()
+{
+	m_nodes.clear();
+	m_meshRoots.clear();
+	m_sceneRoot = WIDE_BVH_EMPTY_ROOT;
+}
+
+int WideBVH::Collapse(const BVHNodeData* nodes, int startNode)
+{
+	if (startNode < 0 || startNode == WIDE_BVH_EMPTY_ROOT)
+		return startNode;
+	unsigned int maxDepth = 0;
+	int root = collapseNode(nodes, startNode, 1, maxDepth);
+	if (maxDepth * (WIDE_BVH_WIDTH - 1) + 1 > WIDE_BVH_STACK_SIZE)
+		throw std::runtime_error(format("The wide bvh has a depth of %u which exceeds the traversal stack of %u entries!", maxDepth, (unsigned int)WIDE_BVH_STACK_SIZE));
+	return root;
+}
+
+void WideBVH::setMeshRoot(unsigned int meshIdx, int root)
+{
+	if (meshIdx >= m_meshRoots.size())
+		m_meshRoots.resize(meshIdx + 1, WIDE_BVH_EMPTY_ROOT);
+	m_meshRoots[meshIdx] = root;
+}
+
+int WideBVH::collapseNode(const BVHNodeData* nodes, int nodeAddr, unsigned int depth, unsigned int& maxDepth)
+{
+	maxDepth = max(maxDepth, depth);
+	struct child
+	{
+		int addr;
+		AABB box;
+	};
+	child c[WIDE_BVH_WIDTH];
+	const BVHNodeData& node = nodes[nodeAddr / 4];
+	node.getBox(c[0].box, c[1].box);
+	c[0].addr = node.getChildren().x;
+	c[1].addr = node.getChildren().y;
+	unsigned int n = 2;
+
+	//repeatedly open the inner child with the largest surface area
+	while (n < WIDE_BVH_WIDTH)
+	{
+		int best = -1;
+		float bestArea = -1.0f;
+		for (unsigned int i = 0; i < n; i++)
+			if (c[i].addr >= 0 && c[i].addr != WIDE_BVH_EMPTY_ROOT && c[i].box.Area() > bestArea)
+			{
+				best = i;
+				bestArea = c[i].box.Area();
+			}
+		if (best == -1)
+			break;
+		const BVHNodeData& inner = nodes[c[best].addr / 4];
+		Vec2i ch = inner.getChildren();
+		inner.getBox(c[best].box, c[n].box);
+		c[best].addr = ch.x;
+		c[n].addr = ch.y;
+		n++;
+	}
+
+	int idx = (int)m_nodes.size();
+	m_nodes.push_back(WideBVHNode());
+
+	//empty slots of single leaf roots and of the rebuilder are dropped
+	unsigned int m = 0;
+	for (unsigned int i = 0; i < n; i++)
+		if (c[i].addr != WIDE_BVH_EMPTY_ROOT)
+			c[m++] = c[i];
+	n = m;
+
+	//the recursion can reallocate m_nodes, therefore compute all children before writing the node
+	int children[WIDE_BVH_WIDTH];
+	for (unsigned int i = 0; i < n; i++)
+		children[i] = c[i].addr >= 0 ? collapseNode(nodes, c[i].addr, depth + 1, maxDepth) : c[i].addr;
+
+	WideBVHNode& w = m_nodes[idx];
+	w.numChildren = n;
+	for (unsigned int i = 0; i < WIDE_BVH_WIDTH; i++)
+	{
+		//unused slots are masked by numChildren during traversal
+		AABB box = i < n ? c[i].box : AABB(Vec3f(0.0f), Vec3f(0.0f));
+		w.lox[i] = box.minV.x; w.hix[i] = box.maxV.x;
+		w.loy[i] = box.minV.y; w.hiy[i] = box.maxV.y;
+		w.loz[i] = box.minV.z; w.hiz[i] = box.maxV.z;
+		w.children[i] = i < n ? children[i] : WIDE_BVH_EMPTY_ROOT;
+	}
+	return idx;
+}
+
+}
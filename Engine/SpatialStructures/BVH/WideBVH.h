@@ -0,0 +1,190 @@
+#pragma once
+
+#include <Defines.h>
+#include <Engine/TriIntersectorData.h>
+#include "BVHTraversal.h"
+#include <vector>
+
+#if !defined(__CUDA_ARCH__) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define WIDE_BVH_USE_SIMD
+#include <immintrin.h>
+#endif
+
+namespace CudaTracerLib {
+
+//8 wide nodes when compiled with AVX, 4 wide (SSE) otherwise
+#if defined(WIDE_BVH_USE_SIMD) && defined(__AVX__)
+#define WIDE_BVH_WIDTH 8
+#else
+#define WIDE_BVH_WIDTH 4
+#endif
+
+//returned as root for empty bvhs, also the child address of empty slots in BVHNodeData
+#define WIDE_BVH_EMPTY_ROOT 0x76543210
+
+//entries of the traversal stack, every visited node pushes at most WIDE_BVH_WIDTH - 1 additional entries
+//Collapse throws for bvhs which are too deep for it
+#define WIDE_BVH_STACK_SIZE (64 * WIDE_BVH_WIDTH)
+
+//Structure of arrays node, children >= 0 index other wide nodes, negative children are leafs with the same encoding as in BVHNodeData
+struct CUDA_ALIGN(32) WideBVHNode
+{
+	float lox[WIDE_BVH_WIDTH], hix[WIDE_BVH_WIDTH];
+	float loy[WIDE_BVH_WIDTH], hiy[WIDE_BVH_WIDTH];
+	float loz[WIDE_BVH_WIDTH], hiz[WIDE_BVH_WIDTH];
+	int children[WIDE_BVH_WIDTH];
+	unsigned int numChildren;
+};
+
+//Host only N-wide bvh collapsed from the binary BVHNodeData layout produced by the SplitBVHBuilder.
+//Only used to accelerate traversal on the host, the device keeps using the binary layout.
+//Multiple bvhs (scene and meshes) are stored in the same node array and identified by their root.
+class WideBVH
+{
+	std::vector<WideBVHNode> m_nodes;
+	std::vector<int> m_meshRoots;
+	int m_sceneRoot;
+
+	int collapseNode(const BVHNodeData* nodes, int nodeAddr, unsigned int depth, unsigned int& maxDepth);
+public:
+	WideBVH()
+		: m_sceneRoot(WIDE_BVH_EMPTY_ROOT)
+	{
+
+	}
+
+	CTL_EXPORT void Clear();
+
+	//collapses the binary bvh with the specified start node (in float4 units relative to nodes, negative for a single leaf)
+	//returns the root of the wide bvh which can be passed to Traverse
+	CTL_EXPORT int Collapse(const BVHNodeData* nodes, int startNode);
+
+	CTL_EXPORT void setMeshRoot(unsigned int meshIdx, int root);
+	void setSceneRoot(int root)
+	{
+		m_sceneRoot = root;
+	}
+	int getMeshRoot(unsigned int meshIdx) const
+	{
+		return meshIdx < m_meshRoots.size() ? m_meshRoots[meshIdx] : WIDE_BVH_EMPTY_ROOT;
+	}
+	int getSceneRoot() const
+	{
+		return m_sceneRoot;
+	}
+	size_t getNumNodes() const
+	{
+		return m_nodes.size();
+	}
+
+	//same callback interface as TracerayTemplate, clb receives the leaf index and returns whether it found an intersection
+	//with ANY_HIT the children are pushed unsorted and the traversal stops at the first intersection
+	template<bool ANY_HIT = false, typename CLB> bool Traverse(const Ray& r, float& rayT, const CLB& clb, int root, TraversalCounters* counters = 0) const
+	{
+		if (root == WIDE_BVH_EMPTY_ROOT)
+			return false;
+		if (root < 0)
+		{
+			TRAVERSAL_COUNT(counters, leafNodes, 1);
+			return clb(~root);
+		}
+
+		const float ooeps = math::exp2(-80.0f);
+		float idirx = 1.0f / (math::abs(r.dir().x) > ooeps ? r.dir().x : copysignf(ooeps, r.dir().x));
+		float idiry = 1.0f / (math::abs(r.dir().y) > ooeps ? r.dir().y : copysignf(ooeps, r.dir().y));
+		float idirz = 1.0f / (math::abs(r.dir().z) > ooeps ? r.dir().z : copysignf(ooeps, r.dir().z));
+		float origx = r.ori().x, origy = r.ori().y, origz = r.ori().z;
+#if defined(WIDE_BVH_USE_SIMD) && WIDE_BVH_WIDTH == 8
+		const __m256 ox = _mm256_set1_ps(origx), oy = _mm256_set1_ps(origy), oz = _mm256_set1_ps(origz);
+		const __m256 idx = _mm256_set1_ps(idirx), idy = _mm256_set1_ps(idiry), idz = _mm256_set1_ps(idirz);
+		const __m256 zero = _mm256_setzero_ps();
+#elif defined(WIDE_BVH_USE_SIMD)
+		const __m128 ox = _mm_set1_ps(origx), oy = _mm_set1_ps(origy), oz = _mm_set1_ps(origz);
+		const __m128 idx = _mm_set1_ps(idirx), idy = _mm_set1_ps(idiry), idz = _mm_set1_ps(idirz);
+		const __m128 zero = _mm_setzero_ps();
+#endif
+
+		struct StackEntry
+		{
+			int node;
+			float tmin;
+		};
+		StackEntry stack[WIDE_BVH_STACK_SIZE];
+		int stackPtr = 0;
+		stack[stackPtr++] = { root, 0.0f };
+		bool found = false;
+		while (stackPtr)
+		{
+			const StackEntry e = stack[--stackPtr];
+			if (e.tmin > rayT)
+				continue;
+			if (e.node < 0)
+			{
+				TRAVERSAL_COUNT(counters, leafNodes, e.node != -214783648);
+				if (e.node != -214783648 && clb(~e.node))
+				{
+					if (ANY_HIT)
+						return true;
+					found = true;
+				}
+				continue;
+			}
+
+			const WideBVHNode& n = m_nodes[e.node];
+			TRAVERSAL_COUNT(counters, innerNodes, 1);
+			CUDA_ALIGN(32) float tmin[WIDE_BVH_WIDTH];
+			unsigned int mask;
+#if defined(WIDE_BVH_USE_SIMD) && WIDE_BVH_WIDTH == 8
+			const __m256 t = _mm256_set1_ps(rayT);
+			__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.lox), ox), idx), t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.hix), ox), idx);
+			__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.loy), oy), idy), t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.hiy), oy), idy);
+			__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.loz), oz), idz), t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.hiz), oz), idz);
+			__m256 tn = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), zero));
+			__m256 tf = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), t));
+			_mm256_store_ps(tmin, tn);
+			mask = (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+#elif defined(WIDE_BVH_USE_SIMD)
+			const __m128 t = _mm_set1_ps(rayT);
+			__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.lox), ox), idx), t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.hix), ox), idx);
+			__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.loy), oy), idy), t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.hiy), oy), idy);
+			__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.loz), oz), idz), t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.hiz), oz), idz);
+			__m128 tn = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), zero));
+			__m128 tf = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), t));
+			_mm_store_ps(tmin, tn);
+			mask = (unsigned int)_mm_movemask_ps(_mm_cmple_ps(tn, tf));
+#else
+			mask = 0;
+			for (int i = 0; i < WIDE_BVH_WIDTH; i++)
+			{
+				float t0x = (n.lox[i] - origx) * idirx, t1x = (n.hix[i] - origx) * idirx;
+				float t0y = (n.loy[i] - origy) * idiry, t1y = (n.hiy[i] - origy) * idiry;
+				float t0z = (n.loz[i] - origz) * idirz, t1z = (n.hiz[i] - origz) * idirz;
+				tmin[i] = kepler_math::spanBeginKepler(t0x, t1x, t0y, t1y, t0z, t1z, 0);
+				float tmax = kepler_math::spanEndKepler(t0x, t1x, t0y, t1y, t0z, t1z, rayT);
+				mask |= (tmin[i] <= tmax) << i;
+			}
+#endif
+			mask &= (1u << n.numChildren) - 1;
+
+			//push the hit children far to near so that the nearest one is processed next
+			int hits[WIDE_BVH_WIDTH], numHits = 0;
+			for (int i = 0; i < WIDE_BVH_WIDTH; i++)
+			{
+				if (!(mask & (1u << i)))
+					continue;
+				int j = numHits++;
+				while (!ANY_HIT && j > 0 && tmin[hits[j - 1]] < tmin[i])
+				{
+					hits[j] = hits[j - 1];
+					j--;
+				}
+				hits[j] = i;
+			}
+			for (int i = 0; i < numHits; i++)
+				stack[stackPtr++] = { n.children[hits[i]], tmin[hits[i]] };
+		}
+		return found;
+	}
+};
+
+}
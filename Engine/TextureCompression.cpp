@@ -0,0 +1,195 @@
+#include "StdAfx.h"
+#include "TextureCompression.h"
+#include "MIPMapHelper.h"
+#include <Base/ThreadPool.h>
+
+namespace CudaTracerLib {
+
+//end points of the segment along the principal axis covering all points, the axis is found by power iteration on the covariance matrix
+static void fitLine(const Vec3f* p, int n, Vec3f& lo, Vec3f& hi)
+{
+	Vec3f mean(0.0f);
+	for (int i = 0; i < n; i++)
+		mean += p[i];
+	mean = mean / float(n);
+	float xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+	for (int i = 0; i < n; i++)
+	{
+		Vec3f d = p[i] - mean;
+		xx += d.x * d.x; xy += d.x * d.y; xz += d.x * d.z;
+		yy += d.y * d.y; yz += d.y * d.z; zz += d.z * d.z;
+	}
+	Vec3f axis(1.0f);
+	for (int it = 0; it < 8; it++)
+	{
+		Vec3f a(xx * axis.x + xy * axis.y + xz * axis.z, xy * axis.x + yy * axis.y + yz * axis.z, xz * axis.x + yz * axis.y + zz * axis.z);
+		float l = length(a);
+		if (l < 1e-12f)
+			break;
+		axis = a / l;
+	}
+	float tmin = 0, tmax = 0;
+	for (int i = 0; i < n; i++)
+	{
+		float t = dot(p[i] - mean, axis);
+		tmin = min(tmin, t);
+		tmax = max(tmax, t);
+	}
+	lo = mean + axis * tmin;
+	hi = mean + axis * tmax;
+}
+
+static unsigned int toRGB565(const Vec3f& c)
+{
+	auto q = [](float f, float s) {return (unsigned int)(math::clamp01(f) * s + 0.5f); };
+	return (q(c.x, 31.0f) << 11) | (q(c.y, 63.0f) << 5) | q(c.z, 31.0f);
+}
+
+template<int N> static unsigned int nearestIndex(const Vec3f& c, const Vec3f(&palette)[N])
+{
+	unsigned int best = 0;
+	for (int k = 1; k < N; k++)
+		if (distanceSquared(c, palette[k]) < distanceSquared(c, palette[best]))
+			best = k;
+	return best;
+}
+
+//rgb in [0, 1]
+static void encodeBC1(const Vec3f* rgb, unsigned int* block)
+{
+	Vec3f lo, hi;
+	fitLine(rgb, 16, lo, hi);
+	unsigned int c0 = toRGB565(hi), c1 = toRGB565(lo), indices = 0;
+	//the four color mode requires c0 > c1
+	if (c0 < c1)
+		swapk(c0, c1);
+	if (c0 != c1)
+	{
+		Vec3f a = decodeRGB565(c0), b = decodeRGB565(c1);
+		Vec3f palette[4] = { a, b, (a * 2.0f + b) / 3.0f, (a + b * 2.0f) / 3.0f };
+		for (int i = 0; i < 16; i++)
+			indices |= nearestIndex(rgb[i], palette) << (2 * i);
+	}
+	block[0] = c0 | (c1 << 16);
+	block[1] = indices;
+}
+
+static void encodeBC4(const unsigned char* alpha, unsigned int* block)
+{
+	unsigned int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		a0 = max(a0, (unsigned int)alpha[i]);
+		a1 = min(a1, (unsigned int)alpha[i]);
+	}
+	unsigned long long bits = a0 | (a1 << 8);
+	if (a0 != a1)
+		for (int i = 0; i < 16; i++)
+		{
+			unsigned int best = 0;
+			float bestErr = FLT_MAX;
+			for (unsigned int k = 0; k < 8; k++)
+			{
+				float v = k == 0 ? float(a0) : k == 1 ? float(a1) : float((8 - k) * a0 + (k - 1) * a1) / 7.0f;
+				float err = math::abs(v - float(alpha[i]));
+				if (err < bestErr)
+				{
+					best = k;
+					bestErr = err;
+				}
+			}
+			bits |= (unsigned long long)best << (16 + 3 * i);
+		}
+	block[0] = (unsigned int)bits;
+	block[1] = (unsigned int)(bits >> 32);
+}
+
+static unsigned int floatToHalfBits(float f)
+{
+	if (!(f > 0.0f))
+		return 0;
+	f = min(f, 65504.0f);
+	//subnormal halfs
+	if (f < 6.103515625e-05f)
+		return (unsigned int)(f * 16777216.0f + 0.5f);
+	unsigned int b = (unsigned int)float_as_int_(f);
+	unsigned int h = (((b >> 23) - 112) << 10) | ((b >> 13) & 0x3ff);
+	//rounding may carry into the exponent which is still correct
+	h += (b >> 12) & 1;
+	return min(h, 0x7bffu);
+}
+
+//rgb is linear, the endpoints are fitted to the half float bit patterns divided by 32
+static void encodeBC6(const Vec3f* rgb, unsigned int* block)
+{
+	Vec3f q[16];
+	for (int i = 0; i < 16; i++)
+		q[i] = Vec3f((float)floatToHalfBits(rgb[i].x), (float)floatToHalfBits(rgb[i].y), (float)floatToHalfBits(rgb[i].z)) / 32.0f;
+	Vec3f lo, hi;
+	fitLine(q, 16, lo, hi);
+	//the largest finite half is 0x7bff
+	auto quantize = [](float f) {return (unsigned int)math::clamp(f + 0.5f, 0.0f, 991.0f); };
+	unsigned int e0[3] = { quantize(lo.x), quantize(lo.y), quantize(lo.z) }, e1[3] = { quantize(hi.x), quantize(hi.y), quantize(hi.z) };
+	Vec3f palette[16];
+	for (unsigned int k = 0; k < 16; k++)
+	{
+		unsigned int w = bc6Weight(k);
+		palette[k] = Vec3f(float(e0[0] * (64 - w) + e1[0] * w), float(e0[1] * (64 - w) + e1[1] * w), float(e0[2] * (64 - w) + e1[2] * w)) / 64.0f;
+	}
+	block[0] = e0[0] | (e0[1] << 10) | (e0[2] << 20);
+	block[1] = e1[0] | (e1[1] << 10) | (e1[2] << 20);
+	block[2] = block[3] = 0;
+	for (int i = 0; i < 16; i++)
+		block[2 + i / 8] |= nearestIndex(q[i], palette) << (4 * (i % 8));
+}
+
+Texture_DataType ChooseBlockFormat(const imgData& img)
+{
+	if (img.t() == vtRGBE)
+		return vtBC6;
+	const RGBCOL* texels = (const RGBCOL*)img.d();
+	for (int i = 0; i < img.w() * img.h(); i++)
+		if (texels[i].w != 255)
+			return vtBC3;
+	return vtBC1;
+}
+
+void CompressImage(const imgData& img, Texture_DataType type, unsigned int* blocks)
+{
+	if (!isBlockCompressed(type) || (type == vtBC6) != (img.t() == vtRGBE))
+		throw std::runtime_error("Invalid block compression format for image!");
+	const int W = img.w(), H = img.h(), bw = (W + 3) / 4, bh = (H + 3) / 4;
+	const unsigned int words = type == vtBC1 ? 2 : 4;
+	ThreadPool::getGlobalPool().ParallelFor(bh, [&](unsigned int by, unsigned int)
+	{
+		Vec3f rgb[16];
+		unsigned char alpha[16];
+		for (int bx = 0; bx < bw; bx++)
+		{
+			//partially covered blocks repeat the border texels
+			for (int i = 0; i < 16; i++)
+			{
+				int x = min(bx * 4 + i % 4, W - 1), y = min((int)by * 4 + i / 4, H - 1);
+				if (img.t() == vtRGBE)
+					rgb[i] = SpectrumConverter::RGBEToFloat3(((const RGBE*)img.d())[y * W + x]);
+				else
+				{
+					RGBCOL c = ((const RGBCOL*)img.d())[y * W + x];
+					rgb[i] = SpectrumConverter::COLORREFToFloat3(c);
+					alpha[i] = c.w;
+				}
+			}
+			unsigned int* block = blocks + (by * bw + bx) * words;
+			if (type == vtBC6)
+				encodeBC6(rgb, block);
+			else if (type == vtBC3)
+			{
+				encodeBC4(alpha, block);
+				encodeBC1(rgb, block + 2);
+			}
+			else encodeBC1(rgb, block);
+		}
+	});
+}
+
+}
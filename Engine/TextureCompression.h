@@ -0,0 +1,99 @@
+#pragma once
+#include "MIPMap_device.h"
+
+namespace CudaTracerLib {
+
+//Block compressed texel formats, every block stores 4x4 texels, the blocks of a level are stored row by row.
+//Blocks at the right and bottom border are only partially used for sizes which are not a multiple of 4.
+//vtBC1 : 8 bytes, two RGB565 endpoints and 2 bit indices, identical to BC1 without alpha
+//vtBC3 : 16 bytes, a BC4 block for the alpha channel followed by a BC1 block, identical to BC3
+//vtBC6 : 16 bytes, for HDR textures, similar to mode 11 of BC6H. The two endpoints store 10 bits per channel of the bit pattern of an unsigned half float,
+//        interpolating these bit patterns with the 4 bit indices is approximately logarithmic. Word 0 and 1 hold the endpoints, word 2 and 3 the indices.
+
+struct imgData;
+
+CUDA_FUNC_IN bool isBlockCompressed(Texture_DataType type)
+{
+	return type == vtBC1 || type == vtBC3 || type == vtBC6;
+}
+
+//size in bytes of a level with w x h texels
+CUDA_FUNC_IN unsigned int getTextureLevelSize(Texture_DataType type, unsigned int w, unsigned int h)
+{
+	if (!isBlockCompressed(type))
+		return w * h * 4;
+	return ((w + 3) / 4) * ((h + 3) / 4) * (type == vtBC1 ? 8 : 16);
+}
+
+//offset in words of the block containing texel (x, y) of a level with width w
+CUDA_FUNC_IN unsigned int getTextureBlockOffset(Texture_DataType type, unsigned int w, unsigned int x, unsigned int y)
+{
+	return ((y / 4) * ((w + 3) / 4) + x / 4) * (type == vtBC1 ? 2 : 4);
+}
+
+CUDA_FUNC_IN Vec3f decodeRGB565(unsigned int c)
+{
+	return Vec3f(float((c >> 11) & 31) / 31.0f, float((c >> 5) & 63) / 63.0f, float(c & 31) / 31.0f);
+}
+
+//texel i of a BC1 block in [0, 1]
+CUDA_FUNC_IN Vec3f decodeBC1(const unsigned int* block, unsigned int i)
+{
+	unsigned int c0 = block[0] & 0xffff, c1 = block[0] >> 16, idx = (block[1] >> (2 * i)) & 3;
+	if (idx < 2)
+		return decodeRGB565(idx == 0 ? c0 : c1);
+	Vec3f a = decodeRGB565(c0), b = decodeRGB565(c1);
+	if (c0 > c1)
+		return idx == 2 ? (a * 2.0f + b) / 3.0f : (a + b * 2.0f) / 3.0f;
+	return idx == 2 ? (a + b) / 2.0f : Vec3f(0.0f);
+}
+
+//alpha of texel i of a BC4 block in [0, 1]
+CUDA_FUNC_IN float decodeBC4(const unsigned int* block, unsigned int i)
+{
+	unsigned long long bits = block[0] | ((unsigned long long)block[1] << 32);
+	unsigned int a0 = block[0] & 255, a1 = (block[0] >> 8) & 255, idx = (unsigned int)(bits >> (16 + 3 * i)) & 7;
+	float a;
+	if (idx < 2)
+		a = float(idx == 0 ? a0 : a1);
+	else if (a0 > a1)
+		a = float((8 - idx) * a0 + (idx - 1) * a1) / 7.0f;
+	else a = idx == 6 ? 0.0f : idx == 7 ? 255.0f : float((6 - idx) * a0 + (idx - 1) * a1) / 5.0f;
+	return a / 255.0f;
+}
+
+//weight of the second endpoint in 1/64 for the 4 bit indices of BC6H
+CUDA_FUNC_IN unsigned int bc6Weight(unsigned int idx)
+{
+	return (idx * 64 + 7) / 15;
+}
+
+//converts the bit pattern of a finite non negative half float
+CUDA_FUNC_IN float halfBitsToFloat(unsigned int h)
+{
+	unsigned int e = h >> 10, m = h & 0x3ff;
+	if (e == 0)
+		return float(m) / 16777216.0f;
+	return int_as_float_(((e + 112) << 23) | (m << 13));
+}
+
+//texel i of a vtBC6 block
+CUDA_FUNC_IN Vec3f decodeBC6(const unsigned int* block, unsigned int i)
+{
+	unsigned int w = bc6Weight((block[2 + i / 8] >> (4 * (i % 8))) & 15);
+	float c[3];
+	for (int j = 0; j < 3; j++)
+	{
+		unsigned int e0 = (block[0] >> (10 * j)) & 1023, e1 = (block[1] >> (10 * j)) & 1023;
+		c[j] = halfBitsToFloat((e0 * (64 - w) + e1 * w) >> 1);
+	}
+	return Vec3f(c[0], c[1], c[2]);
+}
+
+//chooses vtBC6 for HDR images, vtBC1 for opaque and vtBC3 for transparent LDR images
+Texture_DataType ChooseBlockFormat(const imgData& img);
+
+//encodes all blocks of the image in parallel, blocks has to hold getTextureLevelSize(type, img.w(), img.h()) bytes
+void CompressImage(const imgData& img, Texture_DataType type, unsigned int* blocks);
+
+}
@@ -0,0 +1,267 @@
+#include "StdAfx.h"
+#include "TextureTileCache.h"
+#include <Base/FileStream.h>
+#include <Base/CudaMemoryManager.h>
+#include <algorithm>
+#include <climits>
+
+namespace CudaTracerLib {
+
+TextureTileCache::TextureTileCache(size_t tileMemory, unsigned int tileSize, unsigned int maxPages)
+	: m_uTileSize(tileSize), m_uNumPages(maxPages), m_uClock(1), m_uDirtyFirst(UINT_MAX), m_uDirtyEnd(0), m_uNumLoaded(0)
+{
+	//block compressed tiles have to consist of whole blocks
+	if (tileSize < 4 || (tileSize & (tileSize - 1)))
+		throw std::runtime_error(format("Invalid texture tile size %u, it has to be a power of two of at least 4!", tileSize));
+	unsigned int slotWords = tileSize * tileSize;
+	m_uNumSlots = (unsigned int)min(tileMemory / (slotWords * 4), size_t(UINT_MAX - 1));
+	if (!m_uNumSlots || !maxPages)
+		throw std::runtime_error("The texture tile cache has to hold at least one tile and one page!");
+
+	m_sDevice.m_uSlotWords = m_sHost.m_uSlotWords = slotWords;
+	CUDA_MALLOC(&m_sDevice.m_pPageTable, maxPages * sizeof(unsigned int));
+	CUDA_MALLOC(&m_sDevice.m_pRequests, maxPages);
+	CUDA_MALLOC(&m_sDevice.m_pUsed, m_uNumSlots);
+	CUDA_MALLOC(&m_sDevice.m_pTiles, size_t(m_uNumSlots) * slotWords * 4);
+	m_sHost.m_pPageTable = (unsigned int*)malloc(maxPages * sizeof(unsigned int));
+	m_sHost.m_pRequests = (unsigned char*)malloc(maxPages);
+	m_sHost.m_pUsed = (unsigned char*)malloc(m_uNumSlots);
+	m_sHost.m_pTiles = (unsigned int*)malloc(size_t(m_uNumSlots) * slotWords * 4);
+	memset(m_sHost.m_pPageTable, 0xff, maxPages * sizeof(unsigned int));
+	memset(m_sHost.m_pRequests, 0, maxPages);
+	memset(m_sHost.m_pUsed, 0, m_uNumSlots);
+	CUDA_MEMCPY_TO_DEVICE(m_sDevice.m_pPageTable, m_sHost.m_pPageTable, maxPages * sizeof(unsigned int));
+	ThrowCudaErrors(cudaMemset(m_sDevice.m_pRequests, 0, maxPages));
+	ThrowCudaErrors(cudaMemset(m_sDevice.m_pUsed, 0, m_uNumSlots));
+
+	m_slotPages.assign(m_uNumSlots, UINT_MAX);
+	m_slotLastUse.assign(m_uNumSlots, 0);
+	m_slotPinned.assign(m_uNumSlots, false);
+	m_freePages[0] = maxPages;
+}
+
+TextureTileCache::~TextureTileCache()
+{
+	CUDA_FREE(m_sDevice.m_pPageTable);
+	CUDA_FREE(m_sDevice.m_pRequests);
+	CUDA_FREE(m_sDevice.m_pUsed);
+	CUDA_FREE(m_sDevice.m_pTiles);
+	free(m_sHost.m_pPageTable);
+	free(m_sHost.m_pRequests);
+	free(m_sHost.m_pUsed);
+	free(m_sHost.m_pTiles);
+}
+
+void TextureTileCache::setPage(unsigned int page, unsigned int slot)
+{
+	m_sHost.m_pPageTable[page] = slot;
+	m_uDirtyFirst = min(m_uDirtyFirst, page);
+	m_uDirtyEnd = max(m_uDirtyEnd, page + 1);
+}
+
+void TextureTileCache::uploadPageTable()
+{
+	if (m_uDirtyFirst >= m_uDirtyEnd)
+		return;
+	CUDA_MEMCPY_TO_DEVICE(m_sDevice.m_pPageTable + m_uDirtyFirst, m_sHost.m_pPageTable + m_uDirtyFirst, (m_uDirtyEnd - m_uDirtyFirst) * sizeof(unsigned int));
+	m_uDirtyFirst = UINT_MAX;
+	m_uDirtyEnd = 0;
+}
+
+//Move only takes int offsets
+static void moveTo(IInStream& in, size_t pos)
+{
+	long long off = (long long)pos - (long long)in.getPos();
+	while (off != 0)
+	{
+		int n = (int)max((long long)INT_MIN + 1, min((long long)INT_MAX, off));
+		in.Move(n);
+		off -= n;
+	}
+}
+
+void TextureTileCache::loadTiles(unsigned int firstPage, const TileFile& file, const std::vector<std::pair<unsigned int, unsigned int>>& pageSlots)
+{
+	IInStream* in = OpenFile(file.path);
+	for (auto& ps : pageSlots)
+	{
+		moveTo(*in, file.offset + size_t(ps.first - firstPage) * file.tileBytes);
+		unsigned int* tile = m_sHost.m_pTiles + size_t(ps.second) * m_sHost.m_uSlotWords;
+		in->Read(tile, file.tileBytes);
+		CUDA_MEMCPY_TO_DEVICE(m_sDevice.m_pTiles + size_t(ps.second) * m_sDevice.m_uSlotWords, tile, file.tileBytes);
+		m_slotPages[ps.second] = ps.first;
+		m_slotLastUse[ps.second] = m_uClock;
+		setPage(ps.first, ps.second);
+		m_uNumLoaded++;
+	}
+	in->Close();
+	delete in;
+}
+
+unsigned int TextureTileCache::Register(const std::string& file, size_t offset, unsigned int numPages, unsigned int numPinnedPages, unsigned int tileBytes,
+										const std::function<void()>& release)
+{
+	if (tileBytes > m_sHost.m_uSlotWords * 4)
+		throw std::runtime_error(format("The tiles of %s are larger than the slots of the texture tile cache!", file.c_str()));
+	if (!numPinnedPages || numPinnedPages > numPages)
+		throw std::runtime_error(format("Invalid number of pinned tiles %u of %s!", numPinnedPages, file.c_str()));
+	auto range = std::find_if(m_freePages.begin(), m_freePages.end(), [&](const std::pair<const unsigned int, unsigned int>& r) {return r.second >= numPages; });
+	if (range == m_freePages.end())
+		throw std::runtime_error(format("Not enough pages left in the texture tile cache for %s!", file.c_str()));
+
+	//the pinned coarsest level takes free slots first, then the least recently used ones
+	std::vector<unsigned int> slots;
+	for (unsigned int i = 0; i < m_uNumSlots; i++)
+		if (!m_slotPinned[i])
+			slots.push_back(i);
+	if (slots.size() < numPinnedPages)
+		throw std::runtime_error(format("The %u tiles of the coarsest level of %s do not fit into the %u unpinned slots of the texture tile cache!",
+			numPinnedPages, file.c_str(), (unsigned int)slots.size()));
+	std::partial_sort(slots.begin(), slots.begin() + numPinnedPages, slots.end(), [&](unsigned int a, unsigned int b)
+	{
+		bool freeA = m_slotPages[a] == UINT_MAX, freeB = m_slotPages[b] == UINT_MAX;
+		return freeA != freeB ? freeA : m_slotLastUse[a] < m_slotLastUse[b];
+	});
+
+	unsigned int firstPage = range->first, n = range->second;
+	m_freePages.erase(range);
+	if (n > numPages)
+		m_freePages[firstPage + numPages] = n - numPages;
+	const TileFile& f = m_files[firstPage] = TileFile{ file, offset, numPages, tileBytes, release };
+
+	std::vector<std::pair<unsigned int, unsigned int>> pageSlots;
+	for (unsigned int i = 0; i < numPinnedPages; i++)
+	{
+		unsigned int slot = slots[i];
+		if (m_slotPages[slot] != UINT_MAX)
+			setPage(m_slotPages[slot], UINT_MAX);
+		m_slotPinned[slot] = true;
+		pageSlots.push_back(std::make_pair(firstPage + numPages - numPinnedPages + i, slot));
+	}
+	loadTiles(firstPage, f, pageSlots);
+	uploadPageTable();
+	return firstPage;
+}
+
+void TextureTileCache::Unregister(unsigned int firstPage)
+{
+	auto it = m_files.find(firstPage);
+	if (it == m_files.end())
+		return;
+	unsigned int numPages = it->second.numPages;
+	for (unsigned int i = 0; i < m_uNumSlots; i++)
+		if (m_slotPages[i] != UINT_MAX && m_slotPages[i] >= firstPage && m_slotPages[i] < firstPage + numPages)
+		{
+			setPage(m_slotPages[i], UINT_MAX);
+			m_slotPages[i] = UINT_MAX;
+			m_slotPinned[i] = false;
+		}
+	uploadPageTable();
+	std::function<void()> release = it->second.release;
+	m_files.erase(it);
+	if (release)
+		release();
+
+	//merge with the adjacent free ranges
+	auto next = m_freePages.lower_bound(firstPage);
+	if (next != m_freePages.end() && next->first == firstPage + numPages)
+	{
+		numPages += next->second;
+		next = m_freePages.erase(next);
+	}
+	if (next != m_freePages.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == firstPage)
+		{
+			prev->second += numPages;
+			return;
+		}
+	}
+	m_freePages[firstPage] = numPages;
+}
+
+bool TextureTileCache::usesFile(const std::string& file) const
+{
+	for (auto& f : m_files)
+		if (f.second.path == file)
+			return true;
+	return false;
+}
+
+void TextureTileCache::WriteTiles(unsigned int firstPage, FileOutputStream& a_Out)
+{
+	auto it = m_files.find(firstPage);
+	if (it == m_files.end())
+		throw std::runtime_error(format("No texture is registered at page %u of the texture tile cache!", firstPage));
+	const TileFile& file = it->second;
+	IInStream* in = OpenFile(file.path);
+	moveTo(*in, file.offset);
+	std::vector<unsigned char> buf(SECTION_BLOCK_SIZE);
+	for (size_t left = size_t(file.numPages) * file.tileBytes; left;)
+	{
+		size_t n = min(left, buf.size());
+		in->Read(&buf[0], n);
+		a_Out.Write(&buf[0], n);
+		left -= n;
+	}
+	in->Close();
+	delete in;
+}
+
+unsigned int TextureTileCache::Update(unsigned int maxTiles)
+{
+	//the flags can be set by kernels on both sides
+	std::vector<unsigned char> requests(m_uNumPages), used(m_uNumSlots);
+	CUDA_MEMCPY_TO_HOST(&requests[0], m_sDevice.m_pRequests, m_uNumPages);
+	CUDA_MEMCPY_TO_HOST(&used[0], m_sDevice.m_pUsed, m_uNumSlots);
+	for (unsigned int i = 0; i < m_uNumSlots; i++)
+		if (used[i] || m_sHost.m_pUsed[i])
+			m_slotLastUse[i] = m_uClock;
+	//requests of textures which were unregistered in the meantime are ignored
+	std::vector<unsigned int> pages;
+	for (unsigned int i = 0; i < m_uNumPages; i++)
+		if ((requests[i] || m_sHost.m_pRequests[i]) && m_sHost.m_pPageTable[i] == UINT_MAX)
+		{
+			auto file = m_files.upper_bound(i);
+			if (file != m_files.begin() && i < std::prev(file)->first + std::prev(file)->second.numPages)
+				pages.push_back(i);
+		}
+	memset(m_sHost.m_pRequests, 0, m_uNumPages);
+	memset(m_sHost.m_pUsed, 0, m_uNumSlots);
+	ThrowCudaErrors(cudaMemset(m_sDevice.m_pRequests, 0, m_uNumPages));
+	ThrowCudaErrors(cudaMemset(m_sDevice.m_pUsed, 0, m_uNumSlots));
+
+	//free slots first, then the least recently used ones, tiles used in the last pass are kept
+	std::vector<unsigned int> slots;
+	for (unsigned int i = 0; i < m_uNumSlots; i++)
+		if (!m_slotPinned[i] && (m_slotPages[i] == UINT_MAX || m_slotLastUse[i] < m_uClock))
+			slots.push_back(i);
+	std::sort(slots.begin(), slots.end(), [&](unsigned int a, unsigned int b)
+	{
+		bool freeA = m_slotPages[a] == UINT_MAX, freeB = m_slotPages[b] == UINT_MAX;
+		return freeA != freeB ? freeA : m_slotLastUse[a] < m_slotLastUse[b];
+	});
+	m_uClock++;
+	size_t n = min(min(pages.size(), slots.size()), (size_t)maxTiles);
+	for (size_t i = 0; i < n; i++)
+		if (m_slotPages[slots[i]] != UINT_MAX)
+		{
+			setPage(m_slotPages[slots[i]], UINT_MAX);
+			m_slotPages[slots[i]] = UINT_MAX;
+		}
+
+	//the requested pages are sorted, the tiles of one texture are loaded together
+	for (size_t i = 0; i < n;)
+	{
+		auto file = std::prev(m_files.upper_bound(pages[i]));
+		std::vector<std::pair<unsigned int, unsigned int>> pageSlots;
+		for (; i < n && pages[i] < file->first + file->second.numPages; i++)
+			pageSlots.push_back(std::make_pair(pages[i], slots[i]));
+		loadTiles(file->first, file->second, pageSlots);
+	}
+	uploadPageTable();
+	return (unsigned int)n;
+}
+
+}
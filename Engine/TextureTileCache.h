@@ -0,0 +1,92 @@
+#pragma once
+#include "MIPMap_device.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <climits>
+#include <functional>
+
+namespace CudaTracerLib {
+
+class FileOutputStream;
+
+//Fixed size cache of texture tiles for textures which do not fit into memory.
+//Every tiled texture reserves one page per tile of all its levels, the page table maps the pages to the slots of the cache.
+//Kernels accessing a page which is not resident set its request flag and use a coarser level instead, Update loads the requested tiles
+//between the passes and evicts the least recently used ones. All tiles of the coarsest level of every texture are pinned, therefore a texel can always be found.
+class TextureTileCache
+{
+	struct TileFile
+	{
+		std::string path;
+		//position of the first tile in the file
+		size_t offset;
+		unsigned int numPages;
+		unsigned int tileBytes;
+		//called when the texture is unregistered and the file is not read anymore
+		std::function<void()> release;
+	};
+	unsigned int m_uTileSize;
+	unsigned int m_uNumSlots;
+	unsigned int m_uNumPages;
+	KernelTextureTileCache m_sDevice, m_sHost;
+	//page of every slot or UINT_MAX if the slot is free
+	std::vector<unsigned int> m_slotPages;
+	std::vector<unsigned long long> m_slotLastUse;
+	std::vector<bool> m_slotPinned;
+	unsigned long long m_uClock;
+	//registered textures by their first page and free page ranges by their first page
+	std::map<unsigned int, TileFile> m_files;
+	std::map<unsigned int, unsigned int> m_freePages;
+	//range of the page table which has to be uploaded
+	unsigned int m_uDirtyFirst, m_uDirtyEnd;
+	size_t m_uNumLoaded;
+
+	void setPage(unsigned int page, unsigned int slot);
+	void uploadPageTable();
+	//loads the tiles of a file, pageSlots is sorted by the pages
+	void loadTiles(unsigned int firstPage, const TileFile& file, const std::vector<std::pair<unsigned int, unsigned int>>& pageSlots);
+public:
+	//tileMemory is the size of the tile storage in bytes, on the device and on the host, maxPages the number of tiles of all registered textures
+	CTL_EXPORT TextureTileCache(size_t tileMemory, unsigned int tileSize = 64, unsigned int maxPages = 1 << 20);
+	CTL_EXPORT ~TextureTileCache();
+
+	//reserves the pages of a texture whose tiles of tileBytes each are stored consecutively at offset in the file
+	//the last numPinnedPages pages, the coarsest level, are loaded immediately and never evicted, returns the first page
+	//throws if they do not fit into the slots which are not pinned yet
+	//release is called by Unregister, e.g. to unpin the file in the AssetCache, it is not called if the registration fails
+	CTL_EXPORT unsigned int Register(const std::string& file, size_t offset, unsigned int numPages, unsigned int numPinnedPages, unsigned int tileBytes,
+									 const std::function<void()>& release = std::function<void()>());
+	CTL_EXPORT void Unregister(unsigned int firstPage);
+	//true if the tiles of a registered texture are read from file
+	CTL_EXPORT bool usesFile(const std::string& file) const;
+	//copies all tiles of the texture registered at firstPage from its file
+	CTL_EXPORT void WriteTiles(unsigned int firstPage, FileOutputStream& a_Out);
+	//loads the tiles requested since the last call, at most maxTiles of them, and returns their number
+	CTL_EXPORT unsigned int Update(unsigned int maxTiles = UINT_MAX);
+
+	KernelTextureTileCache getKernelData(bool device) const
+	{
+		return device ? m_sDevice : m_sHost;
+	}
+	unsigned int getTileSize() const
+	{
+		return m_uTileSize;
+	}
+	unsigned int getNumSlots() const
+	{
+		return m_uNumSlots;
+	}
+	//number of tiles loaded since the creation, including the pinned ones
+	size_t getNumLoadedTiles() const
+	{
+		return m_uNumLoaded;
+	}
+	//size of the tile storage, the page table and the flags on one side
+	size_t getSizeInBytes() const
+	{
+		return size_t(m_uNumSlots) * m_sDevice.m_uSlotWords * 4 + size_t(m_uNumPages) * 5 + m_uNumSlots;
+	}
+};
+
+}
@@ -60,4 +60,65 @@ bool TriIntersectorData::Intersect(const Ray& r, float* dist, Vec2f* bary) const
 	return false;
 }
 
-}
\ No newline at end of file
+//returns the smallest quantized value whose dequantized position is <= v (ROUND_UP = false) respectively >= v
+template<bool ROUND_UP> static unsigned int quantizePlane(float v, float origin, float step)
+{
+	int q = ROUND_UP ? (int)ceilf((v - origin) / step) : (int)floorf((v - origin) / step);
+	q = math::clamp(q, 0, 255);
+	if (ROUND_UP)
+		while (q < 255 && origin + q * step < v)
+			q++;
+	else
+		while (q > 0 && origin + q * step > v)
+			q--;
+	return (unsigned int)q;
+}
+
+void BVHNodeDataQuantized::setData(const BVHNodeData& node)
+{
+	AABB boxes[2];
+	node.getBox(boxes[0], boxes[1]);
+	bool empty[2];
+	AABB box = AABB::Identity();
+	for (int i = 0; i < 2; i++)
+	{
+		empty[i] = boxes[i].minV.x > boxes[i].maxV.x || boxes[i].minV.y > boxes[i].maxV.y || boxes[i].minV.z > boxes[i].maxV.z;
+		if (!empty[i])
+			box = box.Extend(boxes[i]);
+	}
+	if (empty[0] && empty[1])
+		box = AABB(Vec3f(0.0f), Vec3f(0.0f));
+
+	//power of two step sizes make the dequantization exact up to the final addition
+	unsigned int exps = 0;
+	float steps[3];
+	for (int d = 0; d < 3; d++)
+	{
+		float extent = box.maxV[d] - box.minV[d];
+		int e = extent > 0.0f ? (int)ceilf(log2f(extent / 255.0f)) + 127 : 1;
+		e = math::clamp(e, 1, 254);
+		while (e < 254 && box.minV[d] + 255.0f * int_as_float_(e << 23) < box.maxV[d])
+			e++;
+		steps[d] = int_as_float_(e << 23);
+		exps |= (unsigned int)e << (8 * d);
+	}
+
+	unsigned int q[12];
+	for (int i = 0; i < 2; i++)
+		for (int d = 0; d < 3; d++)
+		{
+			//empty children are collapsed to a point at the origin
+			q[i * 6 + d * 2 + 0] = empty[i] ? 0 : quantizePlane<false>(boxes[i].minV[d], box.minV[d], steps[d]);
+			q[i * 6 + d * 2 + 1] = empty[i] ? 0 : quantizePlane<true>(boxes[i].maxV[d], box.minV[d], steps[d]);
+		}
+
+	a = Vec4f(box.minV.x, box.minV.y, box.minV.z, int_as_float_((int)exps));
+	int packed[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 12; i++)
+		packed[i / 4] |= (int)(q[i] << (8 * (i % 4)));
+	b = Vec4f(int_as_float_(packed[0]), int_as_float_(packed[1]), int_as_float_(packed[2]), 0.0f);
+	Vec2i children = node.getChildren();
+	c = Vec4f(int_as_float_(convertAddress(children.x)), int_as_float_(convertAddress(children.y)), 0.0f, 0.0f);
+}
+
+}
@@ -116,4 +116,54 @@ struct BVHNodeData
 	}
 };
 
-}
\ No newline at end of file
+//Compressed alternative to BVHNodeData with the child boxes quantized to 8 bit per plane relative to the union of both children.
+//The dequantized boxes are conservative. Addresses are in float4 units as well, inner nodes are referenced by node * 3 instead of node * 4.
+struct BVHNodeDataQuantized
+{
+	//      a = Vec4f(origin.x, origin.y, origin.z, biased exponents of the x, y and z step size in byte 0 - 2)
+	//      b = 12 bytes (c0.lo.x, c0.hi.x, c0.lo.y, c0.hi.y, c0.lo.z, c0.hi.z, c1.lo.x, c1.hi.x, c1.lo.y, c1.hi.y, c1.lo.z, c1.hi.z), unused
+	//      c = Vec4f(child_index0, child_index1, unused, unused)
+	Vec4f a, b, c;
+
+	//converts a node address of the BVHNodeData layout to the quantized layout
+	CUDA_FUNC_IN static int convertAddress(int addr)
+	{
+		return addr >= 0 && addr != 0x76543210 ? addr / 4 * 3 : addr;
+	}
+
+	CUDA_FUNC_IN Vec2i getChildren() const
+	{
+		return *(Vec2i*)&c;
+	}
+
+	//decodes the first two float4 of a node into the layout of the first three float4 of BVHNodeData
+	template<typename T> CUDA_FUNC_IN static void decode(const T& q0, const T& q1, T& n0xy, T& n1xy, T& nz)
+	{
+		unsigned int e = (unsigned int)float_as_int_(q0.w);
+		float sx = int_as_float_((e & 0xff) << 23), sy = int_as_float_(((e >> 8) & 0xff) << 23), sz = int_as_float_(((e >> 16) & 0xff) << 23);
+		unsigned int b0 = (unsigned int)float_as_int_(q1.x), b1 = (unsigned int)float_as_int_(q1.y), b2 = (unsigned int)float_as_int_(q1.z);
+#define QBYTE(w, i) (float)(((w) >> (8 * (i))) & 0xff)
+		n0xy.x = q0.x + QBYTE(b0, 0) * sx; n0xy.y = q0.x + QBYTE(b0, 1) * sx;
+		n0xy.z = q0.y + QBYTE(b0, 2) * sy; n0xy.w = q0.y + QBYTE(b0, 3) * sy;
+		nz.x = q0.z + QBYTE(b1, 0) * sz; nz.y = q0.z + QBYTE(b1, 1) * sz;
+		n1xy.x = q0.x + QBYTE(b1, 2) * sx; n1xy.y = q0.x + QBYTE(b1, 3) * sx;
+		n1xy.z = q0.y + QBYTE(b2, 0) * sy; n1xy.w = q0.y + QBYTE(b2, 1) * sy;
+		nz.z = q0.z + QBYTE(b2, 2) * sz; nz.w = q0.z + QBYTE(b2, 3) * sz;
+#undef QBYTE
+	}
+
+	CUDA_FUNC_IN void getBox(AABB& left, AABB& right) const
+	{
+		Vec4f n0xy, n1xy, nz;
+		decode(a, b, n0xy, n1xy, nz);
+		left.minV = Vec3f(n0xy.x, n0xy.z, nz.x);
+		left.maxV = Vec3f(n0xy.y, n0xy.w, nz.y);
+		right.minV = Vec3f(n1xy.x, n1xy.z, nz.z);
+		right.maxV = Vec3f(n1xy.y, n1xy.w, nz.w);
+	}
+
+	//quantizes the boxes of node and converts the child addresses
+	CTL_EXPORT CUDA_HOST void setData(const BVHNodeData& node);
+};
+
+}
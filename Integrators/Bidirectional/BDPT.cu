@@ -113,6 +113,19 @@ void BDPT::RenderBlock(Image* I, int x, int y, int blockW, int blockH)
 													 m_sParameters.getValue(KEY_UseMis()), m_sParameters.getValue(KEY_Force_s()), m_sParameters.getValue(KEY_Force_t()), m_sParameters.getValue(KEY_ResultMultiplier()));
 }
 
+void BDPT::RenderBlockHost(Image* I, int x, int y, int blockW, int blockH)
+{
+	bool use_mis = m_sParameters.getValue(KEY_UseMis());
+	int force_s = m_sParameters.getValue(KEY_Force_s()), force_t = m_sParameters.getValue(KEY_Force_t());
+	float LScale = m_sParameters.getValue(KEY_ResultMultiplier());
+	for (int py = y; py < y + blockH && py < (int)h; py++)
+		for (int px = x; px < x + blockW && px < (int)w; px++)
+		{
+			auto rng = g_SamplerData(py * w + px);
+			BPT(Vec2f(px + rng.randomFloat(), py + rng.randomFloat()), *I, rng, w, h, use_mis, force_s, force_t, LScale);
+		}
+}
+
 void BDPT::DebugInternal(Image* I, const Vec2i& pixel)
 {
 	auto rng = g_SamplerData(pixel.y * I->getWidth() + pixel.x);
@@ -162,8 +162,9 @@ void VCM::StartNewTrace(Image* I)
 int gridLength = 250;
 int numPhotons = 1024 * 1024 * MAX_SUB_PATH_LENGTH;
 VCM::VCM()
-	: m_sPhotonMapsCurrent(Vec3u(gridLength), numPhotons), m_sPhotonMapsNext(Vec3u(gridLength), numPhotons)
+	: m_photonMapScope("PhotonMaps"), m_sPhotonMapsCurrent(Vec3u(gridLength), numPhotons), m_sPhotonMapsNext(Vec3u(gridLength), numPhotons)
 {
+	m_photonMapScope.End();
 }
 
 }
\ No newline at end of file
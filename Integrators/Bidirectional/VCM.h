@@ -14,6 +14,8 @@ protected:
 	CTL_EXPORT virtual void StartNewTrace(Image* I);
 	CTL_EXPORT virtual void RenderBlock(Image* I, int x, int y, int blockW, int blockH);
 private:
+	//accounts the photon maps created in the constructor, has to be declared before them
+	CudaMemoryScope m_photonMapScope;
 	//current will be used for lookup, next will be stored in
 	VCMSurfMap m_sPhotonMapsCurrent, m_sPhotonMapsNext;
 	float m_fInitialRadius;
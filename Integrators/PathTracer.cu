@@ -19,6 +19,8 @@ template<bool DIRECT> CUDA_FUNC_IN Spectrum PathTrace(NormalizedT<Ray>& r, const
 	TraceResult r2;
 	float brdf_scattering_pdf = 0;
 	NormalizedT<Vec3f> last_nor;
+	OccluderCache occluder;
+	occluder.Init();
 	while (depth++ < maxPathLength)
 	{
 		r2 = traceRay(r);
@@ -38,7 +40,7 @@ template<bool DIRECT> CUDA_FUNC_IN Spectrum PathTrace(NormalizedT<Ray>& r, const
 				{
 					PhaseFunctionSamplingRecord pRec(-r.dir(), dRec.d);
 					float p = V.p(mRec.p, pRec);
-					if (p != 0 && !g_SceneData.Occluded(Ray(dRec.ref, dRec.d), 0, dRec.dist))
+					if (p != 0 && !g_SceneData.Occluded(Ray(dRec.ref, dRec.d), 0, dRec.dist, occluder))
 					{
 						const float bsdfPdf = p;//phase functions are normalized
 						const float weight = MonteCarlo::PowerHeuristic(1, dRec.pdf, 1, bsdfPdf);
@@ -79,7 +81,7 @@ template<bool DIRECT> CUDA_FUNC_IN Spectrum PathTrace(NormalizedT<Ray>& r, const
 			Spectrum f = r2.getMat().bsdf.sample(bRec, brdf_scattering_pdf, rnd.randomFloat2());
 			last_nor = bRec.dg.sys.n;
 			if (DIRECT && r2.getMat().bsdf.hasComponent(ESmooth))
-				cl += cf * UniformSampleOneLight(bRec, r2.getMat(), rnd, true);
+				cl += cf * UniformSampleOneLight(bRec, r2.getMat(), rnd, true, true, &occluder);
 			specularBounce = (bRec.sampledType & EDelta) != 0;
 			cf = cf * f;
 			r = NormalizedT<Ray>(bRec.dg.P, bRec.getOutgoing());
@@ -179,26 +181,44 @@ void PathTracer::DebugInternal(Image* I, const Vec2i& p)
 	PathTrace<true>(r, rX, rY, rng, maxPathLength, rrStart);
 }
 
+template<bool DIRECT, bool REGU> CUDA_FUNC_IN void pathPixel(const Vec2i& pixel, Sampler& rng, Image& img, float m, int maxPathLength, int rrStart)
+{
+	NormalizedT<Ray> r, rX, rY;
+	Vec2f pX = Vec2f(pixel.x, pixel.y) + rng.randomFloat2();
+	Spectrum imp = g_SceneData.sampleSensorRay(r, rX, rY, pX, rng.randomFloat2());
+	Spectrum col = imp * (REGU ? PathTraceRegularization<DIRECT>(r, rX, rY, rng, m, maxPathLength, rrStart) : PathTrace<DIRECT>(r, rX, rY, rng, maxPathLength, rrStart));
+	img.AddSample(pX.x, pX.y, col);
+}
+
 template<bool DIRECT, bool REGU> __global__ void pathKernel2(unsigned int w, unsigned int h, unsigned int xoff, unsigned int yoff, Image img, float m, int maxPathLength, int rrStart)
 {
 	Vec2i pixel = TracerBase::getPixelPos(xoff, yoff);
 	auto rng = g_SamplerData(TracerBase::getPixelIndex(xoff, yoff, w, h));
 	if (pixel.x < w && pixel.y < h)
-	{
-		NormalizedT<Ray> r, rX, rY;
-		Vec2f pX = Vec2f(pixel.x, pixel.y) + rng.randomFloat2();
-		Spectrum imp = g_SceneData.sampleSensorRay(r, rX, rY, pX, rng.randomFloat2());
-		Spectrum col = imp * (REGU ? PathTraceRegularization<DIRECT>(r, rX, rY, rng, m, maxPathLength, rrStart) : PathTrace<DIRECT>(r, rX, rY, rng, maxPathLength, rrStart));
-		img.AddSample(pX.x, pX.y, col);
-	}
+		pathPixel<DIRECT, REGU>(pixel, rng, img, m, maxPathLength, rrStart);
 }
 
-void PathTracer::RenderBlock(Image* I, int x, int y, int blockW, int blockH)
+template<bool DIRECT, bool REGU> void pathBlockHost(unsigned int w, unsigned int h, int x, int y, int blockW, int blockH, Image& img, float m, int maxPathLength, int rrStart)
+{
+	for (int py = y; py < y + blockH && py < (int)h; py++)
+		for (int px = x; px < x + blockW && px < (int)w; px++)
+		{
+			auto rng = g_SamplerData(py * w + px);
+			pathPixel<DIRECT, REGU>(Vec2i(px, py), rng, img, m, maxPathLength, rrStart);
+		}
+}
+
+static float getRegularizationRadius(unsigned int passesDone)
 {
 	AABB m_sEyeBox = g_SceneData.m_sBox;
 	float m_fInitialRadius = (m_sEyeBox.maxV - m_sEyeBox.minV).sum() / 100;
 	float ALPHA = 0.75f;
-	float radius2 = math::pow(math::pow(m_fInitialRadius, float(2)) / math::pow(float(m_uPassesDone), 0.5f * (1 - ALPHA)), 1.0f / 2.0f);
+	return math::pow(math::pow(m_fInitialRadius, float(2)) / math::pow(float(passesDone), 0.5f * (1 - ALPHA)), 1.0f / 2.0f);
+}
+
+void PathTracer::RenderBlock(Image* I, int x, int y, int blockW, int blockH)
+{
+	float radius2 = getRegularizationRadius(m_uPassesDone);
 
 	int maxPathLength = m_sParameters.getValue(KEY_MaxPathLength()), rrStart = m_sParameters.getValue(KEY_RRStartDepth());
 
@@ -216,4 +236,24 @@ void PathTracer::RenderBlock(Image* I, int x, int y, int blockW, int blockH)
 	}
 }
 
+void PathTracer::RenderBlockHost(Image* I, int x, int y, int blockW, int blockH)
+{
+	float radius2 = getRegularizationRadius(m_uPassesDone);
+
+	int maxPathLength = m_sParameters.getValue(KEY_MaxPathLength()), rrStart = m_sParameters.getValue(KEY_RRStartDepth());
+
+	if (m_sParameters.getValue(KEY_Regularization()))
+	{
+		if (m_sParameters.getValue(KEY_Direct()))
+			pathBlockHost<true, true>(w, h, x, y, blockW, blockH, *I, radius2, maxPathLength, rrStart);
+		else pathBlockHost<false, true>(w, h, x, y, blockW, blockH, *I, radius2, maxPathLength, rrStart);
+	}
+	else
+	{
+		if (m_sParameters.getValue(KEY_Direct()))
+			pathBlockHost<true, false>(w, h, x, y, blockW, blockH, *I, radius2, maxPathLength, rrStart);
+		else pathBlockHost<false, false>(w, h, x, y, blockW, blockH, *I, radius2, maxPathLength, rrStart);
+	}
+}
+
 }
\ No newline at end of file
@@ -213,6 +213,12 @@ __global__ void primaryKernel(int width, int height, Image g_Image, bool depthIm
 //static int iterations = 0;
 void PrimTracer::DoRender(Image* I)
 {
+	if (useHostExecution())
+	{
+		Tracer<false>::DoRender(I);
+		return;
+	}
+
 	if (hasDepthBuffer())
 		CopyToSymbol(g_DepthImage2, getDeviceDepthBuffer());
 
@@ -232,6 +238,19 @@ void PrimTracer::DoRender(Image* I)
     ThrowCudaErrors(cudaDeviceSynchronize());
 }
 
+void PrimTracer::RenderBlockHost(Image* I, int x, int y, int blockW, int blockH)
+{
+	//the depth buffer is device memory and therefore not written by the host backend
+	PathTrace_DrawMode mode = m_sParameters.getValue(KEY_DrawingMode());
+	int maxPathLength = m_sParameters.getValue(KEY_MaxPathLength());
+	for (int py = y; py < y + blockH && py < (int)h; py++)
+		for (int px = x; px < x + blockW && px < (int)w; px++)
+		{
+			auto rng = g_SamplerData(py * w + px);
+			computePixel(px, py, rng, *I, false, mode, maxPathLength);
+		}
+}
+
 void PrimTracer::DebugInternal(class Image* I, const Vec2i& pixel)
 {
 	auto rng = g_SamplerData(pixel.y * I->getWidth() + pixel.x);
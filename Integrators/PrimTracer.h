@@ -19,6 +19,11 @@ public:
 protected:
 	CTL_EXPORT virtual void DoRender(Image* I);
 	CTL_EXPORT virtual void DebugInternal(Image* I, const Vec2i& pixel);
+	CTL_EXPORT virtual void RenderBlockHost(Image* I, int x, int y, int blockW, int blockH);
+	virtual bool SupportsHostExecution() const
+	{
+		return true;
+	}
 };
 
 }
\ No newline at end of file
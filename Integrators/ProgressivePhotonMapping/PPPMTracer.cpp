@@ -21,7 +21,7 @@ unsigned int ComputePhotonBlocksPerPass()
 }
 
 PPPMTracer::PPPMTracer()
-	: m_pPixelBuffer(0), m_fLightVisibility(1),
+	: m_photonMapScope("PhotonMaps"), m_pPixelBuffer(0), m_fLightVisibility(1),
 	m_fProbSurface(1), m_fProbVolume(1.0f), m_uBlocksPerLaunch(ComputePhotonBlocksPerPass()),
 	m_sSurfaceMap(Vec3u(250), (ComputePhotonBlocksPerPass() + 2) * PPM_slots_per_block), m_sSurfaceMapCaustic(0)
 {
@@ -48,6 +48,7 @@ PPPMTracer::PPPMTracer()
 		m_pVolumeEstimator->getStatusInfo(volLength, volCount);
 		m_fProbVolume = math::clamp01(volLength / (float)m_sSurfaceMap.getNumEntries());
 	}
+	m_photonMapScope.End();
 }
 
 PPPMTracer::~PPPMTracer()
@@ -97,6 +98,7 @@ void PPPMTracer::Resize(unsigned int _w, unsigned int _h)
 		m_pPixelBuffer->Free();
 		delete m_pPixelBuffer;
 	}
+	CudaMemoryScope scope("PPPMPixelBuffer");
 	m_pPixelBuffer = new SynchronizedBuffer<APPM_PixelData>(_w * _h);
 }
 
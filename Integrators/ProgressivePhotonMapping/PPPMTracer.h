@@ -148,6 +148,8 @@ public:
 class PPPMTracer : public Tracer<true>
 {
 private:
+	//accounts the photon maps created in the constructor, has to be declared before them
+	CudaMemoryScope m_photonMapScope;
 	SurfaceMapT m_sSurfaceMap;
 	SurfaceMapT* m_sSurfaceMapCaustic;
 	IVolumeEstimator* m_pVolumeEstimator;
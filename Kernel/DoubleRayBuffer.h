@@ -22,6 +22,7 @@ template<typename T> class DoubleRayBuffer
 
 		secondary_buf(unsigned int N)
 		{
+			CudaMemoryScope scope("DoubleRayBuffer");
 			CUDA_MALLOC(&m_ray_buffer, sizeof(traversalRay) * N);
 			CUDA_MALLOC(&m_res_buffer, sizeof(traversalResult) * N);
 		}
@@ -81,6 +82,7 @@ public:
 
 	//this method has an extra mode COMPUTE_INTERSCTIONS = false where no intersections are computed
 	//this can be used to re-fill already intersected buffers
+	//no traversal counters are recorded here, see TraversalStatistics for the cost of the current view
 	template<bool COMPUTE_INTERSCTIONS = true> void FinishIteration(bool skip_outer = false, bool any_hit_secondary = false)
 	{
 		if (m_insert_payload_index > m_payload_length)
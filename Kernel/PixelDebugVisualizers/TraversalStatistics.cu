@@ -0,0 +1,124 @@
+#include "TraversalStatistics.h"
+#include <Kernel/TraceHelper.h>
+#include <SceneTypes/Samples.h>
+#include <sstream>
+#include <iomanip>
+
+namespace CudaTracerLib {
+
+CUDA_FUNC_IN void traversalStatisticsPixel(unsigned int x, unsigned int y, unsigned int w, TraversalCounters& counters)
+{
+	auto rng = g_SamplerData(y * w + x);
+	NormalizedT<Ray> r, rX, rY;
+	g_SceneData.sampleSensorRay(r, rX, rY, Vec2f((float)x, (float)y) + rng.randomFloat2(), rng.randomFloat2());
+	TraceResult res;
+	res.Init();
+	traceRay(r.dir(), r.ori(), &res, &counters);
+	if (!res.hasHit() || !g_SceneData.m_numLights)
+		return;
+
+	DifferentialGeometry dg;
+	dg.P = r(res.m_fDist);
+	res.fillDG(dg);
+	DirectSamplingRecord dRec(dg.P, dg.sys.n);
+	if (!g_SceneData.sampleEmitterDirect(dRec, rng.randomFloat2()).isZero())
+		traceOcclusion(Ray(dRec.ref, dRec.d), 0, dRec.dist, 0, &counters);
+}
+
+CUDA_GLOBAL void traversalStatisticsKernel(unsigned int w, unsigned int h, SynchronizedBuffer<TraversalCounters> counterBuf)
+{
+	unsigned int x = blockIdx.x * blockDim.x + threadIdx.x, y = blockIdx.y * blockDim.y + threadIdx.y;
+	if (x < w && y < h)
+	{
+		TraversalCounters counters;
+		counters.Init();
+		traversalStatisticsPixel(x, y, w, counters);
+		counterBuf[y * w + x] = counters;
+	}
+}
+
+void TraversalStatistics::Clear(PixelDebugVisualizerManager& manager)
+{
+	manager.findOrCreate<float>(InnerNodesVisualizerName()).Clear();
+	manager.findOrCreate<float>(LeafNodesVisualizerName()).Clear();
+	manager.findOrCreate<float>(TriangleTestsVisualizerName()).Clear();
+	m_histograms.clear();
+	m_uNumPasses = 0;
+}
+
+void TraversalStatistics::AddPass(PixelDebugVisualizerManager& manager, unsigned int w, unsigned int h)
+{
+	if (m_passCounters.getLength() != w * h)
+		m_passCounters.Resize(w * h);
+
+	const int block = 16;
+	traversalStatisticsKernel << < dim3(w / block + 1, h / block + 1), dim3(block, block) >> >(w, h, m_passCounters);
+	ThrowCudaErrors(cudaDeviceSynchronize());
+	m_passCounters.setOnGPU();
+	m_passCounters.Synchronize();
+	m_uNumPasses++;
+
+	struct counter_desc
+	{
+		const char* name;
+		unsigned int TraversalCounters::* member;
+	};
+	const counter_desc counters[] = {
+		{ InnerNodesVisualizerName(), &TraversalCounters::innerNodes },
+		{ LeafNodesVisualizerName(), &TraversalCounters::leafNodes },
+		{ TriangleTestsVisualizerName(), &TraversalCounters::triangleTests },
+	};
+
+	m_histograms.clear();
+	for (auto& c : counters)
+	{
+		auto& vis = manager.findOrCreate<float>(c.name);
+		if (vis.m_normalizationData.type == PixelDebugVisualizer<float>::NormalizationType::None)
+			vis.m_normalizationData.type = PixelDebugVisualizer<float>::NormalizationType::Adaptive;
+
+		Histogram hist;
+		hist.name = c.name;
+		hist.max = 0;
+		double sum = 0;
+		for (unsigned int i = 0; i < w * h; i++)
+		{
+			unsigned int v = m_passCounters[i].*c.member;
+			hist.max = max(hist.max, v);
+			sum += v;
+		}
+		hist.mean = w * h ? float(sum / (w * h)) : 0.0f;
+		hist.bucketWidth = max(1.0f, (hist.max + 1) / float(m_numBuckets));
+		hist.buckets.assign(m_numBuckets, 0);
+
+		for (unsigned int y = 0; y < h; y++)
+			for (unsigned int x = 0; x < w; x++)
+			{
+				unsigned int v = m_passCounters[y * w + x].*c.member;
+				vis(x, y) += (float)v;
+				hist.buckets[min(m_numBuckets - 1, (unsigned int)(v / hist.bucketWidth))]++;
+			}
+		vis.setScale(1.0f / m_uNumPasses);
+		vis.setOnCPU();
+		vis.Synchronize();
+		m_histograms.push_back(hist);
+	}
+}
+
+void TraversalStatistics::PrintHistograms(std::vector<std::string>& a_Buf) const
+{
+	for (auto& hist : m_histograms)
+	{
+		unsigned int maxBucket = 1;
+		for (auto b : hist.buckets)
+			maxBucket = max(maxBucket, b);
+		std::ostringstream str;
+		str << hist.name << " : mean = " << std::fixed << std::setprecision(1) << hist.mean << ", max = " << hist.max << ", bucket width = " << hist.bucketWidth << " |";
+		const char* levels = " .:-=+*#";
+		for (auto b : hist.buckets)
+			str << levels[b == 0 ? 0 : 1 + (b * 6) / maxBucket];
+		str << "|";
+		a_Buf.push_back(str.str());
+	}
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "PixelDebugVisualizer.h"
+#include <Engine/SpatialStructures/BVH/BVHTraversal.h>
+#include <vector>
+#include <string>
+
+namespace CudaTracerLib {
+
+//Measures the bvh traversal cost of the current view. Every pass one jittered camera ray and one shadow ray towards a sampled emitter are traced per pixel.
+//The per pixel counters are averaged over all passes in float visualizers of the manager, the histograms describe the last pass only.
+//Without TRAVERSAL_COUNTERS all counters stay zero.
+class TraversalStatistics
+{
+public:
+	struct Histogram
+	{
+		std::string name;
+		//number of traversal steps covered by one bucket, values above the last bucket are clamped into it
+		float bucketWidth;
+		std::vector<unsigned int> buckets;
+		float mean;
+		unsigned int max;
+	};
+
+	static const char* InnerNodesVisualizerName() { return "Traversal inner nodes"; }
+	static const char* LeafNodesVisualizerName() { return "Traversal leaf nodes"; }
+	static const char* TriangleTestsVisualizerName() { return "Traversal triangle tests"; }
+
+	TraversalStatistics(unsigned int numBuckets = 32)
+		: m_passCounters(0), m_numBuckets(numBuckets), m_uNumPasses(0)
+	{
+
+	}
+
+	void Free()
+	{
+		m_passCounters.Free();
+	}
+
+	//resets the accumulated visualizers and the pass count
+	CTL_EXPORT void Clear(PixelDebugVisualizerManager& manager);
+
+	//traces the statistic rays for all w * h pixels with the currently bound scene and updates the visualizers and histograms
+	CTL_EXPORT void AddPass(PixelDebugVisualizerManager& manager, unsigned int w, unsigned int h);
+
+	const std::vector<Histogram>& getHistograms() const
+	{
+		return m_histograms;
+	}
+
+	unsigned int getNumPasses() const
+	{
+		return m_uNumPasses;
+	}
+
+	//one line per counter with the mean, max and the normalized bucket heights of the last pass
+	CTL_EXPORT void PrintHistograms(std::vector<std::string>& a_Buf) const;
+private:
+	SynchronizedBuffer<TraversalCounters> m_passCounters;
+	std::vector<Histogram> m_histograms;
+	unsigned int m_numBuckets;
+	unsigned int m_uNumPasses;
+};
+
+}
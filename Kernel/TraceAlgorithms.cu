@@ -13,6 +13,13 @@ bool V(const Vec3f& a, const Vec3f& b, TraceResult* res)
 	return !g_SceneData.Occluded(Ray(a, d / l), 0, l, res);
 }
 
+bool V(const Vec3f& a, const Vec3f& b, OccluderCache& cache)
+{
+	Vec3f d = b - a;
+	float l = length(d);
+	return !g_SceneData.Occluded(Ray(a, d / l), 0, l, cache);
+}
+
 float G(const NormalizedT<Vec3f>& N_x, const NormalizedT<Vec3f>& N_y, const Vec3f& x, const Vec3f& y)
 {
 	auto theta = normalize(y - x);
@@ -41,7 +48,7 @@ DirectSamplingRecord DirectSamplingRecFromRay(const NormalizedT<Ray>& r, float d
 	return dRec;
 }
 
-CUDA_FUNC_IN Spectrum EstimateDirect(BSDFSamplingRecord bRec, const Material& mat, const Light* light, float light_pdf, EBSDFType flags, Sampler& rng, bool attenuated, bool use_mis)
+CUDA_FUNC_IN Spectrum EstimateDirect(BSDFSamplingRecord bRec, const Material& mat, const Light* light, float light_pdf, EBSDFType flags, Sampler& rng, bool attenuated, bool use_mis, OccluderCache* cache)
 {
 	DirectSamplingRecord dRec(bRec.dg.P, bRec.dg.sys.n);
 	Spectrum value = light->sampleDirect(dRec, rng.randomFloat2());
@@ -52,7 +59,7 @@ CUDA_FUNC_IN Spectrum EstimateDirect(BSDFSamplingRecord bRec, const Material& ma
 		bRec.wo = bRec.dg.toLocal(dRec.d);
 		bRec.typeMask = flags;
 		Spectrum bsdfVal = mat.bsdf.f(bRec);
-		if (!bsdfVal.isZero() && !g_SceneData.Occluded(Ray(dRec.ref, dRec.d), 0, dRec.dist))
+		if (!bsdfVal.isZero() && !(cache ? g_SceneData.Occluded(Ray(dRec.ref, dRec.d), 0, dRec.dist, *cache) : g_SceneData.Occluded(Ray(dRec.ref, dRec.d), 0, dRec.dist)))
 		{
 			float weight = 1.0f;
 			if (use_mis && dRec.measure != EDiscrete)//compute MIS weight
@@ -72,7 +79,7 @@ CUDA_FUNC_IN Spectrum EstimateDirect(BSDFSamplingRecord bRec, const Material& ma
 	return retVal;
 }
 
-Spectrum UniformSampleAllLights(const BSDFSamplingRecord& bRec, const Material& mat, int nSamples, Sampler& rng, bool attenuated, bool use_mis)
+Spectrum UniformSampleAllLights(const BSDFSamplingRecord& bRec, const Material& mat, int nSamples, Sampler& rng, bool attenuated, bool use_mis, OccluderCache* cache)
 {
 	//only sample the relevant lights and assume the others emit the same
 	Spectrum L = Spectrum(0.0f);
@@ -82,14 +89,14 @@ Spectrum UniformSampleAllLights(const BSDFSamplingRecord& bRec, const Material&
 		Spectrum Ld = Spectrum(0.0f);
 		for (int j = 0; j < nSamples; j++)
 		{
-			Ld += EstimateDirect((BSDFSamplingRecord&)bRec, mat, light, 1.0f, EBSDFType(EAll & ~EDelta), rng, attenuated, use_mis);
+			Ld += EstimateDirect((BSDFSamplingRecord&)bRec, mat, light, 1.0f, EBSDFType(EAll & ~EDelta), rng, attenuated, use_mis, cache);
 		}
 		L += Ld / float(nSamples);
 	}
 	return L;
 }
 
-Spectrum UniformSampleOneLight(const BSDFSamplingRecord& bRec, const Material& mat, Sampler& rng, bool attenuated, bool use_mis)
+Spectrum UniformSampleOneLight(const BSDFSamplingRecord& bRec, const Material& mat, Sampler& rng, bool attenuated, bool use_mis, OccluderCache* cache)
 {
 	if (!g_SceneData.m_numLights)
 		return Spectrum(0.0f);
@@ -97,7 +104,7 @@ Spectrum UniformSampleOneLight(const BSDFSamplingRecord& bRec, const Material& m
 	float pdf;
 	const Light* light = g_SceneData.sampleEmitter(pdf, sample);
 	if (light == 0) return Spectrum(0.0f);
-	return EstimateDirect((BSDFSamplingRecord&)bRec, mat, light, pdf, EBSDFType(EAll & ~EDelta), rng, attenuated, use_mis) / pdf;
+	return EstimateDirect((BSDFSamplingRecord&)bRec, mat, light, pdf, EBSDFType(EAll & ~EDelta), rng, attenuated, use_mis, cache) / pdf;
 }
 
 }
\ No newline at end of file
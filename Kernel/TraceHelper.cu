@@ -9,6 +9,7 @@
 #include <SceneTypes/Node.h>
 #include <Engine/DynamicScene.h>
 #include <Engine/SpatialStructures/BVH/BVHTraversal.h>
+#include <Engine/SpatialStructures/BVH/WideBVH.h>
 #include <Base/Timer.h>
 #include "Sampler.h"
 
@@ -85,98 +86,179 @@ CUDA_FUNC_IN void loadInvModl(int i, float4x4* o)
 #endif
 }
 
-template<bool USE_ALPHA> CUDA_FUNC_IN bool __traceRay_internal__(const Vec3f& dir, const Vec3f& ori, TraceResult* a_Result)
+//uses the collapsed wide bvh on the host if available and the quantized nodes on the device if enabled, meshIdx is -1 for the scene bvh
+template<bool ANY_HIT, typename CLB> CUDA_FUNC_IN bool traverseBVH(const Ray& r, float& rayT, const CLB& clb, texture<float4, 1> bvhNodes_texture, const BVHNodeData* hostNodes, int bvhNodesOffset, int startNode, int meshIdx, TraversalCounters* counters)
+{
+#ifndef ISCUDA
+	if (g_SceneData.m_pHostWideBVH)
+	{
+		const WideBVH& wide = *g_SceneData.m_pHostWideBVH;
+		return wide.Traverse<ANY_HIT>(r, rayT, clb, meshIdx < 0 ? wide.getSceneRoot() : wide.getMeshRoot(meshIdx), counters);
+	}
+#else
+	if (g_SceneData.m_bQuantizedBVH)
+		return TracerayTemplate<ANY_HIT>(r, rayT, clb, bvhNodes_texture, hostNodes, BVHNodeDataQuantized::convertAddress(bvhNodesOffset), BVHNodeDataQuantized::convertAddress(startNode), true, counters);
+#endif
+	return TracerayTemplate<ANY_HIT>(r, rayT, clb, bvhNodes_texture, hostNodes, bvhNodesOffset, startNode, false, counters);
+}
+
+//intersects the triangle at triAddr of the mesh instanced by N with the ray (o, d) in object space, index receives the bvh index entry also when there is no hit
+template<bool USE_ALPHA> CUDA_FUNC_IN bool intersectBVHTriangle(const Node* N, const KernelMesh& mesh, unsigned int triAddr, const Vec3f& o, const Vec3f& d, float tmin, float tmax, float& t, Vec2f& bary, unsigned int& index)
+{
+#ifdef ISCUDA
+	const float4 v00 = tex1Dfetch(t_tris, mesh.m_uBVHTriangleOffset + triAddr * 3 + 0);
+	const float4 v11 = tex1Dfetch(t_tris, mesh.m_uBVHTriangleOffset + triAddr * 3 + 1);
+	const float4 v22 = tex1Dfetch(t_tris, mesh.m_uBVHTriangleOffset + triAddr * 3 + 2);
+	index = tex1Dfetch(t_triIndices, mesh.m_uBVHIndicesOffset + triAddr);
+#else
+	Vec4f* dat = (Vec4f*)g_SceneData.m_sBVHIntData.Data;
+	const Vec4f v00 = dat[mesh.m_uBVHTriangleOffset + triAddr * 3 + 0];
+	const Vec4f v11 = dat[mesh.m_uBVHTriangleOffset + triAddr * 3 + 1];
+	const Vec4f v22 = dat[mesh.m_uBVHTriangleOffset + triAddr * 3 + 2];
+	index = g_SceneData.m_sBVHIndexData.Data[mesh.m_uBVHIndicesOffset + triAddr].index;
+#endif
+
+	float Oz = v00.w - o.x*v00.x - o.y*v00.y - o.z*v00.z;
+	float invDz = 1.0f / (d.x*v00.x + d.y*v00.y + d.z*v00.z);
+	t = Oz * invDz;
+	if (!(t > tmin && t < tmax))
+		return false;
+	float Ox = v11.w + o.x*v11.x + o.y*v11.y + o.z*v11.z;
+	float Dx = d.x*v11.x + d.y*v11.y + d.z*v11.z;
+	float u = Ox + t*Dx;
+	if (u < 0.0f)
+		return false;
+	float Oy = v22.w + o.x*v22.x + o.y*v22.y + o.z*v22.z;
+	float Dy = d.x*v22.x + d.y*v22.y + d.z*v22.z;
+	float v = Oy + t*Dy;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	bary = Vec2f(u, v);
+
+	if (USE_ALPHA)
+	{
+		unsigned int ti = index >> 1;
+		TriangleData* tri = g_SceneData.m_sTriData.Data + ti + mesh.m_uTriangleOffset;
+		unsigned int mIdx = tri->getMatIndex(N->m_uMaterialOffset);
+		auto& mat = g_SceneData.m_sMatData[mIdx];
+		if (mat.AlphaMap.used())
+		{
+#ifdef ISCUDA
+			float4 rowC = tex1Dfetch(t_TriDataB, ti * 4 + 2);
+			float4 rowD = tex1Dfetch(t_TriDataB, ti * 4 + 3);
+			Vec2f a = Vec2f(rowC.z, rowC.w), b = Vec2f(rowD.x, rowD.y), c = Vec2f(rowD.z, rowD.w);
+#else
+			Vec2f a, b, c;
+			tri->getUVSetData(0, a, b, c);
+#endif
+			Vec2f uv = u * a + v * b + (1 - u - v) * c;
+			return mat.AlphaTest(Vec2f(u, v), uv);
+		}
+	}
+	return true;
+}
+
+template<bool USE_ALPHA> CUDA_FUNC_IN bool __traceRay_internal__(const Vec3f& dir, const Vec3f& ori, TraceResult* a_Result, TraversalCounters* counters)
 {
     float rayEps = g_SceneData.m_rayTraceEps;
-	return TracerayTemplate(Ray(ori, dir), a_Result->m_fDist, [&](int nodeIdx)
+	return traverseBVH<false>(Ray(ori, dir), a_Result->m_fDist, [&](int nodeIdx)
 	{
 		Node* N = g_SceneData.m_sNodeData.Data + nodeIdx;
 		KernelMesh mesh = g_SceneData.m_sMeshData[N->m_uMeshIndex];
-		unsigned int meshBvhTriOff = mesh.m_uBVHTriangleOffset, meshBvhIndOff = mesh.m_uBVHIndicesOffset, meshTriOff = mesh.m_uTriangleOffset;
-		unsigned int nodeMatOff = N->m_uMaterialOffset;
 		float4x4 modl;
 		loadInvModl(nodeIdx, &modl);
 		Vec3f d = modl.TransformDirection(dir), o = modl.TransformPoint(ori);
-		return TracerayTemplate(Ray(o, d), a_Result->m_fDist, [&](int triIdx)
+		return traverseBVH<false>(Ray(o, d), a_Result->m_fDist, [&](int triIdx)
 		{
 			bool found = false;
 			for (int triAddr = triIdx;; triAddr++)
 			{
-#ifdef ISCUDA
-				const float4 v00 = tex1Dfetch(t_tris, meshBvhTriOff + triAddr * 3 + 0);
-				const float4 v11 = tex1Dfetch(t_tris, meshBvhTriOff + triAddr * 3 + 1);
-				const float4 v22 = tex1Dfetch(t_tris, meshBvhTriOff + triAddr * 3 + 2);
-				unsigned int index = tex1Dfetch(t_triIndices, meshBvhIndOff + triAddr);
-#else
-				Vec4f* dat = (Vec4f*)g_SceneData.m_sBVHIntData.Data;
-				const Vec4f v00 = dat[meshBvhTriOff + triAddr * 3 + 0];
-				const Vec4f v11 = dat[meshBvhTriOff + triAddr * 3 + 1];
-				const Vec4f v22 = dat[meshBvhTriOff + triAddr * 3 + 2];
-				unsigned int index = g_SceneData.m_sBVHIndexData.Data[meshBvhIndOff + triAddr].index;
-#endif
+				float t;
+				Vec2f bary;
+				unsigned int index;
+				TRAVERSAL_COUNT(counters, triangleTests, 1);
+				if (intersectBVHTriangle<USE_ALPHA>(N, mesh, triAddr, o, d, rayEps, a_Result->m_fDist, t, bary, index))
+				{
+					a_Result->m_nodeIdx = nodeIdx;
+					a_Result->m_triIdx = (index >> 1) + mesh.m_uTriangleOffset;
+					a_Result->m_fBaryCoords = bary;
+					a_Result->m_fDist = t;
+					found = true;
+				}
+				if (index & 1)
+					break;
+			}
+			return found;
+		}, t_nodesA, g_SceneData.m_sBVHNodeData.Data, mesh.m_uBVHNodeOffset, 0, N->m_uMeshIndex, counters);
+	}, t_SceneNodes, g_SceneData.m_sSceneBVH.m_pNodes, 0, g_SceneData.m_sSceneBVH.m_sStartNode, -1, counters);
+}
 
-				float Oz = v00.w - o.x*v00.x - o.y*v00.y - o.z*v00.z;
-				float invDz = 1.0f / (d.x*v00.x + d.y*v00.y + d.z*v00.z);
-				float t = Oz * invDz;
-				if (t > rayEps && t < a_Result->m_fDist)
+template<bool USE_ALPHA> CUDA_FUNC_IN bool __traceOcclusion_internal__(const Ray& r, float tmin, float tmax, OccluderCache* cache, TraversalCounters* counters)
+{
+	if (cache && cache->hasOccluder() && cache->m_nodeIdx < g_SceneData.m_sNodeData.UsedCount)
+	{
+		Node* N = g_SceneData.m_sNodeData.Data + cache->m_nodeIdx;
+		float4x4 modl;
+		loadInvModl(cache->m_nodeIdx, &modl);
+		float t;
+		Vec2f bary;
+		unsigned int index;
+		TRAVERSAL_COUNT(counters, triangleTests, 1);
+		if (intersectBVHTriangle<USE_ALPHA>(N, g_SceneData.m_sMeshData[N->m_uMeshIndex], cache->m_triAddr, modl.TransformPoint(r.ori()), modl.TransformDirection(r.dir()), tmin, tmax, t, bary, index))
+			return true;
+	}
+
+	float rayT = tmax;
+	return traverseBVH<true>(r, rayT, [&](int nodeIdx)
+	{
+		Node* N = g_SceneData.m_sNodeData.Data + nodeIdx;
+		KernelMesh mesh = g_SceneData.m_sMeshData[N->m_uMeshIndex];
+		float4x4 modl;
+		loadInvModl(nodeIdx, &modl);
+		Vec3f d = modl.TransformDirection(r.dir()), o = modl.TransformPoint(r.ori());
+		return traverseBVH<true>(Ray(o, d), rayT, [&](int triIdx)
+		{
+			for (int triAddr = triIdx;; triAddr++)
+			{
+				float t;
+				Vec2f bary;
+				unsigned int index;
+				TRAVERSAL_COUNT(counters, triangleTests, 1);
+				if (intersectBVHTriangle<USE_ALPHA>(N, mesh, triAddr, o, d, tmin, tmax, t, bary, index))
 				{
-					float Ox = v11.w + o.x*v11.x + o.y*v11.y + o.z*v11.z;
-					float Dx = d.x*v11.x + d.y*v11.y + d.z*v11.z;
-					float u = Ox + t*Dx;
-					if (u >= 0.0f)
+					if (cache)
 					{
-						float Oy = v22.w + o.x*v22.x + o.y*v22.y + o.z*v22.z;
-						float Dy = d.x*v22.x + d.y*v22.y + d.z*v22.z;
-						float v = Oy + t*Dy;
-						if (v >= 0.0f && u + v <= 1.0f)
-						{
-							unsigned int ti = index >> 1;
-
-							bool alphaSurvive = true;
-							if (USE_ALPHA)
-							{
-								TriangleData* tri = g_SceneData.m_sTriData.Data + ti + meshTriOff;
-								unsigned int mIdx = tri->getMatIndex(nodeMatOff);
-								auto& mat = g_SceneData.m_sMatData[mIdx];
-								if (mat.AlphaMap.used())
-								{
-#ifdef ISCUDA
-									float4 rowC = tex1Dfetch(t_TriDataB, ti * 4 + 2);
-									float4 rowD = tex1Dfetch(t_TriDataB, ti * 4 + 3);
-									Vec2f a = Vec2f(rowC.z, rowC.w), b = Vec2f(rowD.x, rowD.y), c = Vec2f(rowD.z, rowD.w);
-#else
-									Vec2f a, b, c;
-									tri->getUVSetData(0, a, b, c);
-#endif
-									Vec2f uv = u * a + v * b + (1 - u - v) * c;
-									alphaSurvive = mat.AlphaTest(Vec2f(u, v), uv);
-								}
-							}
-							if (alphaSurvive)
-							{
-								a_Result->m_nodeIdx = nodeIdx;
-								a_Result->m_triIdx = ti + meshTriOff;
-								a_Result->m_fBaryCoords = Vec2f(u, v);
-								a_Result->m_fDist = t;
-								found = true;
-							}
-						}
+						cache->m_nodeIdx = nodeIdx;
+						cache->m_triAddr = triAddr;
 					}
+					return true;
 				}
 				if (index & 1)
 					break;
 			}
-			return found;
-		}, t_nodesA, g_SceneData.m_sBVHNodeData.Data, mesh.m_uBVHNodeOffset, 0);
-	}, t_SceneNodes, g_SceneData.m_sSceneBVH.m_pNodes, 0, g_SceneData.m_sSceneBVH.m_sStartNode);
+			return false;
+		}, t_nodesA, g_SceneData.m_sBVHNodeData.Data, mesh.m_uBVHNodeOffset, 0, N->m_uMeshIndex, counters);
+	}, t_SceneNodes, g_SceneData.m_sSceneBVH.m_pNodes, 0, g_SceneData.m_sSceneBVH.m_sStartNode, -1, counters);
 }
 
-bool traceRay(const Vec3f& dir, const Vec3f& ori, TraceResult* a_Result)
+bool traceRay(const Vec3f& dir, const Vec3f& ori, TraceResult* a_Result, TraversalCounters* counters)
 {
 	Platform::Increment(&g_RayTracedCounter);
 	if(!g_SceneData.m_sNodeData.UsedCount)
 		return false;
-	return g_SceneData.doAlphaMapping ? __traceRay_internal__<true>(dir, ori, a_Result) : __traceRay_internal__<false>(dir, ori, a_Result);
+	return g_SceneData.doAlphaMapping ? __traceRay_internal__<true>(dir, ori, a_Result, counters) : __traceRay_internal__<false>(dir, ori, a_Result, counters);
+}
+
+bool traceOcclusion(const Ray& r, float tmin, float tmax, OccluderCache* cache, TraversalCounters* counters)
+{
+	Platform::Increment(&g_RayTracedCounter);
+	if (!g_SceneData.m_sNodeData.UsedCount)
+		return false;
+	//same interval as the closest hit test in KernelDynamicScene::Occluded
+	float eps = g_SceneData.m_rayTraceEps;
+	tmin = max(tmin + eps, eps);
+	tmax = tmax - eps;
+	return g_SceneData.doAlphaMapping ? __traceOcclusion_internal__<true>(r, tmin, tmax, cache, counters) : __traceOcclusion_internal__<false>(r, tmin, tmax, cache, counters);
 }
 
 void UpdateKernel(DynamicScene* a_Scene, ISamplingSequenceGenerator& sampler)
@@ -185,6 +267,8 @@ void UpdateKernel(DynamicScene* a_Scene, ISamplingSequenceGenerator& sampler)
 
 	if (!a_Scene)
 		return;
+	//the tiles requested by the last pass, the page table is changed in place
+	a_Scene->UpdateTextureTiles();
 	KernelDynamicScene a_Data = a_Scene->getKernelSceneData();
 
 	size_t offset;
@@ -192,10 +276,15 @@ void UpdateKernel(DynamicScene* a_Scene, ISamplingSequenceGenerator& sampler)
 							cdu1 = cudaCreateChannelDesc<unsigned int>(),
 							cdi2 = cudaCreateChannelDesc<int2>(),
 							cdh4 = cudaCreateChannelDescHalf4();
-	ThrowCudaErrors(cudaBindTexture(&offset, &t_nodesA, a_Data.m_sBVHNodeData.Data, &cdf4, a_Data.m_sBVHNodeData.UsedCount * sizeof(BVHNodeData)));
+	//the quantized nodes are bound to the same textures, TracerayTemplate decodes them
+	if (a_Data.m_bQuantizedBVH)
+		ThrowCudaErrors(cudaBindTexture(&offset, &t_nodesA, a_Data.m_pQuantizedBVHNodes, &cdf4, a_Data.m_sBVHNodeData.UsedCount * sizeof(BVHNodeDataQuantized)));
+	else ThrowCudaErrors(cudaBindTexture(&offset, &t_nodesA, a_Data.m_sBVHNodeData.Data, &cdf4, a_Data.m_sBVHNodeData.UsedCount * sizeof(BVHNodeData)));
 	ThrowCudaErrors(cudaBindTexture(&offset, &t_tris, a_Data.m_sBVHIntData.Data, &cdf4, a_Data.m_sBVHIntData.UsedCount * sizeof(TriIntersectorData)));
 	ThrowCudaErrors(cudaBindTexture(&offset, &t_triIndices, a_Data.m_sBVHIndexData.Data, &cdu1, a_Data.m_sBVHIndexData.UsedCount * sizeof(TriIntersectorData2)));
-	ThrowCudaErrors(cudaBindTexture(&offset, &t_SceneNodes, a_Data.m_sSceneBVH.m_pNodes, &cdf4, a_Data.m_sSceneBVH.m_uNumNodes * sizeof(BVHNodeData)));
+	if (a_Data.m_bQuantizedBVH)
+		ThrowCudaErrors(cudaBindTexture(&offset, &t_SceneNodes, a_Data.m_sSceneBVH.m_pQuantizedNodes, &cdf4, a_Data.m_sSceneBVH.m_uNumNodes * sizeof(BVHNodeDataQuantized)));
+	else ThrowCudaErrors(cudaBindTexture(&offset, &t_SceneNodes, a_Data.m_sSceneBVH.m_pNodes, &cdf4, a_Data.m_sSceneBVH.m_uNumNodes * sizeof(BVHNodeData)));
 	ThrowCudaErrors(cudaBindTexture(&offset, &t_NodeTransforms, a_Data.m_sSceneBVH.m_pNodeTransforms, &cdf4, a_Data.m_sNodeData.UsedCount * sizeof(float4x4)));
 	ThrowCudaErrors(cudaBindTexture(&offset, &t_NodeInvTransforms, a_Data.m_sSceneBVH.m_pInvNodeTransforms, &cdf4, a_Data.m_sNodeData.UsedCount * sizeof(float4x4)));
 #ifdef EXT_TRI
@@ -323,7 +412,26 @@ void k_setNumRaysTraced(unsigned int i)
 #define STACK_SIZE 32
 __device__ int g_warpCounter;
 
-template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay* a_RayBuffer, traversalResult* a_ResBuffer)
+//fetches a node in the layout of BVHNodeData, quantized nodes are decoded and their addresses have to be converted with BVHNodeDataQuantized::convertAddress
+CUDA_ONLY_FUNC void fetchBVHNode(texture<float4, 1> tex, int addr, bool quantized, float4& n0xy, float4& n1xy, float4& nz, float4& tmp)
+{
+	if (quantized)
+	{
+		const float4 q0 = tex1Dfetch(tex, addr + 0);
+		const float4 q1 = tex1Dfetch(tex, addr + 1);
+		tmp = tex1Dfetch(tex, addr + 2);
+		BVHNodeDataQuantized::decode(q0, q1, n0xy, n1xy, nz);
+	}
+	else
+	{
+		n0xy = tex1Dfetch(tex, addr + 0); // (c0.lo.x, c0.hi.x, c0.lo.y, c0.hi.y)
+		n1xy = tex1Dfetch(tex, addr + 1); // (c1.lo.x, c1.hi.x, c1.lo.y, c1.hi.y)
+		nz = tex1Dfetch(tex, addr + 2);   // (c0.lo.z, c0.hi.z, c1.lo.z, c1.hi.z)
+		tmp = tex1Dfetch(tex, addr + 3);  // child_index0, child_index1
+	}
+}
+
+template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay* a_RayBuffer, traversalResult* a_ResBuffer, TraversalCounters* a_CounterBuffer)
 {
 	// Traversal stack in CUDA thread-local memory.
 
@@ -351,6 +459,11 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 	float   idirz;
 	Vec2f bCorrds;
 	int nodeIdx;
+	//the textures contain BVHNodeDataQuantized, the child addresses are already converted
+	const bool quantized = g_SceneData.m_bQuantizedBVH;
+#ifdef TRAVERSAL_COUNTERS
+	TraversalCounters counters, *pCounters = &counters;
+#endif
 
 	int ltraversalStack[STACK_SIZE];
 	ltraversalStack[0] = EntrypointSentinel;
@@ -421,9 +534,12 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 
 			stackPtr = (char*)&traversalStack[0];
 			leafAddr = 0;   // No postponed leaf.
-			leafAddr = nodeAddr = g_SceneData.m_sSceneBVH.m_sStartNode;   // Start from the root. set the leafAddr to support scenes with one node
+			leafAddr = nodeAddr = quantized ? BVHNodeDataQuantized::convertAddress(g_SceneData.m_sSceneBVH.m_sStartNode) : g_SceneData.m_sSceneBVH.m_sStartNode;   // Start from the root. set the leafAddr to support scenes with one node
 			hitIndex = -1;  // No triangle intersected so far.
 			nodeIdx = -1;
+#ifdef TRAVERSAL_COUNTERS
+			counters.Init();
+#endif
 		}
 
 		// Traversal loop.
@@ -450,11 +566,10 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 			{
 				// Fetch AABBs of the two child nodes.
 
-				const float4 n0xy = tex1Dfetch(t_SceneNodes, nodeAddr + 0); // (c0.lo.x, c0.hi.x, c0.lo.y, c0.hi.y)
-				const float4 n1xy = tex1Dfetch(t_SceneNodes, nodeAddr + 1); // (c1.lo.x, c1.hi.x, c1.lo.y, c1.hi.y)
-				const float4 nz   = tex1Dfetch(t_SceneNodes, nodeAddr + 2); // (c0.lo.z, c0.hi.z, c1.lo.z, c1.hi.z)
-					  float4 tmp  = tex1Dfetch(t_SceneNodes, nodeAddr + 3); // child_index0, child_index1
-					  int2  cnodes= *(int2*)&tmp;
+				TRAVERSAL_COUNT(pCounters, innerNodes, 1);
+				float4 n0xy, n1xy, nz, tmp;
+				fetchBVHNode(t_SceneNodes, nodeAddr, quantized, n0xy, n1xy, nz, tmp);
+				int2  cnodes= *(int2*)&tmp;
 
 				// Intersect the ray against the child nodes.
 
@@ -475,7 +590,7 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 				const float c1min = kepler_math::spanBeginKepler(c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, tmin);
 				const float c1max = kepler_math::spanEndKepler  (c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, hitT);
 
-				bool swp = (c1min < c0min);
+				bool swp = !ANY_HIT && (c1min < c0min);
 
 				bool traverseChild0 = (c0max >= c0min);
 				bool traverseChild1 = (c1max >= c1min);
@@ -528,6 +643,7 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 			while (leafAddr < 0)
 			{
 				Node* N = g_SceneData.m_sNodeData.Data + (~leafAddr);
+				TRAVERSAL_COUNT(pCounters, leafNodes, 1);
 				//if (terminated)
 				{
 					float4x4 modl;
@@ -554,7 +670,7 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 					lnodeAddr = 0;   // Start from the root.
 				}
 
-				unsigned int m_uBVHNodeOffset = g_SceneData.m_sMeshData[N->m_uMeshIndex].m_uBVHNodeOffset,
+				unsigned int m_uBVHNodeOffset = quantized ? BVHNodeDataQuantized::convertAddress(g_SceneData.m_sMeshData[N->m_uMeshIndex].m_uBVHNodeOffset) : g_SceneData.m_sMeshData[N->m_uMeshIndex].m_uBVHNodeOffset,
 					m_uBVHTriangleOffset = g_SceneData.m_sMeshData[N->m_uMeshIndex].m_uBVHTriangleOffset,
 					m_uBVHIndicesOffset = g_SceneData.m_sMeshData[N->m_uMeshIndex].m_uBVHIndicesOffset,
 					m_uTriangleOffset = g_SceneData.m_sMeshData[N->m_uMeshIndex].m_uTriangleOffset;
@@ -563,10 +679,9 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 				{
 					while (((unsigned int)lnodeAddr) < ((unsigned int)EntrypointSentinel))
 					{
-						const float4 n0xy = tex1Dfetch(t_nodesA, lnodeAddr + 0 + m_uBVHNodeOffset); // (c0.lo.x, c0.hi.x, c0.lo.y, c0.hi.y)
-						const float4 n1xy = tex1Dfetch(t_nodesA, lnodeAddr + 1 + m_uBVHNodeOffset); // (c1.lo.x, c1.hi.x, c1.lo.y, c1.hi.y)
-						const float4 nz = tex1Dfetch(t_nodesA, lnodeAddr + 2 + m_uBVHNodeOffset); // (c0.lo.z, c0.hi.z, c1.lo.z, c1.hi.z)
-						float4 tmp = tex1Dfetch(t_nodesA, lnodeAddr + 3 + m_uBVHNodeOffset); // child_index0, child_index1
+						TRAVERSAL_COUNT(pCounters, innerNodes, 1);
+						float4 n0xy, n1xy, nz, tmp;
+						fetchBVHNode(t_nodesA, lnodeAddr + m_uBVHNodeOffset, quantized, n0xy, n1xy, nz, tmp);
 						int2  cnodes = *(int2*)&tmp;
 
 						// Intersect the ray against the child nodes.
@@ -588,7 +703,7 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 						const float c1min = kepler_math::spanBeginKepler(c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, ltmin);
 						const float c1max = kepler_math::spanEndKepler(c1lox, c1hix, c1loy, c1hiy, c1loz, c1hiz, lhitT);
 
-						bool swp = (c1min < c0min);
+						bool swp = !ANY_HIT && (c1min < c0min);
 
 						bool traverseChild0 = (c0max >= c0min);
 						bool traverseChild1 = (c1max >= c1min);
@@ -635,6 +750,7 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 					}
 					while (lleafAddr < 0)
 					{
+						TRAVERSAL_COUNT(pCounters, leafNodes, 1);
 						for (int triAddr = ~lleafAddr;; triAddr++)
 						{
 							// Tris in TEX (good to fetch as a single batch)
@@ -642,6 +758,7 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 							const float4 v11 = tex1Dfetch(t_tris, triAddr * 3 + 1 + m_uBVHTriangleOffset);
 							const float4 v22 = tex1Dfetch(t_tris, triAddr * 3 + 2 + m_uBVHTriangleOffset);
 							unsigned int index = tex1Dfetch(t_triIndices, triAddr + m_uBVHIndicesOffset);
+							TRAVERSAL_COUNT(pCounters, triangleTests, 1);
 
 							float Oz = v00.w - lorigx*v00.x - lorigy*v00.y - lorigz*v00.z;
 							float invDz = 1.0f / (ldirx*v00.x + ldiry*v00.y + ldirz*v00.z);
@@ -729,18 +846,22 @@ template<bool ANY_HIT> __global__ void intersectKernel(int numRays, traversalRay
 			res.w = (uint32_t)(y_disc << 16) | (uint32_t)x_disc;
 		}
 		((uint4*)a_ResBuffer)[rayidx] = res;
+#ifdef TRAVERSAL_COUNTERS
+		if (a_CounterBuffer)
+			a_CounterBuffer[rayidx] = counters;
+#endif
 //outerlabel: ;
 	} while(true);
 }
 
-void __internal__IntersectBuffers(int N, traversalRay* a_RayBuffer, traversalResult* a_ResBuffer, bool SKIP_OUTER, bool ANY_HIT)
+void __internal__IntersectBuffers(int N, traversalRay* a_RayBuffer, traversalResult* a_ResBuffer, bool SKIP_OUTER, bool ANY_HIT, TraversalCounters* a_CounterBuffer)
 {
 	ThrowCudaErrors(cudaDeviceSetCacheConfig (cudaFuncCachePreferL1));
 	unsigned int zero = 0;
 	ThrowCudaErrors(cudaMemcpyToSymbol(g_warpCounter, &zero, sizeof(unsigned int)));
 	if(ANY_HIT)
-		intersectKernel<true><<< 180, dim3(32, 4, 1)>>>(N, a_RayBuffer, a_ResBuffer);
-	else intersectKernel<false><<< 180, dim3(32, 4, 1)>>>(N, a_RayBuffer, a_ResBuffer);
+		intersectKernel<true><<< 180, dim3(32, 4, 1)>>>(N, a_RayBuffer, a_ResBuffer, a_CounterBuffer);
+	else intersectKernel<false><<< 180, dim3(32, 4, 1)>>>(N, a_RayBuffer, a_ResBuffer, a_CounterBuffer);
 	ThrowCudaErrors(cudaDeviceSynchronize());
 	g_RayTracedCounterHost += N;
 }
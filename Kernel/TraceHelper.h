@@ -7,6 +7,7 @@
 namespace CudaTracerLib {
 
 class ISamplingSequenceGenerator;
+struct TraversalCounters;
 
 extern CUDA_ALIGN(16) CUDA_CONST KernelDynamicScene g_SceneDataDevice;
 extern CUDA_ALIGN(16) CUDA_DEVICE unsigned int g_RayTracedCounterDevice;
@@ -26,7 +27,8 @@ CTL_EXPORT extern CUDA_ALIGN(16) CudaStaticWrapper<SamplerData> g_SamplerDataHos
 #define g_SamplerData (*g_SamplerDataHost)
 #endif
 
-CTL_EXPORT CUDA_DEVICE CUDA_HOST bool traceRay(const Vec3f& dir, const Vec3f& ori, TraceResult* a_Result);
+//counters is only updated when TRAVERSAL_COUNTERS is defined
+CTL_EXPORT CUDA_DEVICE CUDA_HOST bool traceRay(const Vec3f& dir, const Vec3f& ori, TraceResult* a_Result, TraversalCounters* counters = 0);
 
 CUDA_FUNC_IN TraceResult traceRay(const Ray& r)
 {
@@ -36,6 +38,10 @@ CUDA_FUNC_IN TraceResult traceRay(const Ray& r)
 	return r2;
 }
 
+//any hit traversal for shadow rays, returns whether a surface lies within (tmin, tmax) shrunk by the ray tracing epsilon
+//if cache is specified its occluder is tested before the traversal and replaced by the first occluder found
+CTL_EXPORT CUDA_DEVICE CUDA_HOST bool traceOcclusion(const Ray& r, float tmin, float tmax, OccluderCache* cache = 0, TraversalCounters* counters = 0);
+
 CTL_EXPORT CUDA_DEVICE CUDA_HOST void fillDG(const Vec2f& bary, unsigned int triIdx, unsigned int nodeIdx, DifferentialGeometry& dg);
 
 CTL_EXPORT void InitializeKernel();
@@ -68,6 +74,8 @@ struct CUDA_ALIGN(16) traversalResult
 	CUDA_DEVICE CUDA_HOST void fromResult(const TraceResult* tR, KernelDynamicScene& g_SceneData);
 };
 
-CTL_EXPORT void __internal__IntersectBuffers(int N, traversalRay* a_RayBuffer, traversalResult* a_ResBuffer, bool SKIP_OUTER, bool ANY_HIT);
+//a_CounterBuffer is an optional device buffer receiving the traversal counters of every ray, it is only written when compiled with TRAVERSAL_COUNTERS
+//the buffered render path (DoubleRayBuffer) does not pass one, only the separate TraversalStatistics pass is measured
+CTL_EXPORT void __internal__IntersectBuffers(int N, traversalRay* a_RayBuffer, traversalResult* a_ResBuffer, bool SKIP_OUTER, bool ANY_HIT, TraversalCounters* a_CounterBuffer = 0);
 
 }
\ No newline at end of file
@@ -44,4 +44,22 @@ struct TraceResult
 	CTL_EXPORT CUDA_DEVICE CUDA_HOST void getBsdfSample(const NormalizedT<Vec3f>& wi, const Vec3f& p, BSDFSamplingRecord& bRec, ETransportMode mode, const Spectrum* f_i = 0, const NormalizedT<Vec3f>* wo = 0) const;
 };
 
+//Triangle which blocked the last shadow ray, consecutive shadow rays of the same path are likely to be blocked by it again.
+//Only valid during one kernel launch, the scene must not change while it is in use.
+struct OccluderCache
+{
+	unsigned int m_nodeIdx;
+	//address of the triangle relative to the bvh triangle data of the node's mesh
+	unsigned int m_triAddr;
+	CUDA_FUNC_IN void Init()
+	{
+		m_nodeIdx = UINT_MAX;
+		m_triAddr = UINT_MAX;
+	}
+	CUDA_FUNC_IN bool hasOccluder() const
+	{
+		return m_nodeIdx != UINT_MAX;
+	}
+};
+
 }
\ No newline at end of file
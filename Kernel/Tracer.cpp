@@ -7,6 +7,7 @@
 #include "BlockSampler/DifferenceBlockSampler.h"
 #include "BlockSampler/SelectBlockSampler.h"
 #include "Sampler.h"
+#include <Engine/DynamicScene.h>
 
 namespace CudaTracerLib {
 
@@ -16,7 +17,8 @@ TracerBase::TracerBase()
 	ThrowCudaErrors(cudaEventCreate(&start));
 	ThrowCudaErrors(cudaEventCreate(&stop));
 	m_sParameters << KEY_SamplingSequenceType()			<< SamplingSequenceGeneratorTypes::Independent
-				  << KEY_BlockSamplerType()				<< BlockSamplerTypes::Uniform;
+				  << KEY_BlockSamplerType()				<< BlockSamplerTypes::Uniform
+				  << KEY_HostExecution()				<< CreateSetBool(false);
 	setCorrectSamplingSequenceGenerator();
 	setCorrectBlockSampler();
 }
@@ -46,6 +48,13 @@ TracerBase::~TracerBase()
 	m_pBlockSampler = 0;
 	m_pPixelVarianceBuffer = 0;
 	m_debugVisualizerManager.Free();
+	m_traversalStatistics.Free();
+}
+
+void TracerBase::prepareHostExecution()
+{
+	if (m_pScene && !m_pScene->isHostWideBVHEnabled())
+		m_pScene->setHostWideBVHEnabled(true);
 }
 
 void TracerBase::generateNewRandomSequences()
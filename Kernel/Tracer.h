@@ -8,6 +8,9 @@
 #include "TracerSettings.h"
 #include <Kernel/PixelVarianceBuffer.h>
 #include "PixelDebugVisualizers/PixelDebugVisualizer.h"
+#include "PixelDebugVisualizers/TraversalStatistics.h"
+#include <Base/ThreadPool.h>
+#include <Base/Timer.h>
 
 namespace CudaTracerLib {
 
@@ -74,6 +77,8 @@ public:
 
 	PARAMETER_KEY(SamplingSequenceGeneratorTypes, SamplingSequenceType)
 	PARAMETER_KEY(BlockSamplerTypes, BlockSamplerType)
+	//render on all host cores instead of the device, only used by tracers which support it
+	PARAMETER_KEY(bool, HostExecution)
 
 	CUDA_DEVICE static Vec2i getPixelPos(unsigned int xoff, unsigned int yoff)
 	{
@@ -112,6 +117,7 @@ public:
 			m_pPixelVarianceBuffer->Free();
 			delete m_pPixelVarianceBuffer;
 		}
+		CudaMemoryScope scope("PixelVarianceBuffer");
 		m_pPixelVarianceBuffer = new PixelVarianceBuffer(_w, _h);
 		m_debugVisualizerManager.Resize(_w, _h);
 	}
@@ -158,6 +164,11 @@ public:
 	{
 		return m_debugVisualizerManager;
 	}
+	//only updated when compiled with TRAVERSAL_COUNTERS
+	virtual const TraversalStatistics& getTraversalStatistics() const
+	{
+		return m_traversalStatistics;
+	}
 protected:
 	float m_fLastRuntime;
 	unsigned int m_uLastNumRaysTraced;
@@ -172,11 +183,23 @@ protected:
 	TracerParameterCollection m_sParameters;
 	ISamplingSequenceGenerator* m_pSamplingSequenceGenerator;
 	PixelDebugVisualizerManager m_debugVisualizerManager;
+	TraversalStatistics m_traversalStatistics;
 
 	virtual void DebugInternal(Image* I, const Vec2i& pixel)
 	{
 
 	}
+	//tracers which can render their blocks on the host override this and Tracer::RenderBlockHost
+	virtual bool SupportsHostExecution() const
+	{
+		return false;
+	}
+	bool useHostExecution() const
+	{
+		return SupportsHostExecution() && m_sParameters.getValue(KEY_HostExecution());
+	}
+	//builds the host only scene data required for host execution
+	CTL_EXPORT void prepareHostExecution();
 	virtual void setCorrectSamplingSequenceGenerator();
 	virtual void setCorrectBlockSampler();
 	virtual void generateNewRandomSequences();
@@ -210,7 +233,12 @@ public:
 	{
 		setCorrectBlockSampler();
 		setCorrectSamplingSequenceGenerator();
-		ThrowCudaErrors(cudaEventRecord(start, 0));
+		//device events would only measure the idle time of the device when rendering on the host
+		bool hostExecution = useHostExecution();
+		InstructionTimer hostTimer;
+		if (hostExecution)
+			hostTimer.StartTimer();
+		else ThrowCudaErrors(cudaEventRecord(start, 0));
 		// do not clear because of block samplers
 		//m_debugVisualizerManager.ClearAll();
 		if (a_NewTrace || !PROGRESSIVE)
@@ -225,7 +253,12 @@ public:
 				m_pPixelVarianceBuffer->Clear();
 			}
 			StartNewTrace(I);
+#ifdef TRAVERSAL_COUNTERS
+			m_traversalStatistics.Clear(m_debugVisualizerManager);
+#endif
 		}
+		if (hostExecution)
+			prepareHostExecution();
 		UpdateKernel(m_pScene, *m_pSamplingSequenceGenerator);
 		k_setNumRaysTraced(0);
 		m_uPassesDone++;
@@ -236,15 +269,24 @@ public:
 			m_pBlockSampler->AddPass(I, this, *m_pPixelVarianceBuffer);
 		}
 		m_debugVisualizerManager.CopyFromGPU();
-		ThrowCudaErrors(cudaEventRecord(stop, 0));
-		ThrowCudaErrors(cudaEventSynchronize(stop));
-		if (start != stop)
-			ThrowCudaErrors(cudaEventElapsedTime(&m_fLastRuntime, start, stop));
-		else m_fLastRuntime = 0;
-		m_fLastRuntime /= 1000.0f;
+		if (hostExecution)
+			m_fLastRuntime = (float)hostTimer.EndTimer();
+		else
+		{
+			ThrowCudaErrors(cudaEventRecord(stop, 0));
+			ThrowCudaErrors(cudaEventSynchronize(stop));
+			if (start != stop)
+				ThrowCudaErrors(cudaEventElapsedTime(&m_fLastRuntime, start, stop));
+			else m_fLastRuntime = 0;
+			m_fLastRuntime /= 1000.0f;
+		}
 		m_uLastNumRaysTraced = k_getNumRaysTraced();
 		m_fAccRuntime += m_fLastRuntime;
 		m_uAccNumRaysTraced += m_uLastNumRaysTraced;
+#ifdef TRAVERSAL_COUNTERS
+		//after the timing so that the statistic rays do not distort the measurements
+		m_traversalStatistics.AddPass(m_debugVisualizerManager, w, h);
+#endif
 	}
 	virtual bool isMultiPass() const
 	{
@@ -260,9 +302,39 @@ protected:
 	virtual void RenderBlock(Image* I, int x, int y, int blockW, int blockH)
 	{
 
+	}
+	//host version of RenderBlock, called concurrently from multiple threads for disjoint blocks
+	//implementations have to create the Sampler for each pixel themselves
+	virtual void RenderBlockHost(Image* I, int x, int y, int blockW, int blockH)
+	{
+
+	}
+	//distributes the blocks of the block sampler over the global thread pool
+	virtual void DoRenderHost(Image* I)
+	{
+		std::vector<Vec4i> blocks;
+		m_pBlockSampler->IterateBlocks([&](unsigned int block_idx, int x, int y, int bw, int bh)
+		{
+			blocks.push_back(Vec4i(x, y, bw, bh));
+		});
+
+		//bring the accumulated samples of previous passes to the host
+		I->Synchronize();
+		ThreadPool::getGlobalPool().ParallelFor((unsigned int)blocks.size(), [&](unsigned int block_idx, unsigned int thread_idx)
+		{
+			const Vec4i& b = blocks[block_idx];
+			RenderBlockHost(I, b.x, b.y, b.z, b.w);
+		});
+		I->setOnCPU();
+		I->Synchronize();
 	}
 	virtual void DoRender(Image* I)
 	{
+		if (useHostExecution())
+		{
+			DoRenderHost(I);
+			return;
+		}
 		/*
 		xxxxxxxx
 		x      x	Warp := 8x4
@@ -8,7 +8,7 @@
 namespace CudaTracerLib {
 
 Node::Node(unsigned int MeshIndex, Mesh* mesh, StreamReference<Material> mat)
-	: m_uInstanciatedMaterial(false)
+	: m_uInstanciatedMaterial(false), m_vMeshOffset(0.0f)
 {
 	m_uMeshIndex = MeshIndex;
 	m_uMaterialOffset = mat.getIndex();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Base/FixedSizeArray.h>
+#include <Math/Vector.h>
 
 namespace CudaTracerLib {
 
@@ -17,6 +18,8 @@ public:
 	unsigned int m_uMaterialOffset;
 	unsigned int m_uInstanciatedMaterial;
 	FixedSizeArray<unsigned int, MAX_AREALIGHT_NUM, true, 0xff> m_uLights;
+	//position of the mesh in the local space of the node, not zero for nodes sharing the mesh of a translated copy of their geometry
+	Vec3f m_vMeshOffset;
 public:
 	Node() {}
 	CTL_EXPORT Node(unsigned int MeshIndex, Mesh* mesh, BufferReference<Material, Material> mat);